@@ -778,7 +778,9 @@ static void do_writemem(uint32_t addr, uint32_t val)
 
         c = memstat[vis20k][addr >> 8];
         if (c == MSTAT_RAM) {
-            memlook[vis20k][addr >> 8][addr] = (uint8_t)val;
+            uint8_t *ptr = memlook[vis20k][addr >> 8] + addr;
+            *ptr = (uint8_t)val;
+            savestate_dirty(mem_dirty, ptr - ram);
             switch(addr) {
                     case 0x022c:
                         buf_remv = (buf_remv & 0xff00) | val;
@@ -801,8 +803,10 @@ static void do_writemem(uint32_t addr, uint32_t val)
                  * than the one selected by ROMSEL.
                  */
                 log_debug("6502: do_writemem, watford write, addr=%04X, val=%02X", addr, val);
-                if (addr >= 0x8000 && addr < 0xc000)
+                if (addr >= 0x8000 && addr < 0xc000) {
                     weramrom_base[addr] = val;
+                    savestate_dirty(mem_dirty, weramrom_base + addr - ram);
+                }
             }
             else {
                 if (addr >= 0xff30 && addr < 0xff40 && weramrom)
@@ -1008,6 +1012,57 @@ void writemem(uint16_t addr, uint8_t val)
     do_writemem(addr, val);
 }
 
+/*
+ * Copy a block between host memory and a buffer, a page at a time.
+ * Pages that are plain memory are copied directly, the rest, and all
+ * pages while the debugger is watching, go through readmem/writemem.
+ * Page two is among the rest for writes so the vectors are tracked.
+ */
+
+void readmem_block(uint16_t addr, uint8_t *buf, size_t len)
+{
+    while (len > 0) {
+        unsigned page = addr >> 8;
+        size_t chunk = 0x100 - (addr & 0xff);
+        if (chunk > len)
+            chunk = len;
+        if (memstat[vis20k][page] && !dbg_core6502) {
+            memcpy(buf, memlook[vis20k][page] + addr, chunk);
+            for (size_t i = 0; i < chunk; i++)
+                readc[addr + i] = 31;
+        }
+        else
+            for (size_t i = 0; i < chunk; i++)
+                buf[i] = readmem(addr + i);
+        addr += chunk;
+        buf += chunk;
+        len -= chunk;
+    }
+}
+
+void writemem_block(uint16_t addr, const uint8_t *buf, size_t len)
+{
+    while (len > 0) {
+        unsigned page = addr >> 8;
+        size_t chunk = 0x100 - (addr & 0xff);
+        if (chunk > len)
+            chunk = len;
+        if (memstat[vis20k][page] == MSTAT_RAM && page != 0x02 && !dbg_core6502) {
+            uint8_t *ptr = memlook[vis20k][page] + addr;
+            memcpy(ptr, buf, chunk);
+            savestate_dirty_range(mem_dirty, ptr - ram, chunk);
+            for (size_t i = 0; i < chunk; i++)
+                writec[addr + i] = 31;
+        }
+        else
+            for (size_t i = 0; i < chunk; i++)
+                writemem(addr + i, buf[i]);
+        addr += chunk;
+        buf += chunk;
+        len -= chunk;
+    }
+}
+
 int nmi, oldnmi, interrupt, takeint;
 
 /*
@@ -1083,7 +1138,7 @@ static void otherstuff_poll(void) {
         music2000_poll();
     if (!tapelcount) {
         tape_poll();
-        tapelcount = tapellatch;
+        tapelcount = quicktape ? 1 : tapellatch;
     }
     tapelcount--;
     if (motorspin) {
@@ -35,6 +35,8 @@ void m6502_update_swram(void);
 
 uint8_t readmem(uint16_t addr);
 void writemem(uint16_t addr, uint8_t val);
+void readmem_block(uint16_t addr, uint8_t *buf, size_t len);
+void writemem_block(uint16_t addr, const uint8_t *buf, size_t len);
 
 void m6502_savestate(FILE *f);
 void m6502_loadstate(FILE *f);
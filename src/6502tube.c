@@ -25,6 +25,7 @@ static PREG tubep;
 
 /*Memory structures*/
 static uint8_t *tuberam;
+static uint8_t *tuberam_dirty;
 static size_t tuberamsize;
 static uint8_t *tuberom;
 
@@ -40,6 +41,8 @@ void tube_6502_close()
         tuberam = NULL;
         tuberamsize = 0;
     }
+    savestate_dirty_free(tuberam_dirty);
+    tuberam_dirty = NULL;
 }
 
 static int dbg_tube6502 = 0;
@@ -80,8 +83,8 @@ void tube_6502_savestate(ZFILE *zfp)
     bytes[7] = pc & 0xff;
     bytes[8] = pc >> 8;
     savestate_zwrite(zfp, bytes, sizeof bytes);
-    savestate_zwrite(zfp, tuberam, tuberamsize);
-    savestate_zwrite(zfp, tuberom, tubes[curtube].rom_size);
+    savestate_zwrite_pages(zfp, tuberam, tuberamsize, tuberam_dirty);
+    savestate_zwrite_pages(zfp, tuberom, tubes[curtube].rom_size, NULL);
 }
 
 static inline void unpack_flags(uint8_t flags) {
@@ -108,8 +111,8 @@ void tube_6502_loadstate(ZFILE *zfp)
     pc = bytes[7];
     pc |= bytes[8] << 8;
 
-    savestate_zread(zfp, tuberam, tuberamsize);
-    savestate_zread(zfp, tuberom, tubes[curtube].rom_size);
+    savestate_zread_pages(zfp, tuberam, tuberamsize, tuberam_dirty);
+    savestate_zread_pages(zfp, tuberom, tubes[curtube].rom_size, NULL);
 }
 
 static uint32_t dbg_reg_get(int which) {
@@ -197,6 +200,7 @@ static void do_writemem(uint32_t addr, uint32_t value)
         return;
     }
     tuberam[addr] = value;
+    savestate_dirty(tuberam_dirty, addr);
     if (addr == 0xfef0 && tuberamsize > 0x10000) {
         if (value & 0x80)
             enable_turbo();
@@ -262,6 +266,54 @@ static void tube_6502_writemem(uint32_t addr, uint8_t value) {
     do_writemem(addr, value);
 }
 
+/*
+ * Block copies for VDFS.  Below the ROM and I/O area at &F000, or in
+ * the extra memory of the turbo co-processor, memory is a plain array.
+ */
+
+static size_t tube_6502_plain(uint32_t addr, size_t len)
+{
+    if (dbg_tube6502 || addr >= tuberamsize || (addr >= 0xf000 && addr < 0x10000))
+        return 0;
+    uint32_t end = addr < 0xf000 ? 0xf000 : tuberamsize;
+    return len < end - addr ? len : end - addr;
+}
+
+static void tube_6502_readmem_block(uint32_t addr, uint8_t *buf, size_t len)
+{
+    while (len > 0) {
+        size_t chunk = tube_6502_plain(addr, len);
+        if (chunk) {
+            memcpy(buf, tuberam + addr, chunk);
+            addr += chunk;
+            buf += chunk;
+            len -= chunk;
+        }
+        else {
+            *buf++ = tube_6502_readmem(addr++);
+            len--;
+        }
+    }
+}
+
+static void tube_6502_writemem_block(uint32_t addr, const uint8_t *buf, size_t len)
+{
+    while (len > 0) {
+        size_t chunk = tube_6502_plain(addr, len);
+        if (chunk) {
+            memcpy(tuberam + addr, buf, chunk);
+            savestate_dirty_range(tuberam_dirty, addr, chunk);
+            addr += chunk;
+            buf += chunk;
+            len -= chunk;
+        }
+        else {
+            tube_6502_writemem(addr++, *buf++);
+            len--;
+        }
+    }
+}
+
 static uint8_t readmem(uint16_t addr)
 {
     return tube_6502_readmem(addr);
@@ -288,13 +340,11 @@ void tube_6502_reset()
 static bool common_init(void *rom, size_t memsize)
 {
     if (tuberamsize != memsize) {
-        if (tuberam) {
-            free(tuberam);
-            tuberamsize = 0;
-        }
+        tube_6502_close();
         tuberam = (uint8_t *) malloc(memsize);
-        if (!tuberam) {
+        if (!tuberam || !(tuberam_dirty = savestate_dirty_new(memsize))) {
             log_error("6502tube: unable to allocate RAM");
+            tube_6502_close();
             return false;
         }
         tuberamsize = memsize;
@@ -304,6 +354,8 @@ static bool common_init(void *rom, size_t memsize)
     tube_type = TUBE6502;
     tube_readmem = tube_6502_readmem;
     tube_writemem = tube_6502_writemem;
+    tube_readmem_block = tube_6502_readmem_block;
+    tube_writemem_block = tube_6502_writemem_block;
     tube_exec  = tube_6502_exec;
     tube_proc_savestate = tube_6502_savestate;
     tube_proc_loadstate = tube_6502_loadstate;
@@ -12,6 +12,7 @@
 #define W65816_RAM_SIZE 0x80000
 
 static uint8_t *w65816ram, *w65816rom;
+static uint8_t *w65816ram_dirty;
 
 // The bank number to load any native vectors from
 static uint8_t w65816nvb = 0x00;
@@ -337,15 +338,12 @@ static void do_writemem65816(uint32_t a, uint32_t v)
         endtimeslice = 1;
         return;
     }
-    if ((a & 0x7C000) == 0x4000 && !def && (banking & 1)) {
-        w65816ram[(a & 0x3FFF) | ((banknum & 7) << 14)] = v;
-        return;
-    }
-    if ((a & 0x7C000) == 0x8000 && !def && (banking & 2)) {
-        w65816ram[(a & 0x3FFF) | (((banknum >> 3) & 7) << 14)] = v;
-        return;
-    }
+    if ((a & 0x7C000) == 0x4000 && !def && (banking & 1))
+        a = (a & 0x3FFF) | ((banknum & 7) << 14);
+    else if ((a & 0x7C000) == 0x8000 && !def && (banking & 2))
+        a = (a & 0x3FFF) | (((banknum >> 3) & 7) << 14);
     w65816ram[a] = v;
+    savestate_dirty(w65816ram_dirty, a);
 }
 
 static void writemem65816(uint32_t addr, uint8_t val)
@@ -5636,6 +5634,8 @@ void w65816_close(void)
 {
     if (w65816ram)
         free(w65816ram);
+    savestate_dirty_free(w65816ram_dirty);
+    w65816ram = w65816ram_dirty = NULL;
 }
 
 static inline unsigned char *save_reg(unsigned char *ptr, reg * rp)
@@ -5669,8 +5669,8 @@ static void w65816_savestate(ZFILE * zfp)
     ptr = save_uint32(ptr, w65816mask);
     ptr = save_uint16(ptr, toldpc);
     savestate_zwrite(zfp, bytes, sizeof bytes);
-    savestate_zwrite(zfp, w65816ram, W65816_RAM_SIZE);
-    savestate_zwrite(zfp, w65816rom, W65816_ROM_SIZE);
+    savestate_zwrite_pages(zfp, w65816ram, W65816_RAM_SIZE, w65816ram_dirty);
+    savestate_zwrite_pages(zfp, w65816rom, W65816_ROM_SIZE, NULL);
 }
 
 static inline unsigned char *load_reg(unsigned char *ptr, reg * rp)
@@ -5704,8 +5704,8 @@ static void w65816_loadstate(ZFILE * zfp)
     banknum = *ptr++;
     ptr = load_uint32(ptr, &w65816mask);
     ptr = load_uint16(ptr, &toldpc);
-    savestate_zread(zfp, w65816ram, W65816_RAM_SIZE);
-    savestate_zread(zfp, w65816rom, W65816_ROM_SIZE);
+    savestate_zread_pages(zfp, w65816ram, W65816_RAM_SIZE, w65816ram_dirty);
+    savestate_zread_pages(zfp, w65816rom, W65816_ROM_SIZE, NULL);
 }
 
 bool w65816_init_recoco(void *rom) {
@@ -5720,8 +5720,9 @@ bool w65816_init(void *rom, uint8_t nativeVectBank)
 {
     if (!w65816ram) {
         w65816ram = malloc(W65816_RAM_SIZE);
-        if (!w65816ram) {
+        if (!w65816ram || !(w65816ram_dirty = savestate_dirty_new(W65816_RAM_SIZE))) {
             log_error("65816: unable to allocate RAM");
+            w65816_close();
             return false;
         }
     }
@@ -9,6 +9,7 @@
 
 static int overlay_rom = 1;
 static uint8_t *copro_mc6809_ram = NULL;
+static uint8_t *copro_mc6809_dirty = NULL;
 static uint8_t *copro_mc6809_rom;
 
 void tube_6809_int(int new_irq)
@@ -58,8 +59,10 @@ static void writemem(uint32_t addr, uint8_t data)
         overlay_rom = 0;
         tube_parasite_write(addr & 7, data);
     }
-    else
+    else {
         copro_mc6809_ram[addr & 0xffff] = data;
+        savestate_dirty(copro_mc6809_dirty, addr & 0xffff);
+    }
 }
 
 void copro_mc6809nc_write(uint16_t addr, uint8_t data)
@@ -95,8 +98,8 @@ static void mc6809nc_savestate(ZFILE *zfp)
     bytes[13] = reg;
 
     savestate_zwrite(zfp, bytes, sizeof bytes);
-    savestate_zwrite(zfp, copro_mc6809_ram, MC6809_RAM_SIZE);
-    savestate_zwrite(zfp, copro_mc6809_rom, tubes[curtube].rom_size);
+    savestate_zwrite_pages(zfp, copro_mc6809_ram, MC6809_RAM_SIZE, copro_mc6809_dirty);
+    savestate_zwrite_pages(zfp, copro_mc6809_rom, tubes[curtube].rom_size, NULL);
 }
 
 static void mc6809nc_loadstate(ZFILE *zfp)
@@ -114,8 +117,8 @@ static void mc6809nc_loadstate(ZFILE *zfp)
     set_u((bytes[10] << 8) | bytes[11]);
     set_pc((bytes[12] << 8) | bytes[13]);
 
-    savestate_zread(zfp, copro_mc6809_ram, MC6809_RAM_SIZE);
-    savestate_zread(zfp, copro_mc6809_rom, tubes[curtube].rom_size);;
+    savestate_zread_pages(zfp, copro_mc6809_ram, MC6809_RAM_SIZE, copro_mc6809_dirty);
+    savestate_zread_pages(zfp, copro_mc6809_rom, tubes[curtube].rom_size, NULL);
 }
 
 bool tube_6809_init(void *rom)
@@ -128,6 +131,8 @@ bool tube_6809_init(void *rom)
             return false;
         }
     }
+    if (!copro_mc6809_dirty && !(copro_mc6809_dirty = savestate_dirty_new(MC6809_RAM_SIZE)))
+        return false;
     copro_mc6809_rom = rom;
     tube_type = TUBE6809;
     tube_readmem = readmem;
@@ -145,4 +150,6 @@ void mc6809nc_close(void)
         free(copro_mc6809_ram);
         copro_mc6809_ram = NULL;
     }
+    savestate_dirty_free(copro_mc6809_dirty);
+    copro_mc6809_dirty = NULL;
 }
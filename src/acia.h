@@ -21,6 +21,7 @@ uint8_t acia_read(ACIA *acia, uint16_t addr);
 void acia_write(ACIA *acia, uint16_t addr, uint8_t val);
 void acia_poll(ACIA *acia);
 void acia_receive(ACIA *acia, uint8_t val);
+bool acia_rx_full(ACIA *acia);
 
 void acia_savestate(ACIA *acia, FILE *f);
 void acia_loadstate(ACIA *acia, FILE *f);
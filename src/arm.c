@@ -28,6 +28,7 @@ static int armirq=0;
 static int databort;
 static uint32_t *armrom,*armram;
 static uint8_t *armromb,*armramb;
+static uint8_t *armram_dirty;
 #define USER       0
 #define FIQ        1
 #define IRQ        2
@@ -215,6 +216,7 @@ void arm_reset()
         mode=3;
         memmode=2;
         memcpy(armramb,armromb,ARM_ROM_SIZE);
+        savestate_dirty_range(armram_dirty, 0, ARM_ROM_SIZE);
         refillpipeline2();
 }
 
@@ -240,6 +242,8 @@ void arm_close()
         free(armram);
         armram = NULL;
     }
+    savestate_dirty_free(armram_dirty);
+    armram_dirty = NULL;
 }
 
 static unsigned char *save_regset(unsigned char *ptr, uint32_t *regs)
@@ -267,8 +271,8 @@ static void arm_savestate(ZFILE *zfp)
     *ptr++ = armirq;
     *ptr++ = databort;
     savestate_zwrite(zfp, bytes, sizeof bytes);
-    savestate_zwrite(zfp, armram, ARM_RAM_SIZE);
-    savestate_zwrite(zfp, armrom, ARM_ROM_SIZE);
+    savestate_zwrite_pages(zfp, armram, ARM_RAM_SIZE, armram_dirty);
+    savestate_zwrite_pages(zfp, armrom, ARM_ROM_SIZE, NULL);
 }
 
 static unsigned char *load_regset(unsigned char *ptr, uint32_t *regs)
@@ -296,8 +300,8 @@ static void arm_loadstate(ZFILE *zfp)
     ptr = load_uint32(ptr, &opcode3);
     armirq = *ptr++;
     databort = *ptr;
-    savestate_zread(zfp, armram, ARM_RAM_SIZE);
-    savestate_zread(zfp, armrom, ARM_ROM_SIZE);
+    savestate_zread_pages(zfp, armram, ARM_RAM_SIZE, armram_dirty);
+    savestate_zread_pages(zfp, armrom, ARM_ROM_SIZE, NULL);
 }
 
 static int endtimeslice=0;
@@ -368,6 +372,7 @@ static inline void do_writearmb(uint32_t addr, uint8_t val)
         if (addr<0x400000)
         {
                 armramb[addr]=val;
+                savestate_dirty(armram_dirty, addr);
                 return;
         }
         if ((addr&~0x1F)==0x1000000)
@@ -396,6 +401,7 @@ static void writearml(uint32_t addr, uint32_t val)
         if (addr<0x400000)
         {
                 armram[addr>>2]=val;
+                savestate_dirty(armram_dirty, addr);
                 return;
         }
         if (addr<0x400010) return;
@@ -657,6 +663,8 @@ static bool arm_init(void *rom)
             return false;
         }
     }
+    if (!armram_dirty && !(armram_dirty = savestate_dirty_new(ARM_RAM_SIZE)))
+        return false;
     armramb=(uint8_t *)armram;
     armrom = rom;
     armromb = rom;
@@ -0,0 +1,319 @@
+/*B-em v2.2
+  Batch runner*/
+
+/*
+ * The machine is booted once, run unpaced for batch_boot_secs of emulated
+ * time, and then each job in the jobs file is run from that point in a
+ * worker process of its own, up to batch_workers at a time.  Forking
+ * shares the booted machine between the workers copy-on-write, so the
+ * boot is paid for once however many jobs there are.  Where fork is not
+ * available the booted state is captured with savestate_capture instead
+ * and restored before each job, which are then run one after another.
+ *
+ * Each line of the jobs file is one job, one of:
+ *
+ *   paste  text    paste text in via the OS, as -paste
+ *   pastek text    paste text in via the keyboard, as -pastek
+ *   exec   file    have the debugger execute file, as -debug -exec
+ *
+ * A job ends when the emulator would quit, for example from the debugger
+ * or VDFS, with the exit code it would have quit with, or with
+ * SHUTDOWN_EXPIRED after batch_limit_secs of emulated time.  One line per
+ * job is written to the results file as each finishes.
+ */
+
+#include "b-em.h"
+#include "6502.h"
+#include "batch.h"
+#include "debugger.h"
+#include "keyboard.h"
+#include "main.h"
+#include "savestate.h"
+#include "video.h"
+
+#ifdef HAVE_FORK
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+const char *batch_jobs_fn;
+const char *batch_results_fn;
+int batch_workers;
+double batch_boot_secs = 5.0;
+double batch_limit_secs = 600.0;
+
+typedef enum {
+    JOB_PASTE,
+    JOB_PASTEK,
+    JOB_EXEC
+} job_kind_t;
+
+static const char *const job_kinds[] = { "paste", "pastek", "exec" };
+
+typedef struct {
+    job_kind_t kind;
+    char *arg;
+#ifdef HAVE_FORK
+    pid_t pid;
+#endif
+} batch_job_t;
+
+static batch_job_t *jobs;
+static int num_jobs;
+static FILE *results_fp;
+
+static bool load_jobs(void)
+{
+    FILE *fp = fopen(batch_jobs_fn, "r");
+    if (!fp) {
+        log_error("batch: unable to open jobs file %s: %s", batch_jobs_fn, strerror(errno));
+        return false;
+    }
+    char line[1024];
+    int lineno = 0, size = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fp)) {
+        lineno++;
+        size_t end = strlen(line);
+        while (end && strchr(" \t\r\n", line[end - 1]))
+            end--;
+        line[end] = '\0';
+        char *ptr = line + strspn(line, " \t");
+        if (!*ptr || *ptr == '#')
+            continue;
+        size_t len = strcspn(ptr, " \t");
+        char *arg = ptr + len;
+        arg += strspn(arg, " \t");
+        int kind;
+        for (kind = 0; kind < sizeof(job_kinds)/sizeof(job_kinds[0]); kind++)
+            if (strlen(job_kinds[kind]) == len && !strncasecmp(ptr, job_kinds[kind], len))
+                break;
+        if (kind == sizeof(job_kinds)/sizeof(job_kinds[0]) || !*arg) {
+            log_error("batch: %s:%d: invalid job '%s'", batch_jobs_fn, lineno, ptr);
+            ok = false;
+        }
+        else {
+            if (num_jobs == size) {
+                size = size ? size * 2 : 16;
+                batch_job_t *new_jobs = realloc(jobs, size * sizeof(batch_job_t));
+                if (!new_jobs) {
+                    log_error("batch: out of memory for jobs");
+                    ok = false;
+                    break;
+                }
+                jobs = new_jobs;
+            }
+            batch_job_t *job = jobs + num_jobs;
+            if (!(job->arg = strdup(arg))) {
+                log_error("batch: out of memory for jobs");
+                ok = false;
+            }
+            else {
+                job->kind = kind;
+                num_jobs++;
+            }
+        }
+    }
+    fclose(fp);
+    if (ok && !num_jobs) {
+        log_error("batch: no jobs in %s", batch_jobs_fn);
+        ok = false;
+    }
+    return ok;
+}
+
+static void free_jobs(void)
+{
+    for (int i = 0; i < num_jobs; i++)
+        free(jobs[i].arg);
+    free(jobs);
+    jobs = NULL;
+    num_jobs = 0;
+}
+
+/* Run one job from the booted state, returning its exit code. */
+
+static int run_job(batch_job_t *job)
+{
+    switch(job->kind) {
+        case JOB_PASTE:
+            debug_paste(job->arg, os_paste_start);
+            break;
+        case JOB_PASTEK:
+            debug_paste(job->arg, key_paste_start);
+            break;
+        case JOB_EXEC:
+            debug_core = 1;
+            debug_start(job->arg, false);
+    }
+    main_run_unpaced(batch_limit_secs);
+    if (!quitting)
+        set_shutdown_exit_code(SHUTDOWN_EXPIRED);
+    return shutdown_exit_code;
+}
+
+static void report(int num, const char *status)
+{
+    batch_job_t *job = jobs + num;
+    fprintf(results_fp, "%d %s %s %s\n", num + 1, status, job_kinds[job->kind], job->arg);
+    fflush(results_fp);
+}
+
+static void report_code(int num, int code)
+{
+    char status[16];
+    snprintf(status, sizeof(status), "%d", code);
+    report(num, status);
+}
+
+#ifdef HAVE_FORK
+
+static void run_all(void)
+{
+    int next = 0, running = 0, failed = SHUTDOWN_OK;
+
+    if (batch_workers < 1 && (batch_workers = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+        batch_workers = 1;
+    log_info("batch: running %d jobs, %d at a time", num_jobs, batch_workers);
+
+    /* A worker gets a copy of any mutex but not the thread that would
+     * release it, so no other thread may be running when it is forked. */
+    savestate_stop_worker();
+
+    while (next < num_jobs || running) {
+        if (next < num_jobs && running < batch_workers) {
+            batch_job_t *job = jobs + next;
+            fflush(NULL);
+            pid_t pid = fork();
+            if (pid == 0) {
+                /* The worker must not return into main_close, which
+                 * would tear down what it shares with the parent. */
+                int code = run_job(job);
+                fflush(NULL);
+                _exit(code);
+            }
+            if (pid < 0) {
+                log_error("batch: unable to start worker for job %d: %s", next + 1, strerror(errno));
+                report(next, "fork-failed");
+                if (failed == SHUTDOWN_OK)
+                    failed = SHUTDOWN_STARTUP_FAILURE;
+            }
+            else {
+                log_debug("batch: job %d started as pid %d", next + 1, (int)pid);
+                job->pid = pid;
+                running++;
+            }
+            next++;
+            continue;
+        }
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            if (errno == EINTR)
+                continue;
+            log_error("batch: error waiting for workers: %s", strerror(errno));
+            break;
+        }
+        for (int num = 0; num < next; num++) {
+            if (jobs[num].pid == pid) {
+                if (WIFEXITED(status)) {
+                    int code = WEXITSTATUS(status);
+                    report_code(num, code);
+                    if (code != SHUTDOWN_OK && failed == SHUTDOWN_OK)
+                        failed = code;
+                }
+                else {
+                    char desc[16];
+                    snprintf(desc, sizeof(desc), "signal-%d", WTERMSIG(status));
+                    report(num, desc);
+                    if (failed == SHUTDOWN_OK)
+                        failed = SHUTDOWN_STARTUP_FAILURE;
+                }
+                jobs[num].pid = 0;
+                running--;
+                break;
+            }
+        }
+    }
+    if (failed != SHUTDOWN_OK)
+        set_shutdown_exit_code(failed);
+}
+
+#else
+
+static void run_all(void)
+{
+    unsigned char *snap = NULL;
+    size_t size = 1024 * 1024;
+    long len;
+
+    log_info("batch: running %d jobs one at a time", num_jobs);
+    do {
+        unsigned char *buf = realloc(snap, size);
+        if (!buf) {
+            log_error("batch: out of memory for snapshot");
+            free(snap);
+            return;
+        }
+        snap = buf;
+        if ((len = savestate_capture(snap, size)))
+            break;
+        size *= 2;
+    } while (size <= 256 * 1024 * 1024);
+    if (len <= 0) {
+        if (len)
+            log_error("batch: unable to capture the booted machine");
+        else
+            log_error("batch: booted machine state larger than 256M");
+        free(snap);
+        return;
+    }
+    int failed = SHUTDOWN_OK;
+    for (int num = 0; num < num_jobs; num++) {
+        if (num)
+            savestate_restore(snap, len);
+        quitting = false;
+        shutdown_exit_code = SHUTDOWN_OK;
+        int code = run_job(jobs + num);
+        report_code(num, code);
+        if (code != SHUTDOWN_OK && failed == SHUTDOWN_OK)
+            failed = code;
+    }
+    shutdown_exit_code = SHUTDOWN_OK;
+    if (failed != SHUTDOWN_OK)
+        set_shutdown_exit_code(failed);
+    free(snap);
+}
+
+#endif
+
+void batch_run(void)
+{
+    if (!load_jobs()) {
+        set_shutdown_exit_code(SHUTDOWN_STARTUP_FAILURE);
+        return;
+    }
+    if (!batch_results_fn)
+        results_fp = stdout;
+    else if (!(results_fp = fopen(batch_results_fn, "w"))) {
+        log_error("batch: unable to open results file %s: %s", batch_results_fn, strerror(errno));
+        set_shutdown_exit_code(SHUTDOWN_FOPEN);
+        free_jobs();
+        return;
+    }
+    video_enter_batch();
+    log_info("batch: booting for %gs", batch_boot_secs);
+    main_run_unpaced(batch_boot_secs);
+    if (quitting) {
+        log_error("batch: emulator quit while booting");
+        set_shutdown_exit_code(SHUTDOWN_STARTUP_FAILURE);
+    }
+    else {
+        run_all();
+        quitting = true;
+    }
+    if (results_fp != stdout)
+        fclose(results_fp);
+    free_jobs();
+}
@@ -0,0 +1,12 @@
+#ifndef __INC_BATCH_H
+#define __INC_BATCH_H
+
+extern const char *batch_jobs_fn;
+extern const char *batch_results_fn;
+extern int batch_workers;
+extern double batch_boot_secs;
+extern double batch_limit_secs;
+
+void batch_run(void);
+
+#endif
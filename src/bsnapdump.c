@@ -138,7 +138,6 @@ static int zread(ZFILE *zfp, void *dest, size_t size)
                     chunk = BUFSIZ;
                 else
                     chunk = zfp->togo;
-                fprintf(stderr, "snapdump: reading %ld bytes from file\n", chunk);
                 if (fread(zfp->buf, chunk, 1, zfp->fp) != 1)
                     break;
                 zfp->zs.next_in = zfp->buf;
@@ -146,13 +145,11 @@ static int zread(ZFILE *zfp, void *dest, size_t size)
                 zfp->togo -= chunk;
             }
         }
-        fprintf(stderr, "snapdump: inflating, avail_in=%d, avail_out=%d\n", zfp->zs.avail_in, zfp->zs.avail_out);
         res = inflate(&zfp->zs, zfp->flush);
     } while (res == Z_OK && zfp->zs.avail_out > 0);
 
     if (res != Z_OK && res != Z_STREAM_END)
         fprintf(stderr, "snapdump: compression error: %d=%s\n", res, zfp->zs.msg);
-    fprintf(stderr, "snapdump: return from zread, res=%d\n", res);
     return res;
 }
 
@@ -296,7 +293,6 @@ static void dump_iomem(char *hexout, const char *fn, FILE *fp, long size)
 
 static void dump_compressed(char *hexout, const char *fn, FILE *fp, long size)
 {
-    fprintf(stderr, "snapdump: dump_compressed, size=%ld\n", size);
     ZFILE zf;
     unsigned char mem[0x8000];
     zinit(&zf, fp, size);
@@ -309,10 +305,10 @@ static void dump_compressed(char *hexout, const char *fn, FILE *fp, long size)
 
 static void dump_via(const unsigned char *data)
 {
-    uint_least32_t t1l = data[13] | (data[14] << 8) | (data[15] << 15) | (data[16] << 24);
-    uint_least32_t t2l = data[17] | (data[18] << 8) | (data[19] << 15) | (data[20] << 24);
-    uint_least32_t t1c = data[21] | (data[22] << 8) | (data[23] << 15) | (data[24] << 24);
-    uint_least32_t t2c = data[25] | (data[26] << 8) | (data[27] << 15) | (data[28] << 24);
+    uint_least32_t t1l = data[13] | (data[14] << 8) | (data[15] << 16) | (data[16] << 24);
+    uint_least32_t t2l = data[17] | (data[18] << 8) | (data[19] << 16) | (data[20] << 24);
+    uint_least32_t t1c = data[21] | (data[22] << 8) | (data[23] << 16) | (data[24] << 24);
+    uint_least32_t t2c = data[25] | (data[26] << 8) | (data[27] << 16) | (data[28] << 24);
     printf("  ORA=%02X IRA=%02X INA=%02X DDRA=%02X\n"
            "  ORB=%02X IRB=%02X INB=%02X DDRB=%02X\n"
            "  SR=%02X ACR=%02X PCR=%02X IFR=%02X IER=%02X\n"
@@ -358,7 +354,7 @@ static void dump_vula(const unsigned char *data)
         printf("    %2d: %02X (%3d)  %2d: %02X (%3d)  %2d: %02X (%3d)  %2d: %02X (%3d)\n", c, v1, v1, c+4, v2, v2, c+8, v3, v3, c+12, v4, v4);
     }
     fputs("  NuLA palette (RGBA):\n", stdout);
-    const unsigned char *ptr = data+14;
+    const unsigned char *ptr = data+17;
     for (int c= 0; c < 16; ++c) {
         uint_least32_t v = ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | (ptr[3] << 24);
         printf("    %2d: %08X %4d,%4d,%4d,%4d\n", c, v, ptr[0], ptr[1], ptr[2], ptr[3]);
@@ -513,10 +509,29 @@ static void dump_one(char *hexout, const char *fn, FILE *fp)
     music5000_loadstate(fp);}*/
 }
 
+static void dump_base_ref(const char *fn, FILE *fp)
+{
+    unsigned char bytes[8];
+    if (fread(bytes, sizeof(bytes), 1, fp) == 1) {
+        unsigned long crc = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((unsigned long)bytes[3] << 24);
+        unsigned long size = bytes[4] | (bytes[5] << 8) | (bytes[6] << 16) | ((unsigned long)bytes[7] << 24);
+        printf("Delta snapshot\n  Base CRC:   %08lX\n  Base size:  %lu\n", crc, size);
+        print_vstr(fn, fp, "Base file:");
+    }
+    else
+        fprintf(stderr, "snapdump: unexpected EOF on %s\n", fn);
+}
+
+/* In a delta the memory sections are page maps and changed pages. */
+static bool delta;
+
 static void dump_section(char *hexout, const char *fn, FILE *fp, int key, long size)
 {
     long start = ftell(fp);
     switch(key) {
+        case 'B':
+            dump_base_ref(fn, fp);
+            break;
         case 'm':
             dump_model(fn, fp);
             break;
@@ -524,7 +539,12 @@ static void dump_section(char *hexout, const char *fn, FILE *fp, int key, long s
             small_section(fn, fp, size, dump_6502);
             break;
         case 'M':
-            dump_iomem(hexout, fn, fp, size);
+            if (delta) {
+                fputs("I/O processor memory, changed pages\n", stdout);
+                dump_compressed(hexout, fn, fp, size);
+            }
+            else
+                dump_iomem(hexout, fn, fp, size);
             break;
         case 'S':
             small_section(fn, fp, size, dump_sysvia);
@@ -624,6 +644,11 @@ static bool snapdump(char *hexout, const char *fn)
                 case '3':
                     dump_three(hexout, fn, fp);
                     break;
+                case '4':
+                    delta = true;
+                    dump_three(hexout, fn, fp);
+                    delta = false;
+                    break;
                 default:
                     fprintf(stderr, "snapdump: file %s: unrecognised B-Em snapshot file version %c\n", fn, magic[7]);
             }
@@ -637,9 +662,555 @@ static bool snapdump(char *hexout, const char *fn)
     return false;
 }
 
+/*
+ * Diffing two snapshots.  The sections of each file are indexed first so
+ * they can be paired by key regardless of order.  The small fixed-format
+ * sections are compared field by field and everything else, including the
+ * compressed memory sections which are inflated a chunk at a time from
+ * both files in step, as ranges of bytes.
+ */
+
+#define MAX_SECTS 64
+#define DIFF_CHUNK 0x4000
+#define DIFF_GAP   BLOCK_SIZE
+#define DIFF_SHOW  8
+
+typedef struct {
+    int key;
+    long offset;
+    long size;
+} sect_t;
+
+typedef struct {
+    const char *fn;
+    FILE *fp;
+    int vers;
+    int nsect;
+    sect_t sects[MAX_SECTS];
+} snap_t;
+
+typedef struct {
+    const char *name;
+    unsigned char offset;
+    unsigned char width;
+    unsigned char count;
+} field_t;
+
+typedef struct {
+    const char *name;
+    uint_least32_t size;
+} region_t;
+
+static const field_t fields_6502[] = {
+    { "A",         0, 1, 1 },
+    { "X",         1, 1, 1 },
+    { "Y",         2, 1, 1 },
+    { "P",         3, 1, 1 },
+    { "S",         4, 1, 1 },
+    { "PC",        5, 2, 1 },
+    { "NMI",       7, 1, 1 },
+    { "IRQ",       8, 1, 1 },
+    { "cycles",    9, 4, 1 },
+    { NULL }
+};
+
+static const field_t fields_via[] = {
+    { "ORA",       0, 1, 1 },
+    { "ORB",       1, 1, 1 },
+    { "IRA",       2, 1, 1 },
+    { "IRB",       3, 1, 1 },
+    { "INA",       4, 1, 1 },
+    { "INB",       5, 1, 1 },
+    { "DDRA",      6, 1, 1 },
+    { "DDRB",      7, 1, 1 },
+    { "SR",        8, 1, 1 },
+    { "ACR",       9, 1, 1 },
+    { "PCR",      10, 1, 1 },
+    { "IFR",      11, 1, 1 },
+    { "IER",      12, 1, 1 },
+    { "T1L",      13, 4, 1 },
+    { "T2L",      17, 4, 1 },
+    { "T1C",      21, 4, 1 },
+    { "T2C",      25, 4, 1 },
+    { "t1hit",    29, 1, 1 },
+    { "t2hit",    30, 1, 1 },
+    { "ca1",      31, 1, 1 },
+    { "ca2",      32, 1, 1 },
+    { "IC32",     33, 1, 1 },
+    { NULL }
+};
+
+static const field_t fields_vula[] = {
+    { "CTRL",               0, 1,  1 },
+    { "palette",            1, 1, 16 },
+    { "NuLA palette",      17, 4, 16 },
+    { "NuLA write flag",   81, 1,  1 },
+    { "NuLA first byte",   82, 1,  1 },
+    { "NuLA flash",        83, 1,  8 },
+    { "NuLA palette mode", 91, 1,  1 },
+    { "NuLA horiz offset", 92, 1,  1 },
+    { "NuLA left blank",   93, 1,  1 },
+    { "NuLA disable",      94, 1,  1 },
+    { "NuLA attr mode",    95, 1,  1 },
+    { "NuLA attr text",    96, 1,  1 },
+    { NULL }
+};
+
+static const field_t fields_crtc[] = {
+    { "R",         0, 1, 18 },
+    { "VC",       18, 1,  1 },
+    { "SC",       19, 1,  1 },
+    { "HC",       20, 1,  1 },
+    { "MA",       21, 2,  1 },
+    { "MABACK",   23, 2,  1 },
+    { NULL }
+};
+
+static const field_t fields_video[] = {
+    { "scrx",      0, 2, 1 },
+    { "scry",      2, 2, 1 },
+    { "oddclock",  4, 1, 1 },
+    { "vidclocks", 5, 4, 1 },
+    { NULL }
+};
+
+static const field_t fields_sn76489[] = {
+    { "latch",     0, 4, 4 },
+    { "count",    16, 4, 4 },
+    { "stat",     32, 4, 4 },
+    { "vol",      48, 1, 4 },
+    { "noise",    52, 1, 1 },
+    { "shift",    53, 2, 1 },
+    { NULL }
+};
+
+static const field_t fields_adc[] = {
+    { "status",    0, 1, 1 },
+    { "value",     1, 2, 1 },
+    { "latch",     3, 1, 1 },
+    { "time",      4, 1, 1 },
+    { NULL }
+};
+
+static const field_t fields_acia[] = {
+    { "control",   0, 1, 1 },
+    { "status",    1, 1, 1 },
+    { NULL }
+};
+
+static const field_t fields_serial[] = {
+    { "register",  0, 1, 1 },
+    { NULL }
+};
+
+static const region_t regions_iomem[] = {
+    { "ROMSEL/ACCCON",   2 },
+    { "Main RAM",   0x8000 },
+    { "VDU workspace", 0x1000 },
+    { "Hazel workspace", 0x2000 },
+    { "Shadow RAM", 0x5000 },
+    { "ROM 0",      0x4000 },
+    { "ROM 1",      0x4000 },
+    { "ROM 2",      0x4000 },
+    { "ROM 3",      0x4000 },
+    { "ROM 4",      0x4000 },
+    { "ROM 5",      0x4000 },
+    { "ROM 6",      0x4000 },
+    { "ROM 7",      0x4000 },
+    { "ROM 8",      0x4000 },
+    { "ROM 9",      0x4000 },
+    { "ROM 10",     0x4000 },
+    { "ROM 11",     0x4000 },
+    { "ROM 12",     0x4000 },
+    { "ROM 13",     0x4000 },
+    { "ROM 14",     0x4000 },
+    { "ROM 15",     0x4000 },
+    { NULL }
+};
+
+static const char *sect_name(int key)
+{
+    switch(key) {
+        case 'm': return "Model";
+        case '6': return "6502";
+        case 'M': return "I/O memory";
+        case 'S': return "System VIA";
+        case 'U': return "User VIA";
+        case 'V': return "Video ULA";
+        case 'C': return "CRTC";
+        case 'v': return "Video";
+        case 's': return "Sound chip";
+        case 'A': return "ADC";
+        case 'a': return "ACIA";
+        case 'r': return "Serial ULA";
+        case 'F': return "VDFS";
+        case '5': return "Music 5000";
+        case 'T': return "Tube ULA";
+        case 'P': return "Tube processor";
+        case 'p': return "Paula";
+        case 'J': return "JIM memory";
+        default:  return "Unknown";
+    }
+}
+
+static const field_t *sect_fields(int key)
+{
+    switch(key) {
+        case '6': return fields_6502;
+        case 'S':
+        case 'U': return fields_via;
+        case 'V': return fields_vula;
+        case 'C': return fields_crtc;
+        case 'v': return fields_video;
+        case 's': return fields_sn76489;
+        case 'A': return fields_adc;
+        case 'a': return fields_acia;
+        case 'r': return fields_serial;
+        default:  return NULL;
+    }
+}
+
+static bool index_snap(snap_t *snap)
+{
+    char magic[8];
+    if (fread(magic, 8, 1, snap->fp) != 1 || memcmp(magic, "BEMSNAP", 7)) {
+        fprintf(stderr, "snapdump: file %s is not a B-Em snapshot file\n", snap->fn);
+        return false;
+    }
+    snap->vers = magic[7];
+    if (snap->vers != '2' && snap->vers != '3') {
+        fprintf(stderr, "snapdump: file %s: cannot diff B-Em snapshot file version %c\n", snap->fn, snap->vers);
+        return false;
+    }
+    unsigned char hdr[4];
+    size_t hdr_size = snap->vers == '2' ? 4 : 3;
+    snap->nsect = 0;
+    while (fread(hdr, hdr_size, 1, snap->fp) == 1) {
+        int key = hdr[0];
+        long size = hdr[1] | (hdr[2] << 8);
+        if (snap->vers == '2')
+            size |= hdr[3] << 16;
+        else if (key & 0x80) {
+            if (fread(hdr, 2, 1, snap->fp) != 1) {
+                fprintf(stderr, "snapdump: unexpected EOF on %s\n", snap->fn);
+                return false;
+            }
+            size |= (hdr[0] << 16) | ((long)hdr[1] << 24);
+            key &= 0x7f;
+        }
+        if (snap->nsect == MAX_SECTS) {
+            fprintf(stderr, "snapdump: too many sections in %s\n", snap->fn);
+            return false;
+        }
+        sect_t *sect = snap->sects + snap->nsect++;
+        sect->key = key;
+        sect->offset = ftell(snap->fp);
+        sect->size = size;
+        fseek(snap->fp, size, SEEK_CUR);
+    }
+    return true;
+}
+
+static sect_t *find_sect(snap_t *snap, int key)
+{
+    for (int i = 0; i < snap->nsect; i++)
+        if (snap->sects[i].key == key)
+            return snap->sects + i;
+    return NULL;
+}
+
+static uint_least32_t get_field(const unsigned char *data, unsigned width)
+{
+    uint_least32_t value = 0;
+    while (width--)
+        value = (value << 8) | data[width];
+    return value;
+}
+
+static bool diff_fields(snap_t *a, sect_t *sa, snap_t *b, sect_t *sb, const field_t *fields)
+{
+    unsigned char da[256], db[256];
+    if (sa->size > sizeof(da) || sb->size > sizeof(db)) {
+        fprintf(stderr, "snapdump: section %c too big\n", sa->key);
+        return true;
+    }
+    fseek(a->fp, sa->offset, SEEK_SET);
+    fseek(b->fp, sb->offset, SEEK_SET);
+    if (fread(da, sa->size, 1, a->fp) != 1 || fread(db, sb->size, 1, b->fp) != 1) {
+        fprintf(stderr, "snapdump: unexpected EOF\n");
+        return true;
+    }
+    const char *name = sect_name(sa->key);
+    bool differ = false;
+    long done = 0;
+    for (const field_t *f = fields; f->name; f++) {
+        for (int i = 0; i < f->count; i++) {
+            long offset = f->offset + i * f->width;
+            if (offset + f->width > sa->size || offset + f->width > sb->size)
+                break;
+            uint_least32_t va = get_field(da + offset, f->width);
+            uint_least32_t vb = get_field(db + offset, f->width);
+            if (va != vb) {
+                if (f->count > 1)
+                    printf("%s: %s[%d] %0*X -> %0*X\n", name, f->name, i, f->width * 2, va, f->width * 2, vb);
+                else
+                    printf("%s: %s %0*X -> %0*X\n", name, f->name, f->width * 2, va, f->width * 2, vb);
+                differ = true;
+            }
+            done = offset + f->width;
+        }
+    }
+    /* Anything past the known fields, e.g. from a newer version. */
+    long common = sa->size < sb->size ? sa->size : sb->size;
+    for (long offset = done; offset < common; offset++) {
+        if (da[offset] != db[offset]) {
+            printf("%s: byte %ld %02X -> %02X\n", name, offset, da[offset], db[offset]);
+            differ = true;
+        }
+    }
+    if (sa->size != sb->size) {
+        printf("%s: size %ld -> %ld\n", name, sa->size, sb->size);
+        differ = true;
+    }
+    return differ;
+}
+
+/* A section read a chunk at a time, inflating it if it is compressed. */
+
+typedef struct {
+    FILE *fp;
+    bool zlib;
+    bool eof;
+    long togo;
+    ZFILE zf;
+} sstream_t;
+
+static void sstream_init(sstream_t *ss, snap_t *snap, sect_t *sect)
+{
+    ss->fp = snap->fp;
+    ss->zlib = sect->key == 'M' || sect->key == 'P' || sect->key == 'J';
+    ss->eof = false;
+    ss->togo = sect->size;
+    fseek(snap->fp, sect->offset, SEEK_SET);
+    if (ss->zlib)
+        zinit(&ss->zf, snap->fp, sect->size);
+}
+
+static size_t sstream_read(sstream_t *ss, unsigned char *buf, size_t size)
+{
+    if (ss->eof)
+        return 0;
+    if (ss->zlib) {
+        if (zread(&ss->zf, buf, size) != Z_OK)
+            ss->eof = true;
+        return size - ss->zf.zs.avail_out;
+    }
+    if (size > ss->togo)
+        size = ss->togo;
+    if (size && fread(buf, size, 1, ss->fp) != 1)
+        size = 0;
+    ss->togo -= size;
+    if (!size)
+        ss->eof = true;
+    return size;
+}
+
+static void sstream_end(sstream_t *ss)
+{
+    if (ss->zlib)
+        inflateEnd(&ss->zf.zs);
+}
+
+/* Fill a buffer as far as the stream allows. */
+
+static size_t sstream_fill(sstream_t *ss, unsigned char *buf, size_t size)
+{
+    size_t got = 0;
+    while (got < size) {
+        size_t n = sstream_read(ss, buf + got, size - got);
+        if (!n)
+            break;
+        got += n;
+    }
+    return got;
+}
+
+typedef struct {
+    const char *name;
+    const region_t *regions;
+    uint_least32_t start;
+    uint_least32_t end;
+    unsigned nshow;
+    unsigned char olds[DIFF_SHOW];
+    unsigned char news[DIFF_SHOW];
+} run_t;
+
+static void print_range(const char *name, const char *region, uint_least32_t start, uint_least32_t end)
+{
+    if (region)
+        printf("%s: %s %04X-%04X", name, region, start, end - 1);
+    else
+        printf("%s: %08X-%08X", name, start, end - 1);
+    printf(" (%u bytes)", end - start);
+}
+
+static void report_run(run_t *run)
+{
+    uint_least32_t start = run->start, end = run->end;
+    const region_t *region = run->regions;
+    uint_least32_t base = 0;
+
+    /* Split the run where it crosses from one region to the next. */
+    if (region) {
+        while (region->name && start < end) {
+            uint_least32_t rend = base + region->size;
+            if (start < rend) {
+                uint_least32_t stop = end < rend ? end : rend;
+                print_range(run->name, region->name, start - base, stop - base);
+                if (start == run->start && stop == run->end && run->nshow == stop - start) {
+                    fputs(":", stdout);
+                    for (unsigned i = 0; i < run->nshow; i++)
+                        printf(" %02X", run->olds[i]);
+                    fputs(" ->", stdout);
+                    for (unsigned i = 0; i < run->nshow; i++)
+                        printf(" %02X", run->news[i]);
+                }
+                putchar('\n');
+                start = stop;
+            }
+            base = rend;
+            region++;
+        }
+        if (start >= end)
+            return;
+    }
+    print_range(run->name, NULL, start, end);
+    if (start == run->start && run->nshow == end - start) {
+        fputs(":", stdout);
+        for (unsigned i = 0; i < run->nshow; i++)
+            printf(" %02X", run->olds[i]);
+        fputs(" ->", stdout);
+        for (unsigned i = 0; i < run->nshow; i++)
+            printf(" %02X", run->news[i]);
+    }
+    putchar('\n');
+}
+
+static bool diff_bytes(snap_t *a, sect_t *sa, snap_t *b, sect_t *sb, const region_t *regions)
+{
+    static unsigned char ba[DIFF_CHUNK], bb[DIFF_CHUNK];
+    sstream_t sa_s, sb_s;
+    run_t run;
+    bool inrun = false, differ = false;
+    uint_least32_t offset = 0;
+    size_t na, nb;
+
+    run.name = sect_name(sa->key);
+    run.regions = regions;
+    sstream_init(&sa_s, a, sa);
+    sstream_init(&sb_s, b, sb);
+    do {
+        na = sstream_fill(&sa_s, ba, sizeof(ba));
+        nb = sstream_fill(&sb_s, bb, sizeof(bb));
+        size_t n = na < nb ? na : nb;
+        for (size_t i = 0; i < n; i++, offset++) {
+            if (ba[i] != bb[i]) {
+                if (inrun && offset - run.end < DIFF_GAP) {
+                    while (run.end <= offset) {
+                        unsigned back = offset - run.end;
+                        if (run.nshow == run.end - run.start && run.nshow < DIFF_SHOW && back <= i) {
+                            run.olds[run.nshow] = ba[i - back];
+                            run.news[run.nshow++] = bb[i - back];
+                        }
+                        run.end++;
+                    }
+                }
+                else {
+                    if (inrun)
+                        report_run(&run);
+                    run.start = offset;
+                    run.end = offset + 1;
+                    run.olds[0] = ba[i];
+                    run.news[0] = bb[i];
+                    run.nshow = 1;
+                    inrun = differ = true;
+                }
+            }
+        }
+    } while (na == sizeof(ba) && nb == sizeof(bb));
+    if (inrun)
+        report_run(&run);
+    if (na != nb) {
+        /* Count what is left of the longer one. */
+        uint_least32_t la = offset + na, lb = offset + nb;
+        size_t n = na < nb ? na : nb;
+        la -= n;
+        lb -= n;
+        while (!sa_s.eof && (na = sstream_fill(&sa_s, ba, sizeof(ba))))
+            la += na;
+        while (!sb_s.eof && (nb = sstream_fill(&sb_s, bb, sizeof(bb))))
+            lb += nb;
+        if (la != lb) {
+            printf("%s: length %u -> %u\n", run.name, la, lb);
+            differ = true;
+        }
+    }
+    sstream_end(&sa_s);
+    sstream_end(&sb_s);
+    return differ;
+}
+
+static bool diff_sect(snap_t *a, sect_t *sa, snap_t *b, sect_t *sb)
+{
+    const field_t *fields = sect_fields(sa->key);
+    if (fields)
+        return diff_fields(a, sa, b, sb, fields);
+    return diff_bytes(a, sa, b, sb, sa->key == 'M' ? regions_iomem : NULL);
+}
+
+static int snapdiff(const char *fn_a, const char *fn_b)
+{
+    static snap_t a, b;
+    int status = 2;
+
+    a.fn = fn_a;
+    b.fn = fn_b;
+    if (!(a.fp = fopen(fn_a, "rb")))
+        fprintf(stderr, "snapdump: unable to open file %s for reading: %s\n", fn_a, strerror(errno));
+    else if (!(b.fp = fopen(fn_b, "rb")))
+        fprintf(stderr, "snapdump: unable to open file %s for reading: %s\n", fn_b, strerror(errno));
+    else if (index_snap(&a) && index_snap(&b)) {
+        bool differ = false;
+        for (int i = 0; i < a.nsect; i++) {
+            sect_t *sa = a.sects + i;
+            sect_t *sb = find_sect(&b, sa->key);
+            if (sb)
+                differ |= diff_sect(&a, sa, &b, sb);
+            else {
+                printf("%s: only in %s\n", sect_name(sa->key), fn_a);
+                differ = true;
+            }
+        }
+        for (int i = 0; i < b.nsect; i++) {
+            if (!find_sect(&a, b.sects[i].key)) {
+                printf("%s: only in %s\n", sect_name(b.sects[i].key), fn_b);
+                differ = true;
+            }
+        }
+        status = differ ? 1 : 0;
+    }
+    if (a.fp)
+        fclose(a.fp);
+    if (b.fp)
+        fclose(b.fp);
+    return status;
+}
+
 int main(int argc, char **argv)
 {
-    if (--argc) {
+    if (argc == 4 && !strcmp(argv[1], "--diff"))
+        return snapdiff(argv[2], argv[3]);
+    if (--argc && strcmp(argv[1], "--diff")) {
         int status = 1;
         char hexout[OUT_SIZE];
         memset(hexout, ' ', OUT_SIZE);
@@ -653,7 +1224,8 @@ int main(int argc, char **argv)
         return status;
     }
     else {
-        fputs("Usage: snapdump [file] ...\n", stderr);
+        fputs("Usage: snapdump [file] ...\n"
+              "       snapdump --diff file1 file2\n", stderr);
         return 1;
     }
 }
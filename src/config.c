@@ -16,6 +16,7 @@
 #include "music5000.h"
 #include "ide.h"
 #include "midi.h"
+#include "rewind.h"
 #include "scsi.h"
 #include "sdf.h"
 #include "sn76489.h"
@@ -178,6 +179,8 @@ void config_load(ALLEGRO_PATH *path)
     al_remove_config_key(bem_cfg, "", "video_resize");
     al_remove_config_key(bem_cfg, "", "tube6502speed");
     defaultwriteprot = get_config_bool("disc", "defaultwriteprotect", 1);
+    if (!fastdisc && get_config_bool("disc", "fastdisc", false))
+        fastdisc = true;
 
     autopause        = get_config_bool(NULL, "autopause", false);
     if (hiresdisplay & BOOL_USE_CONFIG)
@@ -198,7 +201,8 @@ void config_load(ALLEGRO_PATH *path)
     sound_filter     = get_config_bool("sound", "soundfilter",   true);
     sound_paula      = get_config_bool("sound", "soundpaula",    false);
     music5000_fno    = get_config_int("sound", "music5000_filter", 0);
-    buflen_m5        = get_config_int("sound", "buflen_music5000", BUFLEN_M5);
+    sound_dev_freq   = get_config_int("sound", "samplerate",    0);
+    sound_dev_period = get_config_int("sound", "period",        10);
 
     curwave          = get_config_int("sound", "soundwave",     0);
     sidmethod        = get_config_int("sound", "sidmethod",     0);
@@ -208,6 +212,7 @@ void config_load(ALLEGRO_PATH *path)
     ddnoise_type     = get_config_int("sound", "ddtype",        0);
 
     autoskip         = get_config_bool(NULL, "autoskip",        true);
+    rewind_frames    = get_config_int(NULL, "rewind_frames",    25);
 
     vid_fullborders  = get_config_int("video", "fullborders",   1);
     vid_win_multiplier = get_config_int("video", "winmultipler", 1);
@@ -234,6 +239,8 @@ void config_load(ALLEGRO_PATH *path)
 
     if (!fasttape && get_config_bool("tape", "fasttape", false))
         fasttape = true;
+    if (!quicktape && get_config_bool("tape", "quicktape", false))
+        quicktape = true;
 
     scsi_enabled     = get_config_bool("disc", "scsienable", 0);
     ide_enable       = get_config_bool("disc", "ideenable", 0);
@@ -340,6 +347,7 @@ void config_save(void)
         set_config_string("disc", "mmb", mmb_fn);
         set_config_string("disc", "mmccard", mmccard_fn);
         set_config_bool("disc", "defaultwriteprotect", defaultwriteprot);
+        set_config_bool("disc", "fastdisc", fastdisc);
 
         if (tape_loaded)
             al_set_config_value(bem_cfg, "tape", "tape", al_path_cstr(tape_fn, ALLEGRO_NATIVE_PATH_SEP));
@@ -362,7 +370,8 @@ void config_save(void)
         set_config_bool("sound", "soundfilter", sound_filter);
         set_config_bool("sound", "soundpaula",  sound_paula);
         set_config_int("sound", "music5000_filter", music5000_fno);
-        set_config_int("sound", "buflen_music5000", buflen_m5);
+        set_config_int("sound", "samplerate", sound_dev_freq);
+        set_config_int("sound", "period", sound_dev_period);
 
         set_config_int("sound", "soundwave", curwave);
         set_config_int("sound", "sidmethod", sidmethod);
@@ -372,6 +381,7 @@ void config_save(void)
         set_config_int("sound", "ddtype", ddnoise_type);
 
         set_config_bool(NULL, "autoskip", autoskip);
+        set_config_int(NULL, "rewind_frames", rewind_frames);
 
         set_config_int("video", "fullborders", vid_fullborders);
         set_config_int("video", "winmultipler", vid_win_multiplier);
@@ -386,6 +396,7 @@ void config_save(void)
         set_config_string("video", "mode7font", mode7_fontfile);
 
         set_config_bool("tape", "fasttape", fasttape);
+        set_config_bool("tape", "quicktape", quicktape);
 
         set_config_bool("disc", "scsienable", scsi_enabled);
         set_config_bool("disc", "ideenable", ide_enable);
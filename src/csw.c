@@ -1,5 +1,19 @@
 /*B-em v2.2 by Tom Walker
   CSW cassette support*/
+
+/*
+ * The pulses are read from the file through a stream which inflates
+ * them a buffer at a time, so a tape of any size is played in constant
+ * memory and starts at once.  Each byte of the pulse data is the length
+ * of one half-wave.
+ *
+ * The catalogue is made by decoding the whole tape through a second
+ * stream, so the one being played is not disturbed, and is kept as an
+ * index of the pulse position at which the lead-in tone of each block
+ * starts.  csw_seek_block uses that to wind the tape to a block by
+ * skipping pulses without decoding them.
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <zlib.h>
@@ -8,16 +22,53 @@
 #include "csw.h"
 #include "tape.h"
 
-int csw_toneon=0;
+#define CSW_BUF_SIZE 16384
+
+typedef struct {
+    FILE     *fp;
+    long     start;     // file offset of the pulse data.
+    long     foff;      // file offset of the next read.
+    bool     compressed;
+    bool     eof;
+    z_stream zs;
+    uint32_t posn;      // pulse number of out[out_posn].
+    unsigned out_posn;
+    unsigned out_len;
+    uint8_t  in[CSW_BUF_SIZE];
+    uint8_t  out[CSW_BUF_SIZE];
+} csw_stream;
+
+typedef struct {
+    csw_stream *st;
+    int  intone, indat, datbits, enddat, skip, toneon;
+    bool loop;
+} csw_decoder;
+
+enum {
+    CSW_NONE = -1,
+    CSW_DCD_LOW = 0x100,
+    CSW_DCD_HIGH
+};
+
+#define CSW_NAME_LEN 10
+
+typedef struct {
+    char     name[CSW_NAME_LEN+1];
+    uint8_t  flag;
+    uint16_t len;
+    uint32_t load, exec;
+    uint32_t tone;      // pulse at which the lead-in tone starts.
+} csw_block;
 
-static int csw_intone = 1, csw_indat = 0, csw_datbits = 0, csw_enddat = 0;
-static uint8_t *csw_dat = NULL;
-static int      csw_point;
-static uint8_t  csw_head[0x34];
-static int      csw_skip = 0;
-static int      csw_loop = 1;
+int csw_toneon=0;
 int csw_ena;
 
+static FILE        *csw_f;
+static csw_stream  *csw_play;
+static csw_decoder csw_dec;
+static csw_block   *csw_blocks;
+static int         csw_nblocks = -1;
+
 static void csw_read_failed(FILE *csw_f, const char *fn)
 {
     if (ferror(csw_f))
@@ -26,292 +77,428 @@ static void csw_read_failed(FILE *csw_f, const char *fn)
         log_error("csw: premature EOF on '%s'", fn);
 }
 
-#define CSW_MAXLEN (8 * 1024 * 1024)
-
-void csw_load(const char *fn)
+static csw_stream *stream_open(FILE *fp, long start, bool compressed)
 {
-    FILE *csw_f;
-    int end,c;
-    unsigned long destlen = CSW_MAXLEN;
-    uint8_t *tempin;
-
-    /*Allocate buffer*/
-    if (!csw_dat) {
-        if (!(csw_dat = malloc(CSW_MAXLEN))) {
-            log_error("csw: out of memory reading '%s'", fn);
-            return;
+    csw_stream *st = malloc(sizeof(csw_stream));
+    if (st) {
+        memset(&st->zs, 0, sizeof(st->zs));
+        if (compressed && inflateInit(&st->zs) != Z_OK) {
+            free(st);
+            return NULL;
         }
+        st->fp = fp;
+        st->start = st->foff = start;
+        st->compressed = compressed;
+        st->eof = false;
+        st->posn = st->out_posn = st->out_len = 0;
     }
+    return st;
+}
 
-    /*Open file and get size*/
-    if (!(csw_f = fopen(fn,"rb"))) {
-        log_warn("csw: unable to open CSW file '%s': %s", fn, strerror(errno));
-        return;
-    }
-    fseek(csw_f, -1, SEEK_END);
-    end = ftell(csw_f);
-    fseek(csw_f, 0, SEEK_SET);
+static void stream_close(csw_stream *st)
+{
+    if (st->compressed)
+        inflateEnd(&st->zs);
+    free(st);
+}
 
-    /*Read header*/
-    if (fread(csw_head, 0x34, 1, csw_f) == 1) {
-        for (c = 0; c < csw_head[0x23]; c++)
-            getc(csw_f);
-        /*Allocate temporary memory and read file into memory*/
-        end -= ftell(csw_f);
-        if ((tempin = malloc(end))) {
-            if (fread(tempin, end, 1, csw_f) == 1) {
-                fclose(csw_f);
-                if (2 == csw_head[0x21]) {
-                    /*Decompress*/
-                    uncompress(csw_dat, (unsigned long *)&destlen, tempin, end);
-                } else {
-                    if (end >= CSW_MAXLEN) {
-                        log_error("csw: out of memory reading '%s'", fn);
-                        return;
-                    }
-                    memcpy(csw_dat, tempin, end);
-                    destlen = end;
-                }
-                free(tempin);
-                /*Reset data pointer*/
-                csw_point = 0;
-                acia_dcdhigh(&sysacia);
-                tapellatch  = (1000000 / (1200 / 10)) / 64;
-                tapelcount  = 0;
-                tape_loaded = 1;
-                csw_ena     = 1;
-                return;
-            }
-            else {
-                csw_read_failed(csw_f, fn);
-                free(tempin);
+static void stream_rewind(csw_stream *st)
+{
+    if (st->compressed)
+        inflateReset(&st->zs);
+    st->zs.avail_in = 0;
+    st->foff = st->start;
+    st->eof = false;
+    st->posn = st->out_posn = st->out_len = 0;
+}
+
+static size_t stream_read(csw_stream *st, uint8_t *buf)
+{
+    size_t bytes = 0;
+    if (!fseek(st->fp, st->foff, SEEK_SET))
+        bytes = fread(buf, 1, CSW_BUF_SIZE, st->fp);
+    if (ferror(st->fp))
+        log_error("csw: read error: %s", strerror(errno));
+    st->foff += bytes;
+    return bytes;
+}
+
+/* Refill the output buffer, returning false at the end of the tape. */
+
+static bool stream_fill(csw_stream *st)
+{
+    st->out_posn = st->out_len = 0;
+    while (!st->eof) {
+        if (!st->compressed) {
+            if (!(st->out_len = stream_read(st, st->out)))
+                st->eof = true;
+            return st->out_len;
+        }
+        if (!st->zs.avail_in) {
+            st->zs.next_in = st->in;
+            if (!(st->zs.avail_in = stream_read(st, st->in))) {
+                st->eof = true;
+                break;
             }
         }
-        else
-            log_error("csw: out of memory reading '%s'", fn);
+        st->zs.next_out = st->out;
+        st->zs.avail_out = CSW_BUF_SIZE;
+        int ret = inflate(&st->zs, Z_NO_FLUSH);
+        st->out_len = CSW_BUF_SIZE - st->zs.avail_out;
+        if (ret == Z_STREAM_END)
+            st->eof = true;
+        else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            log_error("csw: error decompressing tape: %s", st->zs.msg ? st->zs.msg : "unknown error");
+            st->eof = true;
+        }
+        if (st->out_len)
+            return true;
     }
-    else
-        csw_read_failed(csw_f, fn);
-    fclose(csw_f);
+    return false;
 }
 
-void csw_close()
+static inline int stream_getc(csw_stream *st)
 {
-    if (csw_dat) {
-        free(csw_dat);
-        csw_dat = NULL;
-    }
+    if (st->out_posn >= st->out_len && !stream_fill(st))
+        return -1;
+    st->posn++;
+    return st->out[st->out_posn++];
 }
 
-static int ffound, fdat;
-static int infilenames;
-static void csw_receive(uint8_t val)
+static void stream_skip(csw_stream *st, uint32_t pulses)
 {
-        csw_toneon--;
-        if (infilenames)
-        {
-                ffound = 1;
-                fdat = val;
+    while (pulses) {
+        unsigned avail = st->out_len - st->out_posn;
+        if (!avail) {
+            if (!stream_fill(st))
+                return;
+            continue;
         }
-        else
-           acia_receive(&sysacia, val);
+        if (avail > pulses)
+            avail = pulses;
+        st->out_posn += avail;
+        st->posn += avail;
+        pulses -= avail;
+    }
 }
 
-void csw_poll()
+static void decoder_reset(csw_decoder *d)
+{
+    d->intone  = 1;
+    d->indat   = 0;
+    d->datbits = 0;
+    d->enddat  = 0;
+    d->skip    = 0;
+    d->toneon  = 2;
+}
+
+/*
+ * Decode up to ten half-waves, returning a byte received, a change of
+ * carrier or CSW_NONE.  fast is the ACIA's fast tape setting.
+ */
+
+static int csw_decode(csw_decoder *d, bool fast)
 {
         int c;
-        uint8_t dat;
-        if (!csw_dat) return;
+        int dat;
+        csw_stream *st = d->st;
 
         for (c = 0; c < 10; c++)
         {
-                dat = csw_dat[csw_point++];
-
-                if (csw_point >= (8 * 1024 * 1024))
+                if ((dat = stream_getc(st)) < 0)
                 {
-                        csw_point = 0;
-                        csw_loop = 1;
+                        /* End of the tape, wind back to the start. */
+                        stream_rewind(st);
+                        d->loop = true;
+                        if ((dat = stream_getc(st)) < 0)
+                                return CSW_NONE;
                 }
-                if (csw_skip)
-                   csw_skip--;
-                else if (csw_intone && dat > 0xD) /*Not in tone any more - data start bit*/
+                if (d->skip)
+                   d->skip--;
+                else if (d->intone && dat > 0xD) /*Not in tone any more - data start bit*/
                 {
-                        csw_point++; /*Skip next half of wave*/
-                        if (sysacia_tapespeed) csw_skip = 6;
-                        csw_intone = 0;
-                        csw_indat = 1;
-
-                        csw_datbits = csw_enddat = 0;
-                        acia_dcdlow(&sysacia);
-                        return;
+                        stream_skip(st, 1); /*Skip next half of wave*/
+                        if (fast) d->skip = 6;
+                        d->intone = 0;
+                        d->indat = 1;
+
+                        d->datbits = d->enddat = 0;
+                        return CSW_DCD_LOW;
                 }
-                else if (csw_indat && csw_datbits != -1 && csw_datbits != -2)
+                else if (d->indat && d->datbits != -1 && d->datbits != -2)
                 {
-                        csw_point++; /*Skip next half of wave*/
-                        if (sysacia_tapespeed) csw_skip = 6;
-                        csw_enddat >>= 1;
+                        stream_skip(st, 1); /*Skip next half of wave*/
+                        if (fast) d->skip = 6;
+                        d->enddat >>= 1;
 
                         if (dat <= 0xD)
                         {
-                                csw_point += 2;
-                                if (sysacia_tapespeed) csw_skip += 6;
-                                csw_enddat |= 0x80;
+                                stream_skip(st, 2);
+                                if (fast) d->skip += 6;
+                                d->enddat |= 0x80;
                         }
-                        csw_datbits++;
-                        if (csw_datbits == 8)
+                        d->datbits++;
+                        if (d->datbits == 8)
                         {
-                                csw_receive(csw_enddat);
-
-                                csw_datbits = -2;
-                                return;
+                                d->toneon--;
+                                d->datbits = -2;
+                                return d->enddat;
                         }
                 }
-                else if (csw_indat && csw_datbits == -2) /*Deal with stop bit*/
+                else if (d->indat && d->datbits == -2) /*Deal with stop bit*/
                 {
-                        csw_point++;
-                        if (sysacia_tapespeed) csw_skip = 6;
+                        stream_skip(st, 1);
+                        if (fast) d->skip = 6;
                         if (dat <= 0xD)
                         {
-                                csw_point += 2;
-                                if (sysacia_tapespeed) csw_skip += 6;
+                                stream_skip(st, 2);
+                                if (fast) d->skip += 6;
                         }
-                        csw_datbits = -1;
+                        d->datbits = -1;
                 }
-                else if (csw_indat && csw_datbits == -1)
+                else if (d->indat && d->datbits == -1)
                 {
                         if (dat <= 0xD) /*Back in tone again*/
                         {
-                                acia_dcdhigh(&sysacia);
-                                csw_toneon  = 2;
-                                csw_indat   = 0;
-                                csw_intone  = 1;
-                                csw_datbits = 0;
-                                return;
+                                d->toneon  = 2;
+                                d->indat   = 0;
+                                d->intone  = 1;
+                                d->datbits = 0;
+                                return CSW_DCD_HIGH;
                         }
                         else /*Start bit*/
                         {
-                                csw_point++; /*Skip next half of wave*/
-                                if (sysacia_tapespeed) csw_skip += 6;
-                                csw_datbits = 0;
-                                csw_enddat  = 0;
+                                stream_skip(st, 1); /*Skip next half of wave*/
+                                if (fast) d->skip += 6;
+                                d->datbits = 0;
+                                d->enddat  = 0;
                         }
                 }
         }
+        return CSW_NONE;
 }
 
-#define getcswbyte()            ffound = 0; \
-                                while (!ffound && !csw_loop) \
-                                { \
-                                        csw_poll(); \
-                                } \
-                                if (csw_loop) break;
+static void csw_free_index(void)
+{
+    if (csw_blocks) {
+        free(csw_blocks);
+        csw_blocks = NULL;
+    }
+    csw_nblocks = -1;
+}
 
-static uint8_t ffilename[16];
-void csw_findfilenames()
+/*
+ * Index the tape by decoding it once from start to end.  A block header
+ * starts with a '*' sync byte straight after a high tone and consists of
+ * the file name, terminated by a zero, the load and execution addresses,
+ * the block number, the block length and the flag byte.  After that come
+ * four spare bytes, the header CRC, the data and the data CRC.
+ */
+
+static bool csw_index(void)
 {
-        int temp, temps, tempd, tempi, tempsk, tempspd;
-        uint8_t tb;
-        int c;
-        int fsize = 0;
-        char s[256];
-        uint32_t run, load;
-        uint8_t status;
-        int skip;
-        if (!csw_dat) return;
-        temp    = csw_point;
-        temps   = csw_indat;
-        tempi   = csw_intone;
-        tempd   = csw_datbits;
-        tempsk  = csw_skip;
-        tempspd = sysacia_tapespeed;
-        csw_point = 0;
-
-        csw_indat = csw_intone = csw_datbits = csw_skip = 0;
-        csw_intone = 1;
-        sysacia_tapespeed = 0;
-
-//        gzseek(csw,12,SEEK_SET);
-        csw_loop = 0;
-        infilenames = 1;
-        while (!csw_loop)
-        {
-//                log_debug("Start\n");
-                ffound = 0;
-                while (!ffound && !csw_loop)
-                {
-                        csw_poll();
+    if (csw_nblocks >= 0)
+        return true;
+    if (!csw_play)
+        return false;
+
+    csw_decoder d;
+    if (!(d.st = stream_open(csw_f, csw_play->start, csw_play->compressed))) {
+        log_error("csw: out of memory indexing tape");
+        return false;
+    }
+    decoder_reset(&d);
+    d.loop = false;
+
+    int nblocks = 0, nalloc = 0, count = 0, state = 0;
+    uint32_t tone = 0;
+    uint8_t header[13];
+    csw_block blk;
+    bool ok = true;
+
+    while (ok && !d.loop) {
+        int val = csw_decode(&d, false);
+        if (val == CSW_DCD_HIGH)
+            tone = d.st->posn;
+        if (val < 0 || val > 0xff)
+            continue;
+        switch(state) {
+            case 0: // looking for the sync byte.
+                if (val == 0x2A && d.toneon == 1) {
+                    memset(&blk, 0, sizeof(blk));
+                    blk.tone = tone;
+                    count = 0;
+                    state = 1;
                 }
-                if (csw_loop) break;
-//                log_debug("FDAT %02X csw_toneon %i\n",fdat,csw_toneon);
-                if (fdat == 0x2A && csw_toneon == 1)
-                {
-                        c = 0;
-                        do
-                        {
-                                ffound = 0;
-                                while (!ffound && !csw_loop)
-                                {
-                                        csw_poll();
-                                }
-                                if (csw_loop) break;
-                                ffilename[c++] = fdat;
-                        } while (fdat != 0x0 && c <= 10);
-                        if (csw_loop) break;
-                        c--;
-                        while (c < 13) ffilename[c++] = 32;
-                        ffilename[c] = 0;
-
-                                getcswbyte();
-                                tb = fdat;
-                                getcswbyte();
-                                load = tb | (fdat << 8);
-                                getcswbyte();
-                                tb = fdat;
-                                getcswbyte();
-                                load |= (tb | (fdat << 8)) << 16;
-
-                                getcswbyte();
-                                tb = fdat;
-                                getcswbyte();
-                                run = tb | (fdat << 8);
-                                getcswbyte();
-                                tb = fdat;
-                                getcswbyte();
-                                run |= (tb | (fdat << 8)) << 16;
-
-                                getcswbyte();
-                                getcswbyte();
-
-                                getcswbyte();
-                                tb = fdat;
-                                getcswbyte();
-                                skip = tb | (fdat << 8);
-
-                                fsize += skip;
-
-                                getcswbyte();
-                                status = fdat;
-
-//log_debug("Got block - %08X %08X %02X\n",load,run,status);
-                        if (status & 0x80)
-                        {
-                                sprintf(s, "%s Size %04X Load %08X Run %08X", ffilename, fsize, load, run);
-                                cataddname(s);
-                                fsize = 0;
-                        }
-                        for (c = 0; c < skip + 8; c++)
-                        {
-                                getcswbyte();
+                break;
+            case 1: // file name.
+                if (!val) {
+                    count = 0;
+                    state = 2;
+                }
+                else if (count < CSW_NAME_LEN)
+                    blk.name[count++] = val;
+                else
+                    state = 0;
+                break;
+            case 2: // rest of the header.
+                header[count++] = val;
+                if (count == sizeof(header)) {
+                    blk.load = header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t)header[3] << 24);
+                    blk.exec = header[4] | (header[5] << 8) | (header[6] << 16) | ((uint32_t)header[7] << 24);
+                    blk.len  = header[10] | (header[11] << 8);
+                    blk.flag = header[12];
+                    if (nblocks == nalloc) {
+                        nalloc = nalloc ? nalloc * 2 : 64;
+                        csw_block *blocks = realloc(csw_blocks, nalloc * sizeof(csw_block));
+                        if (!blocks) {
+                            log_error("csw: out of memory indexing tape");
+                            ok = false;
+                            break;
                         }
+                        csw_blocks = blocks;
+                    }
+                    csw_blocks[nblocks++] = blk;
+                    count = blk.len + 8;
+                    state = 3;
+                }
+                break;
+            case 3: // block body.
+                if (--count == 0)
+                    state = 0;
+        }
+    }
+    stream_close(d.st);
+    if (!ok) {
+        csw_free_index();
+        return false;
+    }
+    log_debug("csw: indexed %d blocks", nblocks);
+    csw_nblocks = nblocks;
+    return true;
+}
+
+void csw_load(const char *fn)
+{
+    uint8_t csw_head[0x34];
+
+    csw_close();
+
+    /*Open file and read header*/
+    if (!(csw_f = fopen(fn,"rb"))) {
+        log_warn("csw: unable to open CSW file '%s': %s", fn, strerror(errno));
+        return;
+    }
+    if (fread(csw_head, 0x34, 1, csw_f) == 1) {
+        if (!fseek(csw_f, csw_head[0x23], SEEK_CUR)) {
+            if (csw_head[0x21] == 1 || csw_head[0x21] == 2) {
+                if ((csw_play = stream_open(csw_f, ftell(csw_f), csw_head[0x21] == 2))) {
+                    csw_dec.st = csw_play;
+                    csw_dec.loop = false;
+                    decoder_reset(&csw_dec);
+                    csw_toneon = 0;
+                    acia_dcdhigh(&sysacia);
+                    tapellatch  = (1000000 / (1200 / 10)) / 64;
+                    tapelcount  = 0;
+                    tape_loaded = 1;
+                    csw_ena     = 1;
+                    return;
                 }
+                log_error("csw: out of memory reading '%s'", fn);
+            }
+            else
+                log_error("csw: unsupported compression type %d in '%s'", csw_head[0x21], fn);
+        }
+        else
+            csw_read_failed(csw_f, fn);
+    }
+    else
+        csw_read_failed(csw_f, fn);
+    fclose(csw_f);
+    csw_f = NULL;
+}
+
+void csw_close()
+{
+    csw_free_index();
+    if (csw_play) {
+        stream_close(csw_play);
+        csw_play = NULL;
+    }
+    if (csw_f) {
+        fclose(csw_f);
+        csw_f = NULL;
+    }
+}
+
+void csw_poll()
+{
+    if (!csw_play) return;
+
+    int val = csw_decode(&csw_dec, sysacia_tapespeed);
+    if (val == CSW_DCD_LOW)
+        acia_dcdlow(&sysacia);
+    else if (val == CSW_DCD_HIGH)
+        acia_dcdhigh(&sysacia);
+    else if (val >= 0)
+        acia_receive(&sysacia, val);
+    csw_toneon = csw_dec.toneon;
+}
+
+/*
+ * Wind the tape to the start of the lead-in tone for block n of the
+ * index, skipping the pulses before it without decoding them.
+ */
+
+static bool csw_seek_block(int n)
+{
+    if (!csw_index() || n < 0 || n >= csw_nblocks)
+        return false;
+    uint32_t tone = csw_blocks[n].tone;
+    if (tone < csw_play->posn)
+        stream_rewind(csw_play);
+    stream_skip(csw_play, tone - csw_play->posn);
+    decoder_reset(&csw_dec);
+    csw_toneon = csw_dec.toneon;
+    acia_dcdhigh(&sysacia);
+    return true;
+}
+
+void csw_findfilenames()
+{
+    char s[256];
+    int fsize = 0, file = 1;
+
+    if (!csw_index())
+        return;
+    for (int n = 0; n < csw_nblocks; n++) {
+        csw_block *blk = csw_blocks + n;
+        fsize += blk->len;
+        if (blk->flag & 0x80) {
+            sprintf(s, "%3d %-13s Size %04X Load %08X Run %08X", file++, blk->name, fsize, blk->load, blk->exec);
+            cataddname(s);
+            fsize = 0;
         }
-        infilenames = 0;
-        csw_indat   = temps;
-        csw_intone  = tempi;
-        csw_datbits = tempd;
-        csw_skip    = tempsk;
-        sysacia_tapespeed = tempspd;
-        csw_point   = temp;
-        csw_loop = 0;
+    }
 }
 
+/*
+ * Wind the tape to the first block of file n, numbered from one as in
+ * the catalogue.
+ */
+
+bool csw_seek_file(int file)
+{
+    int first = 0;
+
+    if (!csw_index())
+        return false;
+    for (int n = 0; n < csw_nblocks; n++) {
+        if (csw_blocks[n].flag & 0x80) {
+            if (--file == 0)
+                return csw_seek_block(first);
+            first = n + 1;
+        }
+    }
+    return false;
+}
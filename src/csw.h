@@ -5,6 +5,7 @@ void csw_load(const char *fn);
 void csw_close(void);
 void csw_poll(void);
 void csw_findfilenames(void);
+bool csw_seek_file(int file);
 
 extern int csw_ena;
 extern int csw_toneon;
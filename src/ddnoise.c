@@ -1,8 +1,25 @@
 /*B-em v2.2 by Tom Walker
   Disc drive noise*/
 
+/*
+ * The drive and tape noise samples are decoded once, when loaded, into
+ * mono floating point at the output rate and mixed here from the
+ * postprocess callback of our own mixer, i.e. on the audio thread.  The emulation
+ * thread only posts small events, timestamped in emulated 2MHz cycles,
+ * so a seek costs it no more than taking a lock and appending to a queue.
+ *
+ * The audio thread keeps its own idea of the emulated time it is playing
+ * which trails the emulation by DDN_LATENCY.  Events are started at the
+ * sample that corresponds to their timestamp so a burst of steps posted
+ * within one timer slice is still heard spread out as it happened.  If an
+ * event turns up well outside the window we expect, for example after a
+ * pause, at full speed or after a reset, the clock is simply resynced.
+ */
+
 #include <stdio.h>
+#include <math.h>
 #include "b-em.h"
+#include "6502.h"
 #include "disc.h"
 #include "ddnoise.h"
 #include "sound.h"
@@ -10,91 +27,331 @@
 
 int ddnoise_vol=3;
 int ddnoise_type=0;
-int ddnoise_ticks = 0;
 
-static ALLEGRO_SAMPLE *seeksmp[4][2];
-static ALLEGRO_SAMPLE *motorsmp[3];
+struct ddnoise_smp {
+    unsigned len;
+    float data[];
+};
+
+#define DDN_LATENCY (2000000.0 * 0.06)
+#define DDN_SLACK   (2000000.0 * 0.25)
+#define DDN_EVQ     64
+
+typedef struct {
+    uint64_t time;
+    ddnoise_smp_t *smp;
+    ddnoise_smp_t *loop;
+    float vol;
+    int voice;
+} ddn_event_t;
+
+typedef struct {
+    ddnoise_smp_t *smp;
+    ddnoise_smp_t *loop;
+    unsigned pos;
+    float vol;
+} ddn_voice_t;
+
+static ALLEGRO_MIXER *mixer;
+static double ddn_cps;          // emulated cycles per output sample.
+static ALLEGRO_MUTEX *mutex;
+
+static ddn_event_t events[DDN_EVQ];
+static unsigned ev_head, ev_tail;
+static ddn_voice_t voices[DDNOISE_VOICES];
+static double mix_time;
+static bool mix_synced;
+
+static ddnoise_smp_t *seeksmp[4][2];
+static ddnoise_smp_t *motorsmp[3];
+
+static float smp_value(const void *data, ALLEGRO_AUDIO_DEPTH depth, size_t i)
+{
+    switch(depth) {
+        case ALLEGRO_AUDIO_DEPTH_INT8:
+            return ((const int8_t *)data)[i] / 128.0f;
+        case ALLEGRO_AUDIO_DEPTH_UINT8:
+            return (((const uint8_t *)data)[i] - 128) / 128.0f;
+        case ALLEGRO_AUDIO_DEPTH_INT16:
+            return ((const int16_t *)data)[i] / 32768.0f;
+        case ALLEGRO_AUDIO_DEPTH_UINT16:
+            return (((const uint16_t *)data)[i] - 32768) / 32768.0f;
+        case ALLEGRO_AUDIO_DEPTH_FLOAT32:
+            return ((const float *)data)[i];
+        default:
+            return 0.0f;
+    }
+}
 
-static ALLEGRO_SAMPLE_ID seek_smp_id;
-static ALLEGRO_SAMPLE_ID motor_smp_id;
+/* Convert a loaded sample to mono float at the output rate. */
 
-ALLEGRO_SAMPLE *find_load_wav(ALLEGRO_PATH *dir, const char *name)
+static ddnoise_smp_t *ddnoise_decode(ALLEGRO_SAMPLE *smp, const char *name)
+{
+    ALLEGRO_AUDIO_DEPTH depth = al_get_sample_depth(smp);
+    unsigned chans = al_get_channel_count(al_get_sample_channels(smp));
+    unsigned freq = al_get_sample_frequency(smp);
+    unsigned inlen = al_get_sample_length(smp);
+    const void *data = al_get_sample_data(smp);
+    unsigned len, i, c;
+    ddnoise_smp_t *dec;
+
+    if (depth == ALLEGRO_AUDIO_DEPTH_INT24 || depth == ALLEGRO_AUDIO_DEPTH_UINT24) {
+        log_error("ddnoise: unsupported sample depth for %s", name);
+        return NULL;
+    }
+    if (!inlen || !freq || !chans)
+        return NULL;
+    len = ((uint64_t)inlen * sound_freq) / freq;
+    if (!len)
+        len = 1;
+    if (!(dec = malloc(sizeof(ddnoise_smp_t) + len * sizeof(float)))) {
+        log_error("ddnoise: out of memory decoding %s", name);
+        return NULL;
+    }
+    dec->len = len;
+    for (i = 0; i < len; i++) {
+        double pos = (double)i * freq / sound_freq;
+        unsigned p0 = pos;
+        unsigned p1 = (p0 + 1 < inlen) ? p0 + 1 : p0;
+        float frac = pos - p0;
+        float v0 = 0.0f, v1 = 0.0f;
+        for (c = 0; c < chans; c++) {
+            v0 += smp_value(data, depth, p0 * chans + c);
+            v1 += smp_value(data, depth, p1 * chans + c);
+        }
+        dec->data[i] = (v0 + (v1 - v0) * frac) / chans;
+    }
+    return dec;
+}
+
+ddnoise_smp_t *ddnoise_load(ALLEGRO_PATH *dir, const char *name)
 {
     ALLEGRO_PATH *path;
     ALLEGRO_SAMPLE *smp;
+    ddnoise_smp_t *dec = NULL;
     const char *cpath;
 
     if ((path = find_dat_file(dir, name, ".wav"))) {
         cpath = al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP);
         if ((smp = al_load_sample(cpath))) {
             log_debug("ddnoise: loaded %s from %s", name, cpath);
-            return smp;
+            dec = ddnoise_decode(smp, name);
+            al_destroy_sample(smp);
         }
-        log_error("ddnoise: unable to load %s from %s", name, cpath);
+        else
+            log_error("ddnoise: unable to load %s from %s", name, cpath);
         al_destroy_path(path);
     }
-    return NULL;
+    return dec;
 }
 
-void ddnoise_init(void)
+void ddnoise_free(ddnoise_smp_t *smp)
+{
+    if (smp)
+        free(smp);
+}
+
+/*
+ * Drop any queued events and silence the voices.  Must be done before any
+ * sample they may refer to is freed.
+ */
+
+void ddnoise_flush(void)
+{
+    if (mutex) {
+        al_lock_mutex(mutex);
+        ev_head = ev_tail = 0;
+        memset(voices, 0, sizeof(voices));
+        mix_synced = false;
+        al_unlock_mutex(mutex);
+    }
+}
+
+void ddnoise_play(int vnum, ddnoise_smp_t *smp, ddnoise_smp_t *loop, float vol)
+{
+    if (mixer) {
+        al_lock_mutex(mutex);
+        unsigned next = (ev_tail + 1) % DDN_EVQ;
+        if (next != ev_head) {
+            ddn_event_t *ev = events + ev_tail;
+            ev->time = stopwatch;
+            ev->smp = smp;
+            ev->loop = loop;
+            ev->vol = vol;
+            ev->voice = vnum;
+            ev_tail = next;
+        }
+        else
+            log_debug("ddnoise: event queue full");
+        al_unlock_mutex(mutex);
+    }
+}
+
+static void mix_voices(float *out, unsigned count)
+{
+    for (ddn_voice_t *v = voices; v < voices + DDNOISE_VOICES; v++) {
+        float *dest = out;
+        unsigned left = count;
+        while (v->smp && left) {
+            unsigned run = v->smp->len - v->pos;
+            if (run > left)
+                run = left;
+            const float *src = v->smp->data + v->pos;
+            for (unsigned i = 0; i < run; i++) {
+                float s = src[i] * v->vol;
+                *dest++ += s;
+                *dest++ += s;
+            }
+            left -= run;
+            v->pos += run;
+            if (v->pos >= v->smp->len) {
+                v->smp = v->loop;
+                v->pos = 0;
+            }
+        }
+    }
+}
+
+/* Mixer postprocess callback, runs on the audio thread. */
+
+static void ddnoise_mix(void *buf, unsigned int samples, void *data)
+{
+    float *out = buf;
+    unsigned done = 0;
+
+    al_lock_mutex(mutex);
+    while (ev_head != ev_tail) {
+        ddn_event_t *ev = events + ev_head;
+        double delta = (double)ev->time - mix_time;
+        if (!mix_synced || delta < -DDN_SLACK || delta > DDN_SLACK) {
+            mix_time = (double)ev->time - DDN_LATENCY;
+            mix_synced = true;
+            delta = DDN_LATENCY;
+        }
+        double at = (delta < 0.0) ? 0.0 : delta / ddn_cps;
+        if (at >= samples - done)
+            break;
+        unsigned run = at;
+        mix_voices(out + done * 2, run);
+        done += run;
+        mix_time += run * ddn_cps;
+        ddn_voice_t *v = voices + ev->voice;
+        v->smp = ev->smp;
+        v->loop = ev->loop;
+        v->pos = 0;
+        v->vol = ev->vol;
+        ev_head = (ev_head + 1) % DDN_EVQ;
+    }
+    mix_voices(out + done * 2, samples - done);
+    mix_time += (samples - done) * ddn_cps;
+    al_unlock_mutex(mutex);
+}
+
+static void ddnoise_load_all(void)
 {
     const char *dir;
     ALLEGRO_PATH *subdir;
-    static ALLEGRO_SAMPLE *smp;
+    ddnoise_smp_t *smp;
 
     if (ddnoise_type) dir = "ddnoise/35";
     else              dir = "ddnoise/525";
     subdir = al_create_path_for_directory(dir);
 
-    if ((smp = find_load_wav(subdir, "stepo"))) {
+    if ((smp = ddnoise_load(subdir, "stepo"))) {
         seeksmp[0][0] = smp;
-        seeksmp[0][1] = find_load_wav(subdir, "stepi");
-        seeksmp[1][0] = find_load_wav(subdir, "seek1o");
-        seeksmp[1][1] = find_load_wav(subdir, "seek1i");
-        seeksmp[2][0] = find_load_wav(subdir, "seek2o");
-        seeksmp[2][1] = find_load_wav(subdir, "seek2i");
-        seeksmp[3][0] = find_load_wav(subdir, "seek3o");
-        seeksmp[3][1] = find_load_wav(subdir, "seek3i");
+        seeksmp[0][1] = ddnoise_load(subdir, "stepi");
+        seeksmp[1][0] = ddnoise_load(subdir, "seek1o");
+        seeksmp[1][1] = ddnoise_load(subdir, "seek1i");
+        seeksmp[2][0] = ddnoise_load(subdir, "seek2o");
+        seeksmp[2][1] = ddnoise_load(subdir, "seek2i");
+        seeksmp[3][0] = ddnoise_load(subdir, "seek3o");
+        seeksmp[3][1] = ddnoise_load(subdir, "seek3i");
     } else {
-        smp = find_load_wav(subdir, "step");
-        seeksmp[0][0] = smp;
-        seeksmp[0][1] = smp;
-        smp = find_load_wav(subdir, "seek");
-        seeksmp[1][0] = smp;
-        seeksmp[1][0] = smp;
-        smp = find_load_wav(subdir, "seek2");
-        seeksmp[2][0] = smp;
-        seeksmp[2][1] = smp;
-        smp = find_load_wav(subdir, "seek3");
-        seeksmp[3][0] = smp;
-        seeksmp[3][1] = smp;
-    }
-    motorsmp[0] = find_load_wav(subdir, "motoron");
-    motorsmp[1] = find_load_wav(subdir, "motor");
-    motorsmp[2] = find_load_wav(subdir, "motoroff");
+        seeksmp[0][0] = seeksmp[0][1] = ddnoise_load(subdir, "step");
+        seeksmp[1][0] = seeksmp[1][1] = ddnoise_load(subdir, "seek");
+        seeksmp[2][0] = seeksmp[2][1] = ddnoise_load(subdir, "seek2");
+        seeksmp[3][0] = seeksmp[3][1] = ddnoise_load(subdir, "seek3");
+    }
+    motorsmp[0] = ddnoise_load(subdir, "motoron");
+    motorsmp[1] = ddnoise_load(subdir, "motor");
+    motorsmp[2] = ddnoise_load(subdir, "motoroff");
+    al_destroy_path(subdir);
 }
 
-void ddnoise_close()
+static void ddnoise_free_all(void)
 {
-    ALLEGRO_SAMPLE *smp, *smpo, *smpi;
+    ddnoise_smp_t *smpo, *smpi;
     int c;
 
+    ddnoise_flush();
     for (c = 0; c < 4; c++) {
-        if ((smpo = seeksmp[c][0])) {
-            al_destroy_sample(smpo);
-            seeksmp[c][0] = NULL;
-        }
-        if ((smpi = seeksmp[c][1])) {
-            if (smpi != smpo)
-                al_destroy_sample(smpo);
-            seeksmp[c][1] = NULL;
-        }
+        smpo = seeksmp[c][0];
+        smpi = seeksmp[c][1];
+        ddnoise_free(smpo);
+        if (smpi != smpo)
+            ddnoise_free(smpi);
+        seeksmp[c][0] = seeksmp[c][1] = NULL;
     }
     for (c = 0; c < 3; c++) {
-        if ((smp = motorsmp[c])) {
-            al_destroy_sample(motorsmp[c]);
-            motorsmp[c] = NULL;
-        }
+        ddnoise_free(motorsmp[c]);
+        motorsmp[c] = NULL;
+    }
+}
+
+void ddnoise_init(void)
+{
+    if (!sound_freq) {
+        log_error("sound: no sound output for disc drive noise");
+        return;
+    }
+    ddn_cps = 2000000.0 / sound_freq;
+    if ((mutex = al_create_mutex())) {
+        if ((mixer = al_create_mixer(sound_freq, ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_2))) {
+            if (sound_attach_mixer(mixer)) {
+                al_set_mixer_postprocess_callback(mixer, ddnoise_mix, NULL);
+                ddnoise_load_all();
+                return;
+            } else
+                log_error("sound: unable to attach mixer for disc drive noise");
+            al_destroy_mixer(mixer);
+            mixer = NULL;
+        } else
+            log_error("sound: unable to create mixer for disc drive noise");
+    } else
+        log_error("sound: unable to create mutex for disc drive noise");
+}
+
+/* Switch between the 5.25" and 3.5" drive sounds. */
+
+void ddnoise_reload(void)
+{
+    ddnoise_free_all();
+    if (mixer)
+        ddnoise_load_all();
+}
+
+bool ddnoise_running(void)
+{
+    return mixer != NULL;
+}
+
+bool ddnoise_attach(ALLEGRO_AUDIO_STREAM *stream)
+{
+    return mixer && al_attach_audio_stream_to_mixer(stream, mixer);
+}
+
+void ddnoise_close()
+{
+    if (mixer)
+        al_set_mixer_postprocess_callback(mixer, NULL, NULL);
+    ddnoise_free_all();
+    if (mixer) {
+        al_destroy_mixer(mixer);
+        mixer = NULL;
+    }
+    if (mutex) {
+        al_destroy_mutex(mutex);
+        mutex = NULL;
     }
 }
 
@@ -113,7 +370,7 @@ static float map_ddnoise_vol(void)
 
 void ddnoise_seek(int len)
 {
-    ALLEGRO_SAMPLE *smp;
+    ddnoise_smp_t *smp;
     int ddnoise_sstat = -1;
     int ddnoise_sdir = 0;
 
@@ -132,46 +389,34 @@ void ddnoise_seek(int len)
             ddnoise_sstat = 2;
         else
             ddnoise_sstat = 3;
-        if ((smp = seeksmp[ddnoise_sstat][ddnoise_sdir])) {
-            al_stop_sample(&seek_smp_id);
-            al_play_sample(smp, map_ddnoise_vol(), 0.0, 1.0, ALLEGRO_PLAYMODE_ONCE, &seek_smp_id);
-        }
+        if ((smp = seeksmp[ddnoise_sstat][ddnoise_sdir]))
+            ddnoise_play(DDNOISE_VOICE_SEEK, smp, NULL, map_ddnoise_vol());
     }
     log_debug("ddnoise: begin seek");
 }
 
+/*
+ * The motor loop follows on from the spin up sample on the audio thread
+ * so there is no longer any need to count down to the head going down.
+ */
+
 void ddnoise_spinup(void)
 {
-    ALLEGRO_SAMPLE *smp;
-
     log_debug("ddnoise: spinup");
-    if (sound_ddnoise && (smp = motorsmp[0])) {
-        al_play_sample(smp, map_ddnoise_vol(), 0.0, 1.0, ALLEGRO_PLAYMODE_ONCE, NULL);
-        ddnoise_ticks = (50 * al_get_sample_length(smp)) / al_get_sample_frequency(smp);
-        log_debug("ddnoise: head load sample to finish in %d ticks", ddnoise_ticks);
+    if (sound_ddnoise) {
+        if (motorsmp[0])
+            ddnoise_play(DDNOISE_VOICE_MOTOR, motorsmp[0], motorsmp[1], map_ddnoise_vol());
+        else if (motorsmp[1])
+            ddnoise_play(DDNOISE_VOICE_MOTOR, motorsmp[1], motorsmp[1], map_ddnoise_vol());
     }
 }
 
-void ddnoise_headdown(void)
-{
-    ALLEGRO_SAMPLE *smp;
-
-    log_debug("ddnoise: head down");
-    if (sound_ddnoise && (smp = motorsmp[1]))
-        al_play_sample(smp, map_ddnoise_vol(), 0.0, 1.0, ALLEGRO_PLAYMODE_LOOP, &motor_smp_id);
-}
-
 void ddnoise_spindown(void)
 {
-    ALLEGRO_SAMPLE *smp;
-
     log_debug("ddnoise: spindown");
     if (sound_ddnoise) {
-        if ((smp = motorsmp[1])) {
-            log_debug("ddnoise: stopping sample");
-            al_stop_sample(&motor_smp_id);
-        }
-        if ((smp = motorsmp[2]))
-            al_play_sample(smp, map_ddnoise_vol(), 0.0, 1.0, ALLEGRO_PLAYMODE_ONCE, NULL);
+        ddnoise_play(DDNOISE_VOICE_MOTOR, NULL, NULL, 0.0f);
+        if (motorsmp[2])
+            ddnoise_play(DDNOISE_VOICE_MOTOROFF, motorsmp[2], NULL, map_ddnoise_vol());
     }
 }
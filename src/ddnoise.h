@@ -2,15 +2,30 @@
 #define __INC_DDNOISE_H
 
 #include <allegro5/allegro_audio.h>
-extern ALLEGRO_SAMPLE *find_load_wav(ALLEGRO_PATH *dir, const char *name);
+
+typedef struct ddnoise_smp ddnoise_smp_t;
+
+enum {
+    DDNOISE_VOICE_SEEK,
+    DDNOISE_VOICE_MOTOR,
+    DDNOISE_VOICE_MOTOROFF,
+    DDNOISE_VOICE_TAPE,
+    DDNOISE_VOICES
+};
+
+ddnoise_smp_t *ddnoise_load(ALLEGRO_PATH *dir, const char *name);
+void ddnoise_free(ddnoise_smp_t *smp);
+void ddnoise_play(int voice, ddnoise_smp_t *smp, ddnoise_smp_t *loop, float vol);
+void ddnoise_flush(void);
+bool ddnoise_running(void);
+bool ddnoise_attach(ALLEGRO_AUDIO_STREAM *stream);
 void ddnoise_init(void);
+void ddnoise_reload(void);
 void ddnoise_close(void);
 void ddnoise_seek(int len);
 void ddnoise_spinup(void);
-void ddnoise_headdown(void);
 void ddnoise_spindown(void);
 extern int ddnoise_vol;
 extern int ddnoise_type;
-extern int ddnoise_ticks;
 
 #endif
@@ -327,6 +327,7 @@ static inline void debug_cons_close(void) {}
 #include "video.h"
 #include "sn76489.h"
 #include "model.h"
+#include "tape.h"
 
 void debug_kill()
 {
@@ -497,6 +498,7 @@ static const char helptext[] =
     "    symlist    - list all symbols\n"
     "    swiftsym f - load symbols in swift format from file f\n"
     "    simplesym f - load symbols in name=value format from file f\n"
+    "    tape n     - wind the tape to file n of the tape catalogue\n"
     "    trace fn   - trace disassembly/registers to file, close file if no fn\n"
     "    trange s e - trace the range s to e (replaces tracing everything)\n"
     "    vrefresh t - extra video refresh on entering debugger.  t=on or off\n"
@@ -1681,6 +1683,15 @@ void debugger_do(cpu_debug_t *cpu, uint32_t addr)
                     debug_tracecmd(cpu, iptr);
                 else if (!strncmp(cmd, "trange", cmdlen))
                     debug_trange(cpu, iptr);
+                else if (!strncmp(cmd, "tape", cmdlen)) {
+                    int file;
+                    if (sscanf(iptr, "%d", &file) != 1)
+                        debug_outf("Missing file number\n");
+                    else if (tape_seek_file(file))
+                        debug_outf("Tape wound to file %d\n", file);
+                    else
+                        debug_outf("No file %d on the tape\n", file);
+                }
                 else
                     badcmd = true;
                 break;
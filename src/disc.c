@@ -18,6 +18,15 @@ int curdrive = 0;
 
 bool defaultwriteprot = false;
 
+/*
+ * In fast disc mode seeks complete at once and sector data is passed
+ * as quickly as the CPU takes it, rather than at the disc's data rate.
+ * This only applies to image formats which set fastok in the drive,
+ * i.e. those with no timing information to keep, so copy protection
+ * that depends on timing still works from the other formats.
+ */
+bool fastdisc = false;
+
 int fdc_time;
 int disc_time;
 
@@ -33,6 +42,7 @@ void (*fdc_datacrcerror)(bool deleted);
 void (*fdc_headercrcerror)();
 void (*fdc_writeprotect)();
 int  (*fdc_getdata)(int last);
+bool (*fdc_pending)(void);
 
 int disc_load(int drive, ALLEGRO_PATH *fn)
 {
@@ -119,9 +129,18 @@ void disc_init()
     curdrive = 0;
 }
 
+bool disc_fast(int drive)
+{
+    return fastdisc && drives[drive].fastok;
+}
+
 void disc_poll()
 {
-        if (drives[curdrive].poll) drives[curdrive].poll();
+        if (drives[curdrive].poll) {
+            /* In fast mode, wait for the CPU rather than overrun. */
+            if (!disc_fast(curdrive) || !fdc_pending || !fdc_pending())
+                drives[curdrive].poll();
+        }
         if (disc_notfound)
         {
                 disc_notfound--;
@@ -134,9 +153,13 @@ static void disc_seek_common(int drive, DRIVE *dp, const char *desc, int tracks,
 {
     if (tracks || dp->newdisk) {
         dp->newdisk = 0;
-        fdc_time = (tracks < 0 ? -tracks : tracks) * step_time + settle_time;
-        if (fdc_time <= 0)
+        if (disc_fast(drive))
             fdc_time = 200;
+        else {
+            fdc_time = (tracks < 0 ? -tracks : tracks) * step_time + settle_time;
+            if (fdc_time <= 0)
+                fdc_time = 200;
+        }
         int newtrack = dp->curtrack + tracks;
         log_debug("disc: drive %d: seek %s %+d tracks to %d, step_time=%'d, settle_time=%'d, calculated fdc_time=%'d", drive, desc, tracks, newtrack, step_time, settle_time, fdc_time);
         if (newtrack < 0) {
@@ -36,6 +36,7 @@ typedef struct
     unsigned fwriteprot:1;
     unsigned newdisk:1;
     unsigned isindex:1;
+    unsigned fastok:1;      // format has no timing worth keeping.
     int curtrack;
 } DRIVE;
 
@@ -62,6 +63,7 @@ void disc_writetrack(int drive, int side, unsigned flags);
 void disc_readtrack(int drive, int side, unsigned flags);
 void disc_abort(int drive);
 int disc_verify(int drive, int track, unsigned flags);
+bool disc_fast(int drive);
 
 extern int disc_time;
 
@@ -80,11 +82,13 @@ extern void (*fdc_datacrcerror)(bool deleted);
 extern void (*fdc_headercrcerror)(void);
 extern void (*fdc_writeprotect)(void);
 extern int  (*fdc_getdata)(int last);
+extern bool (*fdc_pending)(void);
 extern int fdc_time;
 
 extern int motorspin;
 extern int motoron;
 
 extern bool defaultwriteprot;
+extern bool fastdisc;
 
 #endif
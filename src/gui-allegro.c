@@ -120,6 +120,7 @@ static ALLEGRO_MENU *create_file_menu(void)
     al_append_menu_item(menu, "Hard Reset", IDM_FILE_RESET, 0, NULL, NULL);
     al_append_menu_item(menu, "Load state...", IDM_FILE_LOAD_STATE, 0, NULL, NULL);
     al_append_menu_item(menu, "Save State...", IDM_FILE_SAVE_STATE, 0, NULL, NULL);
+    al_append_menu_item(menu, "Save Delta State...", IDM_FILE_SAVE_DELTA, 0, NULL, NULL);
     al_append_menu_item(menu, "Save Screenshot...", IDM_FILE_SCREEN_SHOT, 0, NULL, NULL);
     al_append_menu_item(menu, "Save Screen as Text...", IDM_FILE_SCREEN_TEXT, 0, NULL, NULL);
     al_append_menu_item(menu, "Printing...", 0, 0, NULL, create_print_menu());
@@ -178,6 +179,7 @@ static ALLEGRO_MENU *create_disc_menu(void)
     add_checkbox_item(menu, "Write protect disc :0/2", menu_id_num(IDM_DISC_WPROT, 0), drives[0].writeprot);
     add_checkbox_item(menu, "Write protect disc :1/3", menu_id_num(IDM_DISC_WPROT, 1), drives[1].writeprot);
     add_checkbox_item(menu, "Default write protect", IDM_DISC_WPROT_D, defaultwriteprot);
+    add_checkbox_item(menu, "Fast disc", IDM_DISC_FAST, fastdisc);
     add_checkbox_item(menu, "IDE hard disc", IDM_DISC_HARD_IDE, ide_enable);
     add_checkbox_item(menu, "SCSI hard disc", IDM_DISC_HARD_SCSI, scsi_enabled);
     add_checkbox_item(menu, "VDFS Enabled", IDM_DISC_VDFS_ENABLE, vdfs_enabled);
@@ -193,7 +195,8 @@ void gui_allegro_set_eject_text(int drive, ALLEGRO_PATH *path)
         snprintf(temp, sizeof temp, "Eject drive %s: %s", drive ? "1/3" : "0/2", al_get_path_filename(path));
     else
         snprintf(temp, sizeof temp, "Eject drive %s", drive ? "1/3" : "0/2");
-    al_set_menu_item_caption(disc_menu, menu_id_num(IDM_DISC_EJECT, drive), temp);
+    if (disc_menu)
+        al_set_menu_item_caption(disc_menu, menu_id_num(IDM_DISC_EJECT, drive), temp);
 }
 
 static ALLEGRO_MENU *create_tape_menu(void)
@@ -215,6 +218,7 @@ static ALLEGRO_MENU *create_tape_menu(void)
     al_append_menu_item(speed, "Normal", IDM_TAPE_SPEED_NORMAL, nflags, NULL, NULL);
     al_append_menu_item(speed, "Fast", IDM_TAPE_SPEED_FAST, fflags, NULL, NULL);
     al_append_menu_item(menu, "Tape speed", 0, 0, NULL, speed);
+    add_checkbox_item(menu, "Quick load", IDM_TAPE_QUICK, quicktape);
     return menu;
 }
 
@@ -789,7 +793,8 @@ static void edit_print_clip(ALLEGRO_EVENT *event)
 
 void gui_set_disc_wprot(int drive, bool enabled)
 {
-    al_set_menu_item_flags(disc_menu, menu_id_num(IDM_DISC_WPROT, drive), enabled ? ALLEGRO_MENU_ITEM_CHECKBOX|ALLEGRO_MENU_ITEM_CHECKED : ALLEGRO_MENU_ITEM_CHECKBOX);
+    if (disc_menu)
+        al_set_menu_item_flags(disc_menu, menu_id_num(IDM_DISC_WPROT, drive), enabled ? ALLEGRO_MENU_ITEM_CHECKBOX|ALLEGRO_MENU_ITEM_CHECKED : ALLEGRO_MENU_ITEM_CHECKBOX);
 }
 
 static void disc_choose_new(ALLEGRO_EVENT *event, const char *ext)
@@ -1140,8 +1145,7 @@ static void set_sid_method(ALLEGRO_EVENT *event)
 static void change_ddnoise_dtype(ALLEGRO_EVENT *event)
 {
     ddnoise_type = radio_event_simple(event, ddnoise_type);
-    ddnoise_close();
-    ddnoise_init();
+    ddnoise_reload();
 }
 
 static void change_mode7_font(ALLEGRO_EVENT *event)
@@ -1170,7 +1174,7 @@ static void toggle_music5000(void)
     }
     else {
         sound_music5000 = true;
-        music5000_init(emuspeed);
+        music5000_init();
     }
 }    
 
@@ -1193,6 +1197,9 @@ void gui_allegro_event(ALLEGRO_EVENT *event)
         case IDM_FILE_SAVE_STATE:
             file_chooser_generic(event, savestate_name, "Save state to file", "*.snp", ALLEGRO_FILECHOOSER_SAVE, savestate_save);
             break;
+        case IDM_FILE_SAVE_DELTA:
+            file_chooser_generic(event, savestate_name, "Save delta state to file", "*.snp", ALLEGRO_FILECHOOSER_SAVE, savestate_save_delta);
+            break;
         case IDM_FILE_SCREEN_SHOT:
             file_chooser_generic(event, vid_scrshotname, "Save screenshot to file", "*.bmp;*.pcx;*.tga;*.png;*.jpg", ALLEGRO_FILECHOOSER_SAVE, file_save_scrshot);
             break;
@@ -1280,6 +1287,9 @@ void gui_allegro_event(ALLEGRO_EVENT *event)
         case IDM_DISC_WPROT_D:
             defaultwriteprot = !defaultwriteprot;
             break;
+        case IDM_DISC_FAST:
+            fastdisc = !fastdisc;
+            break;
         case IDM_DISC_HARD_IDE:
             disc_toggle_ide(event);
             break;
@@ -1307,6 +1317,9 @@ void gui_allegro_event(ALLEGRO_EVENT *event)
         case IDM_TAPE_SPEED_FAST:
             tape_fast(event);
             break;
+        case IDM_TAPE_QUICK:
+            quicktape = !quicktape;
+            break;
         case IDM_TAPE_CAT:
             gui_tapecat_start();
             break;
@@ -0,0 +1,141 @@
+/*
+ * B-EM HD Cache - block cache for hard disc images.
+ *
+ * The window is loaded starting at the page holding the block being
+ * accessed so that a multi-block transfer, up to 256 blocks for a
+ * SCSI READ(6), needs only the one read from the file.  Beyond the end
+ * of the image reads as zeros, as the file would be filled were it
+ * extended by a write there.
+ */
+
+#include "b-em.h"
+#include "hdcache.h"
+#include "hdsparse.h"
+#include "overlay.h"
+
+#define HDCACHE_ALIGN 0x1000
+
+bool hdcache_open(hdcache_t *hc, FILE *fp)
+{
+    hc->fp = fp;
+    hc->sparse = NULL;
+    hc->start = -1;
+    hc->dirty_lo = hc->dirty_hi = 0;
+    if (fp) {
+        uint8_t hdr[HDSPARSE_HDR_SIZE];
+        if (overlay_read(fp, 0, hdr, sizeof(hdr)) == sizeof(hdr) && hdsparse_detect(hdr)) {
+            if (!(hc->sparse = hdsparse_open(fp))) {
+                hc->fp = NULL;
+                return false;
+            }
+            log_info("hdcache: sparse image, %ld bytes", (long)hdsparse_size(hc->sparse));
+        }
+    }
+    return true;
+}
+
+off_t hdcache_size(hdcache_t *hc)
+{
+    if (hc->sparse)
+        return hdsparse_size(hc->sparse);
+    if (!hc->fp || fseek(hc->fp, 0, SEEK_END))
+        return 0;
+    return ftell(hc->fp);
+}
+
+static bool load_window(hdcache_t *hc, off_t start)
+{
+    if (hc->sparse)
+        return hdsparse_read(hc->sparse, start, hc->data, HDCACHE_SIZE);
+    size_t bytes = overlay_read(hc->fp, start, hc->data, HDCACHE_SIZE);
+    if (bytes < HDCACHE_SIZE && ferror(hc->fp)) {
+        log_error("hdcache: error reading hard disc image: %s", strerror(errno));
+        clearerr(hc->fp);
+        return false;
+    }
+    memset(hc->data + bytes, 0, HDCACHE_SIZE - bytes);
+    return true;
+}
+
+bool hdcache_flush(hdcache_t *hc)
+{
+    unsigned lo = hc->dirty_lo;
+    unsigned hi = hc->dirty_hi;
+    if (hi > lo) {
+        log_debug("hdcache: writing back %u bytes at %ld", hi - lo, (long)(hc->start + lo));
+        if (hc->sparse) {
+            if (!hdsparse_write(hc->sparse, hc->start + lo, hc->data + lo, hi - lo) || !hdsparse_flush(hc->sparse))
+                return false;
+        }
+        else if (overlay_write(hc->fp, hc->start + lo, hc->data + lo, hi - lo) != hi - lo) {
+            log_error("hdcache: error writing hard disc image: %s", strerror(errno));
+            return false;
+        }
+        // Only now is the data safe to forget, else it is kept to retry.
+        hc->dirty_lo = hc->dirty_hi = 0;
+        fflush(hc->fp);
+    }
+    return true;
+}
+
+static uint8_t *hdcache_ptr(hdcache_t *hc, off_t offset, size_t size)
+{
+    if (!hc->fp)
+        return NULL;
+    off_t start = hc->start;
+    if (start < 0 || offset < start || offset + size > start + HDCACHE_SIZE) {
+        if (!hdcache_flush(hc))
+            return NULL; // keep the window until its data is written.
+        start = offset & ~(off_t)(HDCACHE_ALIGN - 1);
+        if (!load_window(hc, start)) {
+            hc->start = -1;
+            return NULL;
+        }
+        hc->start = start;
+    }
+    return hc->data + (offset - start);
+}
+
+bool hdcache_read(hdcache_t *hc, off_t offset, void *buf, size_t size)
+{
+    uint8_t *ptr = hdcache_ptr(hc, offset, size);
+    if (!ptr)
+        return false;
+    memcpy(buf, ptr, size);
+    return true;
+}
+
+bool hdcache_write(hdcache_t *hc, off_t offset, const void *buf, size_t size)
+{
+    uint8_t *ptr = hdcache_ptr(hc, offset, size);
+    if (!ptr)
+        return false;
+    memcpy(ptr, buf, size);
+    unsigned lo = ptr - hc->data;
+    unsigned hi = lo + size;
+    if (hc->dirty_hi == hc->dirty_lo) {
+        hc->dirty_lo = lo;
+        hc->dirty_hi = hi;
+    }
+    else {
+        if (lo < hc->dirty_lo)
+            hc->dirty_lo = lo;
+        if (hi > hc->dirty_hi)
+            hc->dirty_hi = hi;
+    }
+    return true;
+}
+
+void hdcache_close(hdcache_t *hc)
+{
+    if (hc->fp) {
+        hdcache_flush(hc);
+        if (hc->sparse) {
+            hdsparse_close(hc->sparse);
+            hc->sparse = NULL;
+        }
+        overlay_fclose(hc->fp);
+        hc->fp = NULL;
+    }
+    hc->start = -1;
+}
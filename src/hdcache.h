@@ -0,0 +1,36 @@
+#ifndef __INC_HDCACHE_H
+#define __INC_HDCACHE_H
+
+/*
+ * A block cache for hard disc images.
+ *
+ * Each image has a window onto its file, loaded in one read from the
+ * block being accessed onwards, from which following blocks are then
+ * served by copying.  Writes go into the window and are written back in
+ * one write when the window moves, the image is closed or it is flushed,
+ * which the drivers do as each command completes so that nothing written
+ * is left only in memory while the disc is idle.
+ * Image I/O goes through the overlay functions so images with an overlay
+ * attached are cached too, and sparse images, see hdsparse.h, are
+ * recognised when opened and read and written through that format.
+ */
+
+#define HDCACHE_SIZE 0x10000
+
+typedef struct {
+    FILE    *fp;
+    struct hdsparse *sparse;
+    off_t    start;     // file offset of data[0], -1 if nothing cached.
+    unsigned dirty_lo;
+    unsigned dirty_hi;
+    uint8_t  data[HDCACHE_SIZE];
+} hdcache_t;
+
+bool hdcache_open(hdcache_t *hc, FILE *fp);
+off_t hdcache_size(hdcache_t *hc);
+bool hdcache_read(hdcache_t *hc, off_t offset, void *buf, size_t size);
+bool hdcache_write(hdcache_t *hc, off_t offset, const void *buf, size_t size);
+bool hdcache_flush(hdcache_t *hc);
+void hdcache_close(hdcache_t *hc);
+
+#endif
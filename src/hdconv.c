@@ -0,0 +1,260 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <zlib.h>
+#include "hdsparse.h"
+
+/*
+ * Convert a hard disc image between the flat format and the sparse
+ * format described in hdsparse.h.  Converting a sparse image to sparse
+ * again compacts it, recovering the space left by chunks that have been
+ * moved by writes.
+ */
+
+static inline uint32_t get32(const uint8_t *ptr)
+{
+    return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+static inline uint64_t get64(const uint8_t *ptr)
+{
+    return get32(ptr) | ((uint64_t)get32(ptr + 4) << 32);
+}
+
+static inline void put32(uint8_t *ptr, uint32_t value)
+{
+    ptr[0] = value;
+    ptr[1] = value >> 8;
+    ptr[2] = value >> 16;
+    ptr[3] = value >> 24;
+}
+
+static inline void put64(uint8_t *ptr, uint64_t value)
+{
+    put32(ptr, value);
+    put32(ptr + 4, value >> 32);
+}
+
+typedef struct {
+    FILE     *fp;
+    uint64_t  size;
+    unsigned  chunk_size;
+    unsigned  nchunks;
+    uint8_t  *table;    // raw table if sparse, NULL if flat.
+} image_t;
+
+static bool open_input(image_t *img, const char *fn)
+{
+    uint8_t hdr[HDSPARSE_HDR_SIZE];
+    memset(img, 0, sizeof(image_t));
+    if (!(img->fp = fopen(fn, "rb"))) {
+        fprintf(stderr, "hdconv: unable to open %s: %s\n", fn, strerror(errno));
+        return false;
+    }
+    if (fread(hdr, sizeof hdr, 1, img->fp) == 1 && !memcmp(hdr, HDSPARSE_MAGIC, 8)) {
+        unsigned shift = get32(hdr + 12);
+        if (get32(hdr + 8) != HDSPARSE_VERSION || shift < 9 || shift > 24 || get32(hdr + 24) > get32(hdr + 28)) {
+            fprintf(stderr, "hdconv: %s has an invalid sparse header\n", fn);
+            return false;
+        }
+        img->size = get64(hdr + 16);
+        img->chunk_size = 1 << shift;
+        img->nchunks = get32(hdr + 24);
+        size_t bytes = (size_t)img->nchunks * HDSPARSE_ENT_SIZE;
+        if (!(img->table = malloc(bytes ? bytes : 1)) || fseek(img->fp, get64(hdr + 32), SEEK_SET) ||
+            fread(img->table, 1, bytes, img->fp) != bytes) {
+            fprintf(stderr, "hdconv: unable to read chunk table from %s\n", fn);
+            return false;
+        }
+        printf("hdconv: %s is sparse, size=%lu chunks=%u\n", fn, (unsigned long)img->size, img->nchunks);
+    }
+    else {
+        fseek(img->fp, 0, SEEK_END);
+        img->size = ftell(img->fp);
+        img->chunk_size = 1 << HDSPARSE_SHIFT;
+        printf("hdconv: %s is flat, size=%lu\n", fn, (unsigned long)img->size);
+    }
+    return true;
+}
+
+static bool read_chunk(image_t *img, unsigned chunk, uint8_t *data)
+{
+    memset(data, 0, img->chunk_size);
+    if (img->table) {
+        if (chunk >= img->nchunks)
+            return true;
+        const uint8_t *ent = img->table + chunk * HDSPARSE_ENT_SIZE;
+        uint64_t offset = get64(ent);
+        uint32_t length = get32(ent + 8);
+        if (!offset)
+            return true;
+        if (length > img->chunk_size || fseek(img->fp, offset, SEEK_SET))
+            return false;
+        if (length == img->chunk_size)
+            return fread(data, length, 1, img->fp) == 1;
+        uint8_t *packed = malloc(length);
+        uLongf unpacked = img->chunk_size;
+        bool ok = packed && fread(packed, length, 1, img->fp) == 1 &&
+                  uncompress(data, &unpacked, packed, length) == Z_OK && unpacked == img->chunk_size;
+        free(packed);
+        return ok;
+    }
+    if (fseek(img->fp, (off_t)chunk * img->chunk_size, SEEK_SET))
+        return false;
+    fread(data, 1, img->chunk_size, img->fp);
+    return !ferror(img->fp);
+}
+
+static bool all_zero(const uint8_t *data, size_t size)
+{
+    while (size--)
+        if (*data++)
+            return false;
+    return true;
+}
+
+static int write_sparse(image_t *img, const char *fn, FILE *fp, bool compress)
+{
+    unsigned chunk_size = 1 << HDSPARSE_SHIFT;
+    unsigned nchunks = (img->size + chunk_size - 1) >> HDSPARSE_SHIFT;
+    unsigned table_cap = nchunks ? nchunks : 1;
+    size_t table_bytes = (size_t)table_cap * HDSPARSE_ENT_SIZE;
+    uint8_t *table = calloc(table_cap, HDSPARSE_ENT_SIZE);
+    uint8_t *data = malloc(chunk_size);
+    uLong bound = compressBound(chunk_size);
+    uint8_t *packed = malloc(bound);
+    if (!table || !data || !packed) {
+        fputs("hdconv: out of memory\n", stderr);
+        return 3;
+    }
+    uint64_t offset = HDSPARSE_HDR_SIZE + table_bytes;
+    unsigned stored = 0, packs = 0;
+    if (fseek(fp, offset, SEEK_SET)) {
+        fprintf(stderr, "hdconv: unable to write to %s: %s\n", fn, strerror(errno));
+        return 4;
+    }
+    for (unsigned chunk = 0; chunk < nchunks; chunk++) {
+        if (!read_chunk(img, chunk, data)) {
+            fprintf(stderr, "hdconv: unable to read chunk %u\n", chunk);
+            return 3;
+        }
+        if (all_zero(data, chunk_size))
+            continue;
+        const uint8_t *src = data;
+        uLongf length = chunk_size;
+        if (compress) {
+            uLongf plen = bound;
+            if (compress2(packed, &plen, data, chunk_size, Z_BEST_COMPRESSION) == Z_OK && plen < chunk_size) {
+                src = packed;
+                length = plen;
+                packs++;
+            }
+        }
+        if (fwrite(src, length, 1, fp) != 1) {
+            fprintf(stderr, "hdconv: unable to write to %s: %s\n", fn, strerror(errno));
+            return 4;
+        }
+        put64(table + chunk * HDSPARSE_ENT_SIZE, offset);
+        put32(table + chunk * HDSPARSE_ENT_SIZE + 8, length);
+        offset += length;
+        stored++;
+    }
+    uint8_t hdr[HDSPARSE_HDR_SIZE];
+    memset(hdr, 0, sizeof hdr);
+    memcpy(hdr, HDSPARSE_MAGIC, 8);
+    put32(hdr + 8, HDSPARSE_VERSION);
+    put32(hdr + 12, HDSPARSE_SHIFT);
+    put64(hdr + 16, img->size);
+    put32(hdr + 24, nchunks);
+    put32(hdr + 28, table_cap);
+    put64(hdr + 32, HDSPARSE_HDR_SIZE);
+    if (fseek(fp, 0, SEEK_SET) || fwrite(hdr, sizeof hdr, 1, fp) != 1 || fwrite(table, table_bytes, 1, fp) != 1) {
+        fprintf(stderr, "hdconv: unable to write to %s: %s\n", fn, strerror(errno));
+        return 4;
+    }
+    printf("hdconv: %s written sparse, chunks=%u stored=%u compressed=%u bytes=%lu\n",
+           fn, nchunks, stored, packs, (unsigned long)offset);
+    free(packed);
+    free(data);
+    free(table);
+    return 0;
+}
+
+static int write_flat(image_t *img, const char *fn, FILE *fp)
+{
+    uint8_t *data = malloc(img->chunk_size);
+    if (!data) {
+        fputs("hdconv: out of memory\n", stderr);
+        return 3;
+    }
+    for (uint64_t posn = 0; posn < img->size; posn += img->chunk_size) {
+        unsigned chunk = posn / img->chunk_size;
+        size_t bytes = img->chunk_size;
+        if (bytes > img->size - posn)
+            bytes = img->size - posn;
+        if (!read_chunk(img, chunk, data)) {
+            fprintf(stderr, "hdconv: unable to read chunk %u\n", chunk);
+            return 3;
+        }
+        if (fwrite(data, bytes, 1, fp) != 1) {
+            fprintf(stderr, "hdconv: unable to write to %s: %s\n", fn, strerror(errno));
+            return 4;
+        }
+    }
+    printf("hdconv: %s written flat, size=%lu\n", fn, (unsigned long)img->size);
+    free(data);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int status;
+    bool flat = false, compress = false;
+
+    while (argc > 1 && argv[1][0] == '-') {
+        if (!strcmp(argv[1], "-f"))
+            flat = true;
+        else if (!strcmp(argv[1], "-z"))
+            compress = true;
+        else
+            break;
+        argc--;
+        argv++;
+    }
+    if (argc == 3 && !(flat && compress)) {
+        image_t img;
+        if (open_input(&img, argv[1])) {
+            const char *fn = argv[2];
+            FILE *fp = fopen(fn, "wb");
+            if (fp) {
+                if (flat)
+                    status = write_flat(&img, fn, fp);
+                else
+                    status = write_sparse(&img, fn, fp, compress);
+                if (fclose(fp) && !status) {
+                    fprintf(stderr, "hdconv: unable to write to %s: %s\n", fn, strerror(errno));
+                    status = 4;
+                }
+            }
+            else {
+                fprintf(stderr, "hdconv: unable to create %s: %s\n", fn, strerror(errno));
+                status = 2;
+            }
+        }
+        else
+            status = 2;
+        if (img.fp)
+            fclose(img.fp);
+        free(img.table);
+    }
+    else {
+        fputs("usage: hdconv [-z] <in-file> <out-file>   convert to sparse, -z to compress\n"
+              "       hdconv -f <in-file> <out-file>     convert to flat\n", stderr);
+        status = 1;
+    }
+    return status;
+}
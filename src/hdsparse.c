@@ -0,0 +1,376 @@
+/*
+ * B-EM HD Sparse - sparse and compressed hard disc images.
+ *
+ * The chunk table is kept in memory.  Entries changed are written back
+ * to the file, followed by the header, when the image is flushed; if the
+ * table has had to grow it is written afresh at the end of the file.
+ * Chunk data is always written before the table entry that refers to
+ * it, so an image is left consistent if the emulator stops part way.
+ *
+ * Compressed chunks are decompressed into a small cache, reused least
+ * recently used first.  All access to the file is through the overlay
+ * functions so an image with an overlay attached is never written to.
+ */
+
+#include "b-em.h"
+#include "hdsparse.h"
+#include "overlay.h"
+#include <limits.h>
+#include <zlib.h>
+
+#define HDSPARSE_LRU 8
+
+typedef struct {
+    uint64_t offset;    // file offset of the chunk, 0 if absent.
+    uint32_t length;    // bytes stored, less than the chunk size if compressed.
+} chunk_t;
+
+struct hdsparse {
+    FILE     *fp;
+    off_t     size;     // size of the image.
+    off_t     eof;      // where to append new chunks.
+    off_t     table_off;
+    unsigned  shift;
+    unsigned  chunk_size;
+    unsigned  nchunks;
+    unsigned  table_cap;
+    unsigned  dirty_lo; // range of table entries to write back.
+    unsigned  dirty_hi;
+    bool      hdr_dirty;
+    bool      table_moved;
+    chunk_t  *table;
+    unsigned  tick;
+    struct {
+        unsigned chunk; // chunk number, UINT_MAX if unused.
+        unsigned used;  // tick last used, for LRU replacement.
+        uint8_t *data;
+    } lru[HDSPARSE_LRU];
+};
+
+static inline uint32_t get32(const uint8_t *ptr)
+{
+    return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+static inline uint64_t get64(const uint8_t *ptr)
+{
+    return get32(ptr) | ((uint64_t)get32(ptr + 4) << 32);
+}
+
+static inline void put32(uint8_t *ptr, uint32_t value)
+{
+    ptr[0] = value;
+    ptr[1] = value >> 8;
+    ptr[2] = value >> 16;
+    ptr[3] = value >> 24;
+}
+
+static inline void put64(uint8_t *ptr, uint64_t value)
+{
+    put32(ptr, value);
+    put32(ptr + 4, value >> 32);
+}
+
+bool hdsparse_detect(const uint8_t *hdr)
+{
+    return !memcmp(hdr, HDSPARSE_MAGIC, 8);
+}
+
+static void free_sparse(hdsparse_t *sp)
+{
+    for (int i = 0; i < HDSPARSE_LRU; i++)
+        free(sp->lru[i].data);
+    free(sp->table);
+    free(sp);
+}
+
+hdsparse_t *hdsparse_open(FILE *fp)
+{
+    uint8_t hdr[HDSPARSE_HDR_SIZE];
+    if (overlay_read(fp, 0, hdr, sizeof(hdr)) != sizeof(hdr) || !hdsparse_detect(hdr)) {
+        log_error("hdsparse: missing or short header");
+        return NULL;
+    }
+    if (get32(hdr + 8) != HDSPARSE_VERSION) {
+        log_error("hdsparse: unsupported version %u", get32(hdr + 8));
+        return NULL;
+    }
+    unsigned shift = get32(hdr + 12);
+    unsigned nchunks = get32(hdr + 24);
+    unsigned table_cap = get32(hdr + 28);
+    if (shift < 9 || shift > 24 || nchunks > table_cap) {
+        log_error("hdsparse: invalid header");
+        return NULL;
+    }
+    hdsparse_t *sp = calloc(1, sizeof(hdsparse_t));
+    if (!sp) {
+        log_error("hdsparse: out of memory");
+        return NULL;
+    }
+    sp->fp = fp;
+    sp->shift = shift;
+    sp->chunk_size = 1 << shift;
+    sp->size = get64(hdr + 16);
+    sp->nchunks = nchunks;
+    sp->table_cap = table_cap;
+    sp->table_off = get64(hdr + 32);
+    for (int i = 0; i < HDSPARSE_LRU; i++)
+        sp->lru[i].chunk = UINT_MAX;
+    size_t bytes = (size_t)table_cap * HDSPARSE_ENT_SIZE;
+    uint8_t *raw = malloc(bytes ? bytes : 1);
+    sp->table = calloc(table_cap ? table_cap : 1, sizeof(chunk_t));
+    if (!raw || !sp->table || overlay_read(fp, sp->table_off, raw, bytes) != bytes) {
+        log_error("hdsparse: unable to read chunk table: %s", strerror(errno));
+        free(raw);
+        free_sparse(sp);
+        return NULL;
+    }
+    for (unsigned i = 0; i < table_cap; i++) {
+        sp->table[i].offset = get64(raw + i * HDSPARSE_ENT_SIZE);
+        sp->table[i].length = get32(raw + i * HDSPARSE_ENT_SIZE + 8);
+    }
+    free(raw);
+    if (fseek(fp, 0, SEEK_END)) {
+        free_sparse(sp);
+        return NULL;
+    }
+    sp->eof = ftell(fp);
+    log_debug("hdsparse: %u chunks of %u bytes, size %ld", nchunks, sp->chunk_size, (long)sp->size);
+    return sp;
+}
+
+off_t hdsparse_size(hdsparse_t *sp)
+{
+    return sp->size;
+}
+
+static const uint8_t *get_compressed(hdsparse_t *sp, unsigned chunk)
+{
+    int slot = 0;
+    for (int i = 0; i < HDSPARSE_LRU; i++) {
+        if (sp->lru[i].chunk == chunk) {
+            sp->lru[i].used = ++sp->tick;
+            return sp->lru[i].data;
+        }
+        if (sp->lru[i].used < sp->lru[slot].used)
+            slot = i;
+    }
+    uint8_t *data = sp->lru[slot].data;
+    if (!data && !(data = sp->lru[slot].data = malloc(sp->chunk_size)))
+        return NULL;
+    sp->lru[slot].chunk = UINT_MAX;
+    unsigned length = sp->table[chunk].length;
+    uint8_t *packed = malloc(length);
+    uLongf unpacked = sp->chunk_size;
+    if (!packed || overlay_read(sp->fp, sp->table[chunk].offset, packed, length) != length ||
+        uncompress(data, &unpacked, packed, length) != Z_OK || unpacked != sp->chunk_size) {
+        log_error("hdsparse: unable to read compressed chunk %u", chunk);
+        free(packed);
+        return NULL;
+    }
+    free(packed);
+    sp->lru[slot].chunk = chunk;
+    sp->lru[slot].used = ++sp->tick;
+    return data;
+}
+
+static void drop_compressed(hdsparse_t *sp, unsigned chunk)
+{
+    for (int i = 0; i < HDSPARSE_LRU; i++)
+        if (sp->lru[i].chunk == chunk)
+            sp->lru[i].chunk = UINT_MAX;
+}
+
+bool hdsparse_read(hdsparse_t *sp, off_t offset, void *buf, size_t size)
+{
+    uint8_t *dest = buf;
+    while (size > 0) {
+        unsigned chunk = offset >> sp->shift;
+        unsigned lo = offset & (sp->chunk_size - 1);
+        size_t bytes = sp->chunk_size - lo;
+        if (bytes > size)
+            bytes = size;
+        chunk_t *ent = chunk < sp->nchunks ? sp->table + chunk : NULL;
+        if (!ent || !ent->offset)
+            memset(dest, 0, bytes);
+        else if (ent->length == sp->chunk_size) {
+            size_t got = overlay_read(sp->fp, ent->offset + lo, dest, bytes);
+            if (got < bytes) {
+                if (ferror(sp->fp)) {
+                    log_error("hdsparse: error reading chunk %u: %s", chunk, strerror(errno));
+                    clearerr(sp->fp);
+                    return false;
+                }
+                memset(dest + got, 0, bytes - got);
+            }
+        }
+        else {
+            const uint8_t *data = get_compressed(sp, chunk);
+            if (!data)
+                return false;
+            memcpy(dest, data + lo, bytes);
+        }
+        dest += bytes;
+        offset += bytes;
+        size -= bytes;
+    }
+    return true;
+}
+
+static bool grow_table(hdsparse_t *sp, unsigned chunk)
+{
+    if (chunk >= sp->table_cap) {
+        unsigned cap = sp->table_cap ? sp->table_cap * 2 : 256;
+        while (cap <= chunk)
+            cap *= 2;
+        chunk_t *table = realloc(sp->table, cap * sizeof(chunk_t));
+        if (!table)
+            return false;
+        memset(table + sp->table_cap, 0, (cap - sp->table_cap) * sizeof(chunk_t));
+        sp->table = table;
+        sp->table_cap = cap;
+        sp->table_moved = true;
+    }
+    sp->nchunks = chunk + 1;
+    sp->hdr_dirty = true;
+    return true;
+}
+
+static bool all_zero(const uint8_t *data, size_t size)
+{
+    while (size--)
+        if (*data++)
+            return false;
+    return true;
+}
+
+/*
+ * Store a whole chunk, made from what it held before with the new data
+ * over the top, uncompressed at the end of the file.
+ */
+
+static bool write_new(hdsparse_t *sp, unsigned chunk, unsigned lo, const uint8_t *src, size_t bytes)
+{
+    chunk_t *ent = chunk < sp->nchunks ? sp->table + chunk : NULL;
+    if ((!ent || !ent->offset) && all_zero(src, bytes))
+        return true;
+    uint8_t *data = malloc(sp->chunk_size);
+    if (!data)
+        return false;
+    if (ent && ent->offset) {
+        const uint8_t *old = get_compressed(sp, chunk);
+        if (!old) {
+            free(data);
+            return false;
+        }
+        memcpy(data, old, sp->chunk_size);
+        drop_compressed(sp, chunk);
+    }
+    else
+        memset(data, 0, sp->chunk_size);
+    memcpy(data + lo, src, bytes);
+    if (chunk >= sp->nchunks && !grow_table(sp, chunk)) {
+        free(data);
+        return false;
+    }
+    bool ok = overlay_write(sp->fp, sp->eof, data, sp->chunk_size) == sp->chunk_size;
+    free(data);
+    if (!ok)
+        return false;
+    ent = sp->table + chunk;
+    ent->offset = sp->eof;
+    ent->length = sp->chunk_size;
+    sp->eof += sp->chunk_size;
+    if (sp->dirty_hi == sp->dirty_lo) {
+        sp->dirty_lo = chunk;
+        sp->dirty_hi = chunk + 1;
+    }
+    else if (chunk < sp->dirty_lo)
+        sp->dirty_lo = chunk;
+    else if (chunk >= sp->dirty_hi)
+        sp->dirty_hi = chunk + 1;
+    return true;
+}
+
+bool hdsparse_write(hdsparse_t *sp, off_t offset, const void *buf, size_t size)
+{
+    const uint8_t *src = buf;
+    if (offset + (off_t)size > sp->size) {
+        sp->size = offset + size;
+        sp->hdr_dirty = true;
+    }
+    while (size > 0) {
+        unsigned chunk = offset >> sp->shift;
+        unsigned lo = offset & (sp->chunk_size - 1);
+        size_t bytes = sp->chunk_size - lo;
+        if (bytes > size)
+            bytes = size;
+        chunk_t *ent = chunk < sp->nchunks ? sp->table + chunk : NULL;
+        bool ok;
+        if (ent && ent->offset && ent->length == sp->chunk_size)
+            ok = overlay_write(sp->fp, ent->offset + lo, src, bytes) == bytes;
+        else
+            ok = write_new(sp, chunk, lo, src, bytes);
+        if (!ok) {
+            log_error("hdsparse: error writing chunk %u: %s", chunk, strerror(errno));
+            return false;
+        }
+        src += bytes;
+        offset += bytes;
+        size -= bytes;
+    }
+    return true;
+}
+
+static bool write_table(hdsparse_t *sp, unsigned lo, unsigned hi)
+{
+    size_t bytes = (size_t)(hi - lo) * HDSPARSE_ENT_SIZE;
+    uint8_t *raw = malloc(bytes);
+    if (!raw)
+        return false;
+    for (unsigned i = lo; i < hi; i++) {
+        uint8_t *ptr = raw + (i - lo) * HDSPARSE_ENT_SIZE;
+        put64(ptr, sp->table[i].offset);
+        put32(ptr + 8, sp->table[i].length);
+    }
+    bool ok = overlay_write(sp->fp, sp->table_off + (off_t)lo * HDSPARSE_ENT_SIZE, raw, bytes) == bytes;
+    free(raw);
+    return ok;
+}
+
+bool hdsparse_flush(hdsparse_t *sp)
+{
+    bool ok = true;
+    if (sp->table_moved) {
+        sp->table_off = sp->eof;
+        sp->eof += (off_t)sp->table_cap * HDSPARSE_ENT_SIZE;
+        ok = write_table(sp, 0, sp->table_cap);
+        sp->table_moved = false;
+        sp->hdr_dirty = true;
+    }
+    else if (sp->dirty_hi > sp->dirty_lo)
+        ok = write_table(sp, sp->dirty_lo, sp->dirty_hi);
+    sp->dirty_lo = sp->dirty_hi = 0;
+    if (ok && sp->hdr_dirty) {
+        uint8_t hdr[HDSPARSE_HDR_SIZE];
+        memset(hdr, 0, sizeof(hdr));
+        memcpy(hdr, HDSPARSE_MAGIC, 8);
+        put32(hdr + 8, HDSPARSE_VERSION);
+        put32(hdr + 12, sp->shift);
+        put64(hdr + 16, sp->size);
+        put32(hdr + 24, sp->nchunks);
+        put32(hdr + 28, sp->table_cap);
+        put64(hdr + 32, sp->table_off);
+        ok = overlay_write(sp->fp, 0, hdr, sizeof(hdr)) == sizeof(hdr);
+        sp->hdr_dirty = false;
+    }
+    if (!ok)
+        log_error("hdsparse: error writing chunk table: %s", strerror(errno));
+    return ok;
+}
+
+void hdsparse_close(hdsparse_t *sp)
+{
+    hdsparse_flush(sp);
+    free_sparse(sp);
+}
@@ -0,0 +1,45 @@
+#ifndef __INC_HDSPARSE_H
+#define __INC_HDSPARSE_H
+
+/*
+ * Sparse, optionally compressed, hard disc images.
+ *
+ * The image is divided into chunks, each of which is either absent,
+ * reading as zeros, stored as is, or stored compressed with zlib.  The
+ * file starts with a header:
+ *
+ *   0  magic, "B-EM HDZ"
+ *   8  version, 1
+ *  12  log2 of the chunk size
+ *  16  size of the image, 64 bits
+ *  24  number of chunks in use
+ *  28  number of entries the chunk table has room for
+ *  32  file offset of the chunk table, 64 bits
+ *
+ * with the remainder of the 64 bytes zero.  All values are little
+ * endian.  Each entry of the chunk table is the 64 bit file offset of
+ * the chunk, zero if absent, and its 32 bit stored length, which is less
+ * than the chunk size if it is compressed.
+ *
+ * Chunks written by the emulator are stored uncompressed at the end of
+ * the file; a compressed chunk that is written to is moved there.  The
+ * space left behind is recovered by converting the image with hdconv.
+ */
+
+#define HDSPARSE_MAGIC      "B-EM HDZ"
+#define HDSPARSE_VERSION    1
+#define HDSPARSE_HDR_SIZE   64
+#define HDSPARSE_ENT_SIZE   12
+#define HDSPARSE_SHIFT      16
+
+typedef struct hdsparse hdsparse_t;
+
+bool hdsparse_detect(const uint8_t *hdr);
+hdsparse_t *hdsparse_open(FILE *fp);
+off_t hdsparse_size(hdsparse_t *sp);
+bool hdsparse_read(hdsparse_t *sp, off_t offset, void *buf, size_t size);
+bool hdsparse_write(hdsparse_t *sp, off_t offset, const void *buf, size_t size);
+bool hdsparse_flush(hdsparse_t *sp);
+void hdsparse_close(hdsparse_t *sp);
+
+#endif
@@ -18,7 +18,7 @@
 
   Implement format track.
 
-  Discard track data when the motor "spins down" so that the emulator
+  Discard cached tracks when the motor "spins down" so that the emulator
   can pick up changes to the HFE file (though this may also require us
   to re-read the header as well).
 */
@@ -33,6 +33,17 @@
 
 #undef DUMP_TRACK
 
+/* Patterns matched against the shift register to find address marks;
+   see set_up_for_sector_read and set_up_for_sector_id_scan. */
+#define MFM_ID_MARK_VALUE   UINT64_C(0x4489448944895554)
+#define MFM_ID_MARK_MASK    UINT64_C(0xFFFFFFFFFFFFFFFF)
+#define FM_ID_MARK_VALUE    UINT64_C(0x0000AAAAAAAAF57E)
+#define FM_ID_MARK_MASK     UINT64_C(0x0000FFFFFFFFFFFF)
+#define MFM_DATA_MARK_VALUE UINT64_C(0x4489448944895540)
+#define MFM_DATA_MARK_MASK  UINT64_C(0xFFFFFFFFFFFFFFF0)
+#define FM_DATA_MARK_VALUE  UINT64_C(0x0000AAAAAAAAF56A)
+#define FM_DATA_MARK_MASK   UINT64_C(0x0000FFFFFFFFFFFA)
+
 #define UCHAR_BIT CHAR_BIT
 
 /* HFE_FMT_MODE...: constants from the HFE file format.
@@ -136,6 +147,7 @@ enum
 
 enum { SECTOR_ACCEPT_ANY = -1 };
 enum { NO_TRACK = -1 };
+enum { SECTOR_ADDR_BYTES = 7 /* includes address mark */ };
 typedef void (*scan_setup_fn)(int);
 
 struct sector_address
@@ -147,6 +159,56 @@ struct sector_address
   int sector;
 };
 
+/* hfe_sector describes one sector ID address mark found on a track,
+   as decoded ahead of time by hfe_decode_track.  Bit positions are
+   the index of the track bit on which the address mark scanner (see
+   set_up_for_sector_id_scan and set_up_for_sector_read) would match,
+   which is also when the address mark byte is decoded; byte k of the
+   record is then decoded 16*k bits later. */
+struct hfe_sector
+{
+  long id_bit;
+
+  /* The sector ID record, address mark first, and the index of the
+     first byte of it which has a clock error (SECTOR_ADDR_BYTES if
+     there is none). */
+  unsigned char id[SECTOR_ADDR_BYTES];
+  int id_badclock;
+
+  /* If the ID was read without error, the first data address mark
+     after it, which is where a sector read would go on to, or -1 if
+     there is no such mark on the track. */
+  long data_bit;
+
+  /* The data record following data_bit, address mark first and CRC
+     last, sized according to the size code of this ID. */
+  unsigned char *data;
+  size_t data_bytes;
+  size_t data_badclock;
+};
+
+struct hfe_sector_table
+{
+  int count;
+  long *id_bits;                /* the id_bit of each sector, in order. */
+  struct hfe_sector *sectors;
+};
+
+/* hfe_track holds a track we have already read from the image file.
+   The bitstream is kept because the timing of reads still follows it,
+   but the sectors on it are only decoded once for each density. */
+struct hfe_track
+{
+  unsigned char *bits;
+  size_t bytes;
+  int poll_calls_per_bit;
+  /* Set when decoding found something (such as an absurd size code)
+     which we leave to the bit-by-bit decoder in hfe_poll_drive, the
+     same being true where the table is NULL. */
+  bool undecodable[2];
+  struct hfe_sector_table *table[2];   /* indexed by mfm_mode. */
+};
+
 /* hfe_poll_state contains the state information used by the state
    machine in hfe_poll.  Really a lot of this could be refactored such
    that fdi.c and hfe.c use the same implementation for decoding track
@@ -247,6 +309,16 @@ struct hfe_poll_state
   uint64_t scan_value;
   uint64_t scan_mask;
 
+  /* When cached is true, the current operation is being served from
+     the sector table of the track instead of by decoding bits: when
+     the bit at cached_event passes the head, byte cached_byte of
+     cached_sector (its ID record, or its data record during
+     ROP_READ_SECTOR) is handled just as if it had been decoded.  The
+     shift register is not maintained meanwhile. */
+  bool cached;
+  const struct hfe_sector *cached_sector;
+  size_t cached_byte;
+  long cached_event;
 };
 
 
@@ -260,9 +332,12 @@ struct hfe_info
   int hfe_version;              /* supported versions: 1, 3 */
 
   int current_track;
-  unsigned char *track_data;
+  unsigned char *track_data;    /* owned by tracks[current_track]. */
   size_t track_data_bytes;
 
+  /* Tracks read so far, one for each track in the file. */
+  struct hfe_track *tracks;
+
   /* b-em calls our poll function every 16 clock cycles.  With a 2MHz
      clock that's 1.25e5 Hz (i.e. every 8 microseconds).  The floppy
      revolves at 300 RPM.  The total number of poll calls per
@@ -299,7 +374,6 @@ struct track_data_pos
 
 enum { HFE_DRIVES = 2 };        /* please keep consistent with drives[] in disc.c. */
 enum { OP_REV_LIMIT = 3 };
-enum { SECTOR_ADDR_BYTES = 7 /* includes address mark */ };
 
 static struct hfe_info  *hfe_info[HFE_DRIVES];
 static int hfe_selected_drive;
@@ -406,8 +480,11 @@ static void start_op(int drive, bool mfm, enum OpType op_type, const char *op_na
   p->bits_avail_to_decode = 0;
   p->shift_register = p->shift_register_prevbits = 0;
   p->scan_value = p->scan_mask = 0;
+  p->cached = false;
 }
 
+static void cache_begin(int drive);
+
 static void start_sector_op(int drive, bool mfm, enum OpType op_type,
                             struct sector_address addr, const char *op_name,
                             scan_setup_fn scan_setup)
@@ -415,10 +492,12 @@ static void start_sector_op(int drive, bool mfm, enum OpType op_type,
   start_op(drive, mfm, op_type, op_name);
   hfe_info[drive]->state.target = addr;
   scan_setup(drive);
+  cache_begin(drive);
 }
 
 static void clear_op_state(struct hfe_poll_state* state)
 {
+  state->cached = false;
   state->revolutions_this_op = 0;
   state->bytes_to_read = 0;
   state->current_op = OP_IDLE;
@@ -468,6 +547,32 @@ void hfe_init()
     }
 }
 
+static void free_sector_table(struct hfe_sector_table *table)
+{
+  if (table)
+    {
+      for (int i = 0; i < table->count; ++i)
+        free(table->sectors[i].data);
+      free(table->sectors);
+      free(table->id_bits);
+      free(table);
+    }
+}
+
+static void free_tracks(struct hfe_info *p)
+{
+  if (p->tracks)
+    {
+      for (int t = 0; t < p->header.number_of_track; ++t)
+        {
+          free(p->tracks[t].bits);
+          free_sector_table(p->tracks[t].table[0]);
+          free_sector_table(p->tracks[t].table[1]);
+        }
+      free(p->tracks);
+      p->tracks = NULL;
+    }
+}
 
 static void hfe_close(int drive)
 {
@@ -491,13 +596,9 @@ static void hfe_close(int drive)
           clear_op_state(&hfe_info[drive]->state);
         }
       hfe_info[drive]->current_track = NO_TRACK;
-      if (hfe_info[drive]->track_data)
-        {
-          free(hfe_info[drive]->track_data);
-          hfe_info[drive]->track_data = NULL;
-
-        }
+      hfe_info[drive]->track_data = NULL;
       hfe_info[drive]->track_data_bytes = 0;
+      free_tracks(hfe_info[drive]);
       hfe_info[drive]->poll_calls_per_bit = 1;
       free(hfe_info[drive]);
       log_debug("hfe: drive %d: hfe_close setting hfe_info[%d] to NULL", drive, drive);
@@ -788,8 +889,10 @@ static bool hfe_read_track_data(int drive, int track, int side,
     }
   if (!hfe_read_at_pos(hfe_info[drive]->fp, pos, len, in, err))
     {
-      if (!err)
+      if (!*err)
         log_error("hfe: short read on track data for drive %d track %d", drive, track);
+      free(in);
+      free(out);
       return false;
     }
   hfe_reverse_bit_order(in, len);
@@ -802,6 +905,7 @@ static bool hfe_read_track_data(int drive, int track, int side,
                                      encoding, drive, track,
                                      in + begin, 256, out + (*bytes_read));
     }
+  free(in);
   *result = out;
   return true;
 }
@@ -820,8 +924,7 @@ static void hfe_seek(int drive, int track)
   int err = 0;
   const int side = 0;           /* XXX: how are sides selected? */
   struct track_data_pos where;
-  unsigned char *trackbits = NULL;
-  size_t track_len = 0;
+  struct hfe_track *t;
 
   log_info("hfe: drive %d seek to track %d", drive, track);
   if (NULL == hfe_info[drive]->fp)
@@ -843,34 +946,39 @@ static void hfe_seek(int drive, int track)
     }
 
   log_debug("hfe: drive %d: seek to track %d", drive, track);
-  if (!hfe_locate_track_data(drive, track, &where, &err))
-    {
-      hfe_track_load_failed(drive, track, err);
-      hfe_undiagnosed_failure(drive);
-      return;
-    }
-  log_debug("hfe: drive %d: track %d data: %lu bytes at %lu", drive, track, where.len, where.pos);
-  const unsigned char encoding = encoding_of_track(drive, side, track);
-  if (!hfe_read_track_data(drive, track, side, where.pos, where.len,
-                           encoding, &trackbits, &track_len, &err))
+  t = &hfe_info[drive]->tracks[track];
+  if (!t->bits)
     {
-      hfe_track_load_failed(drive, track, err);
-      hfe_undiagnosed_failure(drive);
-      return;
-    }
+      if (!hfe_locate_track_data(drive, track, &where, &err))
+        {
+          hfe_track_load_failed(drive, track, err);
+          hfe_undiagnosed_failure(drive);
+          return;
+        }
+      log_debug("hfe: drive %d: track %d data: %lu bytes at %lu", drive, track, where.len, where.pos);
+      const unsigned char encoding = encoding_of_track(drive, side, track);
+      if (!hfe_read_track_data(drive, track, side, where.pos, where.len,
+                               encoding, &t->bits, &t->bytes, &err))
+        {
+          hfe_track_load_failed(drive, track, err);
+          hfe_undiagnosed_failure(drive);
+          return;
+        }
 #ifdef DUMP_TRACK
-  log_dump("hfe: track", trackbits, track_len);
+      log_dump("hfe: track", t->bits, t->bytes);
 #endif
-  if (hfe_info[drive]->track_data)
-    {
-      free(hfe_info[drive]->track_data);
-      hfe_info[drive]->track_data = NULL;
+      t->poll_calls_per_bit = encoding ? 1 : 2;
     }
 
   hfe_info[drive]->current_track = track;
-  hfe_info[drive]->track_data = trackbits;
-  hfe_info[drive]->track_data_bytes = track_len;
-  hfe_info[drive]->poll_calls_per_bit = encoding ? 1 : 2;
+  hfe_info[drive]->track_data = t->bits;
+  hfe_info[drive]->track_data_bytes = t->bytes;
+  hfe_info[drive]->poll_calls_per_bit = t->poll_calls_per_bit;
+  /* An operation in progress carries on from the same place on the
+     new track, but the sectors it would have met have gone. */
+  if (hfe_info[drive]->state.track_bit_pos >= (long)t->bytes * UCHAR_BIT)
+    hfe_info[drive]->state.track_bit_pos = 0;
+  hfe_info[drive]->state.cached = false;
   log_debug("hfe: seek: loaded %lu bytes of data for drive %d track %d at %p",
             (unsigned long)hfe_info[drive]->track_data_bytes,
             drive,
@@ -908,8 +1016,8 @@ static void set_up_for_sector_read(int drive, size_t sector_bytes_to_read)
          least significant four bits of the mask to ensure we accept
          either 0x554A or 0x5545.
       */
-      state->scan_value = 0x4489448944895540;
-      state->scan_mask  = 0xFFFFFFFFFFFFFFF0;
+      state->scan_value = MFM_DATA_MARK_VALUE;
+      state->scan_mask  = MFM_DATA_MARK_MASK;
       /* Since all three A1 bytes are matched in the topmost bits of
          state->scan_value, we expect the previous 2 sync bytes (which
          have the data value 0, so clock bits are 1) to appear in the
@@ -929,8 +1037,8 @@ static void set_up_for_sector_read(int drive, size_t sector_bytes_to_read)
          But, (0xF56A & 0xF56F) == 0xF56A, so we scan for that
          and check what we got.  0xA == binary 1010
       */
-      state->scan_value = 0x0000AAAAAAAAF56A;
-      state->scan_mask  = 0x0000FFFFFFFFFFFA;
+      state->scan_value = FM_DATA_MARK_VALUE;
+      state->scan_mask  = FM_DATA_MARK_MASK;
 
       /* Our two required sync bytes are matched in
          scan_value/scan_mask so there is no need to check
@@ -974,8 +1082,8 @@ static void set_up_for_sector_id_scan(int drive)
 
          The clocked value of 0xFE is 0x5554.
        */
-      state->scan_value = 0x4489448944895554;
-      state->scan_mask  = 0xFFFFFFFFFFFFFFFF;
+      state->scan_value = MFM_ID_MARK_VALUE;
+      state->scan_mask  = MFM_ID_MARK_MASK;
     }
   else
     {
@@ -1012,8 +1120,8 @@ static void set_up_for_sector_id_scan(int drive)
          match the three A1 bytes uses up 48 bits of our 64 bit scan
          capacity).
       */
-      state->scan_value = 0xAAAAAAAAF57E;
-      state->scan_mask  = 0xFFFFFFFFFFFF;
+      state->scan_value = FM_ID_MARK_VALUE;
+      state->scan_mask  = FM_ID_MARK_MASK;
     }
   state->bytes_to_read = SECTOR_ADDR_BYTES;
   state->bits_avail_to_decode = 0;
@@ -1074,11 +1182,17 @@ unsigned long crc_cycle(unsigned long crc)
     return crc << 1;
 }
 
-static void crc_byte(struct hfe_poll_state* state, unsigned char value)
+static unsigned short crc_update(unsigned short crc, unsigned char value)
 {
-  state->crc ^= value << 8;
+  crc ^= value << 8;
   for(int k = 0; k < 8; k++)
-    state->crc = crc_cycle(state->crc);
+    crc = crc_cycle(crc);
+  return crc;
+}
+
+static void crc_byte(struct hfe_poll_state* state, unsigned char value)
+{
+  state->crc = crc_update(state->crc, value);
 }
 
 static void crc_reset(int drive)
@@ -1087,6 +1201,23 @@ static void crc_reset(int drive)
   hfe_info[drive]->state.crc = 0xFFFF;
 }
 
+/* Begin the CRC for a record whose address mark has just been found. */
+static void crc_start_record(int drive)
+{
+  struct hfe_poll_state *state = &hfe_info[drive]->state;
+  crc_reset(drive);
+  if (state->mfm_mode)
+    {
+      /* The fact that the shift register matched tells us
+         that we just read the A1 address mark intro bytes.
+         The CRC is computed over the A1 bytes and the rest of
+         the sector address. */
+      crc_byte(state, 0xA1);
+      crc_byte(state, 0xA1);
+      crc_byte(state, 0xA1);
+    }
+}
+
 static void handle_id_byte_sector(int drive, unsigned char value)
 {
   bool ok = true;
@@ -1325,13 +1456,44 @@ static void handle_sector_data_byte(int drive, unsigned char value)
     }
 }
 
-static bool get_next_bit(int drive, bool *end)
+/* Pass a decoded byte of the current record to the handler for the
+   operation in progress. */
+static void handle_record_byte(int drive, unsigned char value)
+{
+  struct hfe_poll_state *state = &hfe_info[drive]->state;
+  assert(state->bytes_to_read > 0);
+  switch (state->current_op)
+    {
+    case ROP_READ_ADDR_FOR_SECTOR:
+      handle_id_byte_sector(drive, value);
+      break;
+
+    case ROP_READ_JUST_ADDR:
+      handle_id_byte_addr(drive, value);
+      break;
+
+    case ROP_READ_SECTOR:
+      handle_sector_data_byte(drive, value);
+      break;
+
+    case OP_IDLE:
+      assert(state->current_op != OP_IDLE);
+      break;
+
+    case WOP_FORMAT:
+    case WOP_WRITE_SECTOR:
+      log_error("hfe: drive %d: address mark scan complete "
+                "(current_op_name=%s)",
+                drive, state->current_op_name);
+      fdc_writeprotect();
+      clear_op_state(state);
+      break;
+    }
+}
+
+static void advance_bit_pos(int drive, bool *end)
 {
   struct hfe_poll_state *state = &hfe_info[drive]->state;
-  const unsigned char *trackdata = hfe_info[drive]->track_data;
-  const int mask_for_this_bit = 1 << (state->track_bit_pos % UCHAR_BIT);
-  const long byte_offset = state->track_bit_pos / UCHAR_BIT;
-  const int this_bit = (trackdata[byte_offset] & mask_for_this_bit) ? 1 : 0;
   ++state->track_bit_pos;
   /* Check if we reached the end of the track data. */
   if ((state->track_bit_pos)/UCHAR_BIT >= hfe_info[drive]->track_data_bytes)
@@ -1339,6 +1501,16 @@ static bool get_next_bit(int drive, bool *end)
       *end = true;
       state->track_bit_pos = 0; /* start again at the beginning. */
     }
+}
+
+static bool get_next_bit(int drive, bool *end)
+{
+  struct hfe_poll_state *state = &hfe_info[drive]->state;
+  const unsigned char *trackdata = hfe_info[drive]->track_data;
+  const int mask_for_this_bit = 1 << (state->track_bit_pos % UCHAR_BIT);
+  const long byte_offset = state->track_bit_pos / UCHAR_BIT;
+  const int this_bit = (trackdata[byte_offset] & mask_for_this_bit) ? 1 : 0;
+  advance_bit_pos(drive, end);
   return this_bit;
 }
 
@@ -1376,6 +1548,307 @@ static void handle_badclock(int drive)
   abandon_op_badclock(drive);
 }
 
+/* Decoding whole tracks ahead of time.
+
+   Scanning for address marks and decoding records a bit at a time in
+   hfe_poll_drive costs a good deal of host CPU for every sector read.
+   Instead, the first time a track is read in each density we run the
+   same scanner and decoder over the whole track just once, noting
+   where each sector ID address mark is, what its ID and data records
+   hold and where any clock errors are.  Reads are then served from
+   that table: the head still moves one bit per bit time, so timing
+   is unchanged, but at each bit we only compare its position with
+   the next one at which something happens.
+*/
+
+static int track_bit(const struct hfe_track *t, long pos)
+{
+  const long nbits = (long)t->bytes * UCHAR_BIT;
+  pos %= nbits;
+  if (pos < 0)
+    pos += nbits;
+  return (t->bits[pos / UCHAR_BIT] >> (pos % UCHAR_BIT)) & 1;
+}
+
+/* Decode the byte whose last bit is at |end| as hfe_poll_drive does,
+   ignoring the first |ignore| clock bits.  Returns -1 on a clock
+   error. */
+static int decode_track_byte(const struct hfe_track *t, long end,
+                             bool mfm, int ignore)
+{
+  int prev_data_bit = track_bit(t, end - 16);
+  int value = 0;
+  for (int i = 0; i < 8; ++i)
+    {
+      const int clock = track_bit(t, end - 15 + 2 * i);
+      const int data = track_bit(t, end - 14 + 2 * i);
+      if (i >= ignore)
+        {
+          const int mfm_expected_clock = (prev_data_bit || data) ? 0 : 1;
+          if (clock != (mfm ? mfm_expected_clock : 1))
+            return -1;
+        }
+      value = (value << 1) | data;
+      prev_data_bit = data;
+    }
+  return value;
+}
+
+/* Decode |len| bytes of the record whose address mark ends at bit
+   |pos|, returning the index of the byte with a clock error, or |len|
+   if there is none. */
+static size_t decode_track_record(const struct hfe_track *t, long pos,
+                                  bool mfm, unsigned char *out, size_t len)
+{
+  for (size_t k = 0; k < len; ++k)
+    {
+      /* In FM, the address mark has some clock bits missing. */
+      const int value = decode_track_byte(t, pos + 16 * (long)k, mfm,
+                                          (k == 0 && !mfm) ? 8 : 0);
+      if (value < 0)
+        return k;
+      out[k] = value;
+    }
+  return len;
+}
+
+static bool add_mark(long **marks, int *count, int *size, long pos)
+{
+  if (*count == *size)
+    {
+      int new_size = *size ? *size * 2 : 32;
+      long *new_marks = realloc(*marks, new_size * sizeof(long));
+      if (!new_marks)
+        return false;
+      *marks = new_marks;
+      *size = new_size;
+    }
+  (*marks)[(*count)++] = pos;
+  return true;
+}
+
+/* Of the marks at |marks|, find the one the scanner would reach first
+   if it started |min_dist| bits on from |from|. */
+static int next_mark(const long *marks, int count,
+                     long nbits, long from, long min_dist)
+{
+  int best = -1;
+  long best_dist = 0;
+  for (int i = 0; i < count; ++i)
+    {
+      long dist = (marks[i] - from - min_dist) % nbits;
+      if (dist < 0)
+        dist += nbits;
+      if (best < 0 || dist < best_dist)
+        {
+          best = i;
+          best_dist = dist;
+        }
+    }
+  return best;
+}
+
+static struct hfe_sector_table *hfe_decode_track(const struct hfe_track *t,
+                                                 bool mfm, bool *undecodable)
+{
+  const long nbits = (long)t->bytes * UCHAR_BIT;
+  const uint64_t id_value = mfm ? MFM_ID_MARK_VALUE : FM_ID_MARK_VALUE;
+  const uint64_t id_mask = mfm ? MFM_ID_MARK_MASK : FM_ID_MARK_MASK;
+  const uint64_t data_value = mfm ? MFM_DATA_MARK_VALUE : FM_DATA_MARK_VALUE;
+  const uint64_t data_mask = mfm ? MFM_DATA_MARK_MASK : FM_DATA_MARK_MASK;
+  long *ids = NULL, *datas = NULL;
+  int nids = 0, ids_size = 0, ndatas = 0, datas_size = 0;
+  struct hfe_sector_table *table = NULL;
+  uint64_t reg = 0;
+  long pos;
+
+  *undecodable = true;
+  if (nbits < 64)
+    return NULL;
+
+  /* The track is a loop, so the shift register is already full of the
+     end of the track when its first bit arrives. */
+  for (pos = nbits - 63; pos < nbits; ++pos)
+    reg = (reg << 1) | track_bit(t, pos);
+  for (pos = 0; pos < nbits; ++pos)
+    {
+      reg = (reg << 1) | track_bit(t, pos);
+      if ((reg & id_mask) == id_value)
+        {
+          if (!add_mark(&ids, &nids, &ids_size, pos))
+            goto fail;
+        }
+      else if ((reg & data_mask) == data_value)
+        {
+          if (!add_mark(&datas, &ndatas, &datas_size, pos))
+            goto fail;
+        }
+    }
+
+  if (!(table = calloc(1, sizeof(*table))))
+    goto fail;
+  if (nids && !(table->sectors = calloc(nids, sizeof(*table->sectors))))
+    goto fail;
+  table->count = nids;
+  table->id_bits = ids;
+  ids = NULL;
+  for (int i = 0; i < nids; ++i)
+    {
+      struct hfe_sector *s = &table->sectors[i];
+      s->id_bit = table->id_bits[i];
+      s->id_badclock = decode_track_record(t, s->id_bit, mfm, s->id, SECTOR_ADDR_BYTES);
+      s->data_bit = -1;
+      if (s->id_badclock < SECTOR_ADDR_BYTES)
+        continue;
+
+      unsigned short crc = 0xFFFF;
+      if (mfm)
+        for (int k = 0; k < 3; ++k)
+          crc = crc_update(crc, 0xA1);
+      for (int k = 0; k < SECTOR_ADDR_BYTES; ++k)
+        crc = crc_update(crc, s->id[k]);
+      if (crc)
+        continue;               /* a read would go on to the next ID. */
+      if (s->id[4] > 7)
+        {
+          log_warn("hfe: size code %u in sector ID is too large to decode ahead", s->id[4]);
+          goto fail;
+        }
+
+      /* The data scan starts after the last byte of the ID. */
+      const int d = next_mark(datas, ndatas, nbits,
+                              s->id_bit + 16 * (SECTOR_ADDR_BYTES - 1), 1);
+      if (d < 0)
+        continue;
+      s->data_bit = datas[d];
+      s->data_bytes = 3u + (1u << (s->id[4] + 7u));
+      if (!(s->data = malloc(s->data_bytes)))
+        goto fail;
+      s->data_badclock = decode_track_record(t, s->data_bit, mfm, s->data, s->data_bytes);
+    }
+  free(ids);
+  free(datas);
+  *undecodable = false;
+  return table;
+
+ fail:
+  free(ids);
+  free(datas);
+  free_sector_table(table);
+  return NULL;
+}
+
+static const struct hfe_sector_table *track_sector_table(struct hfe_track *t, bool mfm)
+{
+  if (!t->table[mfm] && !t->undecodable[mfm])
+    {
+      t->table[mfm] = hfe_decode_track(t, mfm, &t->undecodable[mfm]);
+      if (t->table[mfm])
+        log_debug("hfe: decoded %d %s sector IDs from %lu bytes of track data",
+                  t->table[mfm]->count, mfm ? "MFM" : "FM", (unsigned long)t->bytes);
+    }
+  return t->table[mfm];
+}
+
+/* Set the cached operation up to handle the next sector ID the
+   scanner will find if it starts |min_dist| bits on from |from|. */
+static void cache_next_id(int drive, long from, long min_dist)
+{
+  struct hfe_info *info = hfe_info[drive];
+  struct hfe_poll_state *state = &info->state;
+  const struct hfe_sector_table *table = info->tracks[info->current_track].table[state->mfm_mode];
+  const int i = next_mark(table->id_bits, table->count,
+                          (long)info->track_data_bytes * UCHAR_BIT, from, min_dist);
+  state->cached_byte = 0;
+  if (i < 0)
+    {
+      /* Nothing to find; the revolution limit will end the operation. */
+      state->cached_sector = NULL;
+      state->cached_event = -1;
+    }
+  else
+    {
+      state->cached_sector = &table->sectors[i];
+      state->cached_event = state->cached_sector->id_bit;
+    }
+}
+
+/* Called as an operation starts scanning for a sector ID to serve it
+   from the track's sector table if we can. */
+static void cache_begin(int drive)
+{
+  struct hfe_info *info = hfe_info[drive];
+  struct hfe_poll_state *state = &info->state;
+  if (state->current_op != ROP_READ_ADDR_FOR_SECTOR
+      && state->current_op != ROP_READ_JUST_ADDR)
+    return;
+  if (info->current_track == NO_TRACK || !info->track_data)
+    return;
+  if (!track_sector_table(&info->tracks[info->current_track], state->mfm_mode))
+    return;
+
+  /* start_op cleared the shift register, so a mark can't be found
+     until it is full again.  Until then the scanner also sees the
+     zeros left in it, which can only very rarely make a match the
+     table doesn't have, but where that would happen the bit-by-bit
+     decoder deals with it. */
+  const struct hfe_track *t = &info->tracks[info->current_track];
+  int width = 0;
+  for (uint64_t m = state->scan_mask; m; m >>= 1)
+    ++width;
+  uint64_t reg = 0;
+  for (int i = 0; i < width - 1; ++i)
+    {
+      reg = (reg << 1) | track_bit(t, state->track_bit_pos + i);
+      if ((reg & state->scan_mask) == state->scan_value)
+        return;
+    }
+  state->cached = true;
+  cache_next_id(drive, state->track_bit_pos, width - 1);
+}
+
+/* Handle the byte of a cached operation due at bit |pos|. */
+static void cache_event(int drive, long pos)
+{
+  struct hfe_poll_state *state = &hfe_info[drive]->state;
+  const struct hfe_sector *s = state->cached_sector;
+  const size_t k = state->cached_byte;
+  const bool in_data = (state->current_op == ROP_READ_SECTOR);
+  const unsigned char *record = in_data ? s->data : s->id;
+  const size_t badclock = in_data ? s->data_badclock : (size_t)s->id_badclock;
+
+  if (k == 0)
+    {
+      /* The scanner has matched the address mark. */
+      state->scan_mask = 0;
+      crc_start_record(drive);
+    }
+  if (k == badclock)
+    {
+      handle_badclock(drive);
+      return;
+    }
+  handle_record_byte(drive, record[k]);
+
+  if (state->current_op == OP_IDLE || !state->cached)
+    return;
+  if (in_data && state->current_op != ROP_READ_SECTOR)
+    return;                     /* restarted, see cache_begin. */
+  if (!state->scan_mask)
+    {
+      state->cached_byte = k + 1;
+      state->cached_event = (pos + 16) % ((long)hfe_info[drive]->track_data_bytes * UCHAR_BIT);
+    }
+  else if (state->current_op == ROP_READ_SECTOR)
+    {
+      /* Found the ID, so on to its data. */
+      state->cached_byte = 0;
+      state->cached_event = s->data_bit;
+    }
+  else
+    cache_next_id(drive, pos, 1);
+}
+
 static void hfe_poll_drive(int drive, bool is_selected)
 {
   struct hfe_poll_state *state = &hfe_info[drive]->state;
@@ -1447,7 +1920,14 @@ static void hfe_poll_drive(int drive, bool is_selected)
      physical read head. */
 
   bool end = false;
-  const int this_bit = get_next_bit(drive, &end);
+  const long this_pos = state->track_bit_pos;
+  int this_bit = 0;
+  /* Nothing needs the bit itself unless we're decoding; start_op clears
+     the shift register anyway. */
+  if (state->cached || state->current_op == OP_IDLE)
+    advance_bit_pos(drive, &end);
+  else
+    this_bit = get_next_bit(drive, &end);
   if (!is_selected)
     {
       return;
@@ -1486,6 +1966,17 @@ static void hfe_poll_drive(int drive, bool is_selected)
         }
     }
 
+  if (state->current_op == OP_IDLE)
+    {
+      return;
+    }
+  if (state->cached)
+    {
+      if (this_pos == state->cached_event)
+        cache_event(drive, this_pos);
+      return;
+    }
+
   /* We're going to shift the top bit of state->shift_register out;
      put it into the bottom bit of shift_register_prevbits. */
   const int doomed_shift_bit = state->shift_register & (1LL << 63);
@@ -1495,11 +1986,6 @@ static void hfe_poll_drive(int drive, bool is_selected)
   state->shift_register <<= 1;
   state->shift_register |= this_bit;
 
-  if (state->current_op == OP_IDLE)
-    {
-      return;
-    }
-
   if (state->scan_mask)
     {
       /* If we're scanning for an address mark, we must want to read
@@ -1520,17 +2006,7 @@ static void hfe_poll_drive(int drive, bool is_selected)
                 drive,
                 state->shift_register,state->scan_value, state->scan_mask,
                 state->current_op_name);
-      crc_reset(drive);
-      if (state->mfm_mode)
-        {
-          /* The fact that the shift register matched tells us
-             that we just read the A1 address mark intro bytes.
-             The CRC is computed over the A1 bytes and the rest of
-             the sector address. */
-          crc_byte(state, 0xA1);
-          crc_byte(state, 0xA1);
-          crc_byte(state, 0xA1);
-        }
+      crc_start_record(drive);
 
       /* Start decoding data, either the sector ID or the sector
          (record) data itself. */
@@ -1615,36 +2091,10 @@ static void hfe_poll_drive(int drive, bool is_selected)
         {
           value |= 1;
         }
+      prev_data_bit = data;
     }
 
-  assert(state->bytes_to_read > 0);
-  switch (state->current_op)
-    {
-    case ROP_READ_ADDR_FOR_SECTOR:
-      handle_id_byte_sector(drive, value);
-      break;
-
-    case ROP_READ_JUST_ADDR:
-      handle_id_byte_addr(drive, value);
-      break;
-
-    case ROP_READ_SECTOR:
-      handle_sector_data_byte(drive, value);
-      break;
-
-    case OP_IDLE:
-      assert(state->current_op != OP_IDLE);
-      break;
-
-    case WOP_FORMAT:
-    case WOP_WRITE_SECTOR:
-      log_error("hfe: drive %d: address mark scan complete "
-                "(current_op_name=%s)",
-                drive, state->current_op_name);
-      fdc_writeprotect();
-      clear_op_state(state);
-      break;
-    }
+  handle_record_byte(drive, value);
 }
 
 static void hfe_poll(void)
@@ -1700,6 +2150,7 @@ static void init_hfe_poll_state(struct hfe_poll_state *p,
   p->crc = 0;
   p->shift_register = 0;
   p->scan_value = p->scan_mask = 0;
+  p->cached = false;
 }
 
 static void init_hfe_info(struct hfe_info *p, FILE *f)
@@ -1707,6 +2158,7 @@ static void init_hfe_info(struct hfe_info *p, FILE *f)
   p->current_track = NO_TRACK;
   p->track_data = NULL;
   p->track_data_bytes = 0;
+  p->tracks = NULL;
   p->fp = f;
   init_hfe_poll_state(&p->state, p->poll_calls_per_bit);
 }
@@ -1774,13 +2226,23 @@ int hfe_load(int drive, const char *fn)
     {
       log_error("hfe: HFE disc image '%s' has an invalid header", fn);
       /* unwind the initialization. */
-      free(hfe_info[drive]);
       fclose(hfe_info[drive]->fp);
+      free(hfe_info[drive]);
       log_warn("hfe: drive %d: hfe_load setting hfe_info[%d] to NULL (after failing to load %s)",
                drive, drive, fn);
       hfe_info[drive] = NULL;
       return -1;
     }
+  hfe_info[drive]->tracks = calloc(hfe_info[drive]->header.number_of_track,
+                                   sizeof(struct hfe_track));
+  if (!hfe_info[drive]->tracks)
+    {
+      log_error("hfe: out of memory loading HFE disc image '%s'", fn);
+      fclose(hfe_info[drive]->fp);
+      free(hfe_info[drive]);
+      hfe_info[drive] = NULL;
+      return -1;
+    }
   drives[drive].close       = hfe_close;
   drives[drive].seek        = hfe_seek;
   drives[drive].readsector  = hfe_readsector;
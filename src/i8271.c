@@ -531,6 +531,11 @@ static void i8271_writeprotect(void)
     short_spindown();
 }
 
+static bool i8271_pending(void)
+{
+    return (i8271.status & (I8S_BUSY|I8S_NON_DMA)) == (I8S_BUSY|I8S_NON_DMA);
+}
+
 int i8271_getdata(int last)
 {
 //        printf("Disc get data %i\n",bytenum);
@@ -557,6 +562,7 @@ void i8271_reset()
         fdc_headercrcerror = i8271_headercrcerror;
         fdc_writeprotect   = i8271_writeprotect;
         fdc_getdata        = i8271_getdata;
+        fdc_pending        = i8271_pending;
         motorspin = 45000;
         i8271.paramnum = i8271.paramreq = 0;
         i8271.status = 0;
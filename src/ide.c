@@ -3,7 +3,9 @@
 #include <stdio.h>
 #include "b-em.h"
 #include "ide.h"
+#include "hdcache.h"
 #include "led.h"
+#include "overlay.h"
 
 bool ide_enable;
 int ide_count;
@@ -22,12 +24,12 @@ static struct
 static uint16_t ide_buffer[256];
 static uint8_t *ide_bufferb;
 static uint8_t  ide_buffer2[256];
-static FILE *hdfile[2] = {NULL, NULL};
+static hdcache_t hdcache[2];
 
 void ide_close()
 {
-        if (hdfile[0]) fclose(hdfile[0]);
-        if (hdfile[1]) fclose(hdfile[1]);
+        hdcache_close(&hdcache[0]);
+        hdcache_close(&hdcache[1]);
 }
 
 static void ide_open_hd(int i, const char *name) {
@@ -35,18 +37,22 @@ static void ide_open_hd(int i, const char *name) {
     ALLEGRO_PATH *path;
     const char *cpath;
 
-    if (!hdfile[i]) {
+    if (!hdcache[i].fp) {
         if ((path = find_cfg_file(name, ".hdf"))) {
             cpath = al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP);
-            if ((f = fopen(cpath, "rb+")))
-                hdfile[i] = f;
+            if ((f = overlay_fopen(cpath, "rb+"))) {
+                if (!hdcache_open(&hdcache[i], f)) {
+                    log_error("ide: unable to use hard disk file %s", cpath);
+                    overlay_fclose(f);
+                }
+            }
             else
                 log_error("ide: unable to open hard disk file %s: %s", cpath, strerror(errno));
             al_destroy_path(path);
         } else if ((path = find_cfg_dest(name, ".hdf"))) {
             cpath = al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP);
-            if ((f = fopen(cpath, "wb+")))
-                hdfile[i] = f;
+            if ((f = overlay_fopen(cpath, "wb+")))
+                hdcache_open(&hdcache[i], f);
             else
                 log_error("ide: unable to open hard disk file %s: %s", cpath, strerror(errno));
             al_destroy_path(path);
@@ -246,9 +252,8 @@ void ide_callback()
             case 0x20: /*Read sectors*/
                 addr = ((((ide.cylinder * ide.hpc) + ide.head) * ide.spt) + (ide.sector)) * 256;
                 log_debug("ide: read sector, cylinder=%u, hpc=%u, head=%u, spt=%u, sector=%u, addr=%u", ide.cylinder, ide.hpc, ide.head, ide.spt, ide.sector, addr);
-                fseek(hdfile[ide.drive], addr, SEEK_SET);
                 memset(ide_buffer, 0, 512);
-                if (fread(ide_buffer2, 256, 1, hdfile[ide.drive]) != 1 && ferror(hdfile[ide.drive])) {
+                if (!hdcache_read(&hdcache[ide.drive], addr, ide_buffer2, 256)) {
                     ide.error = 0x40;
                     ide.atastat = 0x51;
                 }
@@ -262,9 +267,8 @@ void ide_callback()
             case 0x30: /*Write sector*/
                 addr = ((((ide.cylinder * ide.hpc) + ide.head) * ide.spt) + (ide.sector)) * 256;
                 log_debug("ide: write sector, cylinder=%u, hpc=%u, head=%u, spt=%u, sector=%u, addr=%u", ide.cylinder, ide.hpc, ide.head, ide.spt, ide.sector, addr);
-                fseek(hdfile[ide.drive], addr, SEEK_SET);
                 for (c = 0; c < 256; c++) ide_buffer2[c] = ide_bufferb[c << 1];
-                fwrite(ide_buffer2, 256, 1, hdfile[ide.drive]);
+                hdcache_write(&hdcache[ide.drive], addr, ide_buffer2, 256);
                 ide.secount--;
                 if (ide.secount)
                 {
@@ -282,6 +286,10 @@ void ide_callback()
                                 }
                         }
                 }
+                else if (!hdcache_flush(&hdcache[ide.drive])) {
+                    ide.error = 0x40;
+                    ide.atastat = 0x51;
+                }
                 else
                    ide.atastat = 0x40;
                 return;
@@ -291,13 +299,17 @@ void ide_callback()
                 return;
             case 0x50: /*Format track*/
                 addr = (((ide.cylinder * ide.hpc) + ide.head) * ide.spt) * 256;
-                fseek(hdfile[ide.drive], addr, SEEK_SET);
                 memset(ide_bufferb, 0, 512);
                 for (c = 0; c < ide.secount; c++)
                 {
-                        fwrite(ide_buffer, 256, 1, hdfile[ide.drive]);
+                        hdcache_write(&hdcache[ide.drive], addr + c * 256, ide_buffer, 256);
                 }
-                ide.atastat = 0x40;
+                if (!hdcache_flush(&hdcache[ide.drive])) {
+                    ide.error = 0x40;
+                    ide.atastat = 0x51;
+                }
+                else
+                    ide.atastat = 0x40;
                 return;
             case 0x91: /*Set parameters*/
                 ide.spt = ide.secount;
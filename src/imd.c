@@ -22,6 +22,7 @@
 #include "b-em.h"
 #include "disc.h"
 #include "imd.h"
+#include "overlay.h"
 
 #define IMD_MAX_SECTS 36
 
@@ -258,10 +259,11 @@ static void imd_close(int drive)
 {
     if (drive >= 0 && drive < NUM_DRIVES) {
         struct imd_file *imd = &imd_discs[drive];
-        if (imd->dirty)
+        /* With an overlay the whole image is already in memory. */
+        if (imd->dirty && !overlay_attached(imd->fp))
             imd_save(imd);
         imd_free(imd);
-        fclose(imd->fp);
+        overlay_fclose(imd->fp);
         imd->fp = NULL;
     }
 }
@@ -1512,7 +1514,7 @@ int imd_load(int drive, const char *fn)
     log_debug("imd: loading IMD image file '%s' into drive %d", fn, drive);
     if (drive >= 0 && drive < NUM_DRIVES) {
         int wprot = 0;
-        FILE *fp = fopen(fn, "rb+");
+        FILE *fp = overlay_fopen(fn, "rb+");
         if (!fp) {
             if (!(fp = fopen(fn, "rb"))) {
                 log_error("Unable to open file '%s' for reading - %s", fn, strerror(errno));
@@ -1546,7 +1548,7 @@ int imd_load(int drive, const char *fn)
         }
         else
             log_error("File '%s' does not have a valid IMD header", fn);
-        fclose(fp);
+        overlay_fclose(fp);
     }
     return -1;
 }
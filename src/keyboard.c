@@ -6,6 +6,7 @@
 #include "model.h"
 #include "6502.h"
 #include "fullscreen.h"
+#include "rewind.h"
 #include <ctype.h>
 #include <allegro5/keyboard.h>
 
@@ -686,7 +687,8 @@ const struct key_act_const keyact_const[KEY_ACTION_MAX] = {
     { "pause",        ALLEGRO_KEY_PGDN,  false, main_key_pause,          do_nothing      },
     { "full-screen1", ALLEGRO_KEY_F11,   false, toggle_fullscreen_menu, do_nothing      },
     { "debug-break",  ALLEGRO_KEY_F10,   false, debug_break,             do_nothing      },
-    { "full-screen2", ALLEGRO_KEY_ENTER, true,  toggle_fullscreen_menu, do_nothing      }
+    { "full-screen2", ALLEGRO_KEY_ENTER, true,  toggle_fullscreen_menu, do_nothing      },
+    { "rewind",       ALLEGRO_KEY_BACKSPACE, true, rewind_key,          do_nothing      }
 };
 
 uint8_t keylookup[ALLEGRO_KEY_MAX];
@@ -705,8 +705,7 @@ MENU waveformmenu[6] =
 int gui_ddtype()
 {
         ddnoise_type = (intptr_t)active_menu->dp;
-        ddnoise_close();
-        ddnoise_init();
+        ddnoise_reload();
         gui_update();
         return D_CLOSE;
 }
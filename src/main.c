@@ -11,6 +11,7 @@
 
 #include "6502.h"
 #include "adc.h"
+#include "batch.h"
 #include "model.h"
 #include "cmos.h"
 #include "config.h"
@@ -36,8 +37,10 @@
 #include "music4000.h"
 #include "music5000.h"
 #include "mmccard.h"
+#include "overlay.h"
 #include "paula.h"
 #include "pal.h"
+#include "rewind.h"
 #include "savestate.h"
 #include "scsi.h"
 #include "sdf.h"
@@ -101,7 +104,13 @@ typedef enum {
 } fspeed_type_t;
 
 static const int slice = 40000; // 8ms to match Music 5000.
-static double time_limit;
+static const double pace_period = 0.005; // host timer tick, seconds.
+static double pace_latency = 0.04;       // target sound latency, seconds.
+static double pace_rate;                 // 2MHz cycles per host second.
+static double pace_time;                 // host time of last pacing decision.
+static double pace_debt;                 // fractional cycles carried over.
+static bool pace_audio;                  // sound can be used as a clock.
+static int slice_cycles;                 // cycles run towards next slice.
 static int fcount = 0;
 static fspeed_type_t fullspeed = FSPEED_NONE;
 static bool bempause  = false;
@@ -158,6 +167,9 @@ static const char helptext[] =
     "-autoboot       - boot disc in drive :0\n"
     "-tape tape.uef  - load tape.uef\n"
     "-fasttape       - set tape speed to fast\n"
+    "-quicktape      - pass tape data as fast as the OS takes it\n"
+    "-fastdisc       - skip disc seek and transfer delays\n"
+    "-overlay        - keep disc and hard disc writes in memory, leaving images unchanged\n"
     "-Fx             - set maximum video frames skipped\n"
     "-s              - scanlines display mode\n"
     "-i              - interlace display mode\n"
@@ -176,18 +188,16 @@ static const char helptext[] =
     "-printfilebin f - printer output to file as text\n"
     "-printcmd c     - printer output via command as text\n"
     "-printcmdbin c  - printer output via command as binary\n"
+    "-latency ms     - target sound latency in milliseconds\n"
+    "-rewind-seconds s - keep s seconds of history for the rewind key\n"
+    "-batch jobs.txt - boot once then run each job in jobs.txt from there\n"
+    "-batch-workers n - run at most n batch jobs at once\n"
+    "-batch-boot s   - emulated seconds to boot for before the batch jobs\n"
+    "-batch-limit s  - emulated seconds after which a batch job is stopped\n"
+    "-batch-results f - write batch job results to file f\n"
     "-vroot host-dir - set the VDFS root\n"
     "-vdir guest-dir - set the initial (boot) dir in VDFS\n\n";
 
-static double main_calc_timer(int speed)
-{
-    double multiplier = emu_speeds[speed].multiplier;
-    double secs = ((double)slice / 2000000.0) / multiplier;
-    time_limit = secs * 2.0;
-    log_debug("main: main_calc_timer for speed#%d, multiplier %g timer %gs", speed, multiplier, secs);
-    return secs;
-}
-
 static int main_speed_cmp(const void *va, const void *vb)
 {
     double res = ((const emu_speed_t *)va)->multiplier - ((const emu_speed_t *)vb)->multiplier;
@@ -254,6 +264,13 @@ typedef enum {
     OPT_PASTE_OS,
     OPT_PASTE_KBD,
     OPT_PRINT,
+    OPT_LATENCY,
+    OPT_REWIND,
+    OPT_BATCH,
+    OPT_BATCH_WORKERS,
+    OPT_BATCH_BOOT,
+    OPT_BATCH_LIMIT,
+    OPT_BATCH_RESULTS,
     OPT_GROUND,
 } opt_state;
 
@@ -298,6 +315,12 @@ void main_init(int argc, char *argv[])
                         sscanf(&arg[1], "%i", &curtube);
                     else if (!strcasecmp(arg, "fasttape"))
                         fasttape = true;
+                    else if (!strcasecmp(arg, "quicktape"))
+                        quicktape = true;
+                    else if (!strcasecmp(arg, "fastdisc"))
+                        fastdisc = true;
+                    else if (!strcasecmp(arg, "overlay"))
+                        overlay_images = true;
                     else if (!strcasecmp(arg, "autoboot"))
                         autoboot = 150;
                     else if (arg[0] == 'f' || arg[0]=='F') {
@@ -349,6 +372,20 @@ void main_init(int argc, char *argv[])
                         hiresdisplay = true;
                     else if (!strcasecmp(arg, "lores"))
                         hiresdisplay = false;
+                    else if (!strcasecmp(arg, "latency"))
+                        state = OPT_LATENCY;
+                    else if (!strcasecmp(arg, "rewind-seconds"))
+                        state = OPT_REWIND;
+                    else if (!strcasecmp(arg, "batch"))
+                        state = OPT_BATCH;
+                    else if (!strcasecmp(arg, "batch-workers"))
+                        state = OPT_BATCH_WORKERS;
+                    else if (!strcasecmp(arg, "batch-boot"))
+                        state = OPT_BATCH_BOOT;
+                    else if (!strcasecmp(arg, "batch-limit"))
+                        state = OPT_BATCH_LIMIT;
+                    else if (!strcasecmp(arg, "batch-results"))
+                        state = OPT_BATCH_RESULTS;
                     else {
                         if (*arg != 'h' && *arg != '?')
                             fprintf(stderr, "b-em: unrecognised option '-%s'\n", arg);
@@ -414,6 +451,29 @@ void main_init(int argc, char *argv[])
             case OPT_PRINT:
                 print_filename = arg;
                 print_filename_alloc = false;
+                break;
+            case OPT_LATENCY:
+                pace_latency = atoi(arg) / 1000.0;
+                if (pace_latency < 0.005)
+                    pace_latency = 0.005;
+                break;
+            case OPT_REWIND:
+                rewind_seconds = atoi(arg);
+                break;
+            case OPT_BATCH:
+                batch_jobs_fn = arg;
+                break;
+            case OPT_BATCH_WORKERS:
+                batch_workers = atoi(arg);
+                break;
+            case OPT_BATCH_BOOT:
+                batch_boot_secs = atof(arg);
+                break;
+            case OPT_BATCH_LIMIT:
+                batch_limit_secs = atof(arg);
+                break;
+            case OPT_BATCH_RESULTS:
+                batch_results_fn = arg;
         }
         state = OPT_GROUND;
     }
@@ -454,22 +514,21 @@ void main_init(int argc, char *argv[])
         log_fatal("main: unable to initialise audio");
         exit(1);
     }
-    if (!al_reserve_samples(3)) {
-        log_fatal("main: unable to reserve audio samples");
-        exit(1);
-    }
     if (!al_init_acodec_addon()) {
         log_fatal("main: unable to initialise audio codecs");
         exit(1);
     }
 
-    sound_init();
+    if (!batch_jobs_fn)
+        sound_init();
     sid_init();
     sid_settype(sidmethod, cursid);
-    music5000_init(emu_speed_normal);
+    music5000_init();
     paula_init();
-    ddnoise_init();
-    tapenoise_init(queue);
+    if (!batch_jobs_fn) {
+        ddnoise_init();
+        tapenoise_init(queue);
+    }
 
     adc_init();
     pal_init();
@@ -490,9 +549,10 @@ void main_init(int argc, char *argv[])
 
     tmp_display = display;
 
-    gui_allegro_init(queue, display);
+    if (!batch_jobs_fn)
+        gui_allegro_init(queue, display);
 
-    if (!(timer = al_create_timer(main_calc_timer(emu_speed_normal)))) {
+    if (!(timer = al_create_timer(pace_period))) {
         log_fatal("main: unable to create timer");
         exit(1);
     }
@@ -522,7 +582,9 @@ void main_init(int argc, char *argv[])
     if (drives[1].discfn)
         gui_set_disc_wprot(1, drives[1].writeprot);
     main_setspeed(emuspeed);
-    debug_start(exec_fn, true);
+    if (!batch_jobs_fn)
+        rewind_init();
+    debug_start(exec_fn, !batch_jobs_fn);
     // lovebug
     if (fullscreen)
         video_enterfullscreen();
@@ -533,6 +595,7 @@ void main_restart()
 {
     main_pause("restarting");
     cmos_save(&models[oldmodel]);
+    savestate_forget_base();
 
     model_init();
     main_reset();
@@ -549,14 +612,23 @@ void main_cleardrawit()
     fcount = 0;
 }
 
+static void main_start_timer(void)
+{
+    pace_time = al_get_time();
+    pace_debt = 0;
+    al_start_timer(timer);
+}
+
 static void main_newspeed(int speed)
 {
     spd = emu_speeds[speed].multiplier;
+    pace_rate = 2000000.0 * spd;
+    pace_audio = fabs(spd - 1.0) < 0.001;
     if (!skipover) {
         vid_fskipmax = autoskip ? 1 : emu_speeds[speed].fskipmax;
         log_debug("main: main_setspeed: vid_fskipmax=%d", vid_fskipmax);
     }
-    music5000_init(speed);
+    sound_set_speed(spd);
 }
 
 void main_start_fullspeed(void)
@@ -581,7 +653,7 @@ void main_stop_fullspeed(bool hostshift)
             log_debug("main: stopping fullspeed (PgUp)");
             if (fullspeed == FSPEED_RUNNING && emuspeed != EMU_SPEED_PAUSED) {
                 main_newspeed(emuspeed);
-                al_start_timer(timer);
+                main_start_timer();
             }
             fullspeed = FSPEED_NONE;
         }
@@ -618,7 +690,7 @@ void main_key_pause(void)
         if (emuspeed != EMU_SPEED_PAUSED) {
             bempause = false;
             if (emuspeed != EMU_SPEED_FULL)
-                al_start_timer(timer);
+                main_start_timer();
         }
     } else {
         al_stop_timer(timer);
@@ -627,40 +699,124 @@ void main_key_pause(void)
 }
 
 static double prev_time = 0;
+static double busy_time = 0;
 static int execs = 0;
 static int slow_count = 0;
 
+/* Work out how many 2MHz cycles to run for this timer tick.  The host
+ * clock gives the nominal amount.  At normal speed, when the sound
+ * output stream is playing, the amount queued for the sound device trims
+ * that so the device sets the long term pace and the latency stays near
+ * pace_latency, and a full output stream holds emulation back.  Other
+ * speeds are paced by the host clock alone so the sound queue cannot
+ * hold them to normal speed.  A host stall is caught up by at most one
+ * slice rather than all at once. */
+
+static int main_pace(double now)
+{
+    if (fullspeed == FSPEED_RUNNING)
+        return slice;
+
+    double due = (now - pace_time) * pace_rate + pace_debt;
+    pace_time = now;
+    if (pace_audio && !sound_ok()) {
+        pace_debt = 0;
+        return 0;
+    }
+    if (due > slice)
+        due = slice;
+    if (pace_audio) {
+        double latency = sound_latency();
+        if (latency >= 0) {
+            double err = (pace_latency - latency) / pace_latency;
+            if (err > 1.0)
+                err = 1.0;
+            else if (err < -1.0)
+                err = -1.0;
+            due *= 1.0 + 0.05 * err;
+        }
+    }
+    int run = (int)due;
+    pace_debt = due - run;
+    return run;
+}
+
+/* Things that count in whole slices of emulated time. */
+
+static void main_slice_done(void)
+{
+    if (autoboot)
+        autoboot--;
+
+    rewind_frame();
+
+    if (tapeledcount) {
+        if (--tapeledcount == 0 && !motor) {
+            log_debug("main: delayed cassette motor LED off");
+            led_update(LED_CASSETTE_MOTOR, 0, 0);
+        }
+    }
+}
+
+/* Adjust the frame skip from the share of host time spent emulating
+ * (which includes drawing frames) so each emulated frame is presented
+ * when the host can keep up and frames are only dropped when it can't. */
+
+static void main_pace_frameskip(double load)
+{
+    if (!autoskip || skipover)
+        return;
+    if (fullspeed != FSPEED_NONE) {
+        if (spd > prev_spd && ++slow_count >= 6) {
+            slow_count = 0;
+            ++vid_fskipmax;
+            log_debug("main: full-speed, speed increased from %g to %g, increasing vid_fskipmax to %d", prev_spd, spd, vid_fskipmax);
+            prev_spd = spd;
+        }
+    }
+    else if (load > 0.9 || spd < (emu_speeds[emuspeed].multiplier * 0.95)) {
+        if (++slow_count >= 6 && vid_fskipmax < 9) {
+            slow_count = 0;
+            ++vid_fskipmax;
+            log_debug("main: going slow, target=%g, spd=%g, load=%g, new vid_fskipmax=%d", emu_speeds[emuspeed].multiplier, spd, load, vid_fskipmax);
+        }
+    }
+    else if (load < 0.5 && vid_fskipmax > 1) {
+        if (++slow_count >= 6) {
+            slow_count = 0;
+            --vid_fskipmax;
+            log_debug("main: keeping up, load=%g, new vid_fskipmax=%d", load, vid_fskipmax);
+        }
+    }
+    else
+        slow_count = 0;
+}
+
 static void main_timer(ALLEGRO_EVENT *event)
 {
     double now = al_get_time();
-    double delay = now - event->any.timestamp;
+    int run = main_pace(now);
 
-    if (delay < time_limit && music5000_ok()) {
-        if (autoboot)
-            autoboot--;
+    if (run > 0) {
         if (x65c02)
-            m65c02_exec(slice);
+            m65c02_exec(run);
         else
-            m6502_exec(slice);
-        execs++;
+            m6502_exec(run);
+        execs += run;
+        busy_time += al_get_time() - now;
 
-        if (ddnoise_ticks > 0 && --ddnoise_ticks == 0)
-            ddnoise_headdown();
-
-        if (tapeledcount) {
-            if (--tapeledcount == 0 && !motor) {
-                log_debug("main: delayed cassette motor LED off");
-                led_update(LED_CASSETTE_MOTOR, 0, 0);
-            }
-        }
+        for (slice_cycles += run; slice_cycles >= slice; slice_cycles -= slice)
+            main_slice_done();
 
+        if (rewind_wanted)
+            rewind_step();
         if (savestate_wantload)
             savestate_doload();
         if (savestate_wantsave)
             savestate_dosave();
 
         if (now - prev_time > 0.1) {
-            double speed = execs * slice / (now - prev_time);
+            double speed = execs / (now - prev_time);
 
             if (spd < 0.0001)
                 spd = speed / 2000000;
@@ -671,26 +827,9 @@ static void main_timer(ALLEGRO_EVENT *event)
             snprintf(buf, sizeof(buf), "%s %.3fMHz %.1f%%", VERSION_STR, speed / 1000000, spd * 100.0);
             al_set_window_title(tmp_display, buf);
 
-            if (autoskip && !skipover) {
-                if (fullspeed != FSPEED_NONE) {
-                    if (spd > prev_spd && ++slow_count >= 6) {
-                        slow_count = 0;
-                        ++vid_fskipmax;
-                        log_debug("main: full-speed, speed increased from %g to %g, increasing vid_fskipmax to %d", prev_spd, spd, vid_fskipmax);
-                        prev_spd = spd;
-                    }
-                }
-                else if (spd < (emu_speeds[emuspeed].multiplier * 0.95)) {
-                    if (++slow_count >= 6) {
-                        slow_count = 0;
-                        ++vid_fskipmax;
-                        log_debug("main: going slow, target=%g, spd=%g, new vid_fskipmax=%d", emu_speeds[emuspeed].multiplier, spd, vid_fskipmax);
-                    }
-                }
-                else
-                    slow_count = 0;
-            }
+            main_pace_frameskip(busy_time / (now - prev_time));
             execs = 0;
+            busy_time = 0;
             prev_time = now;
         }
     }
@@ -703,12 +842,36 @@ static void main_timer(ALLEGRO_EVENT *event)
 
 static double last_switch_in = 0.0;
 
+/*
+ * Run the emulation flat out, with no pacing or events, for the given
+ * number of emulated seconds or until it quits.
+ */
+
+void main_run_unpaced(double secs)
+{
+    double left = secs * 2000000;
+
+    while (!quitting && left > 0) {
+        if (x65c02)
+            m65c02_exec(slice);
+        else
+            m6502_exec(slice);
+        left -= slice;
+        main_slice_done();
+
+        if (savestate_wantload)
+            savestate_doload();
+        if (savestate_wantsave)
+            savestate_dosave();
+    }
+}
+
 void main_run()
 {
     ALLEGRO_EVENT event;
 
     log_debug("main: about to start timer");
-    al_start_timer(timer);
+    main_start_timer();
 
     log_debug("main: entering main loop");
     while (!quitting) {
@@ -793,6 +956,8 @@ void main_close()
 {
     gui_tapecat_close();
     gui_keydefine_close();
+    rewind_close();
+    savestate_close();
 
     debug_kill();
 
@@ -817,8 +982,9 @@ void main_close()
     ide_close();
     vdfs_close();
     music5000_close();
-    ddnoise_close();
     tapenoise_close();
+    ddnoise_close();
+    sound_close();
     tape_free();
     al_destroy_timer(timer);
     al_destroy_event_queue(queue);
@@ -841,9 +1007,8 @@ void main_setspeed(int speed)
                 log_warn("main: speed #%d out of range, defaulting to 100%%", speed);
                 speed = 4;
             }
-            al_set_timer_speed(timer, main_calc_timer(speed));
             main_newspeed(speed);
-            al_start_timer(timer);
+            main_start_timer();
         }
         emuspeed = speed;
     }
@@ -860,7 +1025,7 @@ void main_pause(const char *why)
 void main_resume(void)
 {
     if (emuspeed != EMU_SPEED_PAUSED && emuspeed != EMU_SPEED_FULL)
-        al_start_timer(timer);
+        main_start_timer();
 }
 
 void set_quit(void)
@@ -883,7 +1048,10 @@ void set_shutdown_exit_code (uint8_t c) {
 int main(int argc, char **argv)
 {
     main_init(argc, argv);
-    main_run();
+    if (batch_jobs_fn)
+        batch_run();
+    else
+        main_run();
     main_close();
     return shutdown_exit_code;
 }
@@ -51,6 +51,7 @@ void main_softreset(void);
 void main_reset(void);
 void main_restart(void);
 void main_run(void);
+void main_run_unpaced(double secs);
 void main_close(void);
 void main_pause(const char *why);
 void main_resume(void);
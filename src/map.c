@@ -76,11 +76,14 @@ MAP_getfirst (int *first, int second)
 
   look = MAP_lookupbysecond[hash (second)];
   while (look)
-    if (look->second == second)
-      {
-	*first = look->first;
-	return MAP_NO_ERROR;
-      }
+    {
+      if (look->second == second)
+	{
+	  *first = look->first;
+	  return MAP_NO_ERROR;
+	}
+      look = look->next;
+    }
   return MAP_NO_SUCH_PAIR;
 }
 
@@ -138,3 +141,16 @@ MAP_newmap ()
       MAP_lookupbyfirst[i] = MAP_lookupbysecond[i] = (MAP_Hashentry *) 0;
     }
 }
+
+/* Call func for every pair, in an order that putpair recreates. */
+
+void
+MAP_forall (void (*func) (int first, int second, void *arg), void *arg)
+{
+  MAP_Hashentry *look;
+  int i;
+
+  for (i = 0; i < HASH_TABLE_SIZE; i++)
+    for (look = MAP_lookupbyfirst[i]; look; look = look->next)
+      func (look->first, look->second, arg);
+}
@@ -9,6 +9,7 @@ MAP_Error;
 void MAP_putpair (int first, int second);
 
 void MAP_newmap (void);
+void MAP_forall (void (*func) (int first, int second, void *arg), void *arg);
 MAP_Error MAP_killpair_byfirst (int first);
 MAP_Error MAP_killpair_bysecond (int second);
 
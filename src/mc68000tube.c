@@ -8,6 +8,7 @@
 
 static uint_least32_t mc68000_ram_size;
 static uint8_t *mc68000_ram, *mc68000_rom;
+static uint8_t *mc68000_ram_dirty;
 static bool mc68000_debug_enabled = false;
 static bool rom_low;
 
@@ -98,7 +99,9 @@ static void writemem(uint32_t addr, uint8_t data)
   else
   {
     log_debug("mc68000: write %08X as RAM <- %02X", addr, data);
-    mc68000_ram[addr % mc68000_ram_size] = data;
+    addr %= mc68000_ram_size;
+    mc68000_ram[addr] = data;
+    savestate_dirty(mc68000_ram_dirty, addr);
   }
 }
 
@@ -147,8 +150,8 @@ static void mc68000_savestate(ZFILE *zfp)
         m68k_get_context(buf);
         savestate_zwrite(zfp, buf, bytes);
         free(buf);
-        savestate_zwrite(zfp, mc68000_ram, mc68000_ram_size);
-        savestate_zwrite(zfp, mc68000_rom, MC68000_ROM_SIZE);
+        savestate_zwrite_pages(zfp, mc68000_ram, mc68000_ram_size, mc68000_ram_dirty);
+        savestate_zwrite_pages(zfp, mc68000_rom, MC68000_ROM_SIZE, NULL);
     }
     else
         log_warn("mc68000: out of memory trying to save 68000 state");
@@ -162,8 +165,8 @@ static void mc68000_loadstate(ZFILE *zfp)
         savestate_zread(zfp, buf, bytes);
         m68k_set_context(buf);
         free(buf);
-        savestate_zread(zfp, mc68000_ram, mc68000_ram_size);
-        savestate_zread(zfp, mc68000_rom, MC68000_ROM_SIZE);
+        savestate_zread_pages(zfp, mc68000_ram, mc68000_ram_size, mc68000_ram_dirty);
+        savestate_zread_pages(zfp, mc68000_rom, MC68000_ROM_SIZE, NULL);
     }
     else
         log_warn("mc68000: out of memory trying to load 68000 state");
@@ -180,6 +183,11 @@ bool tube_68000_init(void *rom)
             log_error("mc68000: unable to allocate RAM: %s", strerror(errno));
             return false;
         }
+        if (!(mc68000_ram_dirty = savestate_dirty_new(mc68000_ram_size))) {
+            free(mc68000_ram);
+            mc68000_ram = NULL;
+            return false;
+        }
         m68k_init();
         m68k_set_cpu_type(M68K_CPU_TYPE_68020);
     }
@@ -32,6 +32,11 @@
 uint8_t *ram, *rom, *os;
 uint8_t ram_fe30, ram_fe34;
 
+/* One dirty page map covers the whole block above, including the OS. */
+uint8_t *mem_dirty;
+
+#define ROM_MAP_OFFSET ((RAM_SIZE + ROM_SIZE) >> (SAVESTATE_PAGE_SHIFT + 3))
+
 rom_slot_t rom_slots[ROM_NSLOT];
 
 ALLEGRO_PATH *os_dir, *rom_dir;
@@ -48,7 +53,7 @@ void mem_init()
     log_debug("mem: mem_init");
     size_t size = RAM_SIZE + ROM_SIZE + ROM_NSLOT * ROM_SIZE;
     uint8_t *ptr = malloc(size);
-    if (ptr) {
+    if (ptr && (mem_dirty = savestate_dirty_new(size))) {
         memset(ptr, 0xff, size);
         ram = ptr;
         os  = ptr + RAM_SIZE;
@@ -76,6 +81,7 @@ void mem_close() {
     for (int slot = 0; slot < ROM_NSLOT; slot++)
         rom_free(slot);
     free(ram);
+    savestate_dirty_free(mem_dirty);
     if (os_dir)
         al_destroy_path(os_dir);
     if (rom_dir)
@@ -143,6 +149,7 @@ void mem_loadrom(int slot, const char *name, const char *path, uint8_t use_name)
     if ((f = fopen(path, "rb"))) {
         if (fread(rom + (slot * ROM_SIZE), ROM_SIZE, 1, f) == 1 || feof(f)) {
             fclose(f);
+            mem_dirty_rom(slot, 0, ROM_SIZE);
             log_debug("mem: ROM slot %02d loaded with %s from %s", slot, name, path);
             rom_slots[slot].use_name = use_name;
             rom_slots[slot].alloc = 1;
@@ -385,9 +392,17 @@ void mem_clearrom(int slot) {
     uint8_t *base = rom + (slot * ROM_SIZE);
 
     memset(base, 0xff, ROM_SIZE);
+    mem_dirty_rom(slot, 0, ROM_SIZE);
     rom_clearmeta(slot);
 }
 
+/* For changes to sideways RAM/ROM other than by the 6502 write path. */
+
+void mem_dirty_rom(int slot, unsigned offset, size_t len)
+{
+    savestate_dirty_range(mem_dirty, RAM_SIZE + ROM_SIZE + slot * ROM_SIZE + offset, len);
+}
+
 void mem_clearroms(void) {
     int slot;
 
@@ -406,8 +421,8 @@ void mem_savezlib(ZFILE *zfp)
     latches[0] = ram_fe30;
     latches[1] = ram_fe34;
     savestate_zwrite(zfp, latches, 2);
-    savestate_zwrite(zfp, ram, RAM_SIZE);
-    savestate_zwrite(zfp, rom, ROM_SIZE*ROM_NSLOT);
+    savestate_zwrite_pages(zfp, ram, RAM_SIZE, mem_dirty);
+    savestate_zwrite_pages(zfp, rom, ROM_SIZE*ROM_NSLOT, mem_dirty + ROM_MAP_OFFSET);
 }
 
 void mem_loadzlib(ZFILE *zfp)
@@ -417,8 +432,8 @@ void mem_loadzlib(ZFILE *zfp)
     savestate_zread(zfp, latches, 2);
     writemem(0xFE30, latches[0]);
     writemem(0xFE34, latches[1]);
-    savestate_zread(zfp, ram, RAM_SIZE);
-    savestate_zread(zfp, rom, ROM_SIZE*ROM_NSLOT);
+    savestate_zread_pages(zfp, ram, RAM_SIZE, mem_dirty);
+    savestate_zread_pages(zfp, rom, ROM_SIZE*ROM_NSLOT, mem_dirty + ROM_MAP_OFFSET);
 }
 
 void mem_loadstate(FILE *f) {
@@ -450,6 +465,7 @@ void mem_save_romcfg(const char *sect) {
 enum mem_jim_sz mem_jim_size = JIM_NONE;
 static uint32_t mem_jim_max = 0;
 static uint8_t *mem_jim_data = NULL;
+static uint8_t *mem_jim_dirty = NULL;
 static uint32_t mem_jim_page;
 
 static const uint32_t mem_jim_sizes[6] = {
@@ -461,27 +477,35 @@ static const uint32_t mem_jim_sizes[6] = {
     0x3e000000
 };
 
+static bool mem_jim_alloc(uint32_t nmax)
+{
+    if (nmax == 0) {
+        free(mem_jim_data);
+        mem_jim_data = NULL;
+    }
+    else {
+        uint8_t *njim = realloc(mem_jim_data, nmax);
+        if (!njim)
+            return false;
+        mem_jim_data = njim;
+    }
+    savestate_dirty_free(mem_jim_dirty);
+    mem_jim_dirty = nmax ? savestate_dirty_new(nmax) : NULL;
+    mem_jim_max = nmax;
+    return true;
+}
+
 void mem_jim_setsize(enum mem_jim_sz size)
 {
     if (size != mem_jim_size) {
         uint32_t nmax = mem_jim_sizes[size];
         log_debug("mem: new jim size %d=%d bytes", size, nmax);
-        if (nmax == 0) {
-            free(mem_jim_data);
+        if (mem_jim_alloc(nmax)) {
             mem_jim_size = size;
-            mem_jim_max = nmax;
-            mem_jim_data = NULL;
-        }
-        else {
-            uint8_t *njim = realloc(mem_jim_data, nmax);
-            if (njim) {
-                mem_jim_size = size;
-                mem_jim_max = nmax;
-                mem_jim_data = njim;
-            }
-            else
-                log_error("mem: out of memory allocating JIM expansion RAM");
+            savestate_forget_base();
         }
+        else
+            log_error("mem: out of memory allocating JIM expansion RAM");
     }
 }
 
@@ -504,8 +528,10 @@ void mem_jim_write(uint16_t addr, uint8_t value)
 {
     if (addr >= 0xfd00) {
         uint32_t full_addr = mem_jim_page | (addr & 0xff);
-        if (full_addr < mem_jim_max)
+        if (full_addr < mem_jim_max) {
             mem_jim_data[full_addr] = value;
+            savestate_dirty(mem_jim_dirty, full_addr);
+        }
     }
     else if (addr == 0xfcff)
         mem_jim_page = (mem_jim_page & 0xffff0000) | (value << 8);
@@ -527,7 +553,7 @@ void mem_jim_savez(ZFILE *zfp)
     buf[6] = (mem_jim_page >> 24) & 0xff;
     savestate_zwrite(zfp, buf, sizeof(buf));
     if (mem_jim_max > 0)
-        savestate_zwrite(zfp, mem_jim_data, mem_jim_max);
+        savestate_zwrite_pages(zfp, mem_jim_data, mem_jim_max, mem_jim_dirty);
 }
 
 extern void mem_jim_loadz(ZFILE *zfp)
@@ -535,22 +561,15 @@ extern void mem_jim_loadz(ZFILE *zfp)
     unsigned char buf[7];
     savestate_zread(zfp, buf, sizeof(buf));
     size_t nsize = buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
-    if (mem_jim_data)
-        free(mem_jim_data);
-    mem_jim_data = NULL;
-    mem_jim_max = 0;
     mem_jim_size = JIM_NONE;
-    if (nsize > 0) {
-        uint8_t *njim = malloc(nsize);
-        if (njim) {
-            mem_jim_data = njim;
-            mem_jim_max = nsize;
-            while (mem_jim_size < JIM_INVALID && nsize != mem_jim_sizes[mem_jim_size])
-                ++mem_jim_size;
-            mem_jim_page = (buf[4] << 8) | (buf[5] << 16) | (buf[6] << 24);
-            savestate_zread(zfp, njim, nsize);
-        }
-        else
-            log_warn("mem: out of memory restoring JIM from savefile");
+    if (nsize != mem_jim_max && !mem_jim_alloc(nsize)) {
+        log_warn("mem: out of memory restoring JIM from savefile");
+        mem_jim_alloc(0);
+    }
+    if (nsize > 0 && mem_jim_data) {
+        while (mem_jim_size < JIM_INVALID && nsize != mem_jim_sizes[mem_jim_size])
+            ++mem_jim_size;
+        mem_jim_page = (buf[4] << 8) | (buf[5] << 16) | (buf[6] << 24);
+        savestate_zread_pages(zfp, mem_jim_data, nsize, mem_jim_dirty);
     }
 }
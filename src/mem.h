@@ -30,6 +30,7 @@ extern int mem_findswram(int n);
 extern void mem_clearroms(void);
 
 void mem_clearrom(int slot);
+void mem_dirty_rom(int slot, unsigned offset, size_t len);
 void mem_loadrom(int slot, const char *name, const char *path, uint8_t rel);
 const uint8_t *mem_romdetail(int slot);
 void mem_save_romcfg(const char *sect);
@@ -46,6 +47,7 @@ void mem_dump(void);
 
 extern uint8_t ram_fe30, ram_fe34;
 extern uint8_t *ram, *rom, *os;
+extern uint8_t *mem_dirty;
 extern rom_slot_t rom_slots[ROM_NSLOT];
 
 enum mem_jim_sz {
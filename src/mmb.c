@@ -16,6 +16,7 @@
 #include "6502.h"
 #include "main.h"
 #include "mem.h"
+#include "overlay.h"
 #include "vdfs.h"
 
 #define MMB_ENTRY_SIZE     16
@@ -31,6 +32,13 @@ struct mmb_zone {
     unsigned char index[MMB_ZONE_DISCS][MMB_ENTRY_SIZE];
 };
 
+/*
+ * Discs are found by name through a hash table of chains of disc
+ * numbers, counting across all zones, each chain in ascending order.
+ */
+
+#define MMB_HASH_SIZE      1024
+
 /*
 #define MMB_ENTRY_SIZE     16
 #define MMB_ZONE_SKIP_SIZE (MMB_ZONE_DISCS*MMB_DISC_SIZE+MMB_ENTRY_SIZE)
@@ -41,6 +49,8 @@ static bool mmb_writeprot;
 static unsigned mmb_num_zones;
 static unsigned mmb_base_zone;
 static struct mmb_zone *mmb_zones;
+static int mmb_hash_head[MMB_HASH_SIZE];
+static int *mmb_hash_next;
 static unsigned mmb_boot_discs[4];
 
 unsigned mmb_ndisc;
@@ -61,11 +71,7 @@ static const char err_bad_zone[]     = "\x94" "Not that many zones in MMB file";
 
 static bool mmb_read(const char *fn, FILE *fp, long offset, void *ptr, size_t size)
 {
-    if (fseek(fp, offset, SEEK_SET) < 0) {
-        log_error("mmb: error seeking on MMB file %s: %s", fn, strerror(errno));
-        return false;
-    }
-    if (fread(ptr, size, 1, fp) != 1) {
+    if (overlay_read(fp, offset, ptr, size) != size) {
         if (ferror(fp))
             log_error("mmb: error reading MMB file %s: %s", fn, strerror(errno));
         else
@@ -77,11 +83,7 @@ static bool mmb_read(const char *fn, FILE *fp, long offset, void *ptr, size_t si
 
 static bool mmb_write(long offset, void *ptr, size_t size)
 {
-    if (fseek(mmb_fp, offset, SEEK_SET) < 0) {
-        log_error("mmb: error seeking on MMB file %s: %s", mmb_fn, strerror(errno));
-        return false;
-    }
-    if (fwrite(ptr, size, 1, mmb_fp) != 1) {
+    if (overlay_write(mmb_fp, offset, ptr, size) != size) {
         log_error("mmb: error writing on MMB file %s: %s", mmb_fn, strerror(errno));
         return false;
     }
@@ -134,6 +136,38 @@ void mmb_reset(void)
     }
 }
 
+/*
+ * The hash covers the name up to the first character which compares
+ * equal to a terminating zero in mmb_cat_name_cmp, so names which
+ * match always hash the same.
+ */
+
+static unsigned mmb_name_hash(const unsigned char *name)
+{
+    unsigned hash = 0;
+    for (int i = 0; i < MMB_NAME_SIZE; ++i) {
+        unsigned ch = name[i] & 0x5f;
+        if (!ch)
+            break;
+        hash = hash * 31 + ch;
+    }
+    return hash & (MMB_HASH_SIZE - 1);
+}
+
+static void mmb_index(void)
+{
+    for (int i = 0; i < MMB_HASH_SIZE; ++i)
+        mmb_hash_head[i] = -1;
+    for (int zone = mmb_num_zones - 1; zone >= 0; --zone) {
+        for (int disc = mmb_zones[zone].num_discs - 1; disc >= 0; --disc) {
+            unsigned hash = mmb_name_hash(mmb_zones[zone].index[disc]);
+            int entry = zone * MMB_ZONE_DISCS + disc;
+            mmb_hash_next[entry] = mmb_hash_head[hash];
+            mmb_hash_head[hash] = entry;
+        }
+    }
+}
+
 void mmb_load(char *fn)
 {
     log_info("mmb: load file '%s'", fn);
@@ -143,7 +177,7 @@ void mmb_load(char *fn)
      * open.
      */
     bool new_writeprot = false;
-    FILE *fp = fopen(fn, "rb+");
+    FILE *fp = overlay_fopen(fn, "rb+");
     if (fp == NULL) {
         if ((fp = fopen(fn, "rb")) == NULL) {
             log_error("Unable to open file '%s' for reading - %s", fn, strerror(errno));
@@ -151,9 +185,11 @@ void mmb_load(char *fn)
         }
         new_writeprot = true;
     }
+    else if (!overlay_attached(fp))
+        sdf_journal_replay(fn, fp);
     unsigned char header[16];
     if (!mmb_read(fn, fp, 0, header, sizeof(header))) {
-        fclose(fp);
+        overlay_fclose(fp);
         return;
     }
     log_dump("mmb header: ", header, 16);
@@ -168,15 +204,19 @@ void mmb_load(char *fn)
     }
     log_info("mmb: num_zones=%u, base_zone=%u", new_num_zones, new_base_zone);
     struct mmb_zone *new_zones = malloc(new_num_zones * sizeof(struct mmb_zone));
-    if (!new_zones) {
+    int *new_hash_next = malloc(new_num_zones * MMB_ZONE_DISCS * sizeof(int));
+    if (!new_zones || !new_hash_next) {
         log_error("mmb: out of memory allocating MMB catalogue");
-        fclose(fp);
+        free(new_zones);
+        free(new_hash_next);
+        overlay_fclose(fp);
         return;
     }
     for (unsigned zone = 0; zone < new_num_zones; ++zone) {
         if (!mmb_read(fn, fp, zone * MMB_ZONE_FULL_SIZE, new_zones[zone].header, MMB_ZONE_CAT_SIZE)) {
             free(new_zones);
-            fclose(fp);
+            free(new_hash_next);
+            overlay_fclose(fp);
             return;
         }
         new_zones[zone].num_discs = MMB_ZONE_DISCS;
@@ -195,13 +235,17 @@ void mmb_load(char *fn)
     if (mmb_zones)
         free(mmb_zones);
     mmb_zones = new_zones;
+    if (mmb_hash_next)
+        free(mmb_hash_next);
+    mmb_hash_next = new_hash_next;
     if (mmb_fp)
-        fclose(mmb_fp);
+        overlay_fclose(mmb_fp);
     mmb_fp = fp;
     mmb_fn = fn;
     mmb_writeprot = new_writeprot;
     mmb_num_zones = new_num_zones;
     mmb_base_zone = new_base_zone;
+    mmb_index();
 
     const unsigned char *zone_hdr = new_zones[new_base_zone].header;
     mmb_boot_discs[0] = zone_hdr[0] | (zone_hdr[4] << 8);
@@ -226,13 +270,17 @@ void mmb_eject(void)
     if (mmb_fp) {
         mmb_eject_one(0);
         mmb_eject_one(1);
-        fclose(mmb_fp);
+        overlay_fclose(mmb_fp);
         mmb_fp = NULL;
     }
     if (mmb_zones) {
         free(mmb_zones);
         mmb_zones = NULL;
     }
+    if (mmb_hash_next) {
+        free(mmb_hash_next);
+        mmb_hash_next = NULL;
+    }
     if (mmb_fn) {
         free(mmb_fn);
         mmb_fn = NULL;
@@ -303,17 +351,28 @@ static inline bool mmb_cat_name_cmp(const char *nam_ptr, const unsigned char *ca
     return true;
 }
 
-static int mmb_search_zones(const char *name, unsigned min_zone, unsigned max_zone)
+/*
+ * Find a disc by name, searching from the base zone to the last and then
+ * the zones before the base.
+ */
+
+static int mmb_search_zones(const char *name)
 {
-    for (unsigned zone = min_zone; zone < max_zone; ++zone) {
-        for (unsigned disc = 0; disc < mmb_zones[zone].num_discs; ++disc) {
-            if (mmb_cat_name_cmp(name, mmb_zones[zone].index[disc])) {
-                log_debug("mmb: found MMB SSD '%s' at zone %u, disc %u", name, zone, disc);
-                return zone * MMB_ZONE_DISCS + disc;
+    int found = -1;
+    int base = mmb_base_zone * MMB_ZONE_DISCS;
+    for (int entry = mmb_hash_head[mmb_name_hash((const unsigned char *)name)]; entry >= 0; entry = mmb_hash_next[entry]) {
+        if (mmb_cat_name_cmp(name, mmb_zones[entry / MMB_ZONE_DISCS].index[entry % MMB_ZONE_DISCS])) {
+            if (found < 0)
+                found = entry;
+            if (entry >= base) {
+                found = entry;
+                break;
             }
         }
     }
-    return -1;
+    if (found >= 0)
+        log_debug("mmb: found MMB SSD '%s' at zone %u, disc %u", name, found / MMB_ZONE_DISCS, found % MMB_ZONE_DISCS);
+    return found;
 }
 
 static int mmb_parse_find(uint16_t addr)
@@ -327,14 +386,13 @@ static int mmb_parse_find(uint16_t addr)
         quote = true;
         ch = readmem(addr++);
     }
-    while (ch != '\r' && i < sizeof(name) && ((quote && ch != '"') || (!quote && ch != ' '))) {
+    while (ch != '\r' && i < sizeof(name) - 1 && ((quote && ch != '"') || (!quote && ch != ' '))) {
         name[i++] = ch;
         ch = readmem(addr++);
     }
     name[i] = 0;
-    if ((i = mmb_search_zones(name, mmb_base_zone, mmb_num_zones)) < 0)
-        if ((i = mmb_search_zones(name, 0, mmb_base_zone)) < 0)
-            vdfs_error(err_disc_not_fnd);
+    if ((i = mmb_search_zones(name)) < 0)
+        vdfs_error(err_disc_not_fnd);
     return i;
 }
 
@@ -673,7 +731,9 @@ void mmb_cmd_drecat(void)
         vdfs_error(err_wprotect);
     else {
         log_debug("mmb: begin recatalogue");
-        for (unsigned zone = mmb_base_zone; zone < mmb_num_zones; ++zone) {
+        const char *err = NULL;
+        bool changed = false;
+        for (unsigned zone = mmb_base_zone; !err && zone < mmb_num_zones; ++zone) {
             long zone_start = zone * MMB_ZONE_FULL_SIZE;
             long offset = zone_start + MMB_ZONE_CAT_SIZE;
             bool dirty = false;
@@ -683,8 +743,8 @@ void mmb_cmd_drecat(void)
                     if (!mmb_read(mmb_fn, mmb_fp, offset, title, 8) ||
                         !mmb_read(mmb_fn, mmb_fp, offset+0x100, title+8, 4))
                     {
-                        vdfs_error(err_read_err);
-                        return;
+                        err = err_read_err;
+                        break;
                     }
                     if (memcmp(mmb_zones[zone].index[disc], title, MMB_NAME_SIZE)) {
                         memcpy(mmb_zones[zone].index[disc], title, MMB_NAME_SIZE);
@@ -694,14 +754,20 @@ void mmb_cmd_drecat(void)
                 offset += MMB_DISC_SIZE;
             }
             if (dirty) {
-                log_debug("mmb: zone #%u dirty, writing to %08lx", zone, zone_start);
-                if (!mmb_write(zone_start, mmb_zones[zone].header, MMB_ZONE_CAT_SIZE)) {
-                    vdfs_error(err_write_err);
-                    return;
+                changed = true;
+                if (!err) {
+                    log_debug("mmb: zone #%u dirty, writing to %08lx", zone, zone_start);
+                    if (!mmb_write(zone_start, mmb_zones[zone].header, MMB_ZONE_CAT_SIZE))
+                        err = err_write_err;
                 }
             }
         }
-        log_debug("mmb: recatalogue finished");
+        if (changed)
+            mmb_index();
+        if (err)
+            vdfs_error(err);
+        else
+            log_debug("mmb: recatalogue finished");
     }
 }
 
@@ -9,6 +9,7 @@ enum mmcstate {
     MMC_SEND_ARGS,
     MMC_READ_TOKEN,
     MMC_READ_BYTES,
+    MMC_READ_CRC,
     MMC_WRITE_TOKEN,
     MMC_WRITE_BYTES,
     MMC_WRITE_FINISH
@@ -27,6 +28,22 @@ static unsigned char mmc_buffer[0x200];
 static off_t mmc_block_len = 0x200;
 static bool mmc_sdhc_mode = false;
 
+/*
+ * Reads are served from a buffer filled with a run of blocks from the
+ * card image in one read, so that consecutive single block reads and
+ * multiple block reads (CMD18) need no file access for each block.
+ * Writes go straight through to the file and update the buffer too.
+ */
+
+#define MMC_PREFETCH 0x8000
+
+static unsigned char mmc_cache[MMC_PREFETCH];
+static off_t mmc_cache_start = -1;
+static size_t mmc_cache_len = 0;
+static const unsigned char *mmc_data;
+static off_t mmc_addr;
+static bool mmc_multi = false;
+
 // Card ID - I'm familiar with these numbers
 static const unsigned char CardID[] = {
         0xff, 0xfe, 0x01, 0x00, 0x00,
@@ -35,6 +52,37 @@ static const unsigned char CardID[] = {
         0x7a, 0x34, 0xff, 0x6a, 0xca
 };
 
+static bool mmc_read_block(off_t address)
+{
+    if (address + mmc_block_len > mmc_size)
+        return false;
+    if (mmc_cache_start < 0 || address < mmc_cache_start || address + mmc_block_len > mmc_cache_start + mmc_cache_len) {
+        mmc_cache_start = -1;
+        if (fseek(mmc_fp, address, SEEK_SET))
+            return false;
+        size_t bytes = fread(mmc_cache, 1, sizeof(mmc_cache), mmc_fp);
+        if (bytes < mmc_block_len)
+            return false;
+        log_debug("mmccard: prefetched %zu bytes from %jx", bytes, (intmax_t)address);
+        mmc_cache_start = address;
+        mmc_cache_len = bytes;
+    }
+    mmc_data = mmc_cache + (address - mmc_cache_start);
+    return true;
+}
+
+static void mmc_cache_update(off_t address, const unsigned char *data, size_t len)
+{
+    if (mmc_cache_start >= 0) {
+        off_t lo = address > mmc_cache_start ? address : mmc_cache_start;
+        off_t hi = address + len;
+        if (hi > mmc_cache_start + (off_t)mmc_cache_len)
+            hi = mmc_cache_start + mmc_cache_len;
+        if (lo < hi)
+            memcpy(mmc_cache + (lo - mmc_cache_start), data + (lo - address), hi - lo);
+    }
+}
+
 uint8_t mmccard_read(void)
 {
     log_debug("mmccard: read, shiftreg=%02X", mmc_shiftreg);
@@ -45,6 +93,13 @@ void mmccard_write(uint8_t byte)
 {
     log_debug("mmccard: write, byte=%02X", byte);
     if (mmc_fp && mmc_size) {
+        if (mmc_multi && (byte & 0xc0) == 0x40 && mmc_state >= MMC_READ_TOKEN && mmc_state <= MMC_READ_CRC) {
+            // A command, expected to be stop transmission, ends a multiple block read.
+            mmc_cmd = byte;
+            mmc_count = 0;
+            mmc_state = MMC_RECV_ARGS;
+            return;
+        }
         switch(mmc_state) {
             case MMC_IDLE:
                 if (byte != 0xff) {
@@ -92,13 +147,21 @@ void mmccard_write(uint8_t byte)
                                 mmc_shiftreg = 0x40;
                             mmc_state = MMC_IDLE;
                             break;
+                        case 0x4c: // Stop transmission.
+                            mmc_multi = false;
+                            mmc_shiftreg = 0x00;
+                            mmc_state = MMC_IDLE;
+                            break;
                         case 0x51: // Read sector.
+                        case 0x52: // Read multiple sectors.
                             address = (mmc_args[0] << 24) | (mmc_args[1] << 16) | (mmc_args[2] << 8) | mmc_args[3];
                             if (mmc_sdhc_mode)
                                 address *= 0x200;
                             log_debug("mmccard: read from %jx", (intmax_t)address);
                             if (address < mmc_size) {
-                                if (!fseek(mmc_fp, address, SEEK_SET) && fread(mmc_buffer, mmc_block_len, 1, mmc_fp) == 1) {
+                                if (mmc_read_block(address)) {
+                                    mmc_multi = mmc_cmd == 0x52;
+                                    mmc_addr = address;
                                     mmc_shiftreg = 0x00;
                                     mmc_state = MMC_READ_TOKEN;
                                 }
@@ -122,6 +185,7 @@ void mmccard_write(uint8_t byte)
                                 mmc_state = MMC_IDLE;
                             }
                             else if (!fseek(mmc_fp, address, SEEK_SET)) {
+                                mmc_addr = address;
                                 mmc_count = 0;
                                 mmc_shiftreg = 0;
                                 mmc_state = MMC_WRITE_TOKEN;
@@ -167,9 +231,27 @@ void mmccard_write(uint8_t byte)
                 mmc_state = MMC_READ_BYTES;
                 break;
             case MMC_READ_BYTES:
-                mmc_shiftreg = mmc_buffer[mmc_count++];
-                if (mmc_count >= mmc_block_len)
-                    mmc_state = MMC_END_CMD;
+                mmc_shiftreg = mmc_data[mmc_count++];
+                if (mmc_count >= mmc_block_len) {
+                    if (mmc_multi) {
+                        mmc_count = 0;
+                        mmc_state = MMC_READ_CRC;
+                    }
+                    else
+                        mmc_state = MMC_END_CMD;
+                }
+                break;
+            case MMC_READ_CRC:
+                mmc_shiftreg = 0xff;
+                if (++mmc_count == 2) {
+                    mmc_addr += mmc_block_len;
+                    if (mmc_read_block(mmc_addr))
+                        mmc_state = MMC_READ_TOKEN;
+                    else {
+                        mmc_multi = false;
+                        mmc_state = MMC_IDLE;
+                    }
+                }
                 break;
             case MMC_WRITE_TOKEN:
                 if (byte == 0xfe)
@@ -180,6 +262,7 @@ void mmccard_write(uint8_t byte)
                 if (mmc_count >= mmc_block_len) {
                     if (fwrite(mmc_buffer, mmc_block_len, 1, mmc_fp) == 1) {
                         fflush(mmc_fp); // Guard against a real card being removed.
+                        mmc_cache_update(mmc_addr, mmc_buffer, mmc_block_len);
                         mmc_shiftreg = 0x05;
                         mmc_count = 0;
                         mmc_state = MMC_WRITE_FINISH;
@@ -215,6 +298,8 @@ void mmccard_load(char *fn)
     fseek(fp, 0, SEEK_END);
     mmc_size = ftell(fp);
     mmc_fp = fp;
+    mmc_cache_start = -1;
+    mmc_multi = false;
     log_debug("mmcard: %s loaded, size=%jd", fn, (intmax_t)mmc_size);
 }
 
@@ -223,6 +308,7 @@ void mmccard_eject(void)
     if (mmc_fp) {
         fclose(mmc_fp);
         mmc_fp = NULL;
+        mmc_cache_start = -1;
     }
     if (mmccard_fn) {
         free(mmccard_fn);
@@ -278,6 +278,8 @@ static void *tuberom = NULL;
 
 static void tube_init(void)
 {
+    tube_readmem_block = NULL;
+    tube_writemem_block = NULL;
     if (curtube!=-1) {
         TUBE_MODEL *tube = &tubes[curtube];
         if (!(tube->bootrom && tube->bootrom[0])) { // no boot ROM needed
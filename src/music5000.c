@@ -66,18 +66,12 @@ static struct synth m5000, m3000;
 
 static const uint8_t PanArray[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 6, 6, 6, 5, 4, 3, 2, 1 };
 
-size_t buflen_m5 = BUFLEN_M5;
-
-static ALLEGRO_VOICE *music5000_voice;
-static ALLEGRO_MIXER *music5000_mixer;
-static ALLEGRO_AUDIO_STREAM *music5000_stream;
-
 static ushort antilogtable[128];
 
-static uint16_t *music5000_buf;
+static float music5000_buf[BUFLEN_M5*2];
 static int music5000_bufpos = 0;
 static int music5000_time = 0;
-static unsigned music5000_freq;
+static bool music5000_tables;
 
 static void synth_reset(struct synth *s)
 {
@@ -120,64 +114,16 @@ void music5000_savestate(FILE *f) {
         putc_unlocked('m', f);
 }
 
-void music5000_init(int speed)
+void music5000_init(void)
 {
-    if (sound_music5000) {
-        unsigned new_freq = FREQ_M5;
-        if (speed < num_emu_speeds)
-            new_freq *= emu_speeds[speed].multiplier;
-        if (new_freq != music5000_freq) {
-            ALLEGRO_VOICE *new_voice = al_create_voice(new_freq, ALLEGRO_AUDIO_DEPTH_INT16, ALLEGRO_CHANNEL_CONF_2);
-            if (new_voice) {
-                ALLEGRO_MIXER *new_mixer = al_create_mixer(new_freq, ALLEGRO_AUDIO_DEPTH_INT16, ALLEGRO_CHANNEL_CONF_2);
-                if (new_mixer) {
-                    if (al_attach_mixer_to_voice(new_mixer, new_voice)) {
-                        ALLEGRO_AUDIO_STREAM *new_stream = al_create_audio_stream(8, buflen_m5, new_freq, ALLEGRO_AUDIO_DEPTH_INT16, ALLEGRO_CHANNEL_CONF_2);
-                        if (new_stream) {
-                            if (al_attach_audio_stream_to_mixer(new_stream, new_mixer)) {
-                                void *new_frag = al_get_audio_stream_fragment(new_stream);
-                                if (new_frag) {
-                                    if (music5000_freq == 0) { // Not previously running.
-                                        for (int n = 0; n < 128; n++) {
-                                            //12-bit antilog as per AM6070 datasheet
-                                            int S = n & 15, C = n >> 4;
-                                            antilogtable[n] = (ushort)(2 * (pow(2.0, C)*(S + 16.5) - 16.5));
-                                        }
-                                        music5000_reset();
-                                    }
-                                    if (music5000_stream)
-                                        al_destroy_audio_stream(music5000_stream);
-                                    music5000_stream = new_stream;
-                                    if (music5000_mixer)
-                                        al_destroy_mixer(music5000_mixer);
-                                    music5000_mixer = new_mixer;
-                                    if (music5000_voice)
-                                        al_destroy_voice(music5000_voice);
-                                    music5000_voice = new_voice;
-                                    music5000_freq = new_freq;
-                                    return;
-                                }
-                                else
-                                    log_error("sound: unable to get buffer fragment for Music 5000");
-                            }
-                            else
-                                log_error("sound: unable to attach stream to mixer for Music 5000");
-                            al_destroy_audio_stream(new_stream);
-                        }
-                        else
-                            log_error("sound: unable to create stream for Music 5000 at %uHz", new_freq);
-                    }
-                    else
-                        log_error("sound: unable to attach mixer to voice for Music 5000");
-                    al_destroy_mixer(new_mixer);
-                }
-                else
-                    log_error("sound: unable to create mixer for Music 5000 at %uHz", new_freq);
-                al_destroy_voice(new_voice);
-            }
-            else
-                log_error("sound: unable to create voice for Music 5000 at %uHz", new_freq);
+    if (sound_music5000 && !music5000_tables) {
+        for (int n = 0; n < 128; n++) {
+            //12-bit antilog as per AM6070 datasheet
+            int S = n & 15, C = n >> 4;
+            antilogtable[n] = (ushort)(2 * (pow(2.0, C)*(S + 16.5) - 16.5));
         }
+        music5000_reset();
+        music5000_tables = true;
     }
 }
 
@@ -195,19 +141,8 @@ void music5000_close(void)
 {
     if (music5000_rec.fp)
         sound_stop_rec(&music5000_rec);
-    if (music5000_stream) {
-        al_destroy_audio_stream(music5000_stream);
-        music5000_stream = NULL;
-    }
-    if (music5000_mixer) {
-        al_destroy_mixer(music5000_mixer);
-        music5000_mixer = NULL;
-    }
-    if (music5000_voice) {
-        al_destroy_voice(music5000_voice);
-        music5000_voice = NULL;
-    }
-    music5000_freq = 0;
+    sound_source_stop(SOUND_SRC_M5);
+    music5000_bufpos = 0;
 }
 
 void music5000_loadstate(FILE *f) {
@@ -217,7 +152,7 @@ void music5000_loadstate(FILE *f) {
         if (ch == 'M') {
             if (!sound_music5000) {
                 sound_music5000 = true;
-                music5000_init(emuspeed);
+                music5000_init();
             }
             pc = savestate_load_var(f);
             if (pc == 9) {
@@ -496,8 +431,8 @@ static void music5000_get_sample(const m5000_fcoeff *fcp)
         log_warn("Music 5000 clipped, reducing gain by 3dB (divisor now %d)", divisor);
     }
 
-    music5000_buf[music5000_bufpos++] = sl;
-    music5000_buf[music5000_bufpos++] = sr;
+    music5000_buf[music5000_bufpos++] = sl / 32768.0f;
+    music5000_buf[music5000_bufpos++] = sr / 32768.0f;
 }
 
 void music5000_poll(int cycles)
@@ -505,35 +440,15 @@ void music5000_poll(int cycles)
     if (sound_music5000) {
         music5000_time -= cycles;
         if (music5000_time < 0) {
-            if (!music5000_buf) {
-                music5000_buf = al_get_audio_stream_fragment(music5000_stream);
-                log_debug("music5000: late buffer allocation %s", music5000_buf ? "worked" : "failed");
-            }
-            if (music5000_buf) {
-                const m5000_fcoeff *fcp = music5000_fno < 0 ? NULL : &m500_filters[music5000_fno];
-                music5000_get_sample(fcp);
-                music5000_get_sample(fcp);
-                music5000_get_sample(fcp);
-                if (music5000_bufpos >= (buflen_m5*2)) {
-                    al_set_audio_stream_fragment(music5000_stream, music5000_buf);
-                    al_set_audio_stream_playing(music5000_stream, true);
-                    music5000_buf = al_get_audio_stream_fragment(music5000_stream);
-                    music5000_bufpos = 0;
-                }
+            const m5000_fcoeff *fcp = music5000_fno < 0 ? NULL : &m500_filters[music5000_fno];
+            music5000_get_sample(fcp);
+            music5000_get_sample(fcp);
+            music5000_get_sample(fcp);
+            if (music5000_bufpos >= (BUFLEN_M5*2)) {
+                sound_source_write(SOUND_SRC_M5, music5000_buf, BUFLEN_M5);
+                music5000_bufpos = 0;
             }
             music5000_time += 128;
         }
     }
 }
-
-bool music5000_ok(void)
-{
-    if (sound_music5000) {
-        unsigned frags = al_get_available_audio_stream_fragments(music5000_stream);
-        if (frags < 2)
-            return false;
-        if (frags >= 8)
-            log_debug("music5000: underrun");
-    }
-    return true;
-}
@@ -3,7 +3,7 @@
 
 #include "sound.h"
 
-void music5000_init(int speed);
+void music5000_init(void);
 void music5000_close(void);
 void music5000_loadstate(FILE *f);
 void music5000_savestate(FILE *f);
@@ -12,7 +12,6 @@ void music5000_streamfrag(void);
 void music5000_write(uint16_t addr, uint8_t val);
 void music5000_reset(void);
 void music5000_poll(int cycles);
-bool music5000_ok(void);
 
 extern int music5000_fno;
 extern sound_rec_t music5000_rec;
@@ -0,0 +1,238 @@
+/*
+ * B-EM Overlay - copy-on-write overlays for disc and hard disc images.
+ *
+ * The overlay for an image holds each block of it that has been written
+ * to, found by block number through a hash table.  Reads come from the
+ * image file with any of these blocks copied over the top.  A block
+ * partly written is filled from the image first, so the image is only
+ * read from, never written to.
+ */
+
+#include "b-em.h"
+#include "overlay.h"
+
+#define OVERLAY_BLOCK_SHIFT 8
+#define OVERLAY_BLOCK_SIZE  (1 << OVERLAY_BLOCK_SHIFT)
+
+bool overlay_images = false;
+
+typedef struct {
+    off_t    block;     // block number, -1 if the slot is empty.
+    unsigned index;     // position of its data in the overlay.
+} slot_t;
+
+typedef struct overlay {
+    struct overlay *next;
+    FILE    *fp;
+    off_t    base_size; // size of the image file.
+    off_t    size;      // including any blocks written beyond its end.
+    unsigned nblocks;
+    unsigned nslots;    // a power of two, kept at least twice nblocks.
+    unsigned nalloc;    // blocks of data allocated.
+    slot_t  *slots;
+    uint8_t *data;
+} overlay_t;
+
+static overlay_t *overlays;
+
+static overlay_t *find_overlay(FILE *fp)
+{
+    for (overlay_t *ov = overlays; ov; ov = ov->next)
+        if (ov->fp == fp)
+            return ov;
+    return NULL;
+}
+
+static inline unsigned hash_block(off_t block, unsigned nslots)
+{
+    return ((uint32_t)block * 2654435761u) & (nslots - 1);
+}
+
+static uint8_t *find_block(overlay_t *ov, off_t block)
+{
+    if (ov->nblocks) {
+        for (unsigned i = hash_block(block, ov->nslots); ov->slots[i].block >= 0; i = (i + 1) & (ov->nslots - 1))
+            if (ov->slots[i].block == block)
+                return ov->data + ((size_t)ov->slots[i].index << OVERLAY_BLOCK_SHIFT);
+    }
+    return NULL;
+}
+
+static bool grow_slots(overlay_t *ov)
+{
+    unsigned nslots = ov->nslots ? ov->nslots * 2 : 256;
+    slot_t *slots = malloc(nslots * sizeof(slot_t));
+    if (!slots)
+        return false;
+    for (unsigned i = 0; i < nslots; i++)
+        slots[i].block = -1;
+    for (unsigned i = 0; i < ov->nslots; i++) {
+        if (ov->slots[i].block >= 0) {
+            unsigned j = hash_block(ov->slots[i].block, nslots);
+            while (slots[j].block >= 0)
+                j = (j + 1) & (nslots - 1);
+            slots[j] = ov->slots[i];
+        }
+    }
+    free(ov->slots);
+    ov->slots = slots;
+    ov->nslots = nslots;
+    return true;
+}
+
+/* Add a block to the overlay, filled from the image file. */
+
+static uint8_t *add_block(overlay_t *ov, off_t block)
+{
+    if (ov->nblocks * 2 >= ov->nslots && !grow_slots(ov))
+        return NULL;
+    if (ov->nblocks == ov->nalloc) {
+        unsigned nalloc = ov->nalloc ? ov->nalloc * 2 : 64;
+        uint8_t *data = realloc(ov->data, (size_t)nalloc << OVERLAY_BLOCK_SHIFT);
+        if (!data)
+            return NULL;
+        ov->data = data;
+        ov->nalloc = nalloc;
+    }
+    uint8_t *data = ov->data + ((size_t)ov->nblocks << OVERLAY_BLOCK_SHIFT);
+    off_t start = block << OVERLAY_BLOCK_SHIFT;
+    size_t got = 0;
+    if (start < ov->base_size && !fseek(ov->fp, start, SEEK_SET)) {
+        size_t want = OVERLAY_BLOCK_SIZE;
+        if (want > ov->base_size - start)
+            want = ov->base_size - start;
+        got = fread(data, 1, want, ov->fp);
+        if (got < want && ferror(ov->fp))
+            return NULL;
+    }
+    memset(data + got, 0, OVERLAY_BLOCK_SIZE - got);
+    unsigned i = hash_block(block, ov->nslots);
+    while (ov->slots[i].block >= 0)
+        i = (i + 1) & (ov->nslots - 1);
+    ov->slots[i].block = block;
+    ov->slots[i].index = ov->nblocks++;
+    return data;
+}
+
+FILE *overlay_fopen(const char *fn, const char *mode)
+{
+    if (!overlay_images)
+        return fopen(fn, mode);
+    if (*mode == 'w') {
+        FILE *fp = tmpfile();
+        if (fp)
+            log_info("overlay: %s created as a temporary file", fn);
+        return fp;
+    }
+    if (!strchr(mode, '+'))
+        return fopen(fn, mode);
+
+    FILE *fp = fopen(fn, "rb");
+    if (fp) {
+        overlay_t *ov = calloc(1, sizeof(overlay_t));
+        if (!ov || fseek(fp, 0, SEEK_END)) {
+            log_error("overlay: unable to set up overlay for %s", fn);
+            free(ov);
+            fclose(fp);
+            return NULL;
+        }
+        ov->fp = fp;
+        ov->base_size = ov->size = ftell(fp);
+        ov->next = overlays;
+        overlays = ov;
+        log_info("overlay: %s opened read-only, writes will be discarded", fn);
+    }
+    return fp;
+}
+
+int overlay_fclose(FILE *fp)
+{
+    for (overlay_t **prev = &overlays; *prev; prev = &(*prev)->next) {
+        overlay_t *ov = *prev;
+        if (ov->fp == fp) {
+            log_debug("overlay: discarding %u blocks written", ov->nblocks);
+            *prev = ov->next;
+            free(ov->slots);
+            free(ov->data);
+            free(ov);
+            break;
+        }
+    }
+    return fclose(fp);
+}
+
+bool overlay_attached(FILE *fp)
+{
+    return find_overlay(fp) != NULL;
+}
+
+size_t overlay_read(FILE *fp, off_t offset, void *buf, size_t size)
+{
+    overlay_t *ov = find_overlay(fp);
+    if (!ov) {
+        if (fseek(fp, offset, SEEK_SET))
+            return 0;
+        return fread(buf, 1, size, fp);
+    }
+    if (offset >= ov->size)
+        return 0;
+    if (size > ov->size - offset)
+        size = ov->size - offset;
+    size_t got = 0;
+    if (offset < ov->base_size && !fseek(fp, offset, SEEK_SET)) {
+        size_t want = size;
+        if (want > ov->base_size - offset)
+            want = ov->base_size - offset;
+        got = fread(buf, 1, want, fp);
+        if (got < want && ferror(fp))
+            return got;
+    }
+    memset((uint8_t *)buf + got, 0, size - got);
+    if (ov->nblocks) {
+        off_t end = offset + size;
+        for (off_t block = offset >> OVERLAY_BLOCK_SHIFT; (block << OVERLAY_BLOCK_SHIFT) < end; block++) {
+            uint8_t *data = find_block(ov, block);
+            if (data) {
+                off_t lo = block << OVERLAY_BLOCK_SHIFT;
+                off_t hi = lo + OVERLAY_BLOCK_SIZE;
+                if (lo < offset)
+                    lo = offset;
+                if (hi > end)
+                    hi = end;
+                memcpy((uint8_t *)buf + (lo - offset), data + (lo & (OVERLAY_BLOCK_SIZE - 1)), hi - lo);
+            }
+        }
+    }
+    return size;
+}
+
+size_t overlay_write(FILE *fp, off_t offset, const void *buf, size_t size)
+{
+    overlay_t *ov = find_overlay(fp);
+    if (!ov) {
+        if (fseek(fp, offset, SEEK_SET))
+            return 0;
+        return fwrite(buf, 1, size, fp);
+    }
+    off_t end = offset + size;
+    for (off_t block = offset >> OVERLAY_BLOCK_SHIFT; (block << OVERLAY_BLOCK_SHIFT) < end; block++) {
+        uint8_t *data = find_block(ov, block);
+        if (!data && !(data = add_block(ov, block))) {
+            log_error("overlay: unable to add block to overlay: %s", strerror(errno));
+            size = (block << OVERLAY_BLOCK_SHIFT) - offset;
+            if ((off_t)size > 0)
+                break;
+            return 0;
+        }
+        off_t lo = block << OVERLAY_BLOCK_SHIFT;
+        off_t hi = lo + OVERLAY_BLOCK_SIZE;
+        if (lo < offset)
+            lo = offset;
+        if (hi > end)
+            hi = end;
+        memcpy(data + (lo & (OVERLAY_BLOCK_SIZE - 1)), (const uint8_t *)buf + (lo - offset), hi - lo);
+    }
+    if (offset + (off_t)size > ov->size)
+        ov->size = offset + size;
+    return size;
+}
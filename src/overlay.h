@@ -0,0 +1,27 @@
+#ifndef __INC_OVERLAY_H
+#define __INC_OVERLAY_H
+
+/*
+ * Copy-on-write overlays for disc and hard disc images.
+ *
+ * When overlay_images is set, images that would be opened for update
+ * are opened read-only instead and the writes to each are kept in
+ * memory, in an overlay attached to its FILE, until it is closed.  The
+ * image files are never changed, so any number of emulators can share
+ * them.  Images that would have been created are created as temporary
+ * files.
+ *
+ * The read and write functions work on files with or without an
+ * overlay, so image code can use them throughout.
+ */
+
+extern bool overlay_images;
+
+FILE *overlay_fopen(const char *fn, const char *mode);
+int overlay_fclose(FILE *fp);
+bool overlay_attached(FILE *fp);
+
+size_t overlay_read(FILE *fp, off_t offset, void *buf, size_t size);
+size_t overlay_write(FILE *fp, off_t offset, const void *buf, size_t size);
+
+#endif
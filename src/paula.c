@@ -303,14 +303,14 @@ bool paula_read(uint16_t addr, uint8_t *val)
         return false;
 }
 
-static void fetch_mem(CHANNELREGS *curchan) {
+static inline void fetch_mem(CHANNELREGS *curchan) {
 
 
     //this is a very rough approximation of what really happens in terms of prioritisation
     //but should be close enough - normally data accesses that clash will be queued up
     //by intcon and could take many 8M cycles but here we just always deliver the data!
     int addr = (((int)curchan->addr_bank) << 16) + (int)curchan->addr + (int)curchan->sam_ctr;
-    curchan->data_next = ChipRam[addr % RAM_SIZE];
+    curchan->data_next = ChipRam[addr & (RAM_SIZE - 1)];
 
     if (curchan->sam_ctr == curchan->len)
     {
@@ -331,39 +331,33 @@ static void fetch_mem(CHANNELREGS *curchan) {
 
 }
 
+// Advance one channel by a number of 3.5MHz ticks.  This gives the same
+// result as stepping the channel a tick at a time but only does work at
+// the ticks where the period counter expires and a new sample is fetched,
+// rather than on every tick of every channel.
 
-
-static void paula_update_3_5MHz()
+static void paula_run_channel(CHANNELREGS *curchan, unsigned ticks)
 {
-
-    //do this once every 3.5MhZ
-
-    for (int i = 0; i < NUM_CHANNELS; i++)
-    {
-        CHANNELREGS *curchan = &ChannelRegs[i];
-
+    while (ticks) {
         if (!curchan->act) {
             curchan->samper_ctr = 0;
+            curchan->act_prev = false;
+            return;
         }
-        else {
-            if (!curchan->act_prev)
-            {
-                fetch_mem(curchan);
-                curchan->samper_ctr = curchan->period;
+        if (curchan->act_prev) {
+            if (curchan->samper_ctr >= ticks) {
+                curchan->samper_ctr -= ticks;
+                return;
             }
-            else if (curchan->samper_ctr == 0)
-            {
-                curchan->data = curchan->data_next;
-                fetch_mem(curchan);
-                curchan->samper_ctr = curchan->period;
-            }
-            else
-                curchan->samper_ctr--;
+            // count down to zero then latch the next sample.
+            ticks -= curchan->samper_ctr;
+            curchan->data = curchan->data_next;
         }
-
+        fetch_mem(curchan);
+        curchan->samper_ctr = curchan->period;
         curchan->act_prev = curchan->act;
+        ticks--;
     }
-
 }
 
 static void fput_samples(FILE *fp, int16_t s)
@@ -394,13 +388,14 @@ static int16_t paula_get_sample()
 
 // use sound rate of 31250
 void paula_fillbuf(int16_t *buffer, int len) {
-    int sample;
     int16_t *bufptr = buffer;
-    for (sample = 0; sample < len; sample++) {
+    for (int sample = 0; sample < len; sample++) {
         paula_clock_acc += H1M_PCLK_A;
-        while (paula_clock_acc > H1M_PCLK_LIM) {
-            paula_update_3_5MHz();
-            paula_clock_acc -= H1M_PCLK_LIM;
+        if (paula_clock_acc > H1M_PCLK_LIM) {
+            unsigned ticks = (paula_clock_acc - 1) / H1M_PCLK_LIM;
+            paula_clock_acc -= ticks * H1M_PCLK_LIM;
+            for (int i = 0; i < NUM_CHANNELS; i++)
+                paula_run_channel(&ChannelRegs[i], ticks);
         }
         int16_t s = paula_get_sample();
 
@@ -409,4 +404,3 @@ void paula_fillbuf(int16_t *buffer, int len) {
         *bufptr++ += s;
     }
 }
-
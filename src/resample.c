@@ -0,0 +1,181 @@
+/*B-em v2.2
+  Polyphase resampler for the sound output*/
+
+/*
+ * The filter is a Blackman windowed sinc tabulated at RS_PHASES fractional
+ * offsets, with linear interpolation between neighbouring phases so the
+ * ratio need not be rational.  When decimating the cutoff is lowered to the
+ * output Nyquist frequency and the filter widened in proportion, up to
+ * RS_MAX_HALF, so very high emulation speeds trade a wider transition band
+ * for a bounded cost per output sample.
+ */
+
+#include "b-em.h"
+#include "resample.h"
+
+#define RS_PHASES   128
+#define RS_HALF     16
+#define RS_MAX_HALF 64
+#define RS_CUTOFF   0.91
+
+static double rs_sinc(double x)
+{
+    if (fabs(x) < 1e-9)
+        return 1.0;
+    x *= M_PI;
+    return sin(x) / x;
+}
+
+static bool rs_design(resampler_t *rs, double step)
+{
+    double scale = step > 1.0 ? 1.0 / step : 1.0;
+    unsigned half = ceil(RS_HALF / scale);
+    if (half > RS_MAX_HALF)
+        half = RS_MAX_HALF;
+    unsigned taps = half * 2;
+    float *coef = malloc((RS_PHASES + 1) * taps * sizeof(float));
+    if (!coef) {
+        log_error("resample: out of memory for filter table");
+        return false;
+    }
+    double fc = RS_CUTOFF * scale;
+    for (unsigned p = 0; p <= RS_PHASES; p++) {
+        float *row = coef + p * taps;
+        double frac = (double)p / RS_PHASES;
+        double sum = 0.0;
+        for (unsigned k = 0; k < taps; k++) {
+            double d = frac + half - 1 - k;
+            double t = d / half;
+            double w = (t <= -1.0 || t >= 1.0) ? 0.0 : 0.42 + 0.5 * cos(M_PI * t) + 0.08 * cos(2.0 * M_PI * t);
+            double v = fc * rs_sinc(fc * d) * w;
+            row[k] = v;
+            sum += v;
+        }
+        for (unsigned k = 0; k < taps; k++)
+            row[k] /= sum;
+    }
+    if (rs->coef)
+        free(rs->coef);
+    rs->coef = coef;
+    rs->half = half;
+    rs->step = step;
+    return true;
+}
+
+void resample_reset(resampler_t *rs)
+{
+    rs->in_len = rs->half;
+    memset(rs->inbuf, 0, rs->in_len * rs->chans * sizeof(float));
+    rs->pos = rs->half;
+}
+
+static bool rs_reserve(resampler_t *rs, size_t frames)
+{
+    if (frames > rs->in_size) {
+        size_t size = rs->in_size ? rs->in_size : 1024;
+        while (size < frames)
+            size *= 2;
+        float *inbuf = realloc(rs->inbuf, size * rs->chans * sizeof(float));
+        if (!inbuf) {
+            log_error("resample: out of memory for input buffer");
+            return false;
+        }
+        rs->inbuf = inbuf;
+        rs->in_size = size;
+    }
+    return true;
+}
+
+bool resample_init(resampler_t *rs, unsigned chans, double step)
+{
+    memset(rs, 0, sizeof(resampler_t));
+    rs->chans = chans;
+    if (rs_design(rs, step) && rs_reserve(rs, rs->half * 4)) {
+        resample_reset(rs);
+        return true;
+    }
+    resample_free(rs);
+    return false;
+}
+
+/*
+ * A change of ratio keeps the history, and so is seamless, unless the
+ * filter length changes too.
+ */
+
+bool resample_set_step(resampler_t *rs, double step)
+{
+    unsigned half = rs->half;
+    if (step == rs->step)
+        return true;
+    if (!rs_design(rs, step))
+        return false;
+    if (rs->half != half) {
+        if (!rs_reserve(rs, rs->half * 4))
+            return false;
+        resample_reset(rs);
+    }
+    return true;
+}
+
+void resample_free(resampler_t *rs)
+{
+    if (rs->coef)
+        free(rs->coef);
+    if (rs->inbuf)
+        free(rs->inbuf);
+    rs->coef = NULL;
+    rs->inbuf = NULL;
+    rs->in_len = rs->in_size = 0;
+}
+
+/*
+ * Append frames of input and produce as many output frames as that input
+ * allows, up to max_out.  Any input not yet used is kept for next time.
+ */
+
+size_t resample_run(resampler_t *rs, const float *in, size_t frames, float *out, size_t max_out)
+{
+    unsigned chans = rs->chans;
+    unsigned half = rs->half;
+    unsigned taps = half * 2;
+    float row[RS_MAX_HALF * 2];
+    size_t done = 0;
+
+    if (frames) {
+        if (!rs_reserve(rs, rs->in_len + frames))
+            return 0;
+        memcpy(rs->inbuf + rs->in_len * chans, in, frames * chans * sizeof(float));
+        rs->in_len += frames;
+    }
+    while (done < max_out) {
+        size_t i = rs->pos;
+        if (i + half >= rs->in_len)
+            break;
+        double ph = (rs->pos - i) * RS_PHASES;
+        unsigned p0 = ph;
+        float pf = ph - p0;
+        const float *c0 = rs->coef + p0 * taps;
+        const float *c1 = c0 + taps;
+        for (unsigned k = 0; k < taps; k++)
+            row[k] = c0[k] + pf * (c1[k] - c0[k]);
+        const float *src = rs->inbuf + (i - half + 1) * chans;
+        for (unsigned ch = 0; ch < chans; ch++) {
+            float acc = 0.0f;
+            for (unsigned k = 0; k < taps; k++)
+                acc += src[k * chans + ch] * row[k];
+            *out++ = acc;
+        }
+        rs->pos += rs->step;
+        done++;
+    }
+    size_t first = (size_t)rs->pos - half + 1;
+    if (first > rs->in_len)
+        first = rs->in_len;
+    if (first) {
+        rs->in_len -= first;
+        memmove(rs->inbuf, rs->inbuf + first * chans, rs->in_len * chans * sizeof(float));
+        rs->pos -= first;
+    }
+    return done;
+}
@@ -0,0 +1,27 @@
+#ifndef __INC_RESAMPLE_H
+#define __INC_RESAMPLE_H
+
+/*
+ * Polyphase windowed-sinc resampler used to bring every sound source to
+ * the rate of the output device.  The ratio may be any real number and can
+ * be changed on the fly, e.g. when the emulation speed changes.
+ */
+
+typedef struct {
+    unsigned chans;     // interleaved channels.
+    unsigned half;      // filter half-length in input samples.
+    float    *coef;     // (RS_PHASES+1) rows of 2*half coefficients.
+    double   step;      // input samples per output sample.
+    double   pos;       // input position of the next output sample.
+    float    *inbuf;    // input history, interleaved.
+    size_t   in_len;    // frames in inbuf.
+    size_t   in_size;   // frames allocated for inbuf.
+} resampler_t;
+
+bool resample_init(resampler_t *rs, unsigned chans, double step);
+bool resample_set_step(resampler_t *rs, double step);
+void resample_reset(resampler_t *rs);
+void resample_free(resampler_t *rs);
+size_t resample_run(resampler_t *rs, const float *in, size_t frames, float *out, size_t max_out);
+
+#endif
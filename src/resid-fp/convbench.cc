@@ -0,0 +1,77 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 2004  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+// Benchmark for the FIR convolution kernels used by SAMPLE_RESAMPLE_INTERPOLATE.
+// Each output sample costs two convolutions of fir_N taps; the default
+// fir_N matches the 1MHz -> 31250Hz resampler set up by resid.cc.
+
+#include "convolve.h"
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char **argv)
+{
+    int fir_N = 3969;
+    double secs = 0.5;
+
+    if (argc > 1 && (fir_N = atoi(argv[1])) < 1) {
+        fprintf(stderr, "usage: convbench [fir-length [seconds]]\n");
+        return 1;
+    }
+    if (argc > 2)
+        secs = atof(argv[2]);
+
+    /* Offset both buffers by one float, as sid.cc's ring pointers usually are. */
+    float *samples = new float[fir_N + 16];
+    float *fir = new float[fir_N + 16];
+    for (int i = 0; i < fir_N + 16; i++) {
+        samples[i] = (float) (sin(i * 0.01) * 16384.0);
+        fir[i] = (float) (1.0 / (1 + abs(i - fir_N/2)));
+    }
+
+    const convolve_kernel *best = convolve_select();
+    float ref = convolve(samples + 1, fir + 1, fir_N);
+    printf("fir_N=%d, selected kernel: %s\n", fir_N, best->name);
+
+    for (const convolve_kernel *k = convolve_kernels; k->name; k++) {
+        if (!convolve_supported(k)) {
+            printf("%-8s not supported by this CPU\n", k->name);
+            continue;
+        }
+        volatile float sink = 0;
+        long iters = 0;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed;
+        do {
+            for (int i = 0; i < 256; i++)
+                sink = sink + k->fn(samples + 1, fir + 1, fir_N);
+            iters += 256;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        } while (elapsed < secs);
+        float v = k->fn(samples + 1, fir + 1, fir_N);
+        printf("%-8s %12.0f samples/s  (error vs scalar %g)\n", k->name,
+               iters / 2 / elapsed, fabs(v - ref));
+    }
+
+    delete[] samples;
+    delete[] fir;
+    return 0;
+}
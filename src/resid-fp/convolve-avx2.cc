@@ -0,0 +1,60 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 2004  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "convolve.h"
+
+#if (RESID_USE_AVX==1)
+
+#include <immintrin.h>
+
+RESID_TARGET("avx2,fma")
+float convolve_avx2(const float *a, const float *b, int n)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+
+    /* Two independent accumulators hide the FMA latency.  Unaligned loads
+     * cost nothing extra on AVX2 hardware when the data happens to be
+     * aligned, so no peeling is done as in the SSE version. */
+    while (n >= 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a), _mm256_loadu_ps(b), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + 8), _mm256_loadu_ps(b + 8), acc1);
+        a += 16;
+        b += 16;
+        n -= 16;
+    }
+    if (n >= 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a), _mm256_loadu_ps(b), acc0);
+        a += 8;
+        b += 8;
+        n -= 8;
+    }
+    acc0 = _mm256_add_ps(acc0, acc1);
+
+    __m128 out4 = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+    out4 = _mm_add_ps(_mm_movehl_ps(out4, out4), out4);
+    out4 = _mm_add_ss(_mm_shuffle_ps(out4, out4, 1), out4);
+    float out = _mm_cvtss_f32(out4);
+
+    while (n --)
+        out += (*(a ++)) * (*(b ++));
+
+    return out;
+}
+#endif
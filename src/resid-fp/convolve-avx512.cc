@@ -0,0 +1,53 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 2004  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "convolve.h"
+
+#if (RESID_USE_AVX==1)
+
+#include <immintrin.h>
+
+RESID_TARGET("avx512f")
+float convolve_avx512(const float *a, const float *b, int n)
+{
+    __m512 acc = _mm512_setzero_ps();
+
+    while (n >= 16) {
+        acc = _mm512_fmadd_ps(_mm512_loadu_ps(a), _mm512_loadu_ps(b), acc);
+        a += 16;
+        b += 16;
+        n -= 16;
+    }
+    /* Finish the tail with a masked load rather than a scalar loop. */
+    if (n > 0) {
+        __mmask16 m = (__mmask16) ((1u << n) - 1);
+        acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a), _mm512_maskz_loadu_ps(m, b), acc);
+    }
+
+    /* Reduce by halves; avoids _mm512_reduce_add_ps, which older GCC
+     * headers implement with an uninitialised temporary. */
+    float lanes[16];
+    _mm512_storeu_ps(lanes, acc);
+    for (int w = 8; w > 0; w >>= 1)
+        for (int i = 0; i < w; i++)
+            lanes[i] += lanes[i + w];
+
+    return lanes[0];
+}
+#endif
@@ -0,0 +1,48 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 2004  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "convolve.h"
+
+#if (RESID_USE_NEON==1)
+
+#include <arm_neon.h>
+
+float convolve_neon(const float *a, const float *b, int n)
+{
+    float32x4_t acc0 = vdupq_n_f32(0.f);
+    float32x4_t acc1 = vdupq_n_f32(0.f);
+
+    while (n >= 8) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(a), vld1q_f32(b));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(a + 4), vld1q_f32(b + 4));
+        a += 8;
+        b += 8;
+        n -= 8;
+    }
+    acc0 = vaddq_f32(acc0, acc1);
+
+    float32x2_t sum2 = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+    float out = vget_lane_f32(vpadd_f32(sum2, sum2), 0);
+
+    while (n --)
+        out += (*(a ++)) * (*(b ++));
+
+    return out;
+}
+#endif
@@ -0,0 +1,165 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 2004  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "convolve.h"
+#include <stddef.h>
+
+/* This code is appropriate for 32-bit and 64-bit x86 CPUs. */
+#if defined(__x86_64__) || defined(__i386__) || defined(_MSC_VER)
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+struct cpu_x86_regs_s {
+  unsigned int eax;
+  unsigned int ebx;
+  unsigned int ecx;
+  unsigned int edx;
+};
+typedef struct cpu_x86_regs_s cpu_x86_regs_t;
+
+static cpu_x86_regs_t get_cpuid_regs(unsigned int index, unsigned int subindex = 0)
+{
+  union {
+    cpu_x86_regs_t retval;
+    int regs[4];
+  } data;
+
+#if defined(_MSC_VER)
+  __cpuidex(data.regs, index, subindex);
+#else
+  __cpuid_count(index, subindex, data.retval.eax, data.retval.ebx, data.retval.ecx, data.retval.edx);
+#endif
+
+  return data.retval;
+}
+
+/* Which register sets the OS saves on a context switch (XCR0). */
+static unsigned long long get_xcr0(void)
+{
+#if defined(_MSC_VER)
+  return _xgetbv(0);
+#else
+  unsigned int eax, edx;
+  __asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+  return ((unsigned long long) edx << 32) | eax;
+#endif
+}
+
+static int host_cpu_features_by_cpuid(unsigned int max_index)
+{
+  cpu_x86_regs_t regs = get_cpuid_regs(1);
+
+  int features = 0;
+  if (regs.edx & (1 << 23))
+    features |= HOST_CPU_MMX;
+  if (regs.edx & (1 << 25))
+    features |= HOST_CPU_SSE;
+  if (regs.edx & (1 << 26))
+    features |= HOST_CPU_SSE2;
+  if (regs.ecx & (1 << 0))
+    features |= HOST_CPU_SSE3;
+
+  /* AVX state is only usable if the OS has enabled XSAVE for it. */
+  if (max_index < 7 || !(regs.ecx & (1 << 27)))
+    return features;
+  bool fma = (regs.ecx & (1 << 12)) != 0;
+
+  unsigned long long xcr0 = get_xcr0();
+  if ((xcr0 & 0x06) != 0x06)
+    return features;
+
+  regs = get_cpuid_regs(7, 0);
+  if (regs.ebx & (1 << 5))
+    features |= HOST_CPU_AVX2;
+  if (fma)
+    features |= HOST_CPU_FMA;
+  if ((regs.ebx & (1 << 16)) && (xcr0 & 0xe6) == 0xe6)
+    features |= HOST_CPU_AVX512F;
+
+  return features;
+}
+
+int host_cpu_features(void)
+{
+  static int features = 0;
+  static int features_detected = 0;
+
+  if (features_detected)
+    return features;
+  features_detected = 1;
+
+  /* find the highest supported cpuid function, returned in %eax */
+  unsigned int max_index = get_cpuid_regs(0).eax;
+  if (max_index < 1) {
+    /* no cpuid 1 function, we can't test for features -> no features */
+    return 0;
+  }
+
+  features = host_cpu_features_by_cpuid(max_index);
+  return features;
+}
+
+#else /* !__x86_64__ && !__i386__ && !_MSC_VER */
+int host_cpu_features(void)
+{
+#if (RESID_USE_NEON==1)
+  /* NEON is part of the base ARMv8 ISA and the build requires it anyway. */
+  return HOST_CPU_NEON;
+#else
+  return 0;
+#endif
+}
+#endif
+
+const convolve_kernel convolve_kernels[] = {
+  { "scalar", convolve, 0 },
+#if (RESID_USE_SSE==1)
+  { "sse", convolve_sse, HOST_CPU_SSE },
+#endif
+#if (RESID_USE_NEON==1)
+  { "neon", convolve_neon, HOST_CPU_NEON },
+#endif
+#if (RESID_USE_AVX==1)
+  { "avx2", convolve_avx2, HOST_CPU_AVX2|HOST_CPU_FMA },
+  { "avx512", convolve_avx512, HOST_CPU_AVX512F },
+#endif
+  { NULL, NULL, 0 }
+};
+
+bool convolve_supported(const convolve_kernel *k)
+{
+  return (host_cpu_features() & k->features) == k->features;
+}
+
+// Pick the last (widest) kernel in the table that this host can run.
+const convolve_kernel *convolve_select(void)
+{
+  const convolve_kernel *best = convolve_kernels;
+
+  for (const convolve_kernel *k = convolve_kernels; k->name; k++)
+    if (convolve_supported(k))
+      best = k;
+
+  return best;
+}
@@ -17,7 +17,7 @@
 //  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 //  ---------------------------------------------------------------------------
 
-#include "sid.h"
+#include "convolve.h"
 
 #if (RESID_USE_SSE==1)
 
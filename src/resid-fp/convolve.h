@@ -0,0 +1,60 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 2004  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef __CONVOLVE_H__
+#define __CONVOLVE_H__
+
+#include "siddefs-fp.h"
+
+// FIR convolution kernels used by the resampling interpolator.  All of them
+// compute the same dot product; the fastest one the host supports is picked
+// once at run time by convolve_select().
+typedef float (*convolve_fn)(const float *a, const float *b, int n);
+
+struct convolve_kernel {
+  const char *name;
+  convolve_fn fn;
+  int features;   // host_cpu_feature bits required to run fn.
+};
+
+enum host_cpu_feature {
+    HOST_CPU_MMX=1, HOST_CPU_SSE=2, HOST_CPU_SSE2=4, HOST_CPU_SSE3=8,
+    HOST_CPU_AVX2=16, HOST_CPU_FMA=32, HOST_CPU_AVX512F=64, HOST_CPU_NEON=128
+};
+
+extern float convolve(const float *a, const float *b, int n);
+#if (RESID_USE_SSE==1)
+extern float convolve_sse(const float *a, const float *b, int n);
+#endif
+#if (RESID_USE_AVX==1)
+extern float convolve_avx2(const float *a, const float *b, int n);
+extern float convolve_avx512(const float *a, const float *b, int n);
+#endif
+#if (RESID_USE_NEON==1)
+extern float convolve_neon(const float *a, const float *b, int n);
+#endif
+
+// Kernels compiled into this build, slowest first, terminated by a NULL name.
+extern const convolve_kernel convolve_kernels[];
+
+int host_cpu_features(void);
+bool convolve_supported(const convolve_kernel *k);
+const convolve_kernel *convolve_select(void);
+
+#endif // not __CONVOLVE_H__
@@ -21,89 +21,6 @@
 #include <stdio.h>
 #include <math.h>
 
-extern float convolve(const float *a, const float *b, int n);
-extern float convolve_sse(const float *a, const float *b, int n);
-
-enum host_cpu_feature {
-    HOST_CPU_MMX=1, HOST_CPU_SSE=2, HOST_CPU_SSE2=4, HOST_CPU_SSE3=8
-};
-
-/* This code is appropriate for 32-bit and 64-bit x86 CPUs. */
-#if defined(__x86_64__) || defined(__i386__) || defined(_MSC_VER)
-
-#if defined(_MSC_VER)
-#include <intrin.h>
-#else
-#include <cpuid.h>
-#endif
-
-struct cpu_x86_regs_s {
-  unsigned int eax;
-  unsigned int ebx;
-  unsigned int ecx;
-  unsigned int edx;
-};
-typedef struct cpu_x86_regs_s cpu_x86_regs_t;
-
-static cpu_x86_regs_t get_cpuid_regs(unsigned int index)
-{
-  union {
-    cpu_x86_regs_t retval;
-    int regs[4];
-  } data;
-
-#if defined(_MSC_VER)
-  __cpuid(data.regs, index);
-#else
-  __cpuid(index, data.retval.eax, data.retval.ebx, data.retval.ecx, data.retval.edx);
-#endif
-
-  return data.retval;
-}
-
-static int host_cpu_features_by_cpuid(void)
-{
-  cpu_x86_regs_t regs = get_cpuid_regs(1);
-
-  int features = 0;
-  if (regs.edx & (1 << 23))
-    features |= HOST_CPU_MMX;
-  if (regs.edx & (1 << 25))
-    features |= HOST_CPU_SSE;
-  if (regs.edx & (1 << 26))
-    features |= HOST_CPU_SSE2;
-  if (regs.ecx & (1 << 0))
-    features |= HOST_CPU_SSE3;
-
-  return features;
-}
-
-static int host_cpu_features(void)
-{
-  static int features = 0;
-  static int features_detected = 0;
-
-  if (features_detected)
-    return features;
-  features_detected = 1;
-
-  /* find the highest supported cpuid function, returned in %eax */
-  if (get_cpuid_regs(0).eax < 1) {
-    /* no cpuid 1 function, we can't test for features -> no features */
-    return 0;
-  }
-
-  features = host_cpu_features_by_cpuid();
-  return features;
-}
-
-#else /* !__x86_64__ && !__i386__ && !_MSC_VER */
-static int host_cpu_features(void)
-{
-  return 0;
-}
-#endif
-
 float SIDFP::kinked_dac(const int x, const float nonlinearity, const int max)
 {
     float value = 0.f;
@@ -126,11 +43,7 @@ float SIDFP::kinked_dac(const int x, const float nonlinearity, const int max)
 // ----------------------------------------------------------------------------
 SIDFP::SIDFP()
 {
-#if (RESID_USE_SSE==1)
-  can_use_sse = (host_cpu_features() & HOST_CPU_SSE) != 0;
-#else
-  can_use_sse = false;
-#endif
+  convolver = convolve_select();
 
   // Initialize pointers.
   sample = 0;
@@ -850,10 +763,7 @@ int SIDFP::clock_resample_interpolate(cycle_count& delta_t, short* buf, int n,
     float* sample_start = sample + sample_index - fir_N + RINGSIZE - 1;
 
     float v1 =
-#if (RESID_USE_SSE==1)
-      can_use_sse ? convolve_sse(sample_start, fir + fir_offset*fir_N, fir_N) :
-#endif
-        convolve(sample_start, fir + fir_offset*fir_N, fir_N);
+      convolver->fn(sample_start, fir + fir_offset*fir_N, fir_N);
 
     // Use next FIR table, wrap around to first FIR table using
     // previous sample.
@@ -862,10 +772,7 @@ int SIDFP::clock_resample_interpolate(cycle_count& delta_t, short* buf, int n,
       ++ sample_start;
     }
     float v2 =
-#if (RESID_USE_SSE==1)
-      can_use_sse ? convolve_sse(sample_start, fir + fir_offset*fir_N, fir_N) :
-#endif
-        convolve(sample_start, fir + fir_offset*fir_N, fir_N);
+      convolver->fn(sample_start, fir + fir_offset*fir_N, fir_N);
 
     // Linear interpolation between the sinc tables yields good approximation
     // for the exact value.
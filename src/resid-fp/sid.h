@@ -25,6 +25,7 @@
 #include "filter.h"
 #include "extfilt.h"
 #include "pot.h"
+#include "convolve.h"
 
 class SIDFP
 {
@@ -33,7 +34,7 @@ public:
   ~SIDFP();
 
   static float kinked_dac(const int x, const float nonlinearity, const int bits);
-  bool sse_enabled() { return can_use_sse; }
+  const char *convolve_name() { return convolver->name; }
 
   void set_chip_model(chip_model model);
   FilterFP& get_filter() { return filter; }
@@ -124,7 +125,7 @@ protected:
   // FIR_RES filter tables (FIR_N*FIR_RES).
   float* fir;
 
-  bool can_use_sse;
+  const convolve_kernel *convolver;
 };
 
 #endif // not __SID_H__
@@ -80,6 +80,26 @@ const char* resid_version_string = VERSION;
 #define RESID_USE_SSE 0
 #endif
 
+// The wider x86 kernels are compiled with per-function target attributes so
+// the rest of the build needs no extra -m flags; they are only called after
+// a run time CPUID check.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ >= 5)))
+#define RESID_USE_AVX 1
+#define RESID_TARGET(x) __attribute__((target(x)))
+#elif defined(_MSC_VER) && (_MSC_VER >= 1910) && (defined(_M_X64) || defined(_M_IX86))
+#define RESID_USE_AVX 1
+#define RESID_TARGET(x)
+#else
+#define RESID_USE_AVX 0
+#define RESID_TARGET(x)
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define RESID_USE_NEON 1
+#else
+#define RESID_USE_NEON 0
+#endif
+
 #define HAVE_LOGF
 #define HAVE_EXPF
 #define HAVE_LOGF_PROTOTYPE
@@ -16,6 +16,7 @@ extern "C" void sid_settype(int resamp, int model);
 extern "C" uint8_t sid_read(uint16_t addr);
 extern "C" void sid_write(uint16_t addr, uint8_t val);
 extern "C" void sid_fillbuf(int16_t *buf, int len);
+extern "C" void log_info(const char *fmt, ...);
 
 struct sound_s
 {
@@ -35,7 +36,8 @@ void sid_init()
         
         psid = new sound_t;
         psid->sid = new SIDFP;
-        
+        log_info("sid: using %s convolution for resampling", psid->sid->convolve_name());
+
         psid->sid->set_chip_model(MOS8580FP);
         
         psid->sid->set_voice_nonlinearity(1.0f);
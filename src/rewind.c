@@ -0,0 +1,307 @@
+/*B-em v2.2
+  Rewind buffer*/
+
+/*
+ * Every rewind_frames frames the machine state is captured, uncompressed,
+ * into one of two preallocated arenas with savestate_capture.  The newest
+ * snapshot is always kept whole.  Once a new one has been taken the
+ * previous one is handed to a worker thread which XORs it with the new
+ * one, which leaves mostly zeros, deflates that and adds it to a ring.
+ * Stepping back undoes the newest delta in place and restores the result.
+ *
+ * If the worker is still busy when the next snapshot is due, it is left
+ * until the next frame rather than holding the emulation up.
+ */
+
+#include "b-em.h"
+#include <zlib.h>
+#include "rewind.h"
+#include "savestate.h"
+
+#define REWIND_ARENA_MIN (256 * 1024)
+#define REWIND_ARENA_MAX (64 * 1024 * 1024)
+
+int rewind_seconds = 0;
+int rewind_frames = 25;
+bool rewind_wanted;
+
+typedef struct {
+    unsigned char *data;    // deflated XOR against the next newer snapshot.
+    size_t zlen;
+    size_t len;             // length of the snapshot it gives back.
+} rewind_delta_t;
+
+static rewind_delta_t *ring;
+static unsigned ring_cap, ring_head, ring_count;
+
+static unsigned char *arena[2];
+static size_t arena_len[2];
+static size_t arena_size;
+static unsigned char *scratch;
+static int newest = -1;
+static int frame_count;
+
+static ALLEGRO_THREAD *worker;
+static ALLEGRO_MUTEX *mutex;
+static ALLEGRO_COND *cond;
+static bool job_pending;
+static int job_prev;
+
+static void ring_push(rewind_delta_t *delta)
+{
+    rewind_delta_t *slot = ring + ring_head;
+    if (ring_count == ring_cap) {
+        free(slot->data);
+        ring_count--;
+    }
+    *slot = *delta;
+    ring_head = (ring_head + 1) % ring_cap;
+    ring_count++;
+}
+
+static void ring_clear(void)
+{
+    while (ring_count) {
+        ring_head = (ring_head + ring_cap - 1) % ring_cap;
+        free(ring[ring_head].data);
+        ring_count--;
+    }
+}
+
+static void xor_into(unsigned char *dest, const unsigned char *a, size_t alen, const unsigned char *b, size_t blen)
+{
+    size_t common = alen < blen ? alen : blen;
+    for (size_t i = 0; i < common; i++)
+        dest[i] = a[i] ^ b[i];
+    if (alen > common)
+        memcpy(dest + common, a + common, alen - common);
+}
+
+static void *rewind_worker(ALLEGRO_THREAD *thread, void *arg)
+{
+    al_lock_mutex(mutex);
+    while (!al_get_thread_should_stop(thread)) {
+        if (!job_pending) {
+            al_wait_cond(cond, mutex);
+            continue;
+        }
+        int prev = job_prev;
+        al_unlock_mutex(mutex);
+
+        /* The arenas cannot change while a job is pending. */
+        rewind_delta_t delta;
+        delta.len = arena_len[prev];
+        xor_into(scratch, arena[prev], arena_len[prev], arena[1 - prev], arena_len[1 - prev]);
+        uLongf zlen = compressBound(delta.len);
+        if ((delta.data = malloc(zlen))) {
+            if (compress2(delta.data, &zlen, scratch, delta.len, Z_BEST_SPEED) == Z_OK) {
+                unsigned char *shrunk = realloc(delta.data, zlen);
+                if (shrunk)
+                    delta.data = shrunk;
+                delta.zlen = zlen;
+            }
+            else {
+                free(delta.data);
+                delta.data = NULL;
+            }
+        }
+
+        al_lock_mutex(mutex);
+        if (delta.data)
+            ring_push(&delta);
+        else
+            log_warn("rewind: unable to compress snapshot delta");
+        job_pending = false;
+        al_broadcast_cond(cond);
+    }
+    al_unlock_mutex(mutex);
+    return NULL;
+}
+
+static void rewind_wait_idle(void)
+{
+    al_lock_mutex(mutex);
+    while (job_pending)
+        al_wait_cond(cond, mutex);
+    al_unlock_mutex(mutex);
+}
+
+static bool rewind_grow(void)
+{
+    size_t size = arena_size * 2;
+    if (size > REWIND_ARENA_MAX) {
+        log_error("rewind: snapshot larger than %dM, rewind disabled", REWIND_ARENA_MAX / (1024 * 1024));
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        unsigned char *buf = realloc(arena[i], size);
+        if (!buf) {
+            log_error("rewind: out of memory for snapshot arena");
+            return false;
+        }
+        arena[i] = buf;
+    }
+    unsigned char *buf = realloc(scratch, size);
+    if (!buf) {
+        log_error("rewind: out of memory for snapshot arena");
+        return false;
+    }
+    scratch = buf;
+    arena_size = size;
+    log_debug("rewind: snapshot arenas grown to %zu bytes", size);
+    return true;
+}
+
+void rewind_init(void)
+{
+    if (rewind_seconds <= 0)
+        return;
+    if (rewind_frames < 1)
+        rewind_frames = 1;
+    ring_cap = (rewind_seconds * 50 + rewind_frames - 1) / rewind_frames;
+    if (!(ring = calloc(ring_cap, sizeof(rewind_delta_t)))) {
+        log_error("rewind: out of memory for snapshot ring");
+        return;
+    }
+    arena_size = REWIND_ARENA_MIN / 2;
+    if (rewind_grow()) {
+        if ((mutex = al_create_mutex())) {
+            if ((cond = al_create_cond())) {
+                if ((worker = al_create_thread(rewind_worker, NULL))) {
+                    al_start_thread(worker);
+                    log_info("rewind: %d snapshots, one every %d frames", ring_cap, rewind_frames);
+                    return;
+                }
+                else
+                    log_error("rewind: unable to create worker thread");
+                al_destroy_cond(cond);
+                cond = NULL;
+            }
+            else
+                log_error("rewind: unable to create condition variable");
+            al_destroy_mutex(mutex);
+            mutex = NULL;
+        }
+        else
+            log_error("rewind: unable to create mutex");
+    }
+    rewind_close();
+}
+
+void rewind_close(void)
+{
+    if (worker) {
+        al_lock_mutex(mutex);
+        al_set_thread_should_stop(worker);
+        al_broadcast_cond(cond);
+        al_unlock_mutex(mutex);
+        al_join_thread(worker, NULL);
+        al_destroy_thread(worker);
+        worker = NULL;
+    }
+    if (cond) {
+        al_destroy_cond(cond);
+        cond = NULL;
+    }
+    if (mutex) {
+        al_destroy_mutex(mutex);
+        mutex = NULL;
+    }
+    if (ring) {
+        ring_clear();
+        free(ring);
+        ring = NULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (arena[i]) {
+            free(arena[i]);
+            arena[i] = NULL;
+        }
+    }
+    if (scratch) {
+        free(scratch);
+        scratch = NULL;
+    }
+    newest = -1;
+}
+
+/* Called once per emulated frame. */
+
+void rewind_frame(void)
+{
+    if (!worker || ++frame_count < rewind_frames)
+        return;
+
+    al_lock_mutex(mutex);
+    bool busy = job_pending;
+    al_unlock_mutex(mutex);
+    if (busy) {
+        frame_count--;
+        return;
+    }
+    frame_count = 0;
+
+    int spare = (newest < 0) ? 0 : 1 - newest;
+    long len;
+    while (!(len = savestate_capture(arena[spare], arena_size))) {
+        if (!rewind_grow()) {
+            rewind_close();
+            return;
+        }
+    }
+    if (len < 0) {
+        log_error("rewind: unable to capture machine state, rewind disabled");
+        rewind_close();
+        return;
+    }
+    arena_len[spare] = len;
+    if (newest >= 0) {
+        al_lock_mutex(mutex);
+        job_prev = newest;
+        job_pending = true;
+        al_signal_cond(cond);
+        al_unlock_mutex(mutex);
+    }
+    newest = spare;
+}
+
+/*
+ * Step back one snapshot.  With no history left the newest snapshot is
+ * restored again.
+ */
+
+void rewind_step(void)
+{
+    rewind_wanted = false;
+    if (!worker || newest < 0)
+        return;
+
+    rewind_wait_idle();
+    al_lock_mutex(mutex);
+    if (ring_count) {
+        ring_head = (ring_head + ring_cap - 1) % ring_cap;
+        rewind_delta_t *delta = ring + ring_head;
+        uLongf len = delta->len;
+        if (len <= arena_size && uncompress(scratch, &len, delta->data, delta->zlen) == Z_OK && len == delta->len) {
+            unsigned char *cur = arena[newest];
+            xor_into(cur, scratch, len, cur, arena_len[newest]);
+            arena_len[newest] = len;
+        }
+        else
+            log_warn("rewind: corrupt snapshot delta");
+        free(delta->data);
+        ring_count--;
+    }
+    al_unlock_mutex(mutex);
+    log_debug("rewind: restoring snapshot, %u older remain", ring_count);
+    savestate_restore(arena[newest], arena_len[newest]);
+    frame_count = 0;
+}
+
+void rewind_key(void)
+{
+    if (worker)
+        rewind_wanted = true;
+    else
+        log_debug("rewind: not enabled");
+}
@@ -0,0 +1,14 @@
+#ifndef __INC_REWIND_H
+#define __INC_REWIND_H
+
+extern int rewind_seconds;
+extern int rewind_frames;
+extern bool rewind_wanted;
+
+void rewind_init(void);
+void rewind_close(void);
+void rewind_frame(void);
+void rewind_step(void);
+void rewind_key(void);
+
+#endif
@@ -24,6 +24,7 @@
 struct _sszfile {
     z_stream zs;
     size_t togo;
+    bool raw;
     unsigned char buf[BUFSIZ];
 };
 
@@ -31,9 +32,43 @@ int savestate_wantsave, savestate_wantload;
 char *savestate_name;
 FILE *savestate_fp;
 
-void savestate_save(const char *name)
+/* In-memory snapshots store the zlib sections uncompressed. */
+static bool savestate_raw;
+
+/*
+ * A full snapshot that has just been saved or loaded becomes the base
+ * that delta snapshots refer to.  It is identified by the CRC and size of
+ * the file as well as its name so a changed base is not used by mistake.
+ */
+
+enum { SAVE_FULL = 1, SAVE_DELTA = 2 };
+
+static struct {
+    char *name;
+    uint32_t crc;
+    uint32_t size;
+} savestate_base;
+
+typedef struct dirty_map {
+    struct dirty_map *next;
+    size_t bytes;
+    uint8_t bits[];
+} dirty_map_t;
+
+static dirty_map_t *dirty_maps;
+
+/* Paged blocks hold just the pages changed since the base. */
+static bool savestate_paged;
+static bool load_abort;
+static bool base_pending;
+
+static const uint8_t zero_page[SAVESTATE_PAGE_SIZE];
+
+static void save_wait(void);
+
+static void save_common(const char *name, int want)
 {
-    log_debug("savestate: save, name=%s", name);
+    save_wait();
     if (savestate_fp)
         log_error("savestate: an operation is already in progress");
     else if (curtube != -1 && !tube_proc_savestate)
@@ -50,11 +85,11 @@ void savestate_save(const char *name)
             }
             else
                 strcpy(name_copy + name_len, ".snp");
-            if ((savestate_fp = fopen(name_copy, "wb"))) {
+            if ((savestate_fp = fopen(name_copy, "w+b"))) {
                 if (savestate_name)
                     free(savestate_name);
                 savestate_name = name_copy;
-                savestate_wantsave = 1;
+                savestate_wantsave = want;
             }
             else
                 log_error("savestate: unable to open %s for writing: %s", name, strerror(errno));
@@ -64,9 +99,22 @@ void savestate_save(const char *name)
     }
 }
 
+void savestate_save(const char *name)
+{
+    log_debug("savestate: save, name=%s", name);
+    save_common(name, SAVE_FULL);
+}
+
+void savestate_save_delta(const char *name)
+{
+    log_debug("savestate: save delta, name=%s", name);
+    save_common(name, SAVE_DELTA);
+}
+
 void savestate_load(const char *name)
 {
     log_debug("savestate: load, name=%s", name);
+    save_wait();
     if (savestate_fp)
         log_error("savestate: an operation is already in progress");
     else {
@@ -75,7 +123,7 @@ void savestate_load(const char *name)
             unsigned char magic[8];
             if (fread(magic, 8, 1, fp) == 1 && memcmp(magic, "BEMSNAP", 7) == 0) {
                 int vers = magic[7];
-                if (vers >= '1' && vers <= '3') {
+                if (vers >= '1' && vers <= '4') {
                     char *name_copy = strdup(name);
                     if (name_copy) {
                         if (savestate_name)
@@ -145,6 +193,14 @@ static void save_zlib(FILE *fp, int key, void (*save_func)(ZFILE *zpf))
     fseek(fp, hsize, SEEK_CUR);
 
     ZFILE zfile;
+    if (savestate_raw) {
+        zfile.raw = true;
+        save_func(&zfile);
+        long end = ftell(fp);
+        save_tail(fp, key|0x80, start, end, end - start - hsize);
+        return;
+    }
+    zfile.raw = false;
     zfile.zs.zalloc = Z_NULL;
     zfile.zs.zfree = Z_NULL;
     zfile.zs.opaque = Z_NULL;
@@ -176,6 +232,10 @@ void savestate_zwrite(ZFILE *zfp, void *src, size_t size)
 {
     int res;
 
+    if (zfp->raw) {
+        fwrite(src, size, 1, savestate_fp);
+        return;
+    }
     zfp->zs.next_in = src;
     zfp->zs.avail_in = size;
     while ((res = deflate(&zfp->zs, Z_NO_FLUSH) == Z_OK)) {
@@ -190,11 +250,8 @@ void savestate_zwrite(ZFILE *zfp, void *src, size_t size)
     log_warn("savestate: compression error %d (%s)", res, zfp->zs.msg);
 }
 
-void savestate_dosave(void)
+static void save_machine(FILE *fp)
 {
-    FILE *fp = savestate_fp;
-    fwrite("BEMSNAP3", 8,1, fp);
-    save_sect(fp, 'm', model_savestate);
     save_sect(fp, '6', m6502_savestate);
     save_zlib(fp, 'M', mem_savezlib);
     save_sect(fp, 'S', sysvia_savestate);
@@ -214,9 +271,92 @@ void savestate_dosave(void)
         save_sect(fp, 'T', tube_ula_savestate);
         save_zlib(fp, 'P', tube_proc_savestate);
     }
-    fclose(fp);
-    savestate_wantsave = 0;
-    savestate_fp = NULL;
+}
+
+static void save_state(FILE *fp)
+{
+    fwrite("BEMSNAP3", 8,1, fp);
+    save_sect(fp, 'm', model_savestate);
+    save_machine(fp);
+}
+
+static bool file_crc(FILE *fp, uint32_t *crcp, uint32_t *sizep)
+{
+    unsigned char buf[BUFSIZ];
+    uLong crc = crc32(0L, Z_NULL, 0);
+    uint32_t size = 0;
+    size_t nbytes;
+
+    fflush(fp);
+    if (fseek(fp, 0, SEEK_SET))
+        return false;
+    while ((nbytes = fread(buf, 1, sizeof buf, fp)) > 0) {
+        crc = crc32(crc, buf, nbytes);
+        size += nbytes;
+    }
+    *crcp = crc;
+    *sizep = size;
+    return !ferror(fp);
+}
+
+static void set_base(const char *name, FILE *fp)
+{
+    uint32_t crc, size;
+    if (file_crc(fp, &crc, &size)) {
+        char *name_copy = strdup(name);
+        if (name_copy) {
+            if (savestate_base.name)
+                free(savestate_base.name);
+            savestate_base.name = name_copy;
+            savestate_base.crc = crc;
+            savestate_base.size = size;
+            for (dirty_map_t *dm = dirty_maps; dm; dm = dm->next)
+                memset(dm->bits, 0, dm->bytes);
+            log_debug("savestate: base is now %s, crc=%08X, size=%u", name, crc, size);
+            return;
+        }
+    }
+    savestate_forget_base();
+}
+
+void savestate_forget_base(void)
+{
+    base_pending = false;
+    if (savestate_base.name) {
+        log_debug("savestate: forgetting base %s", savestate_base.name);
+        free(savestate_base.name);
+        savestate_base.name = NULL;
+    }
+}
+
+static void save_base_ref(FILE *fp)
+{
+    unsigned char bytes[8];
+    bytes[0] = savestate_base.crc;
+    bytes[1] = savestate_base.crc >> 8;
+    bytes[2] = savestate_base.crc >> 16;
+    bytes[3] = savestate_base.crc >> 24;
+    bytes[4] = savestate_base.size;
+    bytes[5] = savestate_base.size >> 8;
+    bytes[6] = savestate_base.size >> 16;
+    bytes[7] = savestate_base.size >> 24;
+    fwrite(bytes, sizeof(bytes), 1, fp);
+    savestate_save_str(savestate_base.name, fp);
+}
+
+/*
+ * A delta snapshot has the same sections as a full one except that the
+ * model, which must match the base, is replaced by a reference to the
+ * base, and the memory blocks hold only the pages changed since the base.
+ */
+
+static void save_delta(FILE *fp)
+{
+    fwrite("BEMSNAP4", 8,1, fp);
+    save_sect(fp, 'B', save_base_ref);
+    savestate_paged = true;
+    save_machine(fp);
+    savestate_paged = false;
 }
 
 static void load_state_one(FILE *fp)
@@ -244,6 +384,12 @@ static void load_zlib(long size, void (*load_func)(ZFILE *zpf))
 {
     ZFILE zfile;
 
+    if (savestate_raw) {
+        zfile.raw = true;
+        load_func(&zfile);
+        return;
+    }
+    zfile.raw = false;
     zfile.zs.zalloc = Z_NULL;
     zfile.zs.zfree = Z_NULL;
     zfile.zs.opaque = Z_NULL;
@@ -260,6 +406,11 @@ void savestate_zread(ZFILE *zfp, void *dest, size_t size)
 {
     int res, flush;
 
+    if (zfp->raw) {
+        if (fread(dest, size, 1, savestate_fp) != 1)
+            log_error("savestate: premature end of in-memory snapshot");
+        return;
+    }
     zfp->zs.next_out = dest;
     zfp->zs.avail_out = size;
     do {
@@ -289,6 +440,171 @@ void savestate_zread(ZFILE *zfp, void *dest, size_t size)
         log_error("savestate: compression error reading %s: %d(%s)", savestate_name, res, zfp->zs.msg);
 }
 
+/*
+ * Dirty page maps.  Each is allocated with a small header so that all of
+ * them can be cleared when a new base is taken.
+ */
+
+static size_t map_pages(size_t size)
+{
+    return (size + SAVESTATE_PAGE_SIZE - 1) >> SAVESTATE_PAGE_SHIFT;
+}
+
+uint8_t *savestate_dirty_new(size_t size)
+{
+    size_t bytes = (map_pages(size) + 7) >> 3;
+    dirty_map_t *dm = malloc(sizeof(dirty_map_t) + bytes);
+    if (!dm) {
+        log_error("savestate: out of memory for dirty page map");
+        return NULL;
+    }
+    /* No base has seen this memory yet. */
+    memset(dm->bits, 0xff, bytes);
+    dm->bytes = bytes;
+    dm->next = dirty_maps;
+    dirty_maps = dm;
+    return dm->bits;
+}
+
+void savestate_dirty_free(uint8_t *map)
+{
+    if (map) {
+        dirty_map_t **prev = &dirty_maps;
+        for (dirty_map_t *dm = dirty_maps; dm; dm = dm->next) {
+            if (dm->bits == map) {
+                *prev = dm->next;
+                free(dm);
+                return;
+            }
+            prev = &dm->next;
+        }
+    }
+}
+
+void savestate_dirty_range(uint8_t *map, size_t offset, size_t len)
+{
+    if (map && len) {
+        size_t last = (offset + len - 1) >> SAVESTATE_PAGE_SHIFT;
+        for (size_t page = offset >> SAVESTATE_PAGE_SHIFT; page <= last; page++)
+            map[page >> 3] |= 1 << (page & 7);
+    }
+}
+
+/*
+ * In a delta each paged block is a bit map of the pages present followed
+ * by those pages in order.  Runs of consecutive pages are passed to
+ * zlib together.
+ */
+
+static size_t next_run(const uint8_t *map, size_t page, size_t pages, size_t *endp)
+{
+    while (page < pages) {
+        if (!map[page >> 3])
+            page = (page | 7) + 1;
+        else if (map[page >> 3] & (1 << (page & 7))) {
+            size_t end = page + 1;
+            while (end < pages && (map[end >> 3] & (1 << (end & 7))))
+                end++;
+            *endp = end;
+            return page;
+        }
+        else
+            page++;
+    }
+    return pages;
+}
+
+static void write_marked(ZFILE *zfp, void *src, size_t size, const uint8_t *map)
+{
+    size_t pages = map_pages(size);
+    size_t bytes = (pages + 7) >> 3;
+    if (!map) {
+        while (bytes) {
+            size_t chunk = bytes < sizeof(zero_page) ? bytes : sizeof(zero_page);
+            savestate_zwrite(zfp, (void *)zero_page, chunk);
+            bytes -= chunk;
+        }
+        return;
+    }
+    savestate_zwrite(zfp, (void *)map, bytes);
+    size_t page = 0, end, count = 0;
+    while ((page = next_run(map, page, pages, &end)) < pages) {
+        size_t start = page << SAVESTATE_PAGE_SHIFT;
+        size_t stop = end << SAVESTATE_PAGE_SHIFT;
+        if (stop > size)
+            stop = size;
+        savestate_zwrite(zfp, (uint8_t *)src + start, stop - start);
+        count += end - page;
+        page = end;
+    }
+    log_debug("savestate: %zu of %zu pages saved", count, pages);
+}
+
+static void read_marked(ZFILE *zfp, void *dest, size_t size, uint8_t *map1, uint8_t *map2)
+{
+    size_t pages = map_pages(size);
+    size_t bytes = (pages + 7) >> 3;
+    uint8_t *present = malloc(bytes);
+    if (!present) {
+        log_error("savestate: out of memory for page map");
+        load_abort = true;
+        return;
+    }
+    savestate_zread(zfp, present, bytes);
+    size_t page = 0, end;
+    while ((page = next_run(present, page, pages, &end)) < pages) {
+        size_t start = page << SAVESTATE_PAGE_SHIFT;
+        size_t stop = end << SAVESTATE_PAGE_SHIFT;
+        if (stop > size)
+            stop = size;
+        savestate_zread(zfp, (uint8_t *)dest + start, stop - start);
+        page = end;
+    }
+    for (size_t i = 0; i < bytes; i++) {
+        if (map1)
+            map1[i] |= present[i];
+        if (map2)
+            map2[i] |= present[i];
+    }
+    free(present);
+}
+
+void savestate_zwrite_pages(ZFILE *zfp, void *src, size_t size, const uint8_t *map)
+{
+    if (savestate_paged)
+        write_marked(zfp, src, size, map);
+    else
+        savestate_zwrite(zfp, src, size);
+}
+
+void savestate_zread_pages(ZFILE *zfp, void *dest, size_t size, uint8_t *map)
+{
+    if (savestate_paged)
+        read_marked(zfp, dest, size, map, NULL);
+    else
+        savestate_zread(zfp, dest, size);
+}
+
+/*
+ * A sparse block is written in the same form as a paged block in a delta
+ * but in a full snapshot too, using the map of pages that have ever been
+ * written.  Loading a full snapshot clears the rest of the block.
+ */
+
+void savestate_zwrite_sparse(ZFILE *zfp, void *src, size_t size, const uint8_t *used, const uint8_t *dirty)
+{
+    write_marked(zfp, src, size, savestate_paged ? dirty : used);
+}
+
+void savestate_zread_sparse(ZFILE *zfp, void *dest, size_t size, uint8_t *used, uint8_t *dirty)
+{
+    if (!savestate_paged) {
+        memset(dest, 0, size);
+        memset(used, 0, (map_pages(size) + 7) >> 3);
+    }
+    read_marked(zfp, dest, size, used, dirty);
+}
+
 static void load_section(FILE *fp, int key, long size)
 {
     log_debug("savestate: found section %c of %ld bytes", key, size);
@@ -375,7 +691,7 @@ static void load_state_three(FILE *fp)
 {
     unsigned char hdr[3];
 
-    while (fread(hdr, sizeof hdr, 1, fp) == 1) {
+    while (!load_abort && fread(hdr, sizeof hdr, 1, fp) == 1) {
         int key = hdr[0];
         long size = hdr[1] | (hdr[2] << 8);
         if (key & 0x80) {
@@ -390,9 +706,102 @@ static void load_state_three(FILE *fp)
     }
 }
 
+/*
+ * Open the base named in a delta.  If it is not where it was when the
+ * delta was saved, look in the same directory as the delta in case the
+ * two have been moved together.
+ */
+
+static FILE *open_base(char **namep)
+{
+    const char *name = *namep;
+    FILE *fp = fopen(name, "rb");
+    if (!fp) {
+        const char *leaf = strrchr(name, '/');
+        const char *dir_end = strrchr(savestate_name, '/');
+#ifdef WIN32
+        const char *bs = strrchr(name, '\\');
+        if (bs && (!leaf || bs > leaf))
+            leaf = bs;
+        bs = strrchr(savestate_name, '\\');
+        if (bs && (!dir_end || bs > dir_end))
+            dir_end = bs;
+#endif
+        leaf = leaf ? leaf + 1 : name;
+        size_t dir_len = dir_end ? dir_end - savestate_name + 1 : 0;
+        size_t leaf_len = strlen(leaf);
+        char *alt = malloc(dir_len + leaf_len + 1);
+        if (alt) {
+            memcpy(alt, savestate_name, dir_len);
+            memcpy(alt + dir_len, leaf, leaf_len + 1);
+            if ((fp = fopen(alt, "rb"))) {
+                free(*namep);
+                *namep = alt;
+            }
+            else
+                free(alt);
+        }
+    }
+    return fp;
+}
+
+static bool load_base(FILE *fp)
+{
+    unsigned char hdr[3], bytes[8];
+
+    if (fread(hdr, sizeof hdr, 1, fp) != 1 || hdr[0] != 'B' || fread(bytes, sizeof bytes, 1, fp) != 1) {
+        log_error("savestate: delta snapshot %s has no base reference", savestate_name);
+        return false;
+    }
+    uint32_t crc = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+    uint32_t size = bytes[4] | (bytes[5] << 8) | (bytes[6] << 16) | ((uint32_t)bytes[7] << 24);
+    char *name = savestate_load_str(fp);
+    bool ok = false;
+    FILE *bfp = open_base(&name);
+    if (bfp) {
+        uint32_t bcrc, bsize;
+        unsigned char magic[8];
+        if (!file_crc(bfp, &bcrc, &bsize) || bcrc != crc || bsize != size)
+            log_error("savestate: base snapshot %s does not match the one delta %s was saved against", name, savestate_name);
+        else if (fseek(bfp, 0, SEEK_SET) || fread(magic, sizeof magic, 1, bfp) != 1 || memcmp(magic, "BEMSNAP3", 8))
+            log_error("savestate: base snapshot %s is not a full snapshot", name);
+        else {
+            log_debug("savestate: loading base snapshot %s", name);
+            FILE *delta_fp = savestate_fp;
+            char *delta_name = savestate_name;
+            savestate_fp = bfp;
+            savestate_name = name;
+            load_state_three(bfp);
+            savestate_fp = delta_fp;
+            savestate_name = delta_name;
+            if (ferror(bfp))
+                log_error("savestate: state not fully restored from base snapshot %s: %s", name, strerror(errno));
+            else if (!load_abort) {
+                set_base(name, bfp);
+                ok = true;
+            }
+        }
+        fclose(bfp);
+    }
+    else
+        log_error("savestate: unable to open base snapshot %s: %s", name, strerror(errno));
+    free(name);
+    return ok;
+}
+
+static void load_state_delta(FILE *fp)
+{
+    if (load_base(fp)) {
+        savestate_paged = true;
+        load_state_three(fp);
+        savestate_paged = false;
+    }
+}
+
 void savestate_doload(void)
 {
     FILE *fp = savestate_fp;
+    load_abort = false;
     switch(savestate_wantload) {
         case '1':
             load_state_one(fp);
@@ -403,16 +812,387 @@ void savestate_doload(void)
         case '3':
             load_state_three(fp);
             break;
+        case '4':
+            load_state_delta(fp);
+            break;
     }
     if (ferror(fp))
         log_error("savestate: state not fully restored from V%c file '%s': %s", savestate_wantload, savestate_name, strerror(errno));
-    else
+    else {
         log_debug("savestate: loaded V%c snapshot file", savestate_wantload);
+        if (savestate_wantload == '3' && !load_abort)
+            set_base(savestate_name, fp);
+    }
     fclose(fp);
     savestate_wantload = 0;
     savestate_fp = NULL;
 }
 
+/*
+ * In-memory snapshots.  These are the same sections as a BEMSNAP3 file
+ * but with nothing compressed, written into a buffer the caller owns so
+ * that taking one is cheap enough to do every few frames.
+ */
+
+#ifdef HAVE_FMEMOPEN
+
+static FILE *mem_open(void *buf, size_t size, const char *mode)
+{
+    return fmemopen(buf, size, mode);
+}
+
+#else
+
+/* No memory streams, e.g. on Windows, so go via a temporary file. */
+
+static FILE *mem_open(void *buf, size_t size, const char *mode)
+{
+    FILE *fp = tmpfile();
+    if (fp && *mode == 'r') {
+        fwrite(buf, size, 1, fp);
+        rewind(fp);
+    }
+    return fp;
+}
+
+#endif
+
+/*
+ * Capture the machine state into buf with the given save function.
+ * Returns the number of bytes used, zero if it did not fit, or -1 if it
+ * cannot be captured at all.
+ */
+
+static long capture(unsigned char *buf, size_t size, void (*save_func)(FILE *fp))
+{
+    if (curtube != -1 && !tube_proc_savestate)
+        return -1;
+    FILE *fp = mem_open(buf, size, "w+b");
+    if (!fp) {
+        log_error("savestate: unable to open in-memory snapshot: %s", strerror(errno));
+        return -1;
+    }
+    FILE *save_fp = savestate_fp;
+    savestate_fp = fp;
+    savestate_raw = true;
+    save_func(fp);
+    savestate_raw = false;
+    savestate_fp = save_fp;
+    long len = ftell(fp);
+    bool ok = !ferror(fp) && len > 0 && (size_t)len < size;
+#ifndef HAVE_FMEMOPEN
+    if (ok) {
+        rewind(fp);
+        ok = fread(buf, len, 1, fp) == 1;
+    }
+#endif
+    fclose(fp);
+    return ok ? len : 0;
+}
+
+/*
+ * Capture the machine state into buf.  Returns the number of bytes used,
+ * zero if it did not fit, in which case the caller should try again with
+ * a bigger buffer, or -1 if the state cannot be captured at all, the
+ * reason for which has been logged.
+ */
+
+long savestate_capture(unsigned char *buf, size_t size)
+{
+    if (curtube != -1 && !tube_proc_savestate) {
+        log_error("savestate: current tube processor does not support saving state");
+        return -1;
+    }
+    return capture(buf, size, save_state);
+}
+
+void savestate_restore(unsigned char *buf, size_t len)
+{
+    if (len < 8 || memcmp(buf, "BEMSNAP3", 8)) {
+        log_error("savestate: invalid in-memory snapshot");
+        return;
+    }
+    FILE *fp = mem_open(buf, len, "rb");
+    if (!fp) {
+        log_error("savestate: unable to open in-memory snapshot: %s", strerror(errno));
+        return;
+    }
+    FILE *save_fp = savestate_fp;
+    savestate_fp = fp;
+    savestate_raw = true;
+    fseek(fp, 8, SEEK_SET);
+    load_state_three(fp);
+    savestate_raw = false;
+    savestate_fp = save_fp;
+    fclose(fp);
+}
+
+/*
+ * Saving to a file.  The state is captured uncompressed into memory on
+ * the emulation thread, which is quick, then a worker thread deflates
+ * the zlib sections and writes the file.  Only a further save or load
+ * has to wait for the worker.
+ */
+
+#define CAPTURE_MIN (1024 * 1024)
+
+typedef struct {
+    FILE *fp;
+    char *name;
+    size_t len;
+    bool full;
+    bool ok;
+    uint32_t crc;
+    uint32_t size;
+} save_job_t;
+
+static unsigned char *cap_buf;
+static size_t cap_size;
+static save_job_t save_job;
+static bool job_queued, job_done;
+
+static ALLEGRO_THREAD *save_thread;
+static ALLEGRO_MUTEX *save_mutex;
+static ALLEGRO_COND *save_cond;
+
+static long capture_grow(void (*save_func)(FILE *fp))
+{
+    long len;
+
+    if (!cap_buf) {
+        if (!(cap_buf = malloc(CAPTURE_MIN))) {
+            log_error("savestate: out of memory for capture buffer");
+            return -1;
+        }
+        cap_size = CAPTURE_MIN;
+    }
+    while (!(len = capture(cap_buf, cap_size, save_func))) {
+        unsigned char *buf = realloc(cap_buf, cap_size * 2);
+        if (!buf) {
+            log_error("savestate: out of memory for capture buffer");
+            return -1;
+        }
+        cap_buf = buf;
+        cap_size *= 2;
+        log_debug("savestate: capture buffer grown to %zu bytes", cap_size);
+    }
+    return len;
+}
+
+static bool write_zsect(FILE *fp, int key, const unsigned char *data, size_t size)
+{
+    unsigned char buf[BUFSIZ];
+    z_stream zs;
+    int res;
+
+    long start = ftell(fp);
+    fseek(fp, 5, SEEK_CUR);
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    deflateInit(&zs, Z_DEFAULT_COMPRESSION);
+    zs.next_in = (unsigned char *)data;
+    zs.avail_in = size;
+    do {
+        zs.next_out = buf;
+        zs.avail_out = BUFSIZ;
+        res = deflate(&zs, Z_FINISH);
+        if (zs.avail_out < BUFSIZ)
+            fwrite(buf, BUFSIZ - zs.avail_out, 1, fp);
+    } while (res == Z_OK);
+    bool ok = res == Z_STREAM_END;
+    if (ok) {
+        log_debug("savestate: section %c saved deflated, %ld bytes into %ld", key & 0x7f, zs.total_in, zs.total_out);
+        save_tail(fp, key, start, start + zs.total_out + 5, zs.total_out);
+    }
+    else
+        log_error("savestate: compression error in section %c: %d(%s)", key & 0x7f, res, zs.msg);
+    deflateEnd(&zs);
+    return ok;
+}
+
+/*
+ * Turn the captured state into a file: sections that were to be
+ * compressed are deflated, the rest copied as they are.
+ */
+
+static void write_job(save_job_t *job)
+{
+    const unsigned char *ptr = cap_buf + 8;
+    const unsigned char *end = cap_buf + job->len;
+    FILE *fp = job->fp;
+    bool ok = true;
+
+    fwrite(cap_buf, 8, 1, fp);
+    while (ok && ptr < end) {
+        int key = *ptr;
+        if (key & 0x80) {
+            size_t size = ptr[1] | (ptr[2] << 8) | (ptr[3] << 16) | ((size_t)ptr[4] << 24);
+            ptr += 5;
+            ok = write_zsect(fp, key, ptr, size);
+            ptr += size;
+        }
+        else {
+            size_t size = ptr[1] | (ptr[2] << 8);
+            fwrite(ptr, size + 3, 1, fp);
+            ptr += size + 3;
+        }
+    }
+    if (ok && ferror(fp)) {
+        log_error("savestate: error writing %s: %s", job->name, strerror(errno));
+        ok = false;
+    }
+    if (ok && job->full)
+        ok = file_crc(fp, &job->crc, &job->size);
+    fclose(fp);
+    job->ok = ok;
+    if (ok)
+        log_debug("savestate: finished writing %s", job->name);
+}
+
+static void *save_worker(ALLEGRO_THREAD *thread, void *arg)
+{
+    al_lock_mutex(save_mutex);
+    while (!al_get_thread_should_stop(thread)) {
+        if (!job_queued) {
+            al_wait_cond(save_cond, save_mutex);
+            continue;
+        }
+        al_unlock_mutex(save_mutex);
+        write_job(&save_job);
+        al_lock_mutex(save_mutex);
+        job_queued = false;
+        job_done = true;
+        al_broadcast_cond(save_cond);
+    }
+    al_unlock_mutex(save_mutex);
+    return NULL;
+}
+
+static bool save_worker_start(void)
+{
+    if (!save_thread) {
+        if (!save_mutex && !(save_mutex = al_create_mutex()))
+            return false;
+        if (!save_cond && !(save_cond = al_create_cond()))
+            return false;
+        if (!(save_thread = al_create_thread(save_worker, NULL)))
+            return false;
+        al_start_thread(save_thread);
+    }
+    return true;
+}
+
+/*
+ * Wait for any save in progress to finish and, if it was a full snapshot
+ * that is still wanted as the base, make it so.
+ */
+
+static void save_wait(void)
+{
+    if (save_thread) {
+        al_lock_mutex(save_mutex);
+        while (job_queued)
+            al_wait_cond(save_cond, save_mutex);
+        al_unlock_mutex(save_mutex);
+    }
+    if (job_done) {
+        if (save_job.full && base_pending && save_job.ok) {
+            savestate_base.name = save_job.name;
+            savestate_base.crc = save_job.crc;
+            savestate_base.size = save_job.size;
+            log_debug("savestate: base is now %s, crc=%08X, size=%u", save_job.name, save_job.crc, save_job.size);
+        }
+        else
+            free(save_job.name);
+        save_job.name = NULL;
+        base_pending = false;
+        job_done = false;
+    }
+}
+
+void savestate_dosave(void)
+{
+    FILE *fp = savestate_fp;
+    bool full = savestate_wantsave != SAVE_DELTA;
+    if (!full && !savestate_base.name) {
+        log_warn("savestate: no base snapshot to save a delta against, saving %s in full", savestate_name);
+        full = true;
+    }
+    long len = capture_grow(full ? save_state : save_delta);
+    char *name = strdup(savestate_name);
+    if (len > 0 && name) {
+        if (full) {
+            /* This state becomes the base once it is safely written. */
+            savestate_forget_base();
+            for (dirty_map_t *dm = dirty_maps; dm; dm = dm->next)
+                memset(dm->bits, 0, dm->bytes);
+            base_pending = true;
+        }
+        save_job.fp = fp;
+        save_job.name = name;
+        save_job.len = len;
+        save_job.full = full;
+        if (save_worker_start()) {
+            al_lock_mutex(save_mutex);
+            job_queued = true;
+            al_signal_cond(save_cond);
+            al_unlock_mutex(save_mutex);
+        }
+        else {
+            log_warn("savestate: unable to start writer thread, saving in the foreground");
+            write_job(&save_job);
+            job_done = true;
+            save_wait();
+        }
+    }
+    else {
+        log_error("savestate: unable to capture state to save to %s", savestate_name);
+        if (name)
+            free(name);
+        fclose(fp);
+    }
+    savestate_wantsave = 0;
+    savestate_fp = NULL;
+}
+
+/*
+ * Finish any save in progress and stop the writer thread.  It is started
+ * again by the next save that needs it.
+ */
+
+void savestate_stop_worker(void)
+{
+    save_wait();
+    if (save_thread) {
+        al_lock_mutex(save_mutex);
+        al_set_thread_should_stop(save_thread);
+        al_broadcast_cond(save_cond);
+        al_unlock_mutex(save_mutex);
+        al_join_thread(save_thread, NULL);
+        al_destroy_thread(save_thread);
+        save_thread = NULL;
+    }
+}
+
+void savestate_close(void)
+{
+    savestate_stop_worker();
+    if (save_cond) {
+        al_destroy_cond(save_cond);
+        save_cond = NULL;
+    }
+    if (save_mutex) {
+        al_destroy_mutex(save_mutex);
+        save_mutex = NULL;
+    }
+    if (cap_buf) {
+        free(cap_buf);
+        cap_buf = NULL;
+    }
+    savestate_forget_base();
+}
+
 void savestate_save_var(unsigned var, FILE *f) {
     uint8_t byte;
 
@@ -1,6 +1,7 @@
 #ifndef __INC_SAVESTATE_H
 #define __INC_SAVESTATE_H
 
+#include <stdint.h>
 #include <stdio.h>
 
 typedef struct _sszfile ZFILE;
@@ -9,13 +10,53 @@ extern int savestate_wantsave, savestate_wantload;
 extern char *savestate_name;
 
 void savestate_save(const char *name);
+void savestate_save_delta(const char *name);
 void savestate_load(const char *name);
 void savestate_dosave(void);
 void savestate_doload(void);
+void savestate_close(void);
+void savestate_stop_worker(void);
+long savestate_capture(unsigned char *buf, size_t size);
+void savestate_restore(unsigned char *buf, size_t len);
 
 void savestate_zread(ZFILE *zfp, void *dest, size_t size);
 void savestate_zwrite(ZFILE *zfp, void *src, size_t size);
 
+/*
+ * Dirty page maps for delta snapshots.  There is one bit for each page of
+ * a memory block, set by the block's write path and cleared when a full
+ * snapshot becomes the base that deltas are taken against.  Blocks saved
+ * with the _pages functions are stored whole in a full snapshot and as
+ * just the changed pages in a delta.  A NULL map marks a block, such as a
+ * ROM, that is never written once the machine is set up.
+ */
+
+#define SAVESTATE_PAGE_SHIFT 8
+#define SAVESTATE_PAGE_SIZE  (1 << SAVESTATE_PAGE_SHIFT)
+
+uint8_t *savestate_dirty_new(size_t size);
+void savestate_dirty_free(uint8_t *map);
+void savestate_dirty_range(uint8_t *map, size_t offset, size_t len);
+void savestate_forget_base(void);
+
+static inline void savestate_dirty(uint8_t *map, size_t offset)
+{
+    offset >>= SAVESTATE_PAGE_SHIFT;
+    map[offset >> 3] |= 1 << (offset & 7);
+}
+
+void savestate_zread_pages(ZFILE *zfp, void *dest, size_t size, uint8_t *map);
+void savestate_zwrite_pages(ZFILE *zfp, void *src, size_t size, const uint8_t *map);
+
+/*
+ * Sparse blocks are large blocks, zero to start with, of which only the
+ * pages marked in the used map have been written.  A full snapshot holds
+ * just the used pages and a delta just the dirty ones.
+ */
+
+void savestate_zread_sparse(ZFILE *zfp, void *dest, size_t size, uint8_t *used, uint8_t *dirty);
+void savestate_zwrite_sparse(ZFILE *zfp, void *src, size_t size, const uint8_t *used, const uint8_t *dirty);
+
 extern void savestate_save_var(unsigned var, FILE *f);
 extern void savestate_save_str(const char *str, FILE *f);
 extern unsigned savestate_load_var(FILE *f);
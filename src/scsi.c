@@ -43,7 +43,9 @@ Offset  Description                 Access
 #include "main.h"
 #include "scsi.h"
 #include "6502.h"
+#include "hdcache.h"
 #include "led.h"
+#include "overlay.h"
 
 #define SCSI_INT_NUM 4
 
@@ -89,8 +91,9 @@ struct scsi_disc {
     bool (*ReadSector)(scsidisc *disc, unsigned char *buf, unsigned block);
     bool (*WriteSector)(scsidisc *disc, unsigned char *buf, unsigned block);
     ALLEGRO_PATH *path;
-    FILE *dat_fp, *dsc_fp;
+    FILE *dsc_fp;
     unsigned blocks;
+    hdcache_t dat;
     unsigned char geom[33];
 };
 
@@ -136,6 +139,10 @@ static void Command(void)
 
 static void Status(void)
 {
+    // The command is complete so write back anything it left cached.
+    if (scsi.lun < SCSI_DRIVES && !hdcache_flush(&SCSIDisc[scsi.lun].dat))
+        scsi.status = (scsi.lun << 5) | 0x02;
+
     scsi.phase = status;
 
     scsi.io = true;
@@ -146,7 +153,7 @@ static void Status(void)
 static bool DiscTestUnitReady(unsigned char *buf)
 {
     log_debug("scsi lun %d: test unit ready", scsi.lun);
-    if (SCSIDisc[scsi.lun].dat_fp == NULL)
+    if (SCSIDisc[scsi.lun].dat.fp == NULL)
         return false;
     return true;
 }
@@ -238,12 +245,13 @@ static bool DiscFormat(unsigned char *buf)
         sd->path = path;
     }
     cpath = al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP);
-    if (sd->dat_fp)
-        fclose(sd->dat_fp);
-    if (!(sd->dat_fp = fopen(cpath, "wb+"))) {
+    hdcache_close(&sd->dat);
+    FILE *fp = overlay_fopen(cpath, "wb+");
+    if (!fp) {
         log_error("scsi lun %d: unable to open %s: %s", scsi.lun, cpath, strerror(errno));
         return false;
     }
+    hdcache_open(&sd->dat, fp);
     return true;
 }
 
@@ -271,10 +279,8 @@ static bool ReadWriteNone(scsidisc *sd, unsigned char *buf, unsigned block)
 static bool ReadSectorSimple(scsidisc *sd, unsigned char *buf, unsigned block)
 {
     log_debug("scsi lun %d: read sector %u", scsi.lun, block);
-    if (fseek(sd->dat_fp, block * 256, SEEK_SET))
-        return false;
-    if (fread(buf, 256, 1, sd->dat_fp) != 1 && ferror(sd->dat_fp)) {
-        log_warn("scsi lun %d: read error: %s", scsi.lun, strerror(errno));
+    if (!hdcache_read(&sd->dat, (off_t)block * 256, buf, 256)) {
+        log_warn("scsi lun %d: read error", scsi.lun);
         return false;
     }
     return true;
@@ -284,10 +290,8 @@ static bool ReadSectorPadded(scsidisc *sd, unsigned char *buf, unsigned block)
 {
     unsigned char padbuf[512];
     unsigned char *end = padbuf + sizeof(padbuf);
-    if (fseek(sd->dat_fp, block * sizeof(padbuf), SEEK_SET))
-        return false;
-    if (fread(padbuf, sizeof(padbuf), 1, sd->dat_fp) != 1 && ferror(sd->dat_fp)) {
-        log_warn("scsi lun %d: read error: %s", scsi.lun, strerror(errno));
+    if (!hdcache_read(&sd->dat, (off_t)block * sizeof(padbuf), padbuf, sizeof(padbuf))) {
+        log_warn("scsi lun %d: read error", scsi.lun);
         return false;
     }
     for (unsigned char *ptr = padbuf; ptr < end; ptr += 2)
@@ -328,10 +332,8 @@ static void Read6(void)
 static bool WriteSectorSimple(scsidisc *sd, unsigned char *buf, unsigned block)
 {
     log_debug("scsi lun %d: write sector %d", scsi.lun, block);
-    if (fseek(sd->dat_fp, block * 256, SEEK_SET))
-        return false;
-    if (fwrite(buf, 256, 1, sd->dat_fp) != 1) {
-        log_warn("scsi lun %d: write error: %s", scsi.lun, strerror(errno));
+    if (!hdcache_write(&sd->dat, (off_t)block * 256, buf, 256)) {
+        log_warn("scsi lun %d: write error", scsi.lun);
         return false;
     }
     return true;
@@ -342,12 +344,10 @@ static bool WriteSectorPadded(scsidisc *sd, unsigned char *buf, unsigned block)
     unsigned char padbuf[512];
     unsigned char *end = padbuf + sizeof(padbuf);
     log_debug("scsi lun %d: write sector %d", scsi.lun, block);
-    if (fseek(sd->dat_fp, block * sizeof(padbuf), SEEK_SET))
-        return false;
     for (unsigned char *ptr = padbuf; ptr < end; ptr += 2)
         *ptr = *buf++;
-    if (fwrite(padbuf, sizeof(padbuf), 1, sd->dat_fp) != 1) {
-        log_warn("scsi lun %d: write error: %s", scsi.lun, strerror(errno));
+    if (!hdcache_write(&sd->dat, (off_t)block * sizeof(padbuf), padbuf, sizeof(padbuf))) {
+        log_warn("scsi lun %d: write error", scsi.lun);
         return false;
     }
     return true;
@@ -416,10 +416,8 @@ static bool DiscStartStop(unsigned char *buf)
 {
     if (buf[4] & 0x02) {
         // Eject Disc
-        FILE *fp = SCSIDisc[scsi.lun].dat_fp;
         log_debug("scsi lun %d: eject", scsi.lun);
-        if (fp)
-            fflush(fp);
+        hdcache_flush(&SCSIDisc[scsi.lun].dat);
     }
     else
         log_debug("scsi lun %d: start", scsi.lun);
@@ -551,9 +549,7 @@ static bool WriteGeometory(unsigned char *buf)
     FILE *fp = sd->dsc_fp;
     if (!fp)
         return false;
-    if (fseek(fp, 0, SEEK_SET))
-        return false;
-    if (fwrite(buf, 22, 1, fp) != 1)
+    if (overlay_write(fp, 0, buf, 22) != 22)
         return false;
     return true;
 }
@@ -789,18 +785,14 @@ void scsi_reset(void)
     BusFree();
 }
 
-static bool scsi_check_adfs(FILE *fp, unsigned off1, unsigned off2, const char *pattern, size_t len)
+static bool scsi_check_adfs(hdcache_t *hc, unsigned off1, unsigned off2, const char *pattern, size_t len)
 {
     char id1[10], id2[10];
-    if (fseek(fp, off1, SEEK_SET))
-        return false;
-    if (fread(id1, len, 1, fp) != 1)
+    if (!hdcache_read(hc, off1, id1, len))
         return false;
     if (memcmp(id1+1, pattern, len-1))
         return false;
-    if (fseek(fp, off2, SEEK_SET))
-        return false;
-    if (fread(id2, len, 1, fp) != 1)
+    if (!hdcache_read(hc, off2, id2, len))
         return false;
     if (memcmp(id1, id2, len))
         return false;
@@ -827,24 +819,28 @@ static void scsi_init_lun(scsidisc *sd, int lun)
     char name[50];
     sd->ReadSector  = ReadWriteNone;
     sd->WriteSector = ReadWriteNone;
-    sd->dat_fp = sd->dsc_fp = NULL;
+    sd->dsc_fp = NULL;
+    hdcache_open(&sd->dat, NULL);
     sd->blocks = 0;
     snprintf(name, sizeof(name), "scsi/scsi%d", lun);
     if ((path = find_cfg_file(name, ".dat"))) {
         sd->path = path;
         const char *cpath = al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP);
-        FILE *fp = fopen(cpath, "rb+");
-        if (fp) {
-            if (scsi_check_adfs(fp, 0x200, 0x6fa, "Hugo", 5))
+        FILE *fp = overlay_fopen(cpath, "rb+");
+        if (fp && !hdcache_open(&sd->dat, fp)) {
+            log_error("scsi lun %d: unable to use data file %s", lun, cpath);
+            overlay_fclose(fp);
+        }
+        else if (fp) {
+            if (scsi_check_adfs(&sd->dat, 0x200, 0x6fa, "Hugo", 5))
                 scsi_select_simple(sd, lun, cpath, "detected as simple (SCSI) format");
-            else if (scsi_check_adfs(fp, 0x400, 0xdf4, "\0H\0u\0g\0o", 10))
+            else if (scsi_check_adfs(&sd->dat, 0x400, 0xdf4, "\0H\0u\0g\0o", 10))
                 scsi_select_padded(sd, lun, cpath, "detected as padded (IDE) format");
             else
                 scsi_select_simple(sd, lun, cpath, "selected as simple (SCSI) format by default");
-            sd->dat_fp = fp;
             al_set_path_extension(path, ".dsc");
             cpath = al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP);
-            if ((fp = fopen(cpath, "rb+"))) {
+            if ((fp = overlay_fopen(cpath, "rb+"))) {
                 if (fread(sd->geom, 1, sizeof(sd->geom), fp) >= 22) {
                     unsigned heads = sd->geom[15];
                     unsigned cyls = (sd->geom[13] << 8) | sd->geom[14];
@@ -853,19 +849,18 @@ static void scsi_init_lun(scsidisc *sd, int lun)
                 }
                 else {
                     log_warn("scsi lun %d: short geometry file %s", lun, cpath);
-                    fclose(fp);
+                    overlay_fclose(fp);
                 }
             }
             if (sd->blocks == 0) {
                 unsigned bytes, cyl;
-                fseek(sd->dat_fp, 0, SEEK_END);
-                bytes = ftell(sd->dat_fp);
+                bytes = hdcache_size(&sd->dat);
                 memset(sd->geom, 0, sizeof(sd->geom));
                 cyl = 1 + ((bytes - 1) / (33 * 255));
                 sd->geom[13] = cyl >> 8;
                 sd->geom[14] = cyl & 0xff;
                 sd->geom[15] = 255;
-                if ((fp = fopen(cpath, "wb+"))) {
+                if ((fp = overlay_fopen(cpath, "wb+"))) {
                     fwrite(sd->geom, sizeof(sd->geom), 1, fp);
                     fflush(fp);
                     sd->dsc_fp = fp;
@@ -890,12 +885,9 @@ void scsi_close(void)
 {
     for (int lun = 0; lun < SCSI_DRIVES; lun++) {
         scsidisc *sd = &SCSIDisc[lun];
-        if (sd->dat_fp) {
-            fclose(sd->dat_fp);
-            sd->dat_fp = NULL;
-        }
+        hdcache_close(&sd->dat);
         if (sd->dsc_fp) {
-            fclose(sd->dsc_fp);
+            overlay_fclose(sd->dsc_fp);
             sd->dsc_fp = NULL;
         }
         if (sd->path) {
@@ -13,11 +13,18 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <zlib.h>
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 #include "b-em.h"
 #include "disc.h"
 #include "sdf.h"
 #include "gui-allegro.h"
+#include "overlay.h"
 
 FILE *sdf_fp[NUM_DRIVES], *mmb_fp;
 off_t mmb_offset[NUM_DRIVES][2];
@@ -60,13 +67,228 @@ static uint8_t sdf_side;
 static uint8_t sdf_track;
 static uint8_t sdf_sector;
 
+/*
+ * Sector data is not read and written a byte at a time from the image
+ * file but through a cache of one track per drive, loaded when the track
+ * is seeked to.  Writes update the cache and are written back to the
+ * file as one block when the drive moves to another track, spins down
+ * or the disc is closed.  The cache is dropped at spin down too so that,
+ * with the image unlocked, another process sharing the image file sees
+ * our changes and we see its.
+ *
+ * The two drives may share one file, an MMB, so a drive's cache is also
+ * written back and dropped when the other drive loads a track from, or
+ * writes to, the same file.
+ *
+ * So that a write-back is not left half done if the emulator or host
+ * dies part way through, the data is first written and synced to a
+ * journal file beside the image, and the journal is removed once the
+ * image itself has been synced.  A journal found when an image is
+ * opened is replayed into it.
+ */
+
+#define CACHE_SIZE 8192
+
+static struct {
+    off_t    start;     // file offset of data[0], -1 if nothing cached.
+    off_t    posn;      // file offset of the next byte to transfer.
+    unsigned size;
+    unsigned dirty_lo;
+    unsigned dirty_hi;
+    uint8_t  data[CACHE_SIZE];
+} cache[NUM_DRIVES];
+
+static char *journal_fn[NUM_DRIVES];
+
+#define JOURNAL_MAGIC "B-EM JNL"
+#define JOURNAL_HDR   20
+
+static void put_le32(uint8_t *ptr, uint32_t value)
+{
+    ptr[0] = value;
+    ptr[1] = value >> 8;
+    ptr[2] = value >> 16;
+    ptr[3] = value >> 24;
+}
+
+static uint32_t get_le32(const uint8_t *ptr)
+{
+    return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+static char *journal_name(const char *fn)
+{
+    size_t len = strlen(fn);
+    char *jfn = malloc(len + 5);
+    if (jfn) {
+        memcpy(jfn, fn, len);
+        memcpy(jfn + len, ".jnl", 5);
+    }
+    return jfn;
+}
+
+static bool sync_file(FILE *fp)
+{
+    if (fflush(fp))
+        return false;
+#ifdef WIN32
+    return !_commit(_fileno(fp));
+#else
+    return !fsync(fileno(fp));
+#endif
+}
+
+static bool journal_write(const char *jfn, off_t offset, const uint8_t *data, unsigned len)
+{
+    FILE *jfp = fopen(jfn, "wb");
+    if (jfp) {
+        uint8_t hdr[JOURNAL_HDR];
+        memcpy(hdr, JOURNAL_MAGIC, 8);
+        put_le32(hdr + 8, offset);
+        put_le32(hdr + 12, len);
+        put_le32(hdr + 16, crc32(crc32(0L, Z_NULL, 0), data, len));
+        bool ok = fwrite(hdr, sizeof(hdr), 1, jfp) == 1 && fwrite(data, len, 1, jfp) == 1 && sync_file(jfp);
+        if (!fclose(jfp) && ok)
+            return true;
+        remove(jfn);
+    }
+    log_warn("sdf: unable to write journal %s: %s", jfn, strerror(errno));
+    return false;
+}
+
+/*
+ * Replay a journal left by a write-back that did not complete.  One that
+ * is itself incomplete was never followed by a write to the image, so is
+ * simply discarded.
+ */
+
+void sdf_journal_replay(const char *fn, FILE *fp)
+{
+    char *jfn = journal_name(fn);
+    if (!jfn)
+        return;
+    FILE *jfp = fopen(jfn, "rb");
+    if (jfp) {
+        uint8_t hdr[JOURNAL_HDR], *data = NULL;
+        if (fread(hdr, sizeof(hdr), 1, jfp) == 1 && !memcmp(hdr, JOURNAL_MAGIC, 8)) {
+            uint32_t offset = get_le32(hdr + 8);
+            uint32_t size = get_le32(hdr + 12);
+            if (size <= CACHE_SIZE && (data = malloc(size)) && fread(data, size, 1, jfp) == 1 &&
+                get_le32(hdr + 16) == crc32(crc32(0L, Z_NULL, 0), data, size)) {
+                log_warn("sdf: replaying journal %s, %u bytes at %u", jfn, size, offset);
+                if (overlay_write(fp, offset, data, size) != size || !sync_file(fp)) {
+                    log_error("sdf: unable to replay journal %s: %s", jfn, strerror(errno));
+                    fclose(jfp);
+                    free(data);
+                    free(jfn);
+                    return;
+                }
+            }
+            else
+                log_warn("sdf: discarding incomplete journal %s", jfn);
+        }
+        fclose(jfp);
+        free(data);
+        remove(jfn);
+    }
+    free(jfn);
+}
+
+static void cache_flush(int drive)
+{
+    unsigned lo = cache[drive].dirty_lo;
+    unsigned hi = cache[drive].dirty_hi;
+    if (hi > lo) {
+        FILE *fp = sdf_fp[drive];
+        off_t offset = cache[drive].start + lo;
+        const uint8_t *data = cache[drive].data + lo;
+        const char *jfn = journal_fn[drive];
+        log_debug("sdf: drive %d: writing back %u bytes at %ld", drive, hi - lo, (long)offset);
+        bool journalled = jfn && journal_write(jfn, offset, data, hi - lo);
+        if (overlay_write(fp, offset, data, hi - lo) != hi - lo)
+            log_error("sdf: drive %d: error writing disc image: %s", drive, strerror(errno));
+        else if (journalled) {
+            if (sync_file(fp))
+                remove(jfn);
+            else
+                log_error("sdf: drive %d: error syncing disc image: %s", drive, strerror(errno));
+        }
+        cache[drive].dirty_lo = cache[drive].dirty_hi = 0;
+    }
+}
+
+static void cache_drop(int drive)
+{
+    cache_flush(drive);
+    cache[drive].start = -1;
+}
+
+static void cache_drop_shared(int drive, off_t start, off_t end)
+{
+    int other = drive ^ 1;
+    off_t ostart = cache[other].start;
+    if (sdf_fp[other] == sdf_fp[drive] && ostart >= 0 && ostart < end && ostart + cache[other].size > start)
+        cache_drop(other);
+}
+
+static void cache_load(int drive, off_t start)
+{
+    cache_flush(drive);
+    cache_drop_shared(drive, start, start + cache[drive].size);
+    FILE *fp = sdf_fp[drive];
+    size_t bytes = overlay_read(fp, start, cache[drive].data, cache[drive].size);
+    /* Beyond the end of the image reads as freshly formatted. */
+    memset(cache[drive].data + bytes, 0xe5, cache[drive].size - bytes);
+    cache[drive].start = start;
+}
+
+static uint8_t *cache_ptr(int drive)
+{
+    off_t posn = cache[drive].posn++;
+    off_t start = cache[drive].start;
+    if (start < 0 || posn < start || posn >= start + cache[drive].size) {
+        cache_load(drive, posn);
+        start = posn;
+    }
+    return cache[drive].data + (posn - start);
+}
+
+static int cache_getc(int drive)
+{
+    return *cache_ptr(drive);
+}
+
+static void cache_putc(int b, int drive)
+{
+    uint8_t *ptr = cache_ptr(drive);
+    *ptr = b;
+    unsigned offset = ptr - cache[drive].data;
+    if (cache[drive].dirty_hi == cache[drive].dirty_lo) {
+        off_t start = cache[drive].start;
+        cache_drop_shared(drive, start, start + cache[drive].size);
+        cache[drive].dirty_lo = offset;
+        cache[drive].dirty_hi = offset + 1;
+    }
+    else if (offset < cache[drive].dirty_lo)
+        cache[drive].dirty_lo = offset;
+    else if (offset >= cache[drive].dirty_hi)
+        cache[drive].dirty_hi = offset + 1;
+}
+
 static void sdf_close(int drive)
 {
     if (drive < NUM_DRIVES) {
+        if (sdf_fp[drive])
+            cache_drop(drive);
         geometry[drive] = NULL;
+        drives[drive].fastok = 0;
+        if (journal_fn[drive]) {
+            free(journal_fn[drive]);
+            journal_fn[drive] = NULL;
+        }
         if (sdf_fp[drive]) {
             if (sdf_fp[drive] != mmb_fp)
-                fclose(sdf_fp[drive]);
+                overlay_fclose(sdf_fp[drive]);
             sdf_fp[drive] = NULL;
         }
     }
@@ -116,9 +338,12 @@ static bool io_seek(const struct sdf_geometry *geo, uint8_t drive, uint8_t secto
                     return false;
                 }
             }
-            offset += sector * geo->sector_size + mmb_offset[drive][side];
+            off_t start = offset + mmb_offset[drive][side];
+            offset = start + sector * geo->sector_size;
             log_debug("sdf: drive %u: seeking for side=%u, track=%u, sector=%u to %d bytes\n", drive, side, track, sector, offset);
-            fseek(sdf_fp[drive], offset, SEEK_SET);
+            if (start != cache[drive].start)
+                cache_load(drive, start);
+            cache[drive].posn = offset;
             return true;
         }
         else
@@ -129,14 +354,17 @@ static bool io_seek(const struct sdf_geometry *geo, uint8_t drive, uint8_t secto
     return false;
 }
 
-FILE *sdf_owseek(uint8_t drive, uint8_t sector, uint8_t track, uint8_t side, uint16_t ssize)
+static FILE *ow_seek(uint8_t drive, uint8_t sector, uint8_t track, uint8_t side, uint16_t ssize)
 {
     if (drive < NUM_DRIVES) {
         const struct sdf_geometry *geo = geometry[drive];
         if (geo) {
             if (ssize == geo->sector_size) {
-                if (io_seek(geo, drive, sector, track, side))
+                if (io_seek(geo, drive, sector, track, side)) {
+                    cache_drop(drive);
+                    cache_drop_shared(drive, 0, INT32_MAX);
                     return sdf_fp[drive];
+                }
             }
             else
                 log_debug("sdf: osword seek, sector size %u does not match disk (%u)", ssize, geo->sector_size);
@@ -149,6 +377,29 @@ FILE *sdf_owseek(uint8_t drive, uint8_t sector, uint8_t track, uint8_t side, uin
     return NULL;
 }
 
+bool sdf_owread(uint8_t drive, uint8_t sector, uint8_t track, uint8_t side, uint16_t ssize, void *buf, size_t bytes)
+{
+    FILE *fp = ow_seek(drive, sector, track, side, ssize);
+    if (fp) {
+        size_t got = overlay_read(fp, cache[drive].posn, buf, bytes);
+        /* Beyond the end of the image reads as freshly formatted. */
+        memset((uint8_t *)buf + got, 0xe5, bytes - got);
+        return true;
+    }
+    return false;
+}
+
+bool sdf_owwrite(uint8_t drive, uint8_t sector, uint8_t track, uint8_t side, uint16_t ssize, const void *buf, size_t bytes)
+{
+    FILE *fp = ow_seek(drive, sector, track, side, ssize);
+    if (fp) {
+        if (overlay_write(fp, cache[drive].posn, buf, bytes) != bytes)
+            log_error("sdf: drive %d: error writing disc image: %s", drive, strerror(errno));
+        return true;
+    }
+    return false;
+}
+
 static const struct sdf_geometry *check_seek(int drive, int sector, int track, int side, unsigned flags)
 {
     if (drive < NUM_DRIVES) {
@@ -357,7 +608,7 @@ static void sdf_poll_wrtrack_data(void)
     int b = fdc_getdata(0);
     log_debug("sdf: sdf_poll_wrtrack_data0 byte=%02X, count=%d", b, count);
     if (b != -1) {
-        putc(b, sdf_fp[sdf_drive]);
+        cache_putc(b, sdf_drive);
         if (!--count)
             state = ST_WRTRACK_DATACRC;
     }
@@ -384,7 +635,7 @@ static void sdf_poll()
     int c;
     uint16_t sect_size;
 
-    if (++sdf_time <= 16)
+    if (++sdf_time <= 16 && !disc_fast(sdf_drive))
         return;
     sdf_time = 0;
 
@@ -417,9 +668,7 @@ static void sdf_poll()
             break;
 
         case ST_READSECTOR:
-            if ((c = getc(sdf_fp[sdf_drive])) == EOF)
-                c = 0xe5;
-            fdc_data(c);
+            fdc_data(cache_getc(sdf_drive));
             if (--count == 0) {
                 fdc_finishread(false);
                 state = ST_IDLE;
@@ -438,7 +687,7 @@ static void sdf_poll()
                 log_warn("sdf: data underrun on write");
                 count++;
             } else {
-                putc(c, sdf_fp[sdf_drive]);
+                cache_putc(c, sdf_drive);
                 if (count == 0) {
                     fdc_finishread(false);
                     state = ST_IDLE;
@@ -513,9 +762,9 @@ static void sdf_poll()
             fdc_getdata(--count == 0);  // discard sector size.
             log_debug("sdf: poll format secsz, count=%d, sector=%d", count, sdf_sector);
             if (sdf_sector < geometry[sdf_drive]->sectors_per_track) {
-                log_debug("sdf: poll format secsz, filling at offset %lu", ftell(sdf_fp[sdf_drive]));
+                log_debug("sdf: poll format secsz, filling at offset %ld", (long)cache[sdf_drive].posn);
                 for (unsigned i = 0; i < geometry[sdf_drive]->sector_size; i++)
-                    putc(0xe5, sdf_fp[sdf_drive]);
+                    cache_putc(0xe5, sdf_drive);
                 sdf_sector++;
             }
             if (count == 0) {
@@ -591,7 +840,7 @@ static void sdf_spinup(int drive)
 #ifndef WIN32
     FILE *fp = sdf_fp[drive];
     if (fp)
-        sdf_lock(drive, fp, F_WRLCK);
+        sdf_lock(drive, fp, overlay_attached(fp) ? F_RDLCK : F_WRLCK);
 #endif
 }
 
@@ -600,6 +849,7 @@ static void sdf_spindown(int drive)
     FILE *fp = sdf_fp[drive];
     log_debug("sdf: spindown drive %d", drive);
     if (fp) {
+        cache_drop(drive);
         fflush(fp);
 #ifndef WIN32
         sdf_lock(drive, fp, F_UNLCK);
@@ -609,7 +859,15 @@ static void sdf_spindown(int drive)
 
 void sdf_mount(int drive, const char *fn, FILE *fp, const struct sdf_geometry *geo)
 {
+    unsigned size = geo->sectors_per_track * geo->sector_size;
+    cache[drive].size = size < CACHE_SIZE ? size : CACHE_SIZE;
+    cache[drive].start = -1;
+    cache[drive].dirty_lo = cache[drive].dirty_hi = 0;
     sdf_fp[drive] = fp;
+    if (journal_fn[drive])
+        free(journal_fn[drive]);
+    // Overlaid and temporary images are not kept, so need no journal.
+    journal_fn[drive] = overlay_images ? NULL : journal_name(fn);
     log_info("Loaded drive %d with %s, format %s, %s, %d tracks, %s, %d %d byte sectors/track",
              drive, fn, geo->name, sdf_desc_sides(geo), geo->tracks,
              sdf_desc_dens(geo), geo->sectors_per_track, geo->sector_size);
@@ -627,13 +885,14 @@ void sdf_mount(int drive, const char *fn, FILE *fp, const struct sdf_geometry *g
     drives[drive].abort       = sdf_abort;
     drives[drive].spinup      = sdf_spinup;
     drives[drive].spindown    = sdf_spindown;
+    drives[drive].fastok      = 1;
 
 }
 
 int sdf_load(int this_drive, const char *fn, const char *ext)
 {
     drives[this_drive].writeprot = 0;
-    FILE *this_fp = fopen(fn, "rb+");
+    FILE *this_fp = overlay_fopen(fn, "rb+");
     if (this_fp == NULL) {
         if ((this_fp = fopen(fn, "rb")) == NULL) {
             log_error("Unable to open file '%s' for reading - %s", fn, strerror(errno));
@@ -641,6 +900,8 @@ int sdf_load(int this_drive, const char *fn, const char *ext)
         }
         drives[this_drive].writeprot = 1;
     }
+    else if (!overlay_attached(this_fp))
+        sdf_journal_replay(fn, this_fp);
 #ifdef linux
 #include <sys/stat.h>
     /* On linux only we check if the disc about to be loaded is already
@@ -673,7 +934,7 @@ int sdf_load(int this_drive, const char *fn, const char *ext)
     }
     else {
         log_error("sdf: drive %d: unable to determine geometry for %s", this_drive, fn);
-        fclose(this_fp);
+        overlay_fclose(this_fp);
         return -1;
     }
 }
@@ -684,7 +945,7 @@ void sdf_new_disc(int drive, ALLEGRO_PATH *fn, const struct sdf_geometry *geo)
         log_error("sdf: drive %d: creation of file disc type %s not supported", drive, geo->name);
     else {
         const char *cpath = al_path_cstr(fn, ALLEGRO_NATIVE_PATH_SEP);
-        FILE *f = fopen(cpath, "wb+");
+        FILE *f = overlay_fopen(cpath, "wb+");
         if (f) {
             drives[drive].writeprot = 0;
             geo->new_disc(f, geo);
@@ -61,7 +61,9 @@ const char *sdf_desc_dens(const struct sdf_geometry *geo);
 void sdf_new_disc(int drive, ALLEGRO_PATH *fn, const struct sdf_geometry *geo);
 void sdf_mount(int drive, const char *fn, FILE *fp, const struct sdf_geometry *geo);
 int sdf_load(int drive, const char *fn, const char *ext);
-FILE *sdf_owseek(uint8_t drive, uint8_t sector, uint8_t track, uint8_t side, uint16_t ssize);
+void sdf_journal_replay(const char *fn, FILE *fp);
+bool sdf_owread(uint8_t drive, uint8_t sector, uint8_t track, uint8_t side, uint16_t ssize, void *buf, size_t bytes);
+bool sdf_owwrite(uint8_t drive, uint8_t sector, uint8_t track, uint8_t side, uint16_t ssize, const void *buf, size_t bytes);
 
 //DB: bodge for VS
 #ifdef _MSC_VER
@@ -10,16 +10,55 @@
 #include "uservia.h"
 #include "music5000.h"
 #include "paula.h"
+#include "resample.h"
 
 bool sound_internal = false, sound_beebsid = false, sound_dac = false;
 bool sound_ddnoise = false, sound_tape = false;
 bool sound_music5000 = false, sound_filter = false;
 bool sound_paula = false;
 
+int sound_dev_freq = 0;      // requested output rate, 0 to negotiate.
+int sound_dev_period = 10;   // requested output fragment length, ms.
+unsigned sound_freq;         // output rate in use.
+
 static ALLEGRO_VOICE *voice;
 static ALLEGRO_MIXER *mixer;
 static ALLEGRO_AUDIO_STREAM *stream;
 
+#define NUM_FRAGS_SO 4
+#define MAX_PERIOD   80
+
+static unsigned sound_period;    // current fragment length, ms.
+static unsigned frag_len;        // frames per output fragment.
+static double sound_last_frag;   // host time the last fragment was queued.
+static int sound_underruns;
+
+/*
+ * Every source running on the emulation thread is resampled to the output
+ * rate by its own resampler into a FIFO and, once all the active sources
+ * have a whole fragment, they are mixed into the single output stream.
+ * The sources are all produced in step with emulated time so the FIFOs
+ * stay level with each other and nothing can drift.
+ */
+
+typedef struct {
+    const char *name;
+    unsigned freq;
+    unsigned chans;
+    bool active;
+    resampler_t rs;
+    float *fifo;
+    size_t fill;
+    size_t size;
+} sound_src_t;
+
+static sound_src_t sources[SOUND_NSRC] = {
+    { "internal",   FREQ_SO, 1 },
+    { "Music 5000", FREQ_M5, 2 }
+};
+
+static double sound_speed = 1.0;
+
 static int sound_pos = 0;
 static int sound_sn_pos = 0;
 
@@ -109,9 +148,180 @@ static void sound_rec_int(short *buf)
     }
 }
 
+static bool sound_create_stream(void)
+{
+    frag_len = (sound_freq * sound_period) / 1000;
+    if ((stream = al_create_audio_stream(NUM_FRAGS_SO, frag_len, sound_freq, ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_2))) {
+        if (al_attach_audio_stream_to_mixer(stream, mixer)) {
+            log_debug("sound: output fragments of %u frames (%ums)", frag_len, sound_period);
+            return true;
+        }
+        log_error("sound: unable to attach output stream to mixer");
+        al_destroy_audio_stream(stream);
+        stream = NULL;
+    }
+    else
+        log_error("sound: unable to create output stream");
+    return false;
+}
+
+/*
+ * The device has drained the whole queue even though we have been keeping
+ * it fed, so the period is too short for this host.  A few of those in a
+ * row and the fragments are made longer.  A queue that drained because
+ * the emulation was paused or stalled does not count.
+ */
+
+static void sound_check_underrun(double now)
+{
+    if (al_get_available_audio_stream_fragments(stream) < NUM_FRAGS_SO || (now - sound_last_frag) > (NUM_FRAGS_SO * sound_period / 1000.0)) {
+        sound_underruns = 0;
+        return;
+    }
+    if (++sound_underruns >= 4 && sound_period < MAX_PERIOD) {
+        unsigned period = sound_period * 2;
+        if (period > MAX_PERIOD)
+            period = MAX_PERIOD;
+        log_info("sound: underruns with %ums fragments, increasing to %ums", sound_period, period);
+        al_destroy_audio_stream(stream);
+        sound_period = period;
+        sound_underruns = 0;
+        sound_create_stream();
+    }
+}
+
+static void sound_mix_out(void)
+{
+    for (;;) {
+        sound_src_t *src;
+        bool any = false;
+        for (src = sources; src < sources + SOUND_NSRC; src++) {
+            if (src->active) {
+                if (src->fill < frag_len)
+                    return;
+                any = true;
+            }
+        }
+        if (!any)
+            return;
+        double now = al_get_time();
+        float *buf = NULL;
+        if (stream) {
+            sound_check_underrun(now);
+            if (stream)
+                buf = al_get_audio_stream_fragment(stream);
+        }
+        if (buf) {
+            memset(buf, 0, frag_len * 2 * sizeof(float));
+            for (src = sources; src < sources + SOUND_NSRC; src++) {
+                if (src->active) {
+                    const float *in = src->fifo;
+                    float *out = buf;
+                    if (src->chans == 1) {
+                        for (unsigned c = 0; c < frag_len; c++) {
+                            *out++ += *in;
+                            *out++ += *in++;
+                        }
+                    }
+                    else
+                        for (unsigned c = 0; c < frag_len * 2; c++)
+                            *out++ += *in++;
+                }
+            }
+            al_set_audio_stream_fragment(stream, buf);
+            al_set_audio_stream_playing(stream, true);
+            sound_last_frag = now;
+        } else
+            log_debug("sound: overrun");
+        for (src = sources; src < sources + SOUND_NSRC; src++) {
+            if (src->active) {
+                src->fill -= frag_len;
+                memmove(src->fifo, src->fifo + frag_len * src->chans, src->fill * src->chans * sizeof(float));
+            }
+        }
+    }
+}
+
+/*
+ * A source starting up joins the others with silence up to where they
+ * are, so all the FIFOs stay level.
+ */
+
+static bool sound_source_start(sound_src_t *src)
+{
+    size_t fill = 0;
+
+    if (!src->rs.coef && !resample_init(&src->rs, src->chans, src->freq * sound_speed / sound_freq))
+        return false;
+    resample_reset(&src->rs);
+    for (sound_src_t *other = sources; other < sources + SOUND_NSRC; other++)
+        if (other->active && other->fill > fill)
+            fill = other->fill;
+    if (fill > src->size) {
+        float *fifo = realloc(src->fifo, fill * src->chans * sizeof(float));
+        if (!fifo)
+            return false;
+        src->fifo = fifo;
+        src->size = fill;
+    }
+    if (fill)
+        memset(src->fifo, 0, fill * src->chans * sizeof(float));
+    src->fill = fill;
+    src->active = true;
+    log_debug("sound: %s source started", src->name);
+    return true;
+}
+
+void sound_source_write(int snum, const float *in, size_t frames)
+{
+    sound_src_t *src = sources + snum;
+
+    if (!mixer || (!src->active && !sound_source_start(src)))
+        return;
+    size_t want = src->fill + (size_t)((src->rs.in_len + frames) / src->rs.step) + 2;
+    if (want > src->size) {
+        float *fifo = realloc(src->fifo, want * src->chans * sizeof(float));
+        if (!fifo) {
+            log_error("sound: out of memory for %s source", src->name);
+            return;
+        }
+        src->fifo = fifo;
+        src->size = want;
+    }
+    src->fill += resample_run(&src->rs, in, frames, src->fifo + src->fill * src->chans, src->size - src->fill);
+    sound_mix_out();
+}
+
+void sound_source_stop(int snum)
+{
+    sound_src_t *src = sources + snum;
+
+    if (src->active) {
+        src->active = false;
+        src->fill = 0;
+        log_debug("sound: %s source stopped", src->name);
+        sound_mix_out();
+    }
+}
+
+/*
+ * Away from normal speed the sources are resampled as if they ran at
+ * their nominal rate times the speed so the output keeps up with the
+ * emulation, at the expense of pitch.
+ */
+
+void sound_set_speed(double multiplier)
+{
+    sound_speed = multiplier;
+    if (sound_freq)
+        for (sound_src_t *src = sources; src < sources + SOUND_NSRC; src++)
+            if (src->rs.coef)
+                resample_set_step(&src->rs, src->freq * multiplier / sound_freq);
+}
+
 static void sound_poll_all(void)
 {
-    if ((sound_internal || sound_beebsid) && stream) {
+    if ((sound_internal || sound_beebsid) && mixer) {
         int16_t temp_buffer[2] = {0};
 
         if (sound_beebsid)
@@ -130,26 +340,31 @@ static void sound_poll_all(void)
         // skip forward 8 mono samples
         sound_pos += 8;
         if (sound_pos == BUFLEN_SO) {
-            float *buf = al_get_audio_stream_fragment(stream);
-            if (buf) {
-                if (sound_filter) {
-                    for (int c = 0; c < BUFLEN_SO; c++)
-                        buf[c] = iir((float)sound_buffer[c] / 32767.0);
-                    sound_rec_float(buf);
-                } else {
-                    for (int c = 0; c < BUFLEN_SO; c++)
-                        buf[c] = (float)sound_buffer[c] / 32767.0;
-                    sound_rec_int(sound_buffer);
-                }
-                al_set_audio_stream_fragment(stream, buf);
-                al_set_audio_stream_playing(stream, true);
-            } else
-                log_debug("sound: overrun");
+            float buf[BUFLEN_SO];
+            if (sound_filter) {
+                for (int c = 0; c < BUFLEN_SO; c++)
+                    buf[c] = iir((float)sound_buffer[c] / 32767.0);
+                sound_rec_float(buf);
+            } else {
+                for (int c = 0; c < BUFLEN_SO; c++)
+                    buf[c] = (float)sound_buffer[c] / 32767.0;
+                sound_rec_int(sound_buffer);
+            }
+            sound_source_write(SOUND_SRC_SO, buf, BUFLEN_SO);
             sound_pos = 0;
             sound_sn_pos = 0;
             memset(sound_buffer, 0, sizeof(sound_buffer));
         }
     }
+    else {
+        if (sources[SOUND_SRC_SO].active)
+            sound_source_stop(SOUND_SRC_SO);
+        if (sound_pos) {
+            memset(sound_buffer, 0, sizeof(sound_buffer));
+            sound_pos = 0;
+        }
+        sound_sn_pos = 0;
+    }
 }
 
 void sound_poll(int cycles)
@@ -173,53 +388,130 @@ void sound_poll(int cycles)
     }
 }
 
-static ALLEGRO_VOICE *sound_create_voice(void)
+static bool sound_running(void)
 {
-    ALLEGRO_VOICE *voice;
+    if (stream)
+        for (sound_src_t *src = sources; src < sources + SOUND_NSRC; src++)
+            if (src->active)
+                return true;
+    return false;
+}
 
-    if ((voice = al_create_voice(FREQ_SO, ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_1))) {
-        log_debug("sound: created voice with standard sound freq, float depth");
-        return voice;
-    }
-    if ((voice = al_create_voice(FREQ_SO, ALLEGRO_AUDIO_DEPTH_INT24, ALLEGRO_CHANNEL_CONF_1))) {
-        log_debug("sound: created voice with standard sound freq, 24bit depth");
-        return voice;
-    }
-    if ((voice = al_create_voice(FREQ_SO, ALLEGRO_AUDIO_DEPTH_INT16, ALLEGRO_CHANNEL_CONF_1))) {
-        log_debug("sound: created voice with standard sound freq, 16bit depth");
-        return voice;
-    }
-    if ((voice = al_create_voice(FREQ_DD, ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_1))) {
-        log_debug("sound: created voice with ddnoise freq, float depth");
-        return voice;
+/* How much sound output is waiting to be played, in seconds, or -1 if
+ * the stream is not running so cannot be used as a clock.  Allegro only
+ * reports whole fragments so the time the device has spent on the
+ * fragment at the head of the queue is estimated from when the queue
+ * last got shorter. */
+
+static unsigned sound_prev_queued;
+static double sound_drain_time;
+
+double sound_latency(void)
+{
+    if (sound_running() && al_get_audio_stream_playing(stream)) {
+        double now = al_get_time();
+        double frag_secs = (double)frag_len / sound_freq;
+        unsigned queued = NUM_FRAGS_SO - al_get_available_audio_stream_fragments(stream);
+        size_t fill = 0;
+        if (queued < sound_prev_queued || !queued)
+            sound_drain_time = now;
+        sound_prev_queued = queued;
+        double played = now - sound_drain_time;
+        if (played > frag_secs || !queued)
+            played = queued ? frag_secs : 0.0;
+        for (sound_src_t *src = sources; src < sources + SOUND_NSRC; src++)
+            if (src->active && src->fill > fill)
+                fill = src->fill;
+        return queued * frag_secs + (double)fill / sound_freq + (double)sound_pos / FREQ_SO - played;
     }
-    if ((voice = al_create_voice(FREQ_DD, ALLEGRO_AUDIO_DEPTH_INT24, ALLEGRO_CHANNEL_CONF_1))) {
-        log_debug("sound: created voice with ddnoise freq, 24bit depth");
-        return voice;
+    return -1.0;
+}
+
+/* True if a finished fragment could be handed to the stream now. */
+
+bool sound_ok(void)
+{
+    if (sound_running())
+        return al_get_available_audio_stream_fragments(stream) > 0;
+    return true;
+}
+
+/*
+ * Allegro cannot tell us the native rate of the device so ask for the
+ * rates hardware commonly runs at, most likely first, and take the first
+ * the device will open.  A rate from the config file is tried before any
+ * of those.
+ */
+
+static const unsigned sound_rates[] = { 48000, 44100, 96000, 32000 };
+
+static const struct {
+    ALLEGRO_AUDIO_DEPTH depth;
+    const char *name;
+} sound_depths[] = {
+    { ALLEGRO_AUDIO_DEPTH_FLOAT32, "float" },
+    { ALLEGRO_AUDIO_DEPTH_INT24,   "24bit" },
+    { ALLEGRO_AUDIO_DEPTH_INT16,   "16bit" }
+};
+
+static ALLEGRO_VOICE *sound_try_voice(unsigned freq)
+{
+    ALLEGRO_VOICE *voice;
+
+    for (int d = 0; d < sizeof(sound_depths)/sizeof(sound_depths[0]); d++) {
+        if ((voice = al_create_voice(freq, sound_depths[d].depth, ALLEGRO_CHANNEL_CONF_2))) {
+            log_info("sound: output at %uHz, %s depth", freq, sound_depths[d].name);
+            sound_freq = freq;
+            return voice;
+        }
     }
-    if ((voice = al_create_voice(FREQ_DD, ALLEGRO_AUDIO_DEPTH_INT16, ALLEGRO_CHANNEL_CONF_1))) {
-        log_debug("sound: created voice with ddnoise freq, 16bit depth");
-        return voice;
+    return NULL;
+}
+
+static ALLEGRO_VOICE *sound_create_voice(void)
+{
+    ALLEGRO_VOICE *voice;
+
+    if (sound_dev_freq > 0) {
+        if ((voice = sound_try_voice(sound_dev_freq)))
+            return voice;
+        log_warn("sound: unable to open output at configured rate %dHz", sound_dev_freq);
     }
+    for (int r = 0; r < sizeof(sound_rates)/sizeof(sound_rates[0]); r++)
+        if ((voice = sound_try_voice(sound_rates[r])))
+            return voice;
     return NULL;
 }
 
 void sound_init(void)
 {
+    sound_period = sound_dev_period;
+    if (sound_period < 2)
+        sound_period = 2;
+    else if (sound_period > MAX_PERIOD)
+        sound_period = MAX_PERIOD;
     if ((voice = sound_create_voice())) {
-        if ((mixer = al_create_mixer(FREQ_SO, ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_1))) {
+        if ((mixer = al_create_mixer(sound_freq, ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_2))) {
             if (al_attach_mixer_to_voice(mixer, voice)) {
-                if ((stream = al_create_audio_stream(4, BUFLEN_SO, FREQ_SO, ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_1))) {
-                    if (!al_attach_audio_stream_to_mixer(stream, mixer))
-                        log_error("sound: unable to attach stream to mixer for internal/SID/DAC sound");
-                } else
-                    log_error("sound: unable to create stream for internal/SID/DAC sound");
+                sound_create_stream();
+                return;
             } else
-                log_error("sound: unable to attach mixer to voice for internal/SID/DAC sound");
+                log_error("sound: unable to attach mixer to voice");
+            al_destroy_mixer(mixer);
+            mixer = NULL;
         } else
-            log_error("sound: unable to create mixer for internal/SID/DAC sound");
+            log_error("sound: unable to create mixer");
+        al_destroy_voice(voice);
+        voice = NULL;
     } else
-        log_error("sound: unable to create voice for internal/SID/DAC sound");
+        log_error("sound: unable to create voice");
+}
+
+/* Let a source mixed on the audio thread share the output. */
+
+bool sound_attach_mixer(ALLEGRO_MIXER *sub)
+{
+    return mixer && al_attach_mixer_to_mixer(sub, mixer);
 }
 
 bool sound_start_rec(sound_rec_t *rec, const char *filename)
@@ -312,10 +604,25 @@ void sound_close(void)
 {
     if (sound_rec.fp)
         sound_stop_rec(&sound_rec);
-    if (stream)
+    for (sound_src_t *src = sources; src < sources + SOUND_NSRC; src++) {
+        src->active = false;
+        resample_free(&src->rs);
+        if (src->fifo) {
+            free(src->fifo);
+            src->fifo = NULL;
+        }
+        src->fill = src->size = 0;
+    }
+    if (stream) {
         al_destroy_audio_stream(stream);
-    if (mixer)
+        stream = NULL;
+    }
+    if (mixer) {
         al_destroy_mixer(mixer);
-    if (voice)
+        mixer = NULL;
+    }
+    if (voice) {
         al_destroy_voice(voice);
+        voice = NULL;
+    }
 }
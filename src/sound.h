@@ -1,6 +1,8 @@
 #ifndef __INC_SOUND_H
 #define __INC_SOUND_H
 
+#include <allegro5/allegro_audio.h>
+
 /* Source frequencies in Hz */
 
 #define FREQ_SO  125000  // normal sound
@@ -10,18 +12,34 @@
 
 /* Source buffer lengths in time samples */
 
-#define BUFLEN_SO 8000   //  64ms @ 125KHz    (must be multiple of 8)
+#define BUFLEN_SO 1000   //   8ms @ 125KHz    (must be multiple of 8)
 #define BUFLEN_DD 4410   // 100ms @ 44.1KHz
-#define BUFLEN_M5  750   //  16ms @ 46.875KHz (must be multiple of 3)
+#define BUFLEN_M5  375   //   8ms @ 46.875KHz (must be multiple of 3)
+
+/* Sources resampled and mixed into the one output stream */
+
+enum {
+    SOUND_SRC_SO,
+    SOUND_SRC_M5,
+    SOUND_NSRC
+};
 
-extern size_t buflen_m5;
+extern int sound_dev_freq, sound_dev_period;
+extern unsigned sound_freq;
 
 extern bool sound_internal, sound_beebsid, sound_dac;
 extern bool sound_ddnoise, sound_tape;
 extern bool sound_music5000, sound_filter, sound_paula;
 
 void sound_init(void);
+void sound_close(void);
 void sound_poll(int cycles);
+double sound_latency(void);
+bool sound_ok(void);
+void sound_set_speed(double multiplier);
+void sound_source_write(int snum, const float *in, size_t frames);
+void sound_source_stop(int snum);
+bool sound_attach_mixer(ALLEGRO_MIXER *sub);
 
 typedef struct {
     FILE *fp;
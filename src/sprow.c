@@ -9,13 +9,17 @@
 #include "sprow.h"
 #include "tube.h"
 #include "cpu_debug.h"
-//#include "ssinline.h"
+#include "ssinline.h"
 #include "map.h"
 
 unsigned char  m_ROMMemory[0x80000];
 ARMul_State   *m_State;
 int            m_CycleCount;
 
+/* Pages of co-processor RAM written since it was allocated. */
+static uint8_t *sprow_used;
+static uint8_t *sprow_dirty;
+
 #define OFFSETBITS 0xffff
 #define INSN_SIZE 4
 
@@ -134,12 +138,213 @@ unsigned ARMul_OSHandleSWI (ARMul_State * state, ARMword number)
 
     return TRUE;
 }
+/*
+ * The CPU state is the ARMulator registers, banks and pipeline, with the
+ * interrupt signals; the on-chip hardware registers live in the MAP.
+ * The ROM is never written so is not saved.
+ */
+
+#define SPROW_STATE_WORDS 181
+
+static unsigned char *save_words(unsigned char *ptr, const ARMword *words, int count)
+{
+    while (count--)
+        ptr = save_uint32(ptr, *words++);
+    return ptr;
+}
+
+static unsigned char *load_words(unsigned char *ptr, ARMword *words, int count)
+{
+    while (count--)
+        ptr = load_uint32(ptr, words++);
+    return ptr;
+}
+
+static void count_pair(int first, int second, void *arg)
+{
+    (*(uint32_t *)arg)++;
+}
+
+static void save_pair(int first, int second, void *arg)
+{
+    unsigned char **ptr = arg;
+    *ptr = save_uint32(*ptr, first);
+    *ptr = save_uint32(*ptr, second);
+}
+
 static void sprow_savestate(ZFILE *zfp)
 {
+    unsigned char bytes[SPROW_STATE_WORDS * 4], *ptr;
+    ARMul_State *state = m_State;
+    uint32_t npairs = 0;
+
+    ptr = save_uint32(bytes, state->Emulate);
+    ptr = save_uint32(ptr, state->EndCondition);
+    ptr = save_uint32(ptr, state->ErrorCode);
+    ptr = save_words(ptr, state->Reg, 16);
+    ptr = save_words(ptr, &state->RegBank[0][0], 7 * 16);
+    ptr = save_uint32(ptr, state->Accumulator);
+    ptr = save_uint32(ptr, state->Accumulator >> 32);
+    ptr = save_uint32(ptr, state->Cpsr);
+    ptr = save_words(ptr, state->Spsr, 7);
+    ptr = save_uint32(ptr, state->NFlag);
+    ptr = save_uint32(ptr, state->ZFlag);
+    ptr = save_uint32(ptr, state->CFlag);
+    ptr = save_uint32(ptr, state->VFlag);
+    ptr = save_uint32(ptr, state->IFFlags);
+    ptr = save_uint32(ptr, state->SFlag);
+#ifdef MODET
+    ptr = save_uint32(ptr, state->TFlag);
+#else
+    ptr = save_uint32(ptr, 0);
+#endif
+    ptr = save_uint32(ptr, state->Bank);
+    ptr = save_uint32(ptr, state->Mode);
+    ptr = save_uint32(ptr, state->instr);
+    ptr = save_uint32(ptr, state->pc);
+    ptr = save_uint32(ptr, state->temp);
+    ptr = save_uint32(ptr, state->loaded);
+    ptr = save_uint32(ptr, state->decoded);
+    ptr = save_uint32(ptr, state->NextInstr);
+    ptr = save_uint32(ptr, state->CallDebug);
+    ptr = save_uint32(ptr, state->remapControlRegister);
+    ptr = save_uint32(ptr, state->romSelectRegister);
+    ptr = save_uint32(ptr, state->CP14R0_CCD);
+    ptr = save_uint32(ptr, state->Exception);
+    ptr = save_uint32(ptr, state->NresetSig);
+    ptr = save_uint32(ptr, state->NfiqSig);
+    ptr = save_uint32(ptr, state->NirqSig);
+    ptr = save_uint32(ptr, state->abortSig);
+    ptr = save_uint32(ptr, state->NtransSig);
+    ptr = save_uint32(ptr, state->bigendSig);
+    ptr = save_uint32(ptr, state->prog32Sig);
+    ptr = save_uint32(ptr, state->data32Sig);
+    ptr = save_uint32(ptr, state->lateabtSig);
+    ptr = save_uint32(ptr, state->Vector);
+    ptr = save_uint32(ptr, state->Aborted);
+    ptr = save_uint32(ptr, state->Reseted);
+    ptr = save_uint32(ptr, state->Inted);
+    ptr = save_uint32(ptr, state->LastInted);
+    ptr = save_uint32(ptr, state->Base);
+    ptr = save_uint32(ptr, state->AbortAddr);
+    ptr = save_uint32(ptr, m_CycleCount);
+    ptr = save_uint32(ptr, swi_vector_installed);
+    ptr = save_uint32(ptr, SWI_vector_installed);
+    save_uint32(ptr, tenval);
+    savestate_zwrite(zfp, bytes, sizeof bytes);
+
+    MAP_forall(count_pair, &npairs);
+    unsigned char *pairs = malloc(npairs * 8 + 4);
+    if (!pairs) {
+        log_error("sprow: out of memory saving hardware registers");
+        npairs = 0;
+        pairs = bytes;
+    }
+    ptr = save_uint32(pairs, npairs);
+    if (npairs)
+        MAP_forall(save_pair, &ptr);
+    savestate_zwrite(zfp, pairs, npairs * 8 + 4);
+    if (pairs != bytes)
+        free(pairs);
+
+    savestate_zwrite_sparse(zfp, state->MemDataPtr, state->MemSize, sprow_used, sprow_dirty);
 }
 
 static void sprow_loadstate(ZFILE *zfp)
 {
+    unsigned char bytes[SPROW_STATE_WORDS * 4], *ptr;
+    ARMul_State *state = m_State;
+    uint32_t value, npairs;
+
+    savestate_zread(zfp, bytes, sizeof bytes);
+    ptr = load_uint32(bytes, &state->Emulate);
+    ptr = load_uint32(ptr, &value);
+    state->EndCondition = value;
+    ptr = load_uint32(ptr, &value);
+    state->ErrorCode = value;
+    ptr = load_words(ptr, state->Reg, 16);
+    ptr = load_words(ptr, &state->RegBank[0][0], 7 * 16);
+    ptr = load_uint32(ptr, &value);
+    state->Accumulator = value;
+    ptr = load_uint32(ptr, &value);
+    state->Accumulator |= (ARMdword)value << 32;
+    ptr = load_uint32(ptr, &state->Cpsr);
+    ptr = load_words(ptr, state->Spsr, 7);
+    ptr = load_uint32(ptr, &state->NFlag);
+    ptr = load_uint32(ptr, &state->ZFlag);
+    ptr = load_uint32(ptr, &state->CFlag);
+    ptr = load_uint32(ptr, &state->VFlag);
+    ptr = load_uint32(ptr, &state->IFFlags);
+    ptr = load_uint32(ptr, &state->SFlag);
+#ifdef MODET
+    ptr = load_uint32(ptr, &state->TFlag);
+#else
+    ptr = load_uint32(ptr, &value);
+#endif
+    ptr = load_uint32(ptr, &state->Bank);
+    ptr = load_uint32(ptr, &state->Mode);
+    ptr = load_uint32(ptr, &state->instr);
+    ptr = load_uint32(ptr, &state->pc);
+    ptr = load_uint32(ptr, &state->temp);
+    ptr = load_uint32(ptr, &state->loaded);
+    ptr = load_uint32(ptr, &state->decoded);
+    ptr = load_uint32(ptr, &value);
+    state->NextInstr = value;
+    ptr = load_uint32(ptr, &value);
+    state->CallDebug = value;
+    ptr = load_uint32(ptr, &value);
+    state->remapControlRegister = value;
+    ptr = load_uint32(ptr, &value);
+    state->romSelectRegister = value;
+    ptr = load_uint32(ptr, &state->CP14R0_CCD);
+    ptr = load_uint32(ptr, &value);
+    state->Exception = value;
+    ptr = load_uint32(ptr, &value);
+    state->NresetSig = value;
+    ptr = load_uint32(ptr, &value);
+    state->NfiqSig = value;
+    ptr = load_uint32(ptr, &value);
+    state->NirqSig = value;
+    ptr = load_uint32(ptr, &value);
+    state->abortSig = value;
+    ptr = load_uint32(ptr, &value);
+    state->NtransSig = value;
+    ptr = load_uint32(ptr, &value);
+    state->bigendSig = value;
+    ptr = load_uint32(ptr, &value);
+    state->prog32Sig = value;
+    ptr = load_uint32(ptr, &value);
+    state->data32Sig = value;
+    ptr = load_uint32(ptr, &value);
+    state->lateabtSig = value;
+    ptr = load_uint32(ptr, &state->Vector);
+    ptr = load_uint32(ptr, &state->Aborted);
+    ptr = load_uint32(ptr, &state->Reseted);
+    ptr = load_uint32(ptr, &state->Inted);
+    ptr = load_uint32(ptr, &state->LastInted);
+    ptr = load_uint32(ptr, &state->Base);
+    ptr = load_uint32(ptr, &state->AbortAddr);
+    ptr = load_uint32(ptr, &value);
+    m_CycleCount = value;
+    ptr = load_uint32(ptr, &value);
+    swi_vector_installed = value;
+    ptr = load_uint32(ptr, &value);
+    SWI_vector_installed = value;
+    load_uint32(ptr, &value);
+    tenval = value;
+
+    MAP_newmap();
+    savestate_zread(zfp, bytes, 4);
+    load_uint32(bytes, &npairs);
+    while (npairs--) {
+        uint32_t first, second;
+        savestate_zread(zfp, bytes, 8);
+        ptr = load_uint32(bytes, &first);
+        load_uint32(ptr, &second);
+        MAP_putpair(first, second);
+    }
+
+    savestate_zread_sparse(zfp, state->MemDataPtr, state->MemSize, sprow_used, sprow_dirty);
 }
 
 static inline uint8_t do_sprow_readb(uint32_t addr)
@@ -180,6 +385,13 @@ void sprow_close()
       ARMul_MemoryExit(m_State);
       m_State = 0L;
   }
+  if (sprow_used)
+  {
+      free(sprow_used);
+      sprow_used = NULL;
+  }
+  savestate_dirty_free(sprow_dirty);
+  sprow_dirty = NULL;
 }
 
 void sprow_reset()
@@ -196,13 +408,26 @@ void sprow_reset()
 
 bool sprow_init(void *rom)
 {
+  if (m_State)
+    sprow_close();
   memcpy(m_ROMMemory, rom, 0x80000);
 
   ARMul_EmulateInit();
   m_State = ARMul_NewState();
   m_State->ROMDataPtr = m_ROMMemory;
 
-  ARMul_MemoryInit(m_State, 0x4000000);
+  if (!ARMul_MemoryInit(m_State, 0x4000000))
+  {
+    log_error("sprow: out of memory for co-processor RAM");
+    return false;
+  }
+  if (!sprow_used && !(sprow_used = calloc((m_State->MemSize >> (SAVESTATE_PAGE_SHIFT + 3)) + 1, 1)))
+  {
+    log_error("sprow: out of memory for page map");
+    return false;
+  }
+  if (!sprow_dirty && !(sprow_dirty = savestate_dirty_new(m_State->MemSize)))
+    return false;
   m_CycleCount = 0;
 
   tube_type = TUBESPROW;
@@ -616,6 +841,13 @@ PutWord (ARMul_State * state, ARMword address, ARMword data, int check)
 
         actual_address = (ARMword*)offset_address;
         actual_address[0] = data;
+
+        size_t offset = offset_address - state->MemDataPtr;
+        if (offset < state->MemSize)
+        {
+            savestate_dirty(sprow_used, offset);
+            savestate_dirty(sprow_dirty, offset);
+        }
     }
 }
 
@@ -629,7 +861,7 @@ ARMul_MemoryInit (ARMul_State * state, unsigned long initmemsize)
     if (initmemsize)
         state->MemSize = initmemsize;
 
-    unsigned char *memory = (unsigned char *)malloc(initmemsize);
+    unsigned char *memory = (unsigned char *)calloc(initmemsize, 1);
 
     if (memory == 0)
         return FALSE;
@@ -2,6 +2,7 @@
 #include "led.h"
 #include "tape.h"
 #include "serial.h"
+#include "sysacia.h"
 #include "tapenoise.h"
 #include "uef.h"
 #include "csw.h"
@@ -10,6 +11,7 @@ int tapelcount,tapellatch,tapeledcount;
 
 bool tape_loaded = false;
 bool fasttape = false;
+bool quicktape = false;
 ALLEGRO_PATH *tape_fn = NULL;
 
 static struct
@@ -59,13 +61,33 @@ void tape_close()
         tape_loaded = 0;
 }
 
+/* Wind the loaded tape to file n, numbered as in the catalogue. */
+
+bool tape_seek_file(int file)
+{
+        if (!tape_loaded)
+                return false;
+        if (csw_ena)
+                return csw_seek_file(file);
+        return uef_seek_file(file);
+}
+
 /*Every 128 clocks, ie 15.625khz*/
 /*Div by 13 gives roughly 1200hz*/
 
 static uint16_t newdat;
 
+/*
+ * In quick mode the tape is polled as often as possible but held back
+ * while the last byte has not been taken from the ACIA, so data and
+ * tones pass as fast as the cassette filing system can take them
+ * without overrunning.
+ */
+
 void tape_poll(void) {
     if (motor) {
+        if (quicktape && acia_rx_full(&sysacia))
+            return;
         if (csw_ena) csw_poll();
         else         uef_poll();
 
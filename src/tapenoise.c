@@ -7,8 +7,6 @@
 #include "tapenoise.h"
 #include "sound.h"
 
-static ALLEGRO_VOICE *voice;
-static ALLEGRO_MIXER *mixer;
 static ALLEGRO_AUDIO_STREAM *stream;
 
 static int tpnoisep = 0;
@@ -21,49 +19,40 @@ static int sinewave[32];
 
 #define PI 3.142
 
-static ALLEGRO_SAMPLE *tsamples[2];
+static ddnoise_smp_t *tsamples[2];
 
 void tapenoise_init(ALLEGRO_EVENT_QUEUE *queue)
 {
     log_debug("tapenoise: tapenoise_init");
-    if ((voice = al_create_voice(FREQ_DD, ALLEGRO_AUDIO_DEPTH_INT16, ALLEGRO_CHANNEL_CONF_1))) {
-        if ((mixer = al_create_mixer(FREQ_DD, ALLEGRO_AUDIO_DEPTH_INT16, ALLEGRO_CHANNEL_CONF_1))) {
-            if (al_attach_mixer_to_voice(mixer, voice)) {
-                if ((stream = al_create_audio_stream(4, BUFLEN_DD, FREQ_DD, ALLEGRO_AUDIO_DEPTH_INT16, ALLEGRO_CHANNEL_CONF_1))) {
-                    if (al_attach_audio_stream_to_mixer(stream, mixer)) {
-                        ALLEGRO_PATH *dir = al_create_path_for_directory("ddnoise");
-                        tsamples[0] = find_load_wav(dir, "motoron");
-                        tsamples[1] = find_load_wav(dir, "motoroff");
-                        al_destroy_path(dir);
-                        for (int c = 0; c < 32; c++)
-                            sinewave[c] = (int)(sin((float)c * ((2.0 * PI) / 32.0)) * 128.0);
-                    } else
-                        log_error("sound: unable to attach stream to mixer for tape noise");
-                } else
-                    log_error("sound: unable to create stream for tape noise");
-            } else
-                log_error("sound: unable to attach mixer to voice for tape noise");
+    if (!ddnoise_running()) {
+        log_debug("tapenoise: no drive noise mixer, tape noise disabled");
+        return;
+    }
+    if ((stream = al_create_audio_stream(4, BUFLEN_DD, FREQ_DD, ALLEGRO_AUDIO_DEPTH_INT16, ALLEGRO_CHANNEL_CONF_1))) {
+        if (ddnoise_attach(stream)) {
+            ALLEGRO_PATH *dir = al_create_path_for_directory("ddnoise");
+            tsamples[0] = ddnoise_load(dir, "motoron");
+            tsamples[1] = ddnoise_load(dir, "motoroff");
+            al_destroy_path(dir);
+            for (int c = 0; c < 32; c++)
+                sinewave[c] = (int)(sin((float)c * ((2.0 * PI) / 32.0)) * 128.0);
         } else
-            log_error("sound: unable to create mixer for tape noise");
+            log_error("sound: unable to attach stream to mixer for tape noise");
     } else
-        log_error("sound: unable to create voice for for tape noise");
+        log_error("sound: unable to create stream for tape noise");
 }
 
 void tapenoise_close()
 {
-    ALLEGRO_SAMPLE *smp;
-
     log_debug("tapenoise: tapenoise_close");
-    if ((smp = tsamples[0]))
-        al_destroy_sample(smp);
-    if ((smp = tsamples[1]))
-        al_destroy_sample(smp);
-    if (stream)
+    ddnoise_flush();
+    ddnoise_free(tsamples[0]);
+    ddnoise_free(tsamples[1]);
+    tsamples[0] = tsamples[1] = NULL;
+    if (stream) {
         al_destroy_audio_stream(stream);
-    if (mixer)
-        al_destroy_mixer(mixer);
-    if (voice)
-        al_destroy_voice(voice);
+        stream = NULL;
+    }
 }
 
 static void send_buffer(void)
@@ -72,6 +61,8 @@ static void send_buffer(void)
     int c;
 
     tpnoisep = 0;
+    if (!stream)
+        return;
     if ((tapebuffer = al_get_audio_stream_fragment(stream))) {
 
         for (c = 0; c < BUFLEN_DD; c++) {
@@ -152,9 +143,9 @@ void tapenoise_adddat(uint8_t dat)
 
 void tapenoise_motorchange(int stat)
 {
-    ALLEGRO_SAMPLE *smp;
+    ddnoise_smp_t *smp;
 
     log_debug("tapenoise: motorchange, stat=%d", stat);
     if ((stat < 2) && (smp = tsamples[stat]))
-        al_play_sample(smp, 1.0, 0.0, 1.0, ALLEGRO_PLAYMODE_ONCE, NULL);
+        ddnoise_play(DDNOISE_VOICE_TAPE, smp, NULL, 1.0f);
 }
@@ -25,6 +25,8 @@ int tubecycles = 0;
 
 uint8_t (*tube_readmem)(uint32_t addr);
 void (*tube_writemem)(uint32_t addr, uint8_t byte);
+void (*tube_readmem_block)(uint32_t addr, uint8_t *buf, size_t len);
+void (*tube_writemem_block)(uint32_t addr, const uint8_t *buf, size_t len);
 void (*tube_exec)(void);
 void (*tube_proc_savestate)(ZFILE *zfp);
 void (*tube_proc_loadstate)(ZFILE *zfp);
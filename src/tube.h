@@ -58,6 +58,8 @@ bool tube_32016_init(void *rom);
 
 extern uint8_t (*tube_readmem)(uint32_t addr);
 extern void (*tube_writemem)(uint32_t addr, uint8_t byte);
+extern void (*tube_readmem_block)(uint32_t addr, uint8_t *buf, size_t len);
+extern void (*tube_writemem_block)(uint32_t addr, const uint8_t *buf, size_t len);
 extern void (*tube_exec)(void);
 extern void (*tube_proc_savestate)(ZFILE *zfp);
 extern void (*tube_proc_loadstate)(ZFILE *zfp);
@@ -1,6 +1,14 @@
 /*B-em v2.2 by Tom Walker
   UEF/HQ-UEF tape support*/
 
+/*
+ * The whole tape is decompressed into memory when it is loaded and
+ * indexed by a single pass over its chunks which finds the header of
+ * each cassette filing system block.  uef_poll then plays the tape from
+ * memory, the catalogue is listed from the index and uef_seek_block can
+ * position the tape at any block without playing what comes before it.
+ */
+
 #include <zlib.h>
 #include <stdio.h>
 #include "b-em.h"
@@ -10,87 +18,337 @@
 #include "tape.h"
 
 int pps;
-gzFile uef_f = NULL;
 
 int uef_toneon = 0;
 
+static uint8_t *uef_data;
+static size_t   uef_size, uef_posn;
+
 static int uef_inchunk = 0, uef_chunkid = 0, uef_chunklen = 0;
 static int uef_chunkpos = 0, uef_chunkdatabits = 8;
 static int uef_startchunk;
 static float uef_chunkf;
 static int uef_intone = 0;
 
+#define UEF_NAME_LEN 10
+
+typedef struct {
+        char     name[UEF_NAME_LEN+1];
+        uint8_t  flag;
+        uint16_t blockno;
+        uint16_t len;
+        uint32_t load, exec;
+        size_t   chunk;     // offset of the tone chunk leading in to the block.
+        int      pps;       // baud rate / 10 in force at that chunk.
+} uef_block;
+
+static uef_block *uef_blocks;
+static int uef_nblocks, uef_nalloc;
+
+static inline int uef_getc(void)
+{
+        if (uef_posn < uef_size)
+                return uef_data[uef_posn++];
+        return -1;
+}
+
+static inline uint16_t uef_get16(void)
+{
+        uint16_t value = 0;
+        if (uef_posn + 2 <= uef_size) {
+                value = uef_data[uef_posn] | (uef_data[uef_posn+1] << 8);
+                uef_posn += 2;
+        }
+        else
+                uef_posn = uef_size;
+        return value;
+}
+
+static inline uint32_t uef_get32(void)
+{
+        uint32_t value = uef_get16();
+        return value | (uint32_t)uef_get16() << 16;
+}
+
+static inline void uef_skip(uint32_t len)
+{
+        if (len < uef_size - uef_posn)
+                uef_posn += len;
+        else
+                uef_posn = uef_size;
+}
+
+/*
+ * Index the tape.  This follows the bytes uef_poll would pass to the
+ * ACIA and looks for a '*' sync byte straight after a high tone, which
+ * starts a block header: the file name, terminated by a zero, the load
+ * and execution addresses, the block number, the block length and the
+ * flag byte.  After that come four spare bytes, the header CRC, the
+ * data and the data CRC, which are passed over.
+ */
+
+enum {
+        IDX_HUNT,
+        IDX_NAME,
+        IDX_HEADER,
+        IDX_SKIP
+};
+
+static struct {
+        int       state;
+        int       count;
+        size_t    chunk;
+        int       pps;
+        uef_block block;
+        uint8_t   header[13];
+} idx;
+
+static bool uef_index_byte(uint8_t val, bool after_tone)
+{
+        switch (idx.state)
+        {
+            case IDX_HUNT:
+                if (val == 0x2A && after_tone) {
+                        memset(&idx.block, 0, sizeof(idx.block));
+                        idx.block.chunk = idx.chunk;
+                        idx.block.pps = idx.pps;
+                        idx.count = 0;
+                        idx.state = IDX_NAME;
+                }
+                break;
+
+            case IDX_NAME:
+                if (!val) {
+                        idx.count = 0;
+                        idx.state = IDX_HEADER;
+                }
+                else if (idx.count < UEF_NAME_LEN)
+                        idx.block.name[idx.count++] = val;
+                else {
+                        /* No terminator, so this was not a header. */
+                        idx.state = IDX_HUNT;
+                }
+                break;
+
+            case IDX_HEADER:
+                idx.header[idx.count++] = val;
+                if (idx.count == sizeof(idx.header)) {
+                        const uint8_t *hdr = idx.header;
+                        uef_block *blk = &idx.block;
+                        blk->load    = hdr[0] | (hdr[1] << 8) | (hdr[2] << 16) | ((uint32_t)hdr[3] << 24);
+                        blk->exec    = hdr[4] | (hdr[5] << 8) | (hdr[6] << 16) | ((uint32_t)hdr[7] << 24);
+                        blk->blockno = hdr[8] | (hdr[9] << 8);
+                        blk->len     = hdr[10] | (hdr[11] << 8);
+                        blk->flag    = hdr[12];
+                        if (uef_nblocks == uef_nalloc) {
+                                int nalloc = uef_nalloc ? uef_nalloc * 2 : 64;
+                                uef_block *blocks = realloc(uef_blocks, nalloc * sizeof(uef_block));
+                                if (!blocks) {
+                                        log_error("uef: out of memory indexing tape");
+                                        return false;
+                                }
+                                uef_blocks = blocks;
+                                uef_nalloc = nalloc;
+                        }
+                        uef_blocks[uef_nblocks++] = *blk;
+                        idx.count = blk->len + 8;
+                        idx.state = IDX_SKIP;
+                }
+                break;
+
+            case IDX_SKIP:
+                if (--idx.count == 0)
+                        idx.state = IDX_HUNT;
+        }
+        return true;
+}
+
+static bool uef_index(void)
+{
+        bool after_tone = false;
+        float baud;
+        uint32_t templ;
+
+        memset(&idx, 0, sizeof(idx));
+        idx.pps = 120;
+        uef_posn = 12;
+        while (uef_posn + 6 <= uef_size) {
+                size_t chunk = uef_posn;
+                unsigned id = uef_get16();
+                uint32_t len = uef_get32();
+                size_t end = (len < uef_size - uef_posn) ? uef_posn + len : uef_size;
+                switch (id)
+                {
+                    case 0x100: /*Raw data*/
+                        while (uef_posn < end) {
+                                if (!uef_index_byte(uef_data[uef_posn++], after_tone))
+                                        return false;
+                                after_tone = false;
+                        }
+                        break;
+
+                    case 0x104: /*Defined data*/
+                        if (end - uef_posn >= 3) {
+                                int databits = uef_data[uef_posn];
+                                uef_posn += 3;
+                                while (uef_posn < end) {
+                                        uint8_t val = uef_data[uef_posn++];
+                                        if (databits == 7)
+                                                val &= 0x7F;
+                                        if (!uef_index_byte(val, after_tone))
+                                                return false;
+                                        after_tone = false;
+                                }
+                        }
+                        break;
+
+                    case 0x111: /*High tone with dummy byte*/
+                        if (!uef_index_byte(0xAA, true))
+                                return false;
+                        /* fall through */
+                    case 0x110: /*High tone*/
+                        idx.chunk = chunk;
+                        after_tone = true;
+                        break;
+
+                    case 0x112: /*Gap*/
+                    case 0x116: /*Float gap*/
+                        after_tone = false;
+                        break;
+
+                    case 0x113: /*Float baud rate*/
+                        templ = uef_get32();
+                        memcpy(&baud, &templ, sizeof(baud));
+                        idx.pps = baud / 10;
+                        break;
+                }
+                uef_posn = end;
+        }
+        log_debug("uef: indexed %d blocks", uef_nblocks);
+        return true;
+}
+
+static void uef_free(void)
+{
+        if (uef_data) {
+                free(uef_data);
+                uef_data = NULL;
+        }
+        if (uef_blocks) {
+                free(uef_blocks);
+                uef_blocks = NULL;
+        }
+        uef_size = uef_posn = 0;
+        uef_nblocks = uef_nalloc = 0;
+}
+
+static bool uef_read(const char *fn)
+{
+        gzFile gz = gzopen(fn, "rb");
+        if (!gz) {
+                log_error("uef: unable to open '%s': %s", fn, strerror(errno));
+                return false;
+        }
+        size_t size = 0, alloc = 0;
+        uint8_t *data = NULL;
+        int bytes;
+        do {
+                if (size == alloc) {
+                        alloc = alloc ? alloc * 2 : 65536;
+                        uint8_t *ndata = realloc(data, alloc);
+                        if (!ndata) {
+                                log_error("uef: out of memory reading '%s'", fn);
+                                free(data);
+                                gzclose(gz);
+                                return false;
+                        }
+                        data = ndata;
+                }
+                bytes = gzread(gz, data + size, alloc - size);
+                if (bytes > 0)
+                        size += bytes;
+        } while (bytes > 0);
+        if (bytes < 0) {
+                int err;
+                log_error("uef: error reading '%s': %s", fn, gzerror(gz, &err));
+                free(data);
+                gzclose(gz);
+                return false;
+        }
+        gzclose(gz);
+        if (size < 12 || memcmp(data, "UEF File!", 10)) {
+                log_error("uef: '%s' is not a UEF file", fn);
+                free(data);
+                return false;
+        }
+        uef_data = data;
+        uef_size = size;
+        return true;
+}
+
 void uef_load(const char *fn)
 {
-        int c;
-//      printf("OpenUEF %s %08X\n",fn,uef);
-        if (uef_f)
-           gzclose(uef_f);
-        uef_f = gzopen(fn, "rb");
-        if (!uef_f) { /*printf("Fail!\n");*/ return; }
-        for (c = 0; c < 12; c++)
-            gzgetc(uef_f);
+        uef_free();
+        if (!uef_read(fn))
+                return;
+        if (!uef_index()) {
+                uef_free();
+                return;
+        }
+        uef_posn = 12;
         uef_inchunk = uef_chunklen = uef_chunkid = 0;
+        uef_intone = 0;
         tapellatch = (1000000 / (1200 / 10)) / 64;
         tapelcount = 0;
         pps = 120;
         csw_ena = 0;
-//      printf("Tapellatch %i\n",tapellatch);
         tape_loaded = 1;
-//      gzseek(uef,27535,SEEK_SET);
 }
 
 void uef_close()
 {
-//printf("CloseUEF\n");
-        if (uef_f)
-        {
-                gzclose(uef_f);
-                uef_f = NULL;
+        uef_free();
+}
+
+/*
+ * Position the tape at the start of the lead-in tone for block n of the
+ * index, as if it had been wound there.
+ */
+
+static bool uef_seek_block(int n)
+{
+        if (n < 0 || n >= uef_nblocks)
+                return false;
+        uef_block *blk = uef_blocks + n;
+        uef_posn = blk->chunk;
+        uef_inchunk = uef_chunkpos = uef_intone = 0;
+        if (blk->pps > 0) {
+                pps = blk->pps;
+                tapellatch = (1000000 / pps) / 64;
         }
+        return true;
 }
 
-static int infilenames = 0;
-static int uefloop = 0;
-static uint8_t fdat;
-int ffound;
 static void uef_receive(uint8_t val)
 {
         uef_toneon--;
-        if (infilenames)
-        {
-                ffound = 1;
-                fdat = val;
-//                log_debug("Dat %02X %c\n",val,(val<33)?'.':val);
-        }
-        else
-        {
-                acia_receive(&sysacia, val);
-//                log_debug("Dat %02X\n",val);
-        }
+        acia_receive(&sysacia, val);
 }
 
 void uef_poll()
 {
-        int c;
         uint32_t templ;
         float *tempf;
         uint8_t temp;
-        if (!uef_f)
+        if (!uef_data)
            return;
         if (!uef_inchunk)
         {
                 uef_startchunk = 1;
-//                printf("%i ",gztell(uef));
-                gzread(uef_f, &uef_chunkid, 2);
-                gzread(uef_f, &uef_chunklen, 4);
-                if (gzeof(uef_f))
-                {
-                        gzseek(uef_f, 12, SEEK_SET);
-                        gzread(uef_f, &uef_chunkid, 2);
-                        gzread(uef_f, &uef_chunklen, 4);
-                        uefloop = 1;
-                }
+                if (uef_posn + 6 > uef_size)
+                        uef_posn = 12;
+                uef_chunkid = uef_get16();
+                uef_chunklen = uef_get32();
                 uef_inchunk = 1;
                 uef_chunkpos = 0;
 //                printf("Chunk ID %04X len %i\n",uef_chunkid,uef_chunklen);
@@ -100,14 +358,12 @@ void uef_poll()
         switch (uef_chunkid)
         {
             case 0x000: /*Origin*/
-                for (c = 0; c < uef_chunklen; c++)
-                    gzgetc(uef_f);
+                uef_skip(uef_chunklen);
                 uef_inchunk = 0;
                 return;
 
             case 0x005: /*Target platform*/
-                for (c = 0; c < uef_chunklen; c++)
-                    gzgetc(uef_f);
+                uef_skip(uef_chunklen);
                 uef_inchunk = 0;
                 return;
 
@@ -122,15 +378,15 @@ void uef_poll()
                 {
                         uef_inchunk = 0;
                 }
-                uef_receive(gzgetc(uef_f));
+                uef_receive(uef_getc());
                 return;
 
             case 0x104: /*Defined data*/
                 if (!uef_chunkpos)
                 {
-                        uef_chunkdatabits = gzgetc(uef_f);
-                        gzgetc(uef_f);
-                        gzgetc(uef_f);
+                        uef_chunkdatabits = uef_getc();
+                        uef_getc();
+                        uef_getc();
                         uef_chunklen -= 3;
                         uef_chunkpos = 1;
                         acia_dcdlow(&sysacia);
@@ -140,7 +396,7 @@ void uef_poll()
                         uef_chunklen--;
                         if (uef_chunklen <= 0)
                            uef_inchunk = 0;
-                        temp = gzgetc(uef_f);
+                        temp = uef_getc();
 //                        printf("%i : %i %02X\n",gztell(uef),uef_chunklen,temp);
                         if (uef_chunkdatabits == 7) uef_receive(temp & 0x7F);
                         else                        uef_receive(temp);
@@ -152,8 +408,8 @@ void uef_poll()
                 if (!uef_intone)
                 {
                         acia_dcdhigh(&sysacia);
-                        uef_intone = gzgetc(uef_f);
-                        uef_intone |= (gzgetc(uef_f) << 8);
+                        uef_intone = uef_getc();
+                        uef_intone |= (uef_getc() << 8);
                         uef_intone /= 20;
                         if (!uef_intone) uef_intone = 1;
 //                        printf("uef_intone %i\n",uef_intone);
@@ -173,8 +429,8 @@ void uef_poll()
                 if (!uef_intone)
                 {
                         acia_dcdhigh(&sysacia);
-                        uef_intone = gzgetc(uef_f);
-                        uef_intone |= (gzgetc(uef_f)<<8);
+                        uef_intone = uef_getc();
+                        uef_intone |= (uef_getc()<<8);
                         uef_intone /= 20;
                         if (!uef_intone) uef_intone = 1;
                 }
@@ -188,8 +444,8 @@ void uef_poll()
                         else if (!uef_intone)
                         {
                                 uef_inchunk = 2;
-                                uef_intone = gzgetc(uef_f);
-                                uef_intone |= (gzgetc(uef_f) << 8);
+                                uef_intone = uef_getc();
+                                uef_intone |= (uef_getc() << 8);
                                 uef_intone /= 20;
                                 if (!uef_intone) uef_intone = 1;
                                 uef_receive(0xAA);
@@ -202,8 +458,8 @@ void uef_poll()
                 if (!uef_intone)
                 {
 //                        acia_dcdhigh(&sysacia);
-                        uef_intone = gzgetc(uef_f);
-                        uef_intone |= (gzgetc(uef_f) << 8);
+                        uef_intone = uef_getc();
+                        uef_intone |= (uef_getc() << 8);
                         uef_intone /= 20;
 //                        printf("gap uef_intone %i\n",uef_intone);
                         if (!uef_intone) uef_intone = 1;
@@ -219,10 +475,7 @@ void uef_poll()
                 return;
 
             case 0x113: /*Float baud rate*/
-                templ = gzgetc(uef_f);
-                templ |= (gzgetc(uef_f) << 8);
-                templ |= (gzgetc(uef_f) << 16);
-                templ |= (gzgetc(uef_f) << 24);
+                templ = uef_get32();
                 tempf = (float *)&templ;
                 tapellatch = (1000000 / ((*tempf) / 10)) / 64;
                 pps = (*tempf) / 10;
@@ -233,10 +486,7 @@ void uef_poll()
                 uef_toneon = 0;
                 if (!uef_chunkpos)
                 {
-                        templ = gzgetc(uef_f);
-                        templ |= (gzgetc(uef_f) << 8);
-                        templ |= (gzgetc(uef_f) << 16);
-                        templ |= (gzgetc(uef_f) << 24);
+                        templ = uef_get32();
                         tempf = (float *)&templ;
                         uef_chunkf = *tempf;
                         //printf("Gap %f %i\n",uef_chunkf,pps);
@@ -254,14 +504,12 @@ void uef_poll()
             case 0x114: /*Security waves*/
             case 0x115: /*Polarity change*/
 //                default:
-                for (c = 0; c < uef_chunklen; c++)
-                    gzgetc(uef_f);
+                uef_skip(uef_chunklen);
                 uef_inchunk = 0;
                 return;
 
             default:
-                for (c = 0; c < uef_chunklen; c++)
-                    gzgetc(uef_f);
+                uef_skip(uef_chunklen);
                 uef_inchunk = 0;
                 return;
 //116 : float gap
@@ -273,126 +521,41 @@ void uef_poll()
 //        exit(-1);
 }
 
-uint8_t fbuffer[4];
-
-#define getuefbyte()            ffound = 0; \
-                                while (!ffound && !uefloop) \
-                                { \
-                                        uef_poll(); \
-                                } \
-                                if (uefloop) break;
-
-uint8_t ffilename[16];
 void uef_findfilenames()
 {
-        int temp;
-        uint8_t tb;
-        int c;
-        int fsize = 0;
         char s[256];
-        uint32_t run, load;
-        uint8_t status;
-        int skip;
-        int binchunk  = uef_inchunk,  bchunkid = uef_chunkid, bchunklen = uef_chunklen;
-        int bchunkpos = uef_chunkpos, bchunkdatabits = uef_chunkdatabits;
-        int bintone   = uef_intone,   bffound = ffound;
-        float bchunkf = uef_chunkf;
-        uint8_t bdat  = fdat;
-        if (!uef_f) return;
-
-        uef_inchunk  = 0; uef_chunkid = 0; uef_chunklen = 0;
-        uef_chunkpos = 0; uef_chunkdatabits = 8; uef_intone = 0;
-        uef_chunkf   = 0;
-
-        temp=gztell(uef_f);
-        gzseek(uef_f, 12, SEEK_SET);
-        uefloop = 0;
-        infilenames = 1;
-        while (!uefloop)
+        int fsize = 0, file = 1;
+
+        for (int n = 0; n < uef_nblocks; n++)
         {
-                ffound = 0;
-                while (!ffound && !uefloop)
+                uef_block *blk = uef_blocks + n;
+                fsize += blk->len;
+                if (blk->flag & 0x80)
                 {
-                        uef_poll();
+                        sprintf(s, "%3d %-13s Size %04X Load %08X Run %08X", file++, blk->name, fsize, blk->load, blk->exec);
+                        cataddname(s);
+                        fsize = 0;
                 }
-                if (uefloop) break;
-                fbuffer[0] = fbuffer[1];
-                fbuffer[1] = fbuffer[2];
-                fbuffer[2] = fbuffer[3];
-                fbuffer[3] = fdat;
-                if (fdat == 0x2A && uef_toneon == 1)
+        }
+}
+
+/*
+ * Wind the tape to the first block of file n, numbered from one as in
+ * the catalogue.
+ */
+
+bool uef_seek_file(int file)
+{
+        int first = 0;
+
+        for (int n = 0; n < uef_nblocks; n++)
+        {
+                if (uef_blocks[n].flag & 0x80)
                 {
-                        fbuffer[3] = 0;
-                        c = 0;
-                        do
-                        {
-                                ffound = 0;
-                                while (!ffound && !uefloop)
-                                {
-                                        uef_poll();
-                                }
-                                if (uefloop) break;
-                                ffilename[c++] = fdat;
-                        } while (fdat != 0x0 && c < 10);
-                        if (uefloop) break;
-                        c--;
-                        while (c < 13) ffilename[c++] = 32;
-                        ffilename[c] = 0;
-
-                                getuefbyte();
-                                tb = fdat;
-                                getuefbyte();
-                                load = tb | (fdat << 8);
-                                getuefbyte();
-                                tb = fdat;
-                                getuefbyte();
-                                load |= (tb | (fdat << 8)) << 16;
-
-                                getuefbyte();
-                                tb = fdat;
-                                getuefbyte();
-                                run = tb | (fdat << 8);
-                                getuefbyte();
-                                tb = fdat;
-                                getuefbyte();
-                                run |= (tb | (fdat << 8)) << 16;
-
-                                getuefbyte();
-                                getuefbyte();
-
-                                getuefbyte();
-                                tb = fdat;
-                                getuefbyte();
-                                skip = tb | (fdat << 8);
-
-                                fsize += skip;
-
-                                getuefbyte();
-                                status = fdat;
-
-                        if (status & 0x80)
-                        {
-                                sprintf(s, "%s Size %04X Load %08X Run %08X", ffilename, fsize, load, run);
-                                cataddname(s);
-                                fsize = 0;
-                        }
-                        for (c = 0; c <skip + 8; c++)
-                        {
-                                getuefbyte();
-                        }
+                        if (--file == 0)
+                                return uef_seek_block(first);
+                        first = n + 1;
                 }
         }
-        infilenames = 0;
-        gzseek(uef_f, temp, SEEK_SET);
-        uefloop = 0;
-        uef_inchunk       = binchunk;
-        uef_chunkid       = bchunkid;
-        uef_chunklen      = bchunklen;
-        uef_chunkpos      = bchunkpos;
-        uef_chunkdatabits = bchunkdatabits;
-        uef_chunkf        = bchunkf;
-        fdat = bdat;
-        ffound = bffound;
-        uef_intone = bintone;
+        return false;
 }
-
@@ -5,6 +5,7 @@ void uef_load(const char *fn);
 void uef_close(void);
 void uef_poll(void);
 void uef_findfilenames(void);
+bool uef_seek_file(int file);
 
 extern int uef_toneon;
 
@@ -52,6 +52,11 @@
 //#include <unistd.h>
 
 #include <sys/stat.h>
+#ifdef linux
+#include <sys/inotify.h>
+#include <unistd.h>
+#define VDFS_INOTIFY
+#endif
 
 bool vdfs_enabled = 0;
 const char *vdfs_cfg_root = NULL;
@@ -119,6 +124,8 @@ typedef enum {
 struct vdfs_entry {
     vdfs_entry *parent;
     vdfs_entry *next;
+    vdfs_entry *host_hnext;     // next in parent's host name hash chain.
+    vdfs_entry *acorn_hnext;    // next in parent's Acorn name hash chain.
     char       *host_path;
     char       *host_fn;
     char       *host_inf;
@@ -139,6 +146,10 @@ struct vdfs_entry {
             time_t     scan_mtime;
             unsigned   scan_seq;
             sort_type  sorted;
+            vdfs_entry **index;     // host then Acorn name hash tables.
+            unsigned   index_size;  // entries per table, zero if no index.
+            unsigned   index_count;
+            int        watch;       // inotify watch descriptor or -1.
             char       boot_opt;
             uint8_t    title_len;
             char       title[MAX_TITLE];
@@ -413,6 +424,33 @@ static void writemem32(uint16_t addr, uint32_t value)
     writemem(addr+3, (value >> 24) & 0xff);
 }
 
+/*
+ * Copy blocks between a buffer and memory in either the host or the
+ * tube processor, in one go where the memory is plain RAM.
+ */
+
+static void readmem_guest(uint32_t addr, uint8_t *buf, size_t len, bool host)
+{
+    if (host)
+        readmem_block(addr, buf, len);
+    else if (tube_readmem_block)
+        tube_readmem_block(addr, buf, len);
+    else
+        while (len--)
+            *buf++ = tube_readmem(addr++);
+}
+
+static void writemem_guest(uint32_t addr, const uint8_t *buf, size_t len, bool host)
+{
+    if (host)
+        writemem_block(addr, buf, len);
+    else if (tube_writemem_block)
+        tube_writemem_block(addr, buf, len);
+    else
+        while (len--)
+            tube_writemem(addr++, *buf++);
+}
+
 static void rom_dispatch(enum vdfs_action act)
 {
     int max = readmem(0x8000);
@@ -431,6 +469,222 @@ static void flush_all(void)
     }
 }
 
+/*
+ * The children of each directory are indexed by host name and by Acorn
+ * name so that neither rescanning a large directory nor looking up one
+ * name within it needs a linear search.  Both hash tables are held in
+ * one allocation, host table first, and are built on the first lookup.
+ * Anything that would invalidate the index just drops it so it will be
+ * rebuilt on the next lookup.
+ */
+
+#define INDEX_MIN 16
+
+static unsigned hash_host(const char *fn)
+{
+    unsigned hash = 2166136261u;
+    int ch;
+    while ((ch = *(const unsigned char *)fn++))
+        hash = (hash ^ ch) * 16777619u;
+    return hash;
+}
+
+static unsigned hash_acorn(const char *fn, unsigned len)
+{
+    // Case-insensitive to match vdfs_cmpch.
+    unsigned hash = 2166136261u;
+    while (len--) {
+        int ch = *(const unsigned char *)fn++;
+        if (ch >= 'a' && ch <= 'z')
+            ch = ch - 'a' + 'A';
+        hash = (hash ^ ch) * 16777619u;
+    }
+    return hash;
+}
+
+static void index_drop(vdfs_entry *dir)
+{
+    if (dir->u.dir.index) {
+        free(dir->u.dir.index);
+        dir->u.dir.index = NULL;
+    }
+    dir->u.dir.index_size = 0;
+}
+
+static void index_insert(vdfs_entry *dir, vdfs_entry *ent)
+{
+    unsigned mask = dir->u.dir.index_size - 1;
+    vdfs_entry **slot = dir->u.dir.index + (hash_host(ent->host_fn) & mask);
+    ent->host_hnext = *slot;
+    *slot = ent;
+    slot = dir->u.dir.index + dir->u.dir.index_size + (hash_acorn(ent->acorn_fn, ent->acorn_len) & mask);
+    ent->acorn_hnext = *slot;
+    *slot = ent;
+}
+
+static bool index_build(vdfs_entry *dir)
+{
+    unsigned count = 0, size = INDEX_MIN;
+    for (vdfs_entry *ent = dir->u.dir.children; ent; ent = ent->next)
+        count++;
+    while (size < count * 2)
+        size <<= 1;
+    vdfs_entry **index = calloc(size * 2, sizeof(vdfs_entry *));
+    if (!index) {
+        log_warn("vdfs: out of memory indexing dir %s", dir->host_path);
+        return false;
+    }
+    dir->u.dir.index = index;
+    dir->u.dir.index_size = size;
+    dir->u.dir.index_count = count;
+    for (vdfs_entry *ent = dir->u.dir.children; ent; ent = ent->next)
+        index_insert(dir, ent);
+    log_debug("vdfs: indexed dir %s, entries=%u, size=%u", dir->host_path, count, size);
+    return true;
+}
+
+static void link_child(vdfs_entry *dir, vdfs_entry *ent)
+{
+    ent->next = dir->u.dir.children;
+    dir->u.dir.children = ent;
+    dir->u.dir.sorted = SORT_NONE;
+    if (dir->u.dir.index_size) {
+        if (++dir->u.dir.index_count > dir->u.dir.index_size)
+            index_drop(dir); // rebuild larger on the next lookup.
+        else
+            index_insert(dir, ent);
+    }
+}
+
+#ifdef VDFS_INOTIFY
+
+/*
+ * On Linux each directory that has been scanned is watched with inotify
+ * so the cached entries can be trusted, without a stat on each lookup,
+ * until the host reports a change within that directory.  Events are
+ * read at most once per VDFS call, and only when a directory is looked
+ * up, so calls that do not touch directories make no extra syscalls.
+ */
+
+static int watch_fd = -1;
+static bool watch_pending;
+static vdfs_entry **watch_dirs; // indexed by watch descriptor.
+static unsigned watch_max;
+
+static void watch_add(vdfs_entry *dir)
+{
+    if (dir->u.dir.watch >= 0)
+        return;
+    if (watch_fd < 0 && (watch_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) < 0) {
+        log_warn("vdfs: unable to initialise inotify: %s", strerror(errno));
+        return;
+    }
+    int wd = inotify_add_watch(watch_fd, dir->host_path, IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR);
+    if (wd < 0) {
+        log_debug("vdfs: unable to watch dir %s: %s", dir->host_path, strerror(errno));
+        return;
+    }
+    if ((unsigned)wd >= watch_max) {
+        unsigned new_max = watch_max ? watch_max : 64;
+        while (new_max <= (unsigned)wd)
+            new_max *= 2;
+        vdfs_entry **new_dirs = realloc(watch_dirs, new_max * sizeof(vdfs_entry *));
+        if (!new_dirs) {
+            log_warn("vdfs: out of memory watching dir %s", dir->host_path);
+            inotify_rm_watch(watch_fd, wd);
+            return;
+        }
+        memset(new_dirs + watch_max, 0, (new_max - watch_max) * sizeof(vdfs_entry *));
+        watch_dirs = new_dirs;
+        watch_max = new_max;
+    }
+    // The same host dir reached by two paths shares one watch, so
+    // leave the second to be checked by stat.
+    if (!watch_dirs[wd]) {
+        watch_dirs[wd] = dir;
+        dir->u.dir.watch = wd;
+    }
+}
+
+static void watch_drop(vdfs_entry *dir)
+{
+    int wd = dir->u.dir.watch;
+    if (wd >= 0) {
+        if (watch_dirs[wd] == dir) {
+            inotify_rm_watch(watch_fd, wd);
+            watch_dirs[wd] = NULL;
+        }
+        dir->u.dir.watch = -1;
+    }
+}
+
+static void watch_move(vdfs_entry *old_dir, vdfs_entry *new_dir)
+{
+    int wd = old_dir->u.dir.watch;
+    if (wd >= 0 && watch_dirs[wd] == old_dir)
+        watch_dirs[wd] = new_dir;
+    new_dir->u.dir.watch = wd;
+    old_dir->u.dir.watch = -1;
+}
+
+static void watch_poll(void)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    if (!watch_pending || watch_fd < 0)
+        return;
+    watch_pending = false;
+    while ((len = read(watch_fd, buf, sizeof(buf))) > 0) {
+        const char *ptr = buf;
+        const char *end = buf + len;
+        while (ptr < end) {
+            const struct inotify_event *ev = (const struct inotify_event *)ptr;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                log_debug("vdfs: inotify queue overflow, all dirs to be rescanned");
+                scan_seq++;
+            }
+            else if (ev->wd >= 0 && (unsigned)ev->wd < watch_max) {
+                vdfs_entry *dir = watch_dirs[ev->wd];
+                if (dir) {
+                    log_debug("vdfs: dir %s changed, mask=%08x", dir->host_path, ev->mask);
+                    dir->u.dir.scan_seq = 0;
+                    if (ev->mask & IN_MOVE_SELF)
+                        watch_drop(dir); // the watch no longer follows the path.
+                    else if (ev->mask & IN_IGNORED) {
+                        watch_dirs[ev->wd] = NULL;
+                        dir->u.dir.watch = -1;
+                    }
+                }
+            }
+            ptr += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+}
+
+#else
+
+#define watch_add(dir)
+#define watch_drop(dir)
+
+static void watch_move(vdfs_entry *old_dir, vdfs_entry *new_dir)
+{
+    new_dir->u.dir.watch = old_dir->u.dir.watch;
+    old_dir->u.dir.watch = -1;
+}
+
+#endif
+
+static void free_entry(vdfs_entry *ent);
+
+static void free_dir(vdfs_entry *dir)
+{
+    watch_drop(dir);
+    index_drop(dir);
+    free_entry(dir->u.dir.children);
+    dir->u.dir.children = NULL;
+}
+
 static void free_entry(vdfs_entry *ent)
 {
     if (ent) {
@@ -439,7 +693,7 @@ static void free_entry(vdfs_entry *ent)
         if (ptr)
             free(ptr);
         if (ent->attribs & ATTR_IS_DIR)
-            free_entry(ent->u.dir.children);
+            free_dir(ent);
         free(ent);
     }
 }
@@ -635,6 +889,10 @@ static void init_dir(vdfs_entry *ent)
     ent->u.dir.scan_mtime = 0;
     ent->u.dir.scan_seq = 0;
     ent->u.dir.sorted = SORT_NONE;
+    ent->u.dir.index = NULL;
+    ent->u.dir.index_size = 0;
+    ent->u.dir.index_count = 0;
+    ent->u.dir.watch = -1;
     ent->u.dir.boot_opt = 0;
     ent->u.dir.title_len = 0;
 }
@@ -672,7 +930,7 @@ static void scan_attr(vdfs_entry *ent)
             if (attribs & ATTR_IS_DIR) {
                 log_debug("vdfs: dir %.*s has become a file", ent->acorn_len, ent->acorn_fn);
                 attribs &= ~ATTR_IS_DIR;
-                free_entry(ent->u.dir.children);
+                free_dir(ent);
             }
             ent->u.file.load_addr = 0;
             ent->u.file.exec_addr = 0;
@@ -726,7 +984,7 @@ static void scan_attr(vdfs_entry *ent)
             if (attribs & ATTR_IS_DIR) {
                 log_debug("vdfs: dir %.*s has become a file", ent->acorn_len, ent->acorn_fn);
                 attribs &= ~ATTR_IS_DIR;
-                free_entry(ent->u.dir.children);
+                free_dir(ent);
             }
             ent->u.file.load_addr = 0;
             ent->u.file.exec_addr = 0;
@@ -1092,8 +1350,20 @@ static void scan_inf_dir(vdfs_entry *dir)
     }
 }
 
+// A changed Acorn name invalidates the index of the parent dir.
+
+static void check_renamed(vdfs_entry *ent, const char *old_fn, unsigned old_len)
+{
+    if (old_len && ent->parent != ent && (ent->acorn_len != old_len || memcmp(ent->acorn_fn, old_fn, old_len)))
+        index_drop(ent->parent);
+}
+
 static void scan_entry(vdfs_entry *ent)
 {
+    char old_fn[MAX_FILE_NAME];
+    unsigned old_len = ent->acorn_len;
+    memcpy(old_fn, ent->acorn_fn, old_len);
+
     scan_attr(ent);
     if (ent->attribs & ATTR_IS_DIR)
         scan_inf_dir(ent);
@@ -1101,6 +1371,7 @@ static void scan_entry(vdfs_entry *ent)
         scan_inf_file(ent);
     if (ent->acorn_len == 0)
         hst2bbc(ent);
+    check_renamed(ent, old_fn, old_len);
 }
 
 static void init_entry(vdfs_entry *ent)
@@ -1146,6 +1417,14 @@ static int vdfs_cmp(vdfs_entry *ent_a, vdfs_entry *ent_b)
 
 static vdfs_entry *acorn_search(vdfs_entry *dir, vdfs_entry *obj)
 {
+    if (dir->u.dir.index_size || index_build(dir)) {
+        unsigned mask = dir->u.dir.index_size - 1;
+        vdfs_entry *ent = dir->u.dir.index[dir->u.dir.index_size + (hash_acorn(obj->acorn_fn, obj->acorn_len) & mask)];
+        for (; ent; ent = ent->acorn_hnext)
+            if (!vdfs_cmp(ent, obj))
+                return ent;
+        return NULL;
+    }
     for (vdfs_entry *ent = dir->u.dir.children; ent; ent = ent->next)
         if (!vdfs_cmp(ent, obj))
             return ent;
@@ -1203,6 +1482,15 @@ bool vdfs_wildmat(const char *pattern, unsigned pat_len, const char *candidate,
 
 static vdfs_entry *wild_search(vdfs_entry *dir, vdfs_findres *res)
 {
+    if (!memchr(res->acorn_fn, '*', res->acorn_len) && !memchr(res->acorn_fn, '#', res->acorn_len) && (dir->u.dir.index_size || index_build(dir))) {
+        // Without wildcards only one hash chain can hold a match.
+        unsigned mask = dir->u.dir.index_size - 1;
+        vdfs_entry *ent = dir->u.dir.index[dir->u.dir.index_size + (hash_acorn(res->acorn_fn, res->acorn_len) & mask)];
+        for (; ent; ent = ent->acorn_hnext)
+            if (vdfs_wildmat(res->acorn_fn, res->acorn_len, ent->acorn_fn, ent->acorn_len))
+                return ent;
+        return NULL;
+    }
     for (vdfs_entry *ent = dir->u.dir.children; ent; ent = ent->next)
         if (vdfs_wildmat(res->acorn_fn, res->acorn_len, ent->acorn_fn, ent->acorn_len))
             return ent;
@@ -1253,9 +1541,7 @@ static vdfs_entry *new_entry(vdfs_entry *dir, const char *host_fn)
                 }
                 log_debug("vdfs: new_entry: unique name %.*s used", ent->acorn_len, ent->acorn_fn);
             }
-            ent->next = dir->u.dir.children;
-            dir->u.dir.children = ent;
-            dir->u.dir.sorted = SORT_NONE;
+            link_child(dir, ent);
             log_debug("vdfs: new_entry: returning new entry %p", ent);
             return ent;
         }
@@ -1268,6 +1554,13 @@ static vdfs_entry *new_entry(vdfs_entry *dir, const char *host_fn)
 
 static vdfs_entry *host_search(vdfs_entry *dir, const char *host_fn)
 {
+    if (dir->u.dir.index_size || index_build(dir)) {
+        vdfs_entry *ent = dir->u.dir.index[hash_host(host_fn) & (dir->u.dir.index_size - 1)];
+        for (; ent; ent = ent->host_hnext)
+            if (!strcmp(ent->host_fn, host_fn))
+                return ent;
+        return NULL;
+    }
     for (vdfs_entry *ent = dir->u.dir.children; ent; ent = ent->next)
         if (!strcmp(ent->host_fn, host_fn))
             return ent;
@@ -1309,8 +1602,16 @@ static int scan_dir(vdfs_entry *dir)
 {
     struct stat stb;
 
-    // Has this been scanned sufficiently recently already?
+    // Has this been scanned sufficiently recently already?  A watched
+    // dir is known to be unchanged until inotify reports otherwise.
 
+#ifdef VDFS_INOTIFY
+    watch_poll();
+    if (dir->u.dir.watch >= 0 && dir->u.dir.scan_seq && scan_seq <= dir->u.dir.scan_seq) {
+        log_debug("vdfs: using watched dir info for %s", dir->host_path);
+        return 0;
+    }
+#endif
     if (stat(dir->host_path, &stb) == -1)
         log_warn("vdfs: unable to stat directory '%s': %s", dir->host_path, strerror(errno));
     else if (scan_seq <= dir->u.dir.scan_seq && stb.st_mtime <= dir->u.dir.scan_mtime) {
@@ -1318,12 +1619,17 @@ static int scan_dir(vdfs_entry *dir)
         return 0;
     }
     show_activity();
+    watch_add(dir);
 
     DIR *dp = opendir(dir->host_path);
     if (dp) {
         scan_dir_host(dir, dp);
         closedir(dp);
+        char old_fn[MAX_FILE_NAME];
+        unsigned old_len = dir->acorn_len;
+        memcpy(old_fn, dir->acorn_fn, old_len);
         scan_inf_dir(dir);
+        check_renamed(dir, old_fn, old_len);
         dir->u.dir.scan_seq = scan_seq;
         dir->u.dir.scan_mtime = stb.st_mtime;
         return 0;
@@ -1565,9 +1871,7 @@ static vdfs_entry *add_new_file(vdfs_findres *res)
         }
         new_ent->parent = dir;
         if (make_host_path(new_ent, host_fn)) {
-            new_ent->next = dir->u.dir.children;
-            dir->u.dir.children = new_ent;
-            dir->u.dir.sorted = SORT_NONE;
+            link_child(dir, new_ent);
             return new_ent;
         }
         free(new_ent);
@@ -1712,9 +2016,8 @@ void vdfs_close(void)
         free(ptr);
         root_dir.host_path = NULL;
     }
-    if ((ptr = root_dir.u.dir.children)) {
-        free_entry(ptr);
-        root_dir.u.dir.children = NULL;
+    if (root_dir.attribs & ATTR_IS_DIR) {
+        free_dir(&root_dir);
         root_dir.u.dir.sorted = SORT_NONE;
     }
 }
@@ -1827,6 +2130,9 @@ void vdfs_loadstate(FILE *f)
         else if (ch == 'v')
             vdfs_enabled = false;
         cur_dir.dir = &root_dir;
+#ifdef VDFS_INOTIFY
+        watch_pending = true;
+#endif
         vdfs_entry *new_cdir = ss_load_dir(cur_dir.dir, f, "current");
         lib_dir.dir = ss_load_dir(lib_dir.dir, f, "library");
         prev_dir.dir = ss_load_dir(prev_dir.dir, f, "previous");
@@ -1950,6 +2256,7 @@ static void exec_swr_fs(uint8_t flags, uint16_t fname, int8_t romid, uint32_t st
                             else if ((fp = fopen(ent->host_path, "rb"))) {
                                 if (fread(rom + romid * 0x4000 + start, len, 1, fp) != 1 && ferror(fp))
                                     log_warn("vdfs: error reading file '%s': %s", ent->host_fn, strerror(errno));
+                                mem_dirty_rom(romid, start, len);
                                 fclose(fp);
                             } else {
                                 log_warn("vdfs: unable to load file '%s': %s", ent->host_fn, strerror(errno));
@@ -2007,22 +2314,13 @@ static void exec_swr_ram(uint8_t flags, uint32_t ram_start, uint16_t len, uint32
     int16_t nromid = swr_calc_addr(flags, &sw_start, romid);
     if (nromid >= 0) {
         uint8_t *rom_ptr = rom + romid * 0x4000 + sw_start;
-        if (ram_start >= 0xffff0000 || curtube == -1) {
-            if (flags & 0x80)
-                while (len--)
-                    *rom_ptr++ = readmem(ram_start++);
-            else
-                while (len--)
-                    writemem(ram_start++, *rom_ptr++);
-        }
-        else {
-            if (flags & 0x80)
-                while (len--)
-                    *rom_ptr++ = tube_readmem(ram_start++);
-            else
-                while (len--)
-                    tube_writemem(ram_start++, *rom_ptr++);
-        }
+        if (flags & 0x80)
+            mem_dirty_rom(romid, sw_start, len);
+        bool host = ram_start >= 0xffff0000 || curtube == -1;
+        if (flags & 0x80)
+            readmem_guest(ram_start, rom_ptr, len, host);
+        else
+            writemem_guest(ram_start, rom_ptr, len, host);
     }
 }
 
@@ -2263,59 +2561,25 @@ static void osfile_attribs(uint32_t pb, vdfs_entry *ent)
     writemem(pb+0x11, 0);
 }
 
+static void translate_nl(uint8_t *buffer, size_t bytes, uint8_t from, uint8_t to)
+{
+    uint8_t *end = buffer + bytes;
+    while ((buffer = memchr(buffer, from, end - buffer)))
+        *buffer++ = to;
+}
+
 static uint32_t write_bytes(FILE *fp, uint32_t addr, size_t bytes, unsigned nlflag)
 {
-    if (addr >= 0xffff0000 || curtube == -1) {
-        char buffer[8192];
-        while (bytes >= sizeof buffer) {
-            char *ptr = buffer;
-            size_t chunk = sizeof buffer;
-            while (chunk--) {
-                int ch = readmem(addr++);
-                if (ch == '\r' && nlflag)
-                    ch = '\n';
-                *ptr++ = ch;
-            }
-            fwrite(buffer, sizeof buffer, 1, fp);
-            bytes -= sizeof buffer;
-        }
-        if (bytes > 0) {
-            char *ptr = buffer;
-            size_t chunk = bytes;
-            while (chunk--) {
-                int ch = readmem(addr++);
-                if (ch == '\r' && nlflag)
-                    ch = '\n';
-                *ptr++ = ch;
-            }
-            fwrite(buffer, bytes, 1, fp);
-        }
-    }
-    else {
-        char buffer[8192];
-        while (bytes >= sizeof buffer) {
-            char *ptr = buffer;
-            size_t chunk = sizeof buffer;
-            while (chunk--) {
-                int ch = tube_readmem(addr++);
-                if (ch == '\r' && nlflag)
-                    ch = '\n';
-                *ptr++ = ch;
-            }
-            fwrite(buffer, sizeof buffer, 1, fp);
-            bytes -= sizeof buffer;
-        }
-        if (bytes > 0) {
-            char *ptr = buffer;
-            size_t chunk = bytes;
-            while (chunk--) {
-                int ch = tube_readmem(addr++);
-                if (ch == '\r' && nlflag)
-                    ch = '\n';
-                *ptr++ = ch;
-            }
-            fwrite(buffer, bytes, 1, fp);
-        }
+    bool host = addr >= 0xffff0000 || curtube == -1;
+    uint8_t buffer[8192];
+    while (bytes > 0) {
+        size_t chunk = bytes < sizeof buffer ? bytes : sizeof buffer;
+        readmem_guest(addr, buffer, chunk, host);
+        if (nlflag)
+            translate_nl(buffer, chunk, '\r', '\n');
+        fwrite(buffer, chunk, 1, fp);
+        addr += chunk;
+        bytes -= chunk;
     }
     return addr;
 }
@@ -2414,6 +2678,8 @@ static void osfile_write(uint32_t pb, const vdfs_path *path, uint32_t (*callback
         if ((fp = fopen(ent->host_path, "wb"))) {
             uint32_t start_addr = readmem32(pb+0x0a);
             uint32_t end_addr = readmem32(pb+0x0e);
+            if (ent->attribs & ATTR_IS_DIR)
+                free_dir(ent);
             ent->attribs = (ent->attribs & ~ATTR_IS_DIR) | ATTR_EXISTS;
             callback(fp, start_addr, end_addr - start_addr, ent->attribs & ATTR_NL_TRANS);
             fclose(fp);
@@ -2632,6 +2898,7 @@ static void delete_file(vdfs_entry *ent)
         else if (rmdir(ent->host_path) == 0) {
             if (ent == prev_dir.dir)
                 prev_dir = cur_dir;
+            free_dir(ent);
             ent->attribs &= ~(ATTR_IS_DIR|ATTR_EXISTS);
             delete_inf(ent);
             a = 2;
@@ -2718,42 +2985,30 @@ static void update_length(vdfs_entry *ent, uint32_t addr, uint32_t dest)
     }
 }
 
-static void read_file_io(vdfs_entry *ent, FILE *fp, uint32_t addr)
+static void read_file_mem(vdfs_entry *ent, FILE *fp, uint32_t addr, bool host)
 {
-    char buffer[32768];
+    uint8_t buffer[32768];
     size_t nbytes;
     uint32_t dest = addr;
     unsigned nlflag = ent->attribs & ATTR_NL_TRANS;
 
     while ((nbytes = fread(buffer, 1, sizeof buffer, fp)) > 0) {
-        char *ptr = buffer;
-        while (nbytes--) {
-            int ch = *ptr++;
-            if (ch == '\n' && nlflag)
-                ch = '\r';
-            writemem(dest++, ch);
-        }
+        if (nlflag)
+            translate_nl(buffer, nbytes, '\n', '\r');
+        writemem_guest(dest, buffer, nbytes, host);
+        dest += nbytes;
     }
     update_length(ent, addr, dest);
 }
 
-static void read_file_tube(vdfs_entry *ent, FILE *fp, uint32_t addr)
+static void read_file_io(vdfs_entry *ent, FILE *fp, uint32_t addr)
 {
-    char buffer[32768];
-    size_t nbytes;
-    uint32_t dest = addr;
-    unsigned nlflag = ent->attribs & ATTR_NL_TRANS;
+    read_file_mem(ent, fp, addr, true);
+}
 
-    while ((nbytes = fread(buffer, 1, sizeof buffer, fp)) > 0) {
-        char *ptr = buffer;
-        while (nbytes--) {
-            int ch = *ptr++;
-            if (ch == '\n' && nlflag)
-                ch = '\r';
-            tube_writemem(dest++, ch);
-        }
-    }
-    update_length(ent, addr, dest);
+static void read_file_tube(vdfs_entry *ent, FILE *fp, uint32_t addr)
+{
+    read_file_mem(ent, fp, addr, false);
 }
 
 static void osfile_load(uint32_t pb, const vdfs_path *path)
@@ -3041,52 +3296,17 @@ static void osgbpb_write(uint32_t pb)
 
 static size_t read_bytes(FILE *fp, uint32_t addr, size_t bytes, unsigned nlflag)
 {
-    char buffer[8192];
-    size_t nbytes;
-
-    while (bytes >= sizeof buffer) {
-        char *ptr = buffer;
-        if ((nbytes = fread(buffer, 1, sizeof buffer, fp)) <= 0)
-            return bytes;
-        bytes -= nbytes;
-        if (addr >= 0xffff0000 || curtube == -1) {
-            while (nbytes--) {
-                int ch = *ptr++;
-                if (ch == '\n' && nlflag)
-                    ch = '\r';
-                writemem(addr++, ch);
-            }
-        }
-        else {
-            while (nbytes--) {
-                int ch = *ptr++;
-                if (ch == '\n' && nlflag)
-                    ch = '\r';
-                tube_writemem(addr++, ch);
-            }
-        }
-    }
+    bool host = addr >= 0xffff0000 || curtube == -1;
+    uint8_t buffer[8192];
     while (bytes > 0) {
-        char *ptr = buffer;
-        if ((nbytes = fread(buffer, 1, bytes, fp)) <= 0)
+        size_t nbytes = fread(buffer, 1, bytes < sizeof buffer ? bytes : sizeof buffer, fp);
+        if (nbytes == 0)
             return bytes;
+        if (nlflag)
+            translate_nl(buffer, nbytes, '\n', '\r');
+        writemem_guest(addr, buffer, nbytes, host);
+        addr += nbytes;
         bytes -= nbytes;
-        if (addr >= 0xffff0000 || curtube == -1) {
-            while (nbytes--) {
-                int ch = *ptr++;
-                if (ch == '\n' && nlflag)
-                    ch = '\r';
-                writemem(addr++, ch);
-            }
-        }
-        else {
-            while (nbytes--) {
-                int ch = *ptr++;
-                if (ch == '\n' && nlflag)
-                    ch = '\r';
-                tube_writemem(addr++, ch);
-            }
-        }
     }
     return 0;
 }
@@ -4011,8 +4231,14 @@ static void rename_tail(vdfs_entry *old_ent, vdfs_entry *new_ent)
             new_ent->u.dir.scan_seq   = old_ent->u.dir.scan_seq;
             new_ent->u.dir.scan_mtime = old_ent->u.dir.scan_mtime;
             new_ent->u.dir.sorted     = old_ent->u.dir.sorted;
+            new_ent->u.dir.index      = old_ent->u.dir.index;
+            new_ent->u.dir.index_size = old_ent->u.dir.index_size;
+            new_ent->u.dir.index_count = old_ent->u.dir.index_count;
+            watch_move(old_ent, new_ent);
             old_ent->u.dir.children   = NULL;
             old_ent->u.dir.sorted     = SORT_NONE;
+            old_ent->u.dir.index      = NULL;
+            old_ent->u.dir.index_size = 0;
         }
         else {
             new_ent->attribs |= ATTR_EXISTS;
@@ -4905,18 +5131,20 @@ static void osword_discio(void)
         ssize = 256;
     log_debug("vdfs: osword 7F: drive=%u, cmd=%02X, track=%u, sect=%u, sects=%u, ssize=%u", drive, cmd, track, sect, sects, ssize);
 
-    FILE *fp = sdf_owseek(drive & 1, sect, track, (drive >> 1) & 1, ssize);
-    if (fp) {
-        uint32_t addr = readmem32(pb+1);
-        size_t bytes = (sects & 0x0f) << 8;
-        if (cmd == 0x53)
-            read_bytes(fp, addr, bytes, 0);
-        else if (cmd == 0x4b) {
-            write_bytes(fp, addr, bytes, 0);
+    uint32_t addr = readmem32(pb+1);
+    size_t bytes = (sects & 0x0f) << 8;
+    bool host = addr >= 0xffff0000 || curtube == -1;
+    uint8_t buffer[0x0f << 8];
+    bool found;
+    if (cmd == 0x4b) {
+        readmem_guest(addr, buffer, bytes, host);
+        if ((found = sdf_owwrite(drive & 1, sect, track, (drive >> 1) & 1, ssize, buffer, bytes)))
             p.z = 1;
-        }
-        writemem(pb+10, 0);
     }
+    else if ((found = sdf_owread(drive & 1, sect, track, (drive >> 1) & 1, ssize, buffer, bytes)) && cmd == 0x53)
+        writemem_guest(addr, buffer, bytes, host);
+    if (found)
+        writemem(pb+10, 0);
     else {
         log_debug("vdfs: osword attempting to read invalid/empty drive %d", drive);
         writemem(pb+10, 0x14); // track 0 not found.
@@ -5234,6 +5462,9 @@ void vdfs_write(uint16_t addr, uint8_t value)
             break;
         case 2:
             a = reg_a;
+#ifdef VDFS_INOTIFY
+            watch_pending = true;
+#endif
             dispatch(value);
             break;
         case 3:
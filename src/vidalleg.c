@@ -29,6 +29,7 @@ int save_winsizex, save_winsizey;
 int scr_x_start, scr_x_size, scr_y_start, scr_y_size;
 
 bool vid_print_mode = false;
+bool vid_batch = false;
 
 #ifdef WIN32
 static const int y_fudge = 0;
@@ -596,11 +597,11 @@ static void render_leds(void)
 
 void video_doblit(bool non_ttx, uint8_t vtotal)
 {
-    if (vid_savescrshot)
+    if (vid_savescrshot && !vid_batch)
         save_screenshot();
 
     ++framesrun;
-    if (++fskipcount >= ((motor && fasttape) ? 5 : vid_fskipmax)) {
+    if (!vid_batch && ++fskipcount >= ((motor && fasttape) ? 5 : vid_fskipmax)) {
         if (fullscreen_pending) {
             ALLEGRO_DISPLAY *display = al_get_current_display();
             int newsizex = al_get_display_width(display);
@@ -7,6 +7,7 @@
 #include "b-em.h"
 
 #include "config.h"
+#include "led.h"
 #include "6502.h"
 #include "mem.h"
 #include "model.h"
@@ -858,6 +859,26 @@ ALLEGRO_DISPLAY *video_init(void)
     return display;
 }
 
+/*
+ * For the batch runner: move the frame buffers into memory and stop
+ * drawing to the display so that forked processes, which must not use the
+ * graphics context they inherit, can carry on emulating.
+ */
+
+void video_enter_batch(void)
+{
+    al_unlock_bitmap(b);
+    al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+    al_convert_bitmap(b);
+    al_convert_bitmap(b16);
+    al_convert_bitmap(b32);
+    if (led_bitmap)
+        al_convert_bitmap(led_bitmap);
+    al_set_target_bitmap(b);
+    region = al_lock_bitmap(b, ALLEGRO_PIXEL_FORMAT_ARGB_8888, ALLEGRO_LOCK_WRITEONLY);
+    vid_batch = true;
+}
+
 void video_close()
 {
     al_destroy_bitmap(b32);
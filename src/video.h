@@ -41,6 +41,7 @@ void video_reset(void);
 void video_poll(int clocks, int timer_enable);
 void video_savestate(FILE *f);
 void video_loadstate(FILE *f);
+void video_enter_batch(void);
 
 void nula_reset(void);
 
@@ -57,6 +57,7 @@ extern enum vid_coltype {
 extern int vid_fskipmax, vid_fullborders;
 extern int vid_ledlocation, vid_ledvisibility;
 extern bool vid_print_mode;
+extern bool vid_batch;
 extern int vid_lock_type;
 
 extern int vid_savescrshot;
@@ -523,7 +523,7 @@ static void wd1770_cmd_next(unsigned cmd)
             else {
                 log_debug("wd1770: multi-sector read, inter-sector gap");
                 wd1770.in_gap = 1;
-                fdc_time = 5000;
+                fdc_time = disc_fast(curdrive) ? 200 : 5000;
             }
             break;
 
@@ -537,7 +537,7 @@ static void wd1770_cmd_next(unsigned cmd)
             else {
                 log_debug("wd1770: multi-sector write, inter-sector gap");
                 wd1770.in_gap = 1;
-                fdc_time = 5000;
+                fdc_time = disc_fast(curdrive) ? 200 : 5000;
             }
             break;
 
@@ -723,6 +723,11 @@ static int wd1770_getdata(int last)
     }
 }
 
+static bool wd1770_pending(void)
+{
+    return (wd1770.status & (WDS_BUSY|WDS_DATA_REQ)) == (WDS_BUSY|WDS_DATA_REQ);
+}
+
 static void wd1770_writeprotect()
 {
     wd1770_fault(WDS_WRITE_PROTECT, "write protect");
@@ -750,6 +755,7 @@ void wd1770_reset()
         fdc_headercrcerror = wd1770_headercrcerror;
         fdc_writeprotect   = wd1770_writeprotect;
         fdc_getdata        = wd1770_getdata;
+        fdc_pending        = wd1770_pending;
         motorspin = 45000;
         if (motoron)
             wd1770.status |= WDS_MOTOR_ON;
@@ -26,6 +26,7 @@ static void loadseg(uint16_t val, x86seg *seg)
 }
 
 static uint8_t *x86ram,*x86rom;
+static uint8_t *x86ram_dirty;
 
 static inline uint8_t readmemblx86(uint32_t addr)
 {
@@ -64,7 +65,9 @@ static inline uint16_t readmemwl(uint32_t seg, uint32_t addr)
 
 static inline void writememblx86(uint32_t addr, uint8_t byte)
 {
-    x86ram[addr & 0xFFFFF] = byte;
+    addr &= 0xFFFFF;
+    x86ram[addr] = byte;
+    savestate_dirty(x86ram_dirty, addr);
 }
 
 static inline void writemembl(uint32_t addr, uint8_t byte)
@@ -76,7 +79,10 @@ static inline void writemembl(uint32_t addr, uint8_t byte)
 
 static inline void writememwlx86(uint32_t addr, uint16_t word)
 {
-    *(uint16_t *)(&x86ram[addr & 0xFFFFF]) = word;
+    addr &= 0xFFFFF;
+    *(uint16_t *)(&x86ram[addr]) = word;
+    savestate_dirty(x86ram_dirty, addr);
+    savestate_dirty(x86ram_dirty, (addr + 1) & 0xFFFFF);
 }
 
 static inline void writememwl(uint32_t seg, uint32_t addr, uint16_t word)
@@ -688,6 +694,8 @@ void x86_close()
         free(x86ram);
         x86ram = NULL;
     }
+    savestate_dirty_free(x86ram_dirty);
+    x86ram_dirty = NULL;
 }
 
 static unsigned char *save_seg(unsigned char *ptr, x86seg *seg)
@@ -733,8 +741,8 @@ static void x86_savestate(ZFILE *zfp)
     ptr = save_uint16(ptr, oldcs);
 
     savestate_zwrite(zfp, bytes, sizeof bytes);
-    savestate_zwrite(zfp, x86ram, X86_RAM_SIZE);
-    savestate_zwrite(zfp, x86rom, X86_ROM_SIZE);
+    savestate_zwrite_pages(zfp, x86ram, X86_RAM_SIZE, x86ram_dirty);
+    savestate_zwrite_pages(zfp, x86rom, X86_ROM_SIZE, NULL);
 }
 
 static unsigned char *load_seg(unsigned char *ptr, x86seg *seg)
@@ -780,8 +788,8 @@ static void x86_loadstate(ZFILE *zfp)
     ptr = load_uint32(ptr, &old82);
     ptr = load_uint32(ptr, &old83);
     ptr = load_uint16(ptr, &oldcs);
-    savestate_zread(zfp, x86ram, X86_RAM_SIZE);
-    savestate_zread(zfp, x86rom, X86_ROM_SIZE);
+    savestate_zread_pages(zfp, x86ram, X86_RAM_SIZE, x86ram_dirty);
+    savestate_zread_pages(zfp, x86rom, X86_ROM_SIZE, NULL);
 }
 
 bool x86_init(void *rom)
@@ -793,6 +801,8 @@ bool x86_init(void *rom)
             return false;
         }
     }
+    if (!x86ram_dirty && !(x86ram_dirty = savestate_dirty_new(X86_RAM_SIZE)))
+        return false;
     x86rom = rom;
     x86makeznptable();
     memset(x86ram,0,X86_RAM_SIZE);
@@ -6,6 +6,7 @@
 #include <stdio.h>
 
 #include "b-em.h"
+#include "model.h"
 #include "tube.h"
 #include "z80.h"
 #include "z80dis.h"
@@ -34,6 +35,7 @@ static int im;
 #define Z80_RAM_SIZE 0x10000
 
 static uint8_t *z80ram, *z80rom;
+static uint8_t *z80ram_dirty;
 static int z80_oldnmi;
 
 #define S_FLAG 0x80
@@ -87,6 +89,7 @@ static uint32_t dbg_z80_readmem(uint32_t addr)
 static inline void z80_do_writemem(uint16_t a, uint8_t v)
 {
     z80ram[a] = v;
+    savestate_dirty(z80ram_dirty, a);
 }
 
 static inline void z80_writemem(uint16_t a, uint8_t v)
@@ -473,6 +476,8 @@ void z80_close(void)
         free(z80ram);
         z80ram = NULL;
     }
+    savestate_dirty_free(z80ram_dirty);
+    z80ram_dirty = NULL;
 }
 
 static void z80_savestate(ZFILE * zfp)
@@ -525,8 +530,8 @@ static void z80_savestate(ZFILE * zfp)
     bytes[43] = intreg;
 
     savestate_zwrite(zfp, bytes, sizeof bytes);
-    savestate_zwrite(zfp, z80ram, sizeof z80ram);
-    savestate_zwrite(zfp, z80rom, sizeof z80rom);
+    savestate_zwrite_pages(zfp, z80ram, Z80_RAM_SIZE, z80ram_dirty);
+    savestate_zwrite_pages(zfp, z80rom, tubes[curtube].rom_size, NULL);
 }
 
 static void z80_loadstate(ZFILE * zfp)
@@ -570,8 +575,8 @@ static void z80_loadstate(ZFILE * zfp)
     z80_rom_in = bytes[42];
     intreg = bytes[43];
 
-    savestate_zread(zfp, z80ram, sizeof z80ram);
-    savestate_zread(zfp, z80rom, sizeof z80rom);
+    savestate_zread_pages(zfp, z80ram, Z80_RAM_SIZE, z80ram_dirty);
+    savestate_zread_pages(zfp, z80rom, tubes[curtube].rom_size, NULL);
 }
 
 bool z80_init(void *rom)
@@ -583,6 +588,8 @@ bool z80_init(void *rom)
             return false;
         }
     }
+    if (!z80ram_dirty && !(z80ram_dirty = savestate_dirty_new(Z80_RAM_SIZE)))
+        return false;
     z80rom = rom;
     makeznptable();
     tube_readmem = tube_z80_readmem;